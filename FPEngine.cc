@@ -1049,6 +1049,65 @@ static void apply_scale(struct feature_node *features, unsigned int num_features
   }
 }
 
+/* The weights of FPModel as floats. They are laid out like liblinear's, one
+   row of class weights per feature, but each row is padded with zeros to a
+   multiple of SCORE_LANES classes so that the inner loop of score_batch is a
+   plain vector multiply-add with no remainder. Built on first use. */
+static float *score_weights = NULL;
+static int score_stride;
+
+static void init_score_weights(void) {
+  int nr_feature, nr_class, i, j;
+
+  if (score_weights != NULL)
+    return;
+
+  nr_feature = get_nr_feature(&FPModel);
+  nr_class = get_nr_class(&FPModel);
+  score_stride = (nr_class + SCORE_LANES - 1) / SCORE_LANES * SCORE_LANES;
+  score_weights = (float *) safe_zalloc(nr_feature * score_stride * sizeof(float));
+  for (i = 0; i < nr_feature; i++) {
+    for (j = 0; j < nr_class; j++)
+      score_weights[i * score_stride + j] = FPModel.w[i * nr_class + j];
+  }
+}
+
+/* Computes the decision values of n hosts at once, as predict_values does for
+   one. x holds the n dense scaled feature vectors one after the other, and
+   values receives score_stride values per host. Each row of weights is applied
+   to every host of the batch while it is in cache, and the accumulation runs
+   across classes rather than across features, so the compiler can vectorize it
+   without reordering any sum. Weights and features are single precision to
+   halve the memory traffic, but the sums are kept in double: decision values
+   reach the tens and summing 695 products in single precision would drift by
+   more than SCORE_EPSILON. */
+static void score_batch(const float *x, int n, double *values) {
+  int nr_feature, i, h, j;
+
+  nr_feature = get_nr_feature(&FPModel);
+  memset(values, 0, n * score_stride * sizeof(double));
+  for (i = 0; i < nr_feature; i++) {
+    const float *w = score_weights + i * score_stride;
+
+    for (h = 0; h < n; h++) {
+      double *out = values + h * score_stride;
+      double v = x[h * nr_feature + i];
+
+      for (j = 0; j < score_stride; j += SCORE_LANES) {
+        double acc[SCORE_LANES];
+        int k;
+
+        /* All loads before any store, so that the block vectorizes even
+           without knowing that out and w do not overlap. */
+        for (k = 0; k < SCORE_LANES; k++)
+          acc[k] = out[j + k] + (double) w[j + k] * v;
+        for (k = 0; k < SCORE_LANES; k++)
+          out[j + k] = acc[k];
+      }
+    }
+  }
+}
+
 /* (label, prob) pairs for purpose of sorting. */
 struct label_prob {
   int label;
@@ -1091,10 +1150,14 @@ int label_prob_cmp(const void *a, const void *b) {
    and we handle them the same way: by using a small default variance. This will
    tend to make small differences count a lot (because we probably want this
    fingerprint in order to expand the class), while still allowing near-perfect
-   matches to match. */
-static double novelty_of(const struct feature_node *features, int label) {
+   matches to match.
+
+   The sum is kept in SCORE_LANES independent partial sums so that the loop
+   vectorizes. */
+static double novelty_of(const float *x, int label) {
   const double *means, *variances;
-  int i, nr_feature;
+  double sums[SCORE_LANES];
+  int i, j, nr_feature;
   double sum;
 
   nr_feature = get_nr_feature(&FPModel);
@@ -1104,40 +1167,66 @@ static double novelty_of(const struct feature_node *features, int label) {
   means = FPmean[label];
   variances = FPvariance[label];
 
-  sum = 0.0;
-  for (i = 0; i < nr_feature; i++) {
-    double d, v;
+  for (j = 0; j < SCORE_LANES; j++)
+    sums[j] = 0.0;
+  for (i = 0; i + SCORE_LANES <= nr_feature; i += SCORE_LANES) {
+    for (j = 0; j < SCORE_LANES; j++) {
+      double d, v;
 
-    assert(i + 1 == features[i].index);
-    d = features[i].value - means[i];
-    v = variances[i];
-    if (v == 0.0) {
+      d = x[i + j] - means[i + j];
+      v = variances[i + j];
       /* No variance? It means that samples were identical. Substitute a default
          variance. This will tend to make novelty large in these cases, which
          will hopefully encourage for submissions for this class. */
-      v = 0.01;
+      v = v == 0.0 ? 0.01 : v;
+      sums[j] += d * d / v;
     }
-    sum += d * d / v;
+  }
+  for (; i < nr_feature; i++) {
+    double d, v;
+
+    d = x[i] - means[i];
+    v = variances[i];
+    v = v == 0.0 ? 0.01 : v;
+    sums[0] += d * d / v;
   }
 
+  sum = 0.0;
+  for (j = 0; j < SCORE_LANES; j++)
+    sum += sums[j];
+
   return sqrt(sum);
 }
 
-static void classify(FingerPrintResultsIPv6 *FPR) {
+/* Checks the decision values of a host against liblinear's, which are what the
+   model was trained and tested with. */
+static void check_values(const struct feature_node *features, const double *values) {
   int nr_class, i;
-  struct feature_node *features;
-  double *values;
-  struct label_prob *labels;
+  double *exact;
+  double err;
 
   nr_class = get_nr_class(&FPModel);
+  exact = new double[nr_class];
+  predict_values(&FPModel, features, exact);
+  err = 0.0;
+  for (i = 0; i < nr_class; i++)
+    err = MAX(err, fabs(exact[i] - values[i]));
+  if (err > SCORE_EPSILON)
+    error("Warning: OS classifier decision values differ from liblinear's by %g.", err);
+  else if (o.debugging > 2)
+    log_write(LOG_PLAIN, "OS classifier decision values within %g of liblinear's.\n", err);
+  delete[] exact;
+}
+
+/* Picks the matches of one host from its decision values and dense feature
+   vector. */
+static void classify_one(FingerPrintResultsIPv6 *FPR, const float *x, const double *values) {
+  int nr_class, i;
+  struct label_prob *labels;
 
-  features = vectorize(FPR);
-  values = new double[nr_class];
+  nr_class = get_nr_class(&FPModel);
   labels = new struct label_prob[nr_class];
 
-  apply_scale(features, get_nr_feature(&FPModel), FPscale);
-
-  predict_values(&FPModel, features, values);
   for (i = 0; i < nr_class; i++) {
     labels[i].label = i;
     labels[i].prob = 1.0 / (1.0 + exp(-values[i]));
@@ -1151,7 +1240,7 @@ static void classify(FingerPrintResultsIPv6 *FPR) {
       FPR->num_perfect_matches = i + 1;
     if (o.debugging > 2) {
       printf("%7.4f %7.4f %3u %s\n", FPR->accuracy[i] * 100,
-        novelty_of(features, labels[i].label), labels[i].label, FPR->matches[i]->OS_name);
+        novelty_of(x, labels[i].label), labels[i].label, FPR->matches[i]->OS_name);
     }
   }
   if (FPR->num_perfect_matches == 0) {
@@ -1159,7 +1248,7 @@ static void classify(FingerPrintResultsIPv6 *FPR) {
   } else if (FPR->num_perfect_matches == 1) {
     double novelty;
 
-    novelty = novelty_of(features, labels[0].label);
+    novelty = novelty_of(x, labels[0].label);
     if (o.debugging > 1)
       log_write(LOG_PLAIN, "Novelty of closest match is %.3f.\n", novelty);
 
@@ -1178,11 +1267,44 @@ static void classify(FingerPrintResultsIPv6 *FPR) {
     FPR->num_perfect_matches = 0;
   }
 
-  delete[] features;
-  delete[] values;
   delete[] labels;
 }
 
+/* Classifies the fingerprints of a batch of up to CLASSIFY_BATCH hosts. The
+   scaled feature vectors are stored densely, one after the other, and scored
+   together against the model. */
+static void classify(FingerPrintResultsIPv6 **FPRs, int n) {
+  int nr_feature, h, i;
+  struct feature_node *features[CLASSIFY_BATCH];
+  float *x;
+  double *values;
+
+  assert(n <= CLASSIFY_BATCH);
+  init_score_weights();
+  nr_feature = get_nr_feature(&FPModel);
+  x = new float[n * nr_feature];
+  values = new double[n * score_stride];
+
+  for (h = 0; h < n; h++) {
+    features[h] = vectorize(FPRs[h]);
+    apply_scale(features[h], nr_feature, FPscale);
+    for (i = 0; i < nr_feature; i++)
+      x[h * nr_feature + i] = features[h][i].value;
+  }
+
+  score_batch(x, n, values);
+
+  for (h = 0; h < n; h++) {
+    if (o.debugging)
+      check_values(features[h], values + h * score_stride);
+    classify_one(FPRs[h], x + h * nr_feature, values + h * score_stride);
+    delete[] features[h];
+  }
+
+  delete[] x;
+  delete[] values;
+}
+
 
 /* This method is the core of the FPEngine class. It takes a list of IPv6
  * targets that need to be fingerprinted. The method handles the whole
@@ -1284,11 +1406,16 @@ int FPEngine6::os_scan(std::vector<Target *> &Targets) {
 
   /* Once we've finished with all fphosts, check which ones were correctly
    * fingerprinted, and update the Target objects. */
-  for (size_t i = 0; i < this->fphosts.size(); i++) {
-    fphosts[i]->finish();
-
-    fphosts[i]->fill_FPR((FingerPrintResultsIPv6 *) Targets[i]->FPR);
-    classify((FingerPrintResultsIPv6 *) Targets[i]->FPR);
+  for (size_t i = 0; i < this->fphosts.size(); i += CLASSIFY_BATCH) {
+    FingerPrintResultsIPv6 *FPRs[CLASSIFY_BATCH];
+    int n;
+
+    for (n = 0; n < CLASSIFY_BATCH && i + n < this->fphosts.size(); n++) {
+      fphosts[i + n]->finish();
+      FPRs[n] = (FingerPrintResultsIPv6 *) Targets[i + n]->FPR;
+      fphosts[i + n]->fill_FPR(FPRs[n]);
+    }
+    classify(FPRs, n);
   }
 
   /* Cleanup and return */
@@ -164,6 +164,16 @@ struct FingerMatch;
    is too different from other members of the class. */
 #define FP_NOVELTY_THRESHOLD 15.0
 
+/* Number of hosts whose fingerprints are classified together, and the number
+   of classes or features handled by one step of the vectorized loops. */
+#define CLASSIFY_BATCH 16
+#define SCORE_LANES 8
+
+/* Largest difference allowed between the decision values of the classifier,
+   which uses single-precision weights and features, and those computed by
+   liblinear in double precision. */
+#define SCORE_EPSILON 1e-4
+
 const unsigned int OSDETECT_FLOW_LABEL = 0x12345;
 
 
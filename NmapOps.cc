@@ -143,6 +143,9 @@ NmapOps o;
 
 NmapOps::NmapOps() {
   datadir = NULL;
+  timing_cache = NULL;
+  netsim = NULL;
+  telemetry = NULL;
   xsl_stylesheet = NULL;
   Initialize();
 }
@@ -194,6 +197,18 @@ NmapOps::~NmapOps() {
     free(datadir);
     datadir = NULL;
   }
+  if (timing_cache) {
+    free(timing_cache);
+    timing_cache = NULL;
+  }
+  if (netsim) {
+    free(netsim);
+    netsim = NULL;
+  }
+  if (telemetry) {
+    free(telemetry);
+    telemetry = NULL;
+  }
 
 #ifndef NOLUA
   if (scriptversion || script)
@@ -298,6 +313,7 @@ void NmapOps::Initialize() {
   min_packet_send_rate = 0.0; /* Unset. */
   max_packet_send_rate = 0.0; /* Unset. */
   stats_interval = 0.0; /* Unset. */
+  telemetry_interval = 1.0;
   randomize_hosts = 0;
   randomize_ports = 1;
   sendpref = PACKET_SEND_NOPREF;
@@ -358,6 +374,13 @@ void NmapOps::Initialize() {
   adler32 = false;
   if (datadir) free(datadir);
   datadir = NULL;
+  if (timing_cache) free(timing_cache);
+  timing_cache = NULL;
+  congestion_control = NULL;
+  if (netsim) free(netsim);
+  netsim = NULL;
+  if (telemetry) free(telemetry);
+  telemetry = NULL;
   xsl_stylesheet_set = false;
   if (xsl_stylesheet) free(xsl_stylesheet);
   xsl_stylesheet = NULL;
@@ -386,6 +409,7 @@ void NmapOps::Initialize() {
   scriptupdatedb = 0;
   scripthelp = false;
   scripttimeout = 0;
+  scriptworkers = 1;
   chosenScripts.clear();
 #endif
   memset(&sourcesock, 0, sizeof(sourcesock));
@@ -142,6 +142,7 @@
 
 struct FingerPrintDB;
 struct FingerMatch;
+struct congestion_control;
 
 class NmapOps {
  public:
@@ -227,6 +228,8 @@ class NmapOps {
   float max_packet_send_rate;
   /* The requested auto stats printing interval, or 0.0 if unset. */
   float stats_interval;
+  /* The interval between --telemetry records, in seconds. */
+  float telemetry_interval;
   int randomize_hosts;
   int randomize_ports;
   int spoofsource; /* -S used */
@@ -360,6 +363,11 @@ class NmapOps {
   int ttl; // Time to live
   int badsum;
   char *datadir;
+  char *timing_cache; /* --timing-cache file, or NULL */
+  /* --congestion-control algorithm, or NULL for the default */
+  const struct congestion_control *congestion_control;
+  char *netsim; /* --netsim network description, or NULL for the real network */
+  char *telemetry; /* --telemetry file or "unix:" socket, or NULL */
   /* A map from abstract data file names like "nmap-services" and "nmap-os-db"
      to paths which have been requested by the user. nmap_fetchfile will return
      the file names defined in this map instead of searching for a matching
@@ -404,6 +412,7 @@ class NmapOps {
   int scriptupdatedb;
   bool scripthelp;
   double scripttimeout;
+  int scriptworkers;
   void chooseScripts(char* argument);
   std::vector<std::string> chosenScripts;
 #endif
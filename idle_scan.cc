@@ -173,6 +173,12 @@
 #include "struct_ip.h"
 
 #include <stdio.h>
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include <string>
+#include <vector>
 
 extern NmapOps o;
 #ifdef WIN32
@@ -203,8 +209,73 @@ struct idle_proxy_info {
   int rawsd; /* Socket descriptor for sending probe packets to the proxy */
   struct eth_nfo eth; // For when we want to send probes via raw IP instead.
   struct eth_nfo *ethptr; // points to eth if filled out, otherwise NULL
+  struct timeout_info target_to; /* Timing of the target being scanned, as
+                                    seen through this zombie */
 };
 
+/* When several zombies are given, each one is driven by its own thread.
+   The threads share idle_lock, which a thread holds except while it sleeps
+   or waits for packets, so that the rest of Nmap only ever sees one of them
+   at a time. An idle scan spends nearly all its time waiting, so the zombies
+   still work almost entirely in parallel. */
+#if HAVE_PTHREAD_H
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool idle_threaded = false;
+#endif
+
+static void idle_usleep(long usec) {
+#if HAVE_PTHREAD_H
+  if (idle_threaded) {
+    pthread_mutex_unlock(&idle_lock);
+    usleep(usec);
+    pthread_mutex_lock(&idle_lock);
+    return;
+  }
+#endif
+  usleep(usec);
+}
+
+static void idle_sleep(unsigned int secs) {
+#if HAVE_PTHREAD_H
+  if (idle_threaded) {
+    pthread_mutex_unlock(&idle_lock);
+    sleep(secs);
+    pthread_mutex_lock(&idle_lock);
+    return;
+  }
+#endif
+  sleep(secs);
+}
+
+/* Like readip_pcap with validation. readip_pcap may return a static buffer,
+   so zombie threads drop idle_lock only to wait for a packet and read it
+   with the lock held. */
+static char *idle_readip_pcap(pcap_t *pd, unsigned int *len, long to_usec,
+                              struct timeval *rcvdtime) {
+#if HAVE_PTHREAD_H
+  if (idle_threaded) {
+    struct timeval start, now;
+    char *p;
+    long left;
+
+    gettimeofday(&start, NULL);
+    for (;;) {
+      p = readip_pcap(pd, len, 0, rcvdtime, NULL, true);
+      if (p != NULL)
+        return p;
+      gettimeofday(&now, NULL);
+      left = to_usec - TIMEVAL_SUBTRACT(now, start);
+      if (left <= 0)
+        return NULL;
+      pthread_mutex_unlock(&idle_lock);
+      pcap_select(pd, left);
+      pthread_mutex_lock(&idle_lock);
+    }
+  }
+#endif
+  return readip_pcap(pd, len, to_usec, rcvdtime, NULL, true);
+}
+
 /* Finds the IPv6 extension header for fragmentation in an IPv6 packet, and returns
  * the identification value of the fragmentation header
 */
@@ -321,7 +392,7 @@ static int ipid_proxy_probe(struct idle_proxy_info *proxy, int *probes_sent,
       to_usec = proxy->host.to.timeout - TIMEVAL_SUBTRACT(tv_end, tv_sent[tries - 1]);
       if (to_usec < 0)
         to_usec = 0; // Final no-block poll
-      ip = (struct ip *) readip_pcap(proxy->pd, &bytes, to_usec, &rcvdtime, NULL, true);
+      ip = (struct ip *) idle_readip_pcap(proxy->pd, &bytes, to_usec, &rcvdtime);
       gettimeofday(&tv_end, NULL);
       if (ip) {
         if (o.af() == AF_INET) {
@@ -472,7 +543,7 @@ static void ipv6_force_fragmentation(struct idle_proxy_info *proxy, Target *targ
   /* Now let's wait for the answer */
   while (!response_received) {
     gettimeofday(&tmptv, NULL);
-    ip = (struct ip *) readip_pcap(proxy->pd, &bytes, proxy_reply_timeout, &rcvdtime, NULL, true);
+    ip = (struct ip *) idle_readip_pcap(proxy->pd, &bytes, proxy_reply_timeout, &rcvdtime);
     if (!ip) {
       if (TIMEVAL_SUBTRACT(tmptv, ipv6_packet_send_time) >= hardtimeout) {
             fatal("Idle scan zombie %s (%s) port %hu cannot be used because it has not returned any of our ICMPv6 Echo Requests -- perhaps it is down or firewalled.",
@@ -530,7 +601,7 @@ static void ipv6_force_fragmentation(struct idle_proxy_info *proxy, Target *targ
 
   ipv6_packet = build_icmpv6_raw(target->v6hostip(), proxy->host.v6hostip(), 0x00, 0x0000, o.ttl, 0x00 , 0x00, 0x02, 0x00, data, sizeof(data) , &packetlen);
   /* give the decoy host time to reply to the target */
-  usleep(10000);
+  idle_usleep(10000);
   res = send_ip_packet(proxy->rawsd, proxy->ethptr, &ss, ipv6_packet, packetlen);
   if (res == -1)
     fatal("Error occurred while trying to send ICMPv6 PTB to the idle host");
@@ -728,7 +799,7 @@ static void initialize_idleproxy(struct idle_proxy_info *proxy, char *proxyName,
     if (o.scan_delay)
       enforce_scan_delay(NULL);
     else if (probes_sent != 0)
-      usleep(30000);
+      idle_usleep(30000);
 
     /* TH_SYN|TH_ACK is what the proxy will really be receiving from
        the target, and is more likely to get through firewalls.  But
@@ -767,7 +838,7 @@ static void initialize_idleproxy(struct idle_proxy_info *proxy, char *proxyName,
     while (probes_returned < probes_sent && !timedout) {
 
       to_usec = (probes_sent == NUM_IPID_PROBES) ? hardtimeout : 1000;
-      ip = (struct ip *) readip_pcap(proxy->pd, &bytes, to_usec, &rcvdtime, NULL, true);
+      ip = (struct ip *) idle_readip_pcap(proxy->pd, &bytes, to_usec, &rcvdtime);
 
       gettimeofday(&tmptv, NULL);
 
@@ -929,7 +1000,7 @@ static void initialize_idleproxy(struct idle_proxy_info *proxy, char *proxyName,
   if (target->v4hostip() || target->v6hostip()) {
     for (probes_sent = 0; probes_sent < 4; probes_sent++) {
       if (probes_sent != 0)
-        usleep(50000);
+        idle_usleep(50000);
       if (target->v4hostip()) {
         send_tcp_raw(proxy->rawsd, proxy->ethptr,
                     target->v4hostip(), proxy->host.v4hostip(),
@@ -956,7 +1027,7 @@ static void initialize_idleproxy(struct idle_proxy_info *proxy, char *proxyName,
     }
 
     /* Sleep a little while to give packets time to reach their destination */
-    usleep(300000);
+    idle_usleep(300000);
     newipid = ipid_proxy_probe(proxy, NULL, NULL);
     if (newipid == -1)
       newipid = ipid_proxy_probe(proxy, NULL, NULL); /* OK, we'll give it one more try */
@@ -1099,7 +1170,7 @@ static int idlescan_countopen2(struct idle_proxy_info *proxy,
   for (pr0be = 0; pr0be < numports; pr0be++) {
     if (o.scan_delay)
       enforce_scan_delay(NULL);
-    else if (proxy->senddelay && pr0be > 0) usleep(proxy->senddelay);
+    else if (proxy->senddelay && pr0be > 0) idle_usleep(proxy->senddelay);
 
     /* Maybe I should involve decoys in the picture at some point --
        but doing it the straightforward way (using the same decoys as
@@ -1131,12 +1202,12 @@ static int idlescan_countopen2(struct idle_proxy_info *proxy,
 
   openports = -1;
   tries = 0;
-  TIMEVAL_MSEC_ADD(probe_times[0], start, MAX(50, (target->to.srtt * 3 / 4) / 1000));
-  TIMEVAL_MSEC_ADD(probe_times[1], start, target->to.srtt / 1000 );
-  TIMEVAL_MSEC_ADD(probe_times[2], end, MAX(75, (2 * target->to.srtt +
-                   target->to.rttvar) / 1000));
-  TIMEVAL_MSEC_ADD(probe_times[3], end, MIN(4000, (2 * target->to.srtt +
-                   (target->to.rttvar << 2 )) / 1000));
+  TIMEVAL_MSEC_ADD(probe_times[0], start, MAX(50, (proxy->target_to.srtt * 3 / 4) / 1000));
+  TIMEVAL_MSEC_ADD(probe_times[1], start, proxy->target_to.srtt / 1000 );
+  TIMEVAL_MSEC_ADD(probe_times[2], end, MAX(75, (2 * proxy->target_to.srtt +
+                   proxy->target_to.rttvar) / 1000));
+  TIMEVAL_MSEC_ADD(probe_times[3], end, MIN(4000, (2 * proxy->target_to.srtt +
+                   (proxy->target_to.rttvar << 2 )) / 1000));
 
   do {
     if (tries == 2)
@@ -1156,7 +1227,7 @@ static int idlescan_countopen2(struct idle_proxy_info *proxy,
     if (o.debugging > 1)
       error("In preparation for idle scan probe try #%d, sleeping for %d usecs", tries, sleeptime);
     if (sleeptime > 0)
-      usleep(sleeptime);
+      idle_usleep(sleeptime);
 
     newipid = ipid_proxy_probe(proxy, &sent, &rcvd);
     proxyprobes_sent += sent;
@@ -1203,6 +1274,11 @@ static int idlescan_countopen2(struct idle_proxy_info *proxy,
     proxy->senddelay = (int) (proxy->senddelay * 0.95);
     if (proxy->senddelay < 500)
       proxy->senddelay = 0;
+    /* A group with no open ports never gets to adjust_idle_timing, so a
+       quiet count is all the encouragement a zombie scanning closed ports
+       gets */
+    if (openports == 0)
+      proxy->current_groupsz = MIN(proxy->max_groupsz, proxy->current_groupsz * 1.05);
     proxy->current_groupsz = MAX(proxy->min_groupsz, MIN(proxy->current_groupsz, 500000 / (proxy->senddelay + 1)));
   }
 
@@ -1245,10 +1321,10 @@ static int idlescan_countopen(struct idle_proxy_info *proxy,
     }
     /* Sleep for a little while -- maybe proxy host had brief birst of
        traffic or similar problem */
-    sleep(tries * tries);
+    idle_sleep(tries * tries);
     if (tries == 5)
-      sleep(45); /* We're gonna give up if this fails, so we will be a bit
-                    patient */
+      idle_sleep(45); /* We're gonna give up if this fails, so we will be a bit
+                         patient */
     /* Since the host may have received packets while we were sleeping,
        lets update our proxy IP ID counter */
     proxy->latestid = ipid_proxy_probe(proxy, NULL, NULL);
@@ -1284,8 +1360,8 @@ static int idle_treescan(struct idle_proxy_info *proxy, Target *target,
   if (o.debugging > 1) {
     error("%s: Called against %s with %d ports, starting with %hu. expectedopen: %d", __func__, target->targetipstr(), numports, ports[0], expectedopen);
     error("IDLE SCAN TIMING: grpsz: %.3f delay: %d srtt: %d rttvar: %d",
-          proxy->current_groupsz, proxy->senddelay, target->to.srtt,
-          target->to.rttvar);
+          proxy->current_groupsz, proxy->senddelay, proxy->target_to.srtt,
+          proxy->target_to.rttvar);
   }
 
   flatcount1 = idlescan_countopen(proxy, target, ports, firstHalfSz, &sentTime1, &rcvTime1);
@@ -1323,7 +1399,7 @@ static int idle_treescan(struct idle_proxy_info *proxy, Target *target,
       if (o.debugging > 1) {
         error("Adjusting timing -- idlescan_countopen correctly found %d open ports (out of %d, starting with %hu)", flatcount1, firstHalfSz, ports[0]);
       }
-      adjust_timeouts2(&sentTime1, &rcvTime1, &(target->to));
+      adjust_timeouts2(&sentTime1, &rcvTime1, &(proxy->target_to));
     }
 
     if (flatcount2 > 0) {
@@ -1331,7 +1407,7 @@ static int idle_treescan(struct idle_proxy_info *proxy, Target *target,
         error("Adjusting timing -- idlescan_countopen correctly found %d open ports (out of %d, starting with %hu)", flatcount2, secondHalfSz,
               ports[firstHalfSz]);
       }
-      adjust_timeouts2(&sentTime2, &rcvTime2, &(target->to));
+      adjust_timeouts2(&sentTime2, &rcvTime2, &(proxy->target_to));
     }
   }
 
@@ -1400,27 +1476,246 @@ static int idle_treescan(struct idle_proxy_info *proxy, Target *target,
 
 
 
+/* Runs task(arg, i) for each zombie i, on a thread of its own for all but the
+   first when there are several. The tasks hold idle_lock except while they
+   wait. */
+static void idle_run(unsigned int numproxies,
+                     void (*task)(void *arg, unsigned int proxyno), void *arg);
+
+struct idle_pool_init {
+  std::vector<char *> names;
+  std::vector<struct idle_proxy_info *> *proxies;
+  Target *target;
+  const struct scan_lists *ports;
+};
+
+static void idle_init_task(void *arg, unsigned int proxyno) {
+  struct idle_pool_init *init = (struct idle_pool_init *) arg;
+
+  initialize_idleproxy((*init->proxies)[proxyno], init->names[proxyno],
+                       init->target, init->ports);
+}
+
+/* Takes the comma-separated list of zombies given to -sI and sets up each of
+   them with initialize_idleproxy, all at once */
+static void initialize_idlepool(std::vector<struct idle_proxy_info *> &proxies,
+                                const char *proxyNames, Target *target,
+                                const struct scan_lists *ports) {
+  struct idle_pool_init init;
+  char *list, *name, *next;
+
+  list = strdup(proxyNames);
+  for (name = list; name != NULL; name = next) {
+    next = strchr(name, ',');
+    if (next != NULL)
+      *next++ = '\0';
+    if (*name == '\0')
+      fatal("Empty zombie name in idle scan zombie list \"%s\"", proxyNames);
+    init.names.push_back(name);
+    proxies.push_back(new struct idle_proxy_info);
+  }
+  init.proxies = &proxies;
+  init.target = target;
+  init.ports = ports;
+  idle_run(proxies.size(), idle_init_task, &init);
+  free(list);
+}
+
+/* A group of ports that was scanned through one zombie. */
+struct idle_group {
+  unsigned int proxy; /* Index of the zombie in the pool */
+  u16 *ports;
+  int numports;
+};
+
+/* The ports of a target, handed out in groups to the zombies as they become
+   free. */
+struct idle_job {
+  std::vector<struct idle_proxy_info *> *proxies;
+  Target *target;
+  u16 *portarray;
+  int numports;
+  int portidx;
+  std::vector<struct idle_group> groups;
+};
+
+/* Takes the next group of ports from the job and scans it through the given
+   zombie. Returns false if there were no ports left. */
+static bool idle_scan_group(struct idle_job *job, unsigned int proxyno) {
+  struct idle_proxy_info *proxy = (*job->proxies)[proxyno];
+  struct idle_group group;
+
+  if (job->portidx >= job->numports)
+    return false;
+
+  group.proxy = proxyno;
+  group.ports = job->portarray + job->portidx;
+  /* current_groupsz is doubled because idle_treescan cuts in half */
+  group.numports = MIN(job->numports - job->portidx, (int) (proxy->current_groupsz * 2));
+  job->portidx += group.numports;
+  idle_treescan(proxy, job->target, group.ports, group.numports, -1);
+  job->groups.push_back(group);
+  return true;
+}
+
+#if HAVE_PTHREAD_H
+struct idle_worker {
+  void (*task)(void *arg, unsigned int proxyno);
+  void *arg;
+  unsigned int proxyno;
+};
+
+static void *idle_worker_main(void *arg) {
+  struct idle_worker *worker = (struct idle_worker *) arg;
+
+  pthread_mutex_lock(&idle_lock);
+  worker->task(worker->arg, worker->proxyno);
+  pthread_mutex_unlock(&idle_lock);
+  return NULL;
+}
+#endif
+
+static void idle_run(unsigned int numproxies,
+                     void (*task)(void *arg, unsigned int proxyno), void *arg) {
+  unsigned int i;
+
+#if HAVE_PTHREAD_H
+  if (numproxies > 1) {
+    std::vector<struct idle_worker> workers(numproxies);
+    std::vector<pthread_t> threads;
+    pthread_t thread;
+
+    pthread_mutex_lock(&idle_lock);
+    idle_threaded = true;
+    for (i = 1; i < numproxies; i++) {
+      workers[i].task = task;
+      workers[i].arg = arg;
+      workers[i].proxyno = i;
+      if (pthread_create(&thread, NULL, idle_worker_main, &workers[i]) != 0) {
+        /* The remaining zombies are run one after the other by this one */
+        error("Warning: Unable to start a thread for idle scan zombie #%u", i + 1);
+        break;
+      }
+      threads.push_back(thread);
+    }
+    task(arg, 0);
+    for (; i < numproxies; i++)
+      task(arg, i);
+    pthread_mutex_unlock(&idle_lock);
+    for (i = 0; i < threads.size(); i++)
+      pthread_join(threads[i], NULL);
+    idle_threaded = false;
+    return;
+  }
+#endif
+
+  for (i = 0; i < numproxies; i++)
+    task(arg, i);
+}
+
+static void idle_scan_task(void *arg, unsigned int proxyno) {
+  while (idle_scan_group((struct idle_job *) arg, proxyno))
+    ;
+}
+
+/* Scans all the ports of the job, with each zombie taking a new group as soon
+   as it is done with the last one. A zombie that is fast and quiet thus ends
+   up scanning more ports than one that is slow or noisy. */
+static void idle_dispatch(struct idle_job *job) {
+  unsigned int i, numproxies = job->proxies->size();
+
+#if HAVE_PTHREAD_H
+  if (numproxies > 1) {
+    idle_run(numproxies, idle_scan_task, job);
+    return;
+  }
+#endif
+
+  /* Without threads, the zombies take turns. */
+  for (i = 0; idle_scan_group(job, i % numproxies); i++)
+    ;
+}
+
+/* Counts the open ports of each group again through a different zombie than
+   the one that found them. If the counts disagree, each of the ports is
+   checked on its own through that zombie, and ties are broken through a
+   third one (or the first one again if there are only two). Ports that do
+   not get a majority are forgotten. */
+static void idle_verify(struct idle_job *job) {
+  std::vector<struct idle_proxy_info *> &proxies = *job->proxies;
+  unsigned int numproxies = proxies.size();
+  Target *target = job->target;
+  std::vector<struct idle_group>::iterator group;
+
+  if (numproxies < 2)
+    return;
+
+  for (group = job->groups.begin(); group != job->groups.end(); group++) {
+    struct idle_proxy_info *other, *third;
+    std::vector<u16> open;
+    int i, count, newipid;
+
+    for (i = 0; i < group->numports; i++) {
+      if (!target->ports.portIsDefault(group->ports[i], IPPROTO_TCP))
+        open.push_back(group->ports[i]);
+    }
+    if (open.empty())
+      continue;
+
+    other = proxies[(group->proxy + 1) % numproxies];
+    third = proxies[numproxies > 2 ? (group->proxy + 2) % numproxies : group->proxy];
+
+    /* The zombie may have sent packets of its own since it was last used. */
+    newipid = ipid_proxy_probe(other, NULL, NULL);
+    if (newipid >= 0)
+      other->latestid = newipid;
+
+    count = idlescan_countopen(other, target, &open[0], open.size(), NULL, NULL);
+    if (count == (int) open.size())
+      continue;
+
+    if (o.debugging) {
+      error("%s: zombie %s found %d open ports starting with %hu, but zombie %s counted %d",
+            __func__, proxies[group->proxy]->host.targetipstr(), (int) open.size(),
+            open[0], other->host.targetipstr(), count);
+    }
+    for (i = 0; i < (int) open.size(); i++) {
+      int votes;
+
+      votes = 1 + idlescan_countopen(other, target, &open[i], 1, NULL, NULL);
+      if (votes == 1)
+        votes += idlescan_countopen(third, target, &open[i], 1, NULL, NULL);
+      if (votes < 2)
+        target->ports.forgetPort(open[i], IPPROTO_TCP);
+    }
+  }
+}
+
 /* The very top-level idle scan function -- scans the given target
-   host using the given proxy -- the proxy is cached so that you can keep
-   calling this function with different targets */
+   host using the given proxies -- the proxies are cached so that you can keep
+   calling this function with different targets. proxyNames is a
+   comma-separated list of zombies; with more than one, groups of ports are
+   scanned through all of them at once and the open ports found through each
+   one are checked through another. */
 void idle_scan(Target *target, u16 *portarray, int numports,
-               char *proxyName, const struct scan_lists *ports) {
+               char *proxyNames, const struct scan_lists *ports) {
 
-  static char lastproxy[FQDN_LEN + 1] = ""; /* The proxy used in any previous call */
-  static struct idle_proxy_info proxy;
-  int groupsz;
-  int portidx = 0; /* Used for splitting the port array into chunks */
-  int portsleft;
+  static std::string lastproxy; /* The proxies used in any previous call */
+  static std::vector<struct idle_proxy_info *> proxies;
+  struct idle_proxy_info *proxy;
+  struct idle_job job;
+  int portidx;
+  unsigned int i;
   char scanname[128];
   Snprintf(scanname, sizeof(scanname), "idle scan against %s", target->NameIP());
   ScanProgressMeter SPM(scanname);
 
   if (numports == 0)
     return; /* nothing to scan for */
-  if (!proxyName)
+  if (!proxyNames)
     fatal("idle scan requires a proxy host");
 
-  if (*lastproxy && strcmp(proxyName, lastproxy))
+  if (!lastproxy.empty() && lastproxy != proxyNames)
     fatal("%s: You are not allowed to change proxies midstream.  Sorry", __func__);
   assert(target);
 
@@ -1435,21 +1730,24 @@ void idle_scan(Target *target, u16 *portarray, int numports,
   target->startTimeOutClock(NULL);
 
   /* If this is the first call,  */
-  if (!*lastproxy) {
-    initialize_idleproxy(&proxy, proxyName, target, ports);
-    strncpy(lastproxy, proxyName, sizeof(lastproxy));
+  if (lastproxy.empty()) {
+    initialize_idlepool(proxies, proxyNames, target, ports);
+    lastproxy = proxyNames;
   }
 
-  /* If we don't have timing infoz for the new target, we'll use values
-     derived from the proxy */
-  if (target->to.srtt == -1 && target->to.rttvar == -1) {
-    target->to.srtt = MAX(200000, 2 * proxy.host.to.srtt);
-    target->to.rttvar = MAX(10000, MIN(proxy.host.to.rttvar, 2000000));
-    target->to.timeout = target->to.srtt + (target->to.rttvar << 2);
-  } else {
-    target->to.srtt = MAX(target->to.srtt, proxy.host.to.srtt);
-    target->to.rttvar = MAX(target->to.rttvar, proxy.host.to.rttvar);
-    target->to.timeout = target->to.srtt + (target->to.rttvar << 2);
+  for (i = 0; i < proxies.size(); i++) {
+    proxy = proxies[i];
+    proxy->target_to = target->to;
+    /* If we don't have timing infoz for the new target, we'll use values
+       derived from the proxy */
+    if (proxy->target_to.srtt == -1 && proxy->target_to.rttvar == -1) {
+      proxy->target_to.srtt = MAX(200000, 2 * proxy->host.to.srtt);
+      proxy->target_to.rttvar = MAX(10000, MIN(proxy->host.to.rttvar, 2000000));
+    } else {
+      proxy->target_to.srtt = MAX(proxy->target_to.srtt, proxy->host.to.srtt);
+      proxy->target_to.rttvar = MAX(proxy->target_to.rttvar, proxy->host.to.rttvar);
+    }
+    proxy->target_to.timeout = proxy->target_to.srtt + (proxy->target_to.rttvar << 2);
   }
 
   /* Now I guess it is time to let the scanning begin!  Since Idle
@@ -1457,14 +1755,21 @@ void idle_scan(Target *target, u16 *portarray, int numports,
      it up and drill down in subscans of the group), we split the port
      space into smaller groups and then call a recursive
      divide-and-conquer function to find the open ports */
-  while (portidx < numports) {
-    portsleft = numports - portidx;
-    /* current_groupsz is doubled below because idle_subscan cuts in half */
-    groupsz = MIN(portsleft, (int) (proxy.current_groupsz * 2));
-    idle_treescan(&proxy, target, portarray + portidx, groupsz, -1);
-    portidx += groupsz;
+  job.proxies = &proxies;
+  job.target = target;
+  job.portarray = portarray;
+  job.numports = numports;
+  job.portidx = 0;
+  idle_dispatch(&job);
+  idle_verify(&job);
+
+  /* Keep the timing of the fastest zombie for the target */
+  proxy = proxies[0];
+  for (i = 1; i < proxies.size(); i++) {
+    if (proxies[i]->target_to.srtt < proxy->target_to.srtt)
+      proxy = proxies[i];
   }
-
+  target->to = proxy->target_to;
 
   char additional_info[14];
   Snprintf(additional_info, sizeof(additional_info), "%d ports", numports);
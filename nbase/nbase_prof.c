@@ -0,0 +1,300 @@
+/***************************************************************************
+ * nbase_prof.c -- Compile-time optional profiling counters and event trace*
+ ***********************IMPORTANT NMAP LICENSE TERMS************************
+ *                                                                         *
+ * The Nmap Security Scanner is (C) 1996-2016 Insecure.Com LLC ("The Nmap  *
+ * Project"). Nmap is also a registered trademark of the Nmap Project.     *
+ * This program is free software; you may redistribute and/or modify it    *
+ * under the terms of the GNU General Public License as published by the   *
+ * Free Software Foundation; Version 2 ("GPL"), BUT ONLY WITH ALL OF THE   *
+ * CLARIFICATIONS AND EXCEPTIONS DESCRIBED HEREIN.  This guarantees your   *
+ * right to use, modify, and redistribute this software under certain      *
+ * conditions.  If you wish to embed Nmap technology into proprietary      *
+ * software, we sell alternative licenses (contact sales@nmap.com).        *
+ * Dozens of software vendors already license Nmap technology such as      *
+ * host discovery, port scanning, OS detection, version detection, and     *
+ * the Nmap Scripting Engine.                                              *
+ *                                                                         *
+ * Note that the GPL places important restrictions on "derivative works",  *
+ * yet it does not provide a detailed definition of that term.  To avoid   *
+ * misunderstandings, we interpret that term as broadly as copyright law   *
+ * allows.  For example, we consider an application to constitute a        *
+ * derivative work for the purpose of this license if it does any of the   *
+ * following with any software or content covered by this license          *
+ * ("Covered Software"):                                                   *
+ *                                                                         *
+ * o Integrates source code from Covered Software.                         *
+ *                                                                         *
+ * o Reads or includes copyrighted data files, such as Nmap's nmap-os-db   *
+ * or nmap-service-probes.                                                 *
+ *                                                                         *
+ * o Is designed specifically to execute Covered Software and parse the    *
+ * results (as opposed to typical shell or execution-menu apps, which will *
+ * execute anything you tell them to).                                     *
+ *                                                                         *
+ * o Includes Covered Software in a proprietary executable installer.  The *
+ * installers produced by InstallShield are an example of this.  Including *
+ * Nmap with other software in compressed or archival form does not        *
+ * trigger this provision, provided appropriate open source decompression  *
+ * or de-archiving software is widely available for no charge.  For the    *
+ * purposes of this license, an installer is considered to include Covered *
+ * Software even if it actually retrieves a copy of Covered Software from  *
+ * another source during runtime (such as by downloading it from the       *
+ * Internet).                                                              *
+ *                                                                         *
+ * o Links (statically or dynamically) to a library which does any of the  *
+ * above.                                                                  *
+ *                                                                         *
+ * o Executes a helper program, module, or script to do any of the above.  *
+ *                                                                         *
+ * This list is not exclusive, but is meant to clarify our interpretation  *
+ * of derived works with some common examples.  Other people may interpret *
+ * the plain GPL differently, so we consider this a special exception to   *
+ * the GPL that we apply to Covered Software.  Works which meet any of     *
+ * these conditions must conform to all of the terms of this license,      *
+ * particularly including the GPL Section 3 requirements of providing      *
+ * source code and allowing free redistribution of the work as a whole.    *
+ *                                                                         *
+ * As another special exception to the GPL terms, the Nmap Project grants  *
+ * permission to link the code of this program with any version of the     *
+ * OpenSSL library which is distributed under a license identical to that  *
+ * listed in the included docs/licenses/OpenSSL.txt file, and distribute   *
+ * linked combinations including the two.                                  *
+ *                                                                         * 
+ * The Nmap Project has permission to redistribute Npcap, a packet         *
+ * capturing driver and library for the Microsoft Windows platform.        *
+ * Npcap is a separate work with it's own license rather than this Nmap    *
+ * license.  Since the Npcap license does not permit redistribution        *
+ * without special permission, our Nmap Windows binary packages which      *
+ * contain Npcap may not be redistributed without special permission.      *
+ *                                                                         *
+ * Any redistribution of Covered Software, including any derived works,    *
+ * must obey and carry forward all of the terms of this license, including *
+ * obeying all GPL rules and restrictions.  For example, source code of    *
+ * the whole work must be provided and free redistribution must be         *
+ * allowed.  All GPL references to "this License", are to be treated as    *
+ * including the terms and conditions of this license text as well.        *
+ *                                                                         *
+ * Because this license imposes special exceptions to the GPL, Covered     *
+ * Work may not be combined (even as part of a larger work) with plain GPL *
+ * software.  The terms, conditions, and exceptions of this license must   *
+ * be included as well.  This license is incompatible with some other open *
+ * source licenses as well.  In some cases we can relicense portions of    *
+ * Nmap or grant special permissions to use it in other open source        *
+ * software.  Please contact fyodor@nmap.org with any such requests.       *
+ * Similarly, we don't incorporate incompatible open source software into  *
+ * Covered Software without special permission from the copyright holders. *
+ *                                                                         *
+ * If you have any questions about the licensing restrictions on using     *
+ * Nmap in other works, are happy to help.  As mentioned above, we also    *
+ * offer alternative license to integrate Nmap into proprietary            *
+ * applications and appliances.  These contracts have been sold to dozens  *
+ * of software vendors, and generally include a perpetual license as well  *
+ * as providing for priority support and updates.  They also fund the      *
+ * continued development of Nmap.  Please email sales@nmap.com for further *
+ * information.                                                            *
+ *                                                                         *
+ * If you have received a written license agreement or contract for        *
+ * Covered Software stating terms other than these, you may choose to use  *
+ * and redistribute Covered Software under those terms instead of these.   *
+ *                                                                         *
+ * Source is provided to this software because we believe users have a     *
+ * right to know exactly what a program is going to do before they run it. *
+ * This also allows you to audit the software for security holes.          *
+ *                                                                         *
+ * Source code also allows you to port Nmap to new platforms, fix bugs,    *
+ * and add new features.  You are highly encouraged to send your changes   *
+ * to the dev@nmap.org mailing list for possible incorporation into the    *
+ * main distribution.  By sending these changes to Fyodor or one of the    *
+ * Insecure.Org development mailing lists, or checking them into the Nmap  *
+ * source code repository, it is understood (unless you specify            *
+ * otherwise) that you are offering the Nmap Project the unlimited,        *
+ * non-exclusive right to reuse, modify, and relicense the code.  Nmap     *
+ * will always be available Open Source, but this is important because     *
+ * the inability to relicense code has caused devastating problems for     *
+ * other Free Software projects (such as KDE and NASM).  We also           *
+ * occasionally relicense the code to third parties as discussed above.    *
+ * If you wish to specify special license conditions of your               *
+ * contributions, just say so when you send them.                          *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Nmap      *
+ * license file for more details (it's in a COPYING file included with     *
+ * Nmap, and also available from https://svn.nmap.org/nmap/COPYING)        *
+ *                                                                         *
+ ***************************************************************************/
+
+/* $Id$ */
+
+#include "nbase.h"
+#include "nbase_prof.h"
+
+#ifdef NBASE_PROFILE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#if HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/* The number of events kept, the most recent ones. A power of two. */
+#define RING_SIZE 65536
+
+struct prof_record {
+  unsigned long long start;
+  unsigned long long ticks; /* Span length, or 0 for a single event */
+  const char *name;
+  long arg;
+};
+
+static struct prof_record *ring = NULL;
+static unsigned long long ring_next = 0;
+static struct nbase_prof_counter *counters = NULL;
+
+/* The tick count and the time at which the profiler started, to convert ticks
+   to microseconds at the end. */
+static unsigned long long start_ticks;
+static struct timeval start_tv;
+static int start_pid;
+
+static void prof_dump(void);
+
+static unsigned long long read_ticks(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return __builtin_ia32_rdtsc();
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  return __rdtsc();
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (unsigned long long) tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
+unsigned long long nbase_prof_now(void) {
+  if (ring == NULL) {
+    ring = (struct prof_record *) safe_zalloc(RING_SIZE * sizeof(*ring));
+    start_ticks = read_ticks();
+    gettimeofday(&start_tv, NULL);
+    start_pid = getpid();
+    atexit(prof_dump);
+  }
+  return read_ticks();
+}
+
+static void record(unsigned long long start, unsigned long long ticks,
+                   const char *name, long arg) {
+  struct prof_record *r = &ring[ring_next++ & (RING_SIZE - 1)];
+
+  r->start = start;
+  r->ticks = ticks;
+  r->name = name;
+  r->arg = arg;
+}
+
+void nbase_prof_span(struct nbase_prof_counter *counter, unsigned long long start) {
+  unsigned long long ticks = read_ticks() - start;
+
+  if (counter->calls++ == 0) {
+    counter->next = counters;
+    counters = counter;
+  }
+  counter->ticks += ticks;
+  /* A zero length would make it an event. */
+  record(start, ticks > 0 ? ticks : 1, counter->name, 0);
+}
+
+void nbase_prof_event(const char *name, long arg) {
+  record(nbase_prof_now(), 0, name, arg);
+}
+
+static int counter_cmp(const void *a, const void *b) {
+  const struct nbase_prof_counter *ca = *(const struct nbase_prof_counter **) a;
+  const struct nbase_prof_counter *cb = *(const struct nbase_prof_counter **) b;
+
+  if (ca->ticks != cb->ticks)
+    return ca->ticks < cb->ticks ? 1 : -1;
+  return 0;
+}
+
+/* Writes a string as a JSON string. Event names are literals in the code, so
+   only quotes and backslashes need escaping. */
+static void write_json_string(FILE *fp, const char *s) {
+  putc('"', fp);
+  for (; *s != '\0'; s++) {
+    if (*s == '"' || *s == '\\')
+      putc('\\', fp);
+    putc(*s, fp);
+  }
+  putc('"', fp);
+}
+
+static void prof_dump(void) {
+  struct nbase_prof_counter *c, **sorted;
+  struct timeval now;
+  unsigned long long i, first;
+  double ticks_per_us;
+  const char *path;
+  FILE *fp;
+  int n, j;
+
+  if (getpid() != start_pid)
+    return;
+
+  gettimeofday(&now, NULL);
+  ticks_per_us = (double) (read_ticks() - start_ticks) / TIMEVAL_SUBTRACT(now, start_tv);
+  if (!(ticks_per_us > 0))
+    ticks_per_us = 1;
+
+  n = 0;
+  for (c = counters; c != NULL; c = c->next)
+    n++;
+  sorted = (struct nbase_prof_counter **) safe_malloc((n + 1) * sizeof(*sorted));
+  n = 0;
+  for (c = counters; c != NULL; c = c->next)
+    sorted[n++] = c;
+  qsort(sorted, n, sizeof(*sorted), counter_cmp);
+  fprintf(stderr, "%-32s %10s %12s %10s\n", "profile counter", "calls", "total ms", "avg us");
+  for (j = 0; j < n; j++) {
+    c = sorted[j];
+    fprintf(stderr, "%-32s %10llu %12.2f %10.2f\n", c->name, c->calls,
+            c->ticks / ticks_per_us / 1000, c->ticks / ticks_per_us / c->calls);
+  }
+  free(sorted);
+
+  path = getenv("NBASE_PROFILE_TRACE");
+  if (path == NULL || *path == '\0')
+    path = "nbase-trace.json";
+  fp = fopen(path, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Unable to write profile trace to %s: %s\n", path, strerror(errno));
+    return;
+  }
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  first = ring_next > RING_SIZE ? ring_next - RING_SIZE : 0;
+  for (i = first; i < ring_next; i++) {
+    const struct prof_record *r = &ring[i & (RING_SIZE - 1)];
+    double ts = (double) (r->start - start_ticks) / ticks_per_us;
+
+    fprintf(fp, "%s{\"name\":", i == first ? "" : ",\n");
+    write_json_string(fp, r->name);
+    if (r->ticks > 0) {
+      fprintf(fp, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":1}",
+              ts, r->ticks / ticks_per_us, start_pid);
+    } else {
+      fprintf(fp, ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":1,\"args\":{\"arg\":%ld}}",
+              ts, start_pid, r->arg);
+    }
+  }
+  fprintf(fp, "\n]}\n");
+  fclose(fp);
+  fprintf(stderr, "Wrote %llu profile trace events to %s\n", ring_next - first, path);
+}
+
+#endif /* NBASE_PROFILE */
@@ -0,0 +1,211 @@
+/***************************************************************************
+ * nbase_prof.h -- Compile-time optional profiling counters and event trace*
+ ***********************IMPORTANT NMAP LICENSE TERMS************************
+ *                                                                         *
+ * The Nmap Security Scanner is (C) 1996-2016 Insecure.Com LLC ("The Nmap  *
+ * Project"). Nmap is also a registered trademark of the Nmap Project.     *
+ * This program is free software; you may redistribute and/or modify it    *
+ * under the terms of the GNU General Public License as published by the   *
+ * Free Software Foundation; Version 2 ("GPL"), BUT ONLY WITH ALL OF THE   *
+ * CLARIFICATIONS AND EXCEPTIONS DESCRIBED HEREIN.  This guarantees your   *
+ * right to use, modify, and redistribute this software under certain      *
+ * conditions.  If you wish to embed Nmap technology into proprietary      *
+ * software, we sell alternative licenses (contact sales@nmap.com).        *
+ * Dozens of software vendors already license Nmap technology such as      *
+ * host discovery, port scanning, OS detection, version detection, and     *
+ * the Nmap Scripting Engine.                                              *
+ *                                                                         *
+ * Note that the GPL places important restrictions on "derivative works",  *
+ * yet it does not provide a detailed definition of that term.  To avoid   *
+ * misunderstandings, we interpret that term as broadly as copyright law   *
+ * allows.  For example, we consider an application to constitute a        *
+ * derivative work for the purpose of this license if it does any of the   *
+ * following with any software or content covered by this license          *
+ * ("Covered Software"):                                                   *
+ *                                                                         *
+ * o Integrates source code from Covered Software.                         *
+ *                                                                         *
+ * o Reads or includes copyrighted data files, such as Nmap's nmap-os-db   *
+ * or nmap-service-probes.                                                 *
+ *                                                                         *
+ * o Is designed specifically to execute Covered Software and parse the    *
+ * results (as opposed to typical shell or execution-menu apps, which will *
+ * execute anything you tell them to).                                     *
+ *                                                                         *
+ * o Includes Covered Software in a proprietary executable installer.  The *
+ * installers produced by InstallShield are an example of this.  Including *
+ * Nmap with other software in compressed or archival form does not        *
+ * trigger this provision, provided appropriate open source decompression  *
+ * or de-archiving software is widely available for no charge.  For the    *
+ * purposes of this license, an installer is considered to include Covered *
+ * Software even if it actually retrieves a copy of Covered Software from  *
+ * another source during runtime (such as by downloading it from the       *
+ * Internet).                                                              *
+ *                                                                         *
+ * o Links (statically or dynamically) to a library which does any of the  *
+ * above.                                                                  *
+ *                                                                         *
+ * o Executes a helper program, module, or script to do any of the above.  *
+ *                                                                         *
+ * This list is not exclusive, but is meant to clarify our interpretation  *
+ * of derived works with some common examples.  Other people may interpret *
+ * the plain GPL differently, so we consider this a special exception to   *
+ * the GPL that we apply to Covered Software.  Works which meet any of     *
+ * these conditions must conform to all of the terms of this license,      *
+ * particularly including the GPL Section 3 requirements of providing      *
+ * source code and allowing free redistribution of the work as a whole.    *
+ *                                                                         *
+ * As another special exception to the GPL terms, the Nmap Project grants  *
+ * permission to link the code of this program with any version of the     *
+ * OpenSSL library which is distributed under a license identical to that  *
+ * listed in the included docs/licenses/OpenSSL.txt file, and distribute   *
+ * linked combinations including the two.                                  *
+ *                                                                         * 
+ * The Nmap Project has permission to redistribute Npcap, a packet         *
+ * capturing driver and library for the Microsoft Windows platform.        *
+ * Npcap is a separate work with it's own license rather than this Nmap    *
+ * license.  Since the Npcap license does not permit redistribution        *
+ * without special permission, our Nmap Windows binary packages which      *
+ * contain Npcap may not be redistributed without special permission.      *
+ *                                                                         *
+ * Any redistribution of Covered Software, including any derived works,    *
+ * must obey and carry forward all of the terms of this license, including *
+ * obeying all GPL rules and restrictions.  For example, source code of    *
+ * the whole work must be provided and free redistribution must be         *
+ * allowed.  All GPL references to "this License", are to be treated as    *
+ * including the terms and conditions of this license text as well.        *
+ *                                                                         *
+ * Because this license imposes special exceptions to the GPL, Covered     *
+ * Work may not be combined (even as part of a larger work) with plain GPL *
+ * software.  The terms, conditions, and exceptions of this license must   *
+ * be included as well.  This license is incompatible with some other open *
+ * source licenses as well.  In some cases we can relicense portions of    *
+ * Nmap or grant special permissions to use it in other open source        *
+ * software.  Please contact fyodor@nmap.org with any such requests.       *
+ * Similarly, we don't incorporate incompatible open source software into  *
+ * Covered Software without special permission from the copyright holders. *
+ *                                                                         *
+ * If you have any questions about the licensing restrictions on using     *
+ * Nmap in other works, are happy to help.  As mentioned above, we also    *
+ * offer alternative license to integrate Nmap into proprietary            *
+ * applications and appliances.  These contracts have been sold to dozens  *
+ * of software vendors, and generally include a perpetual license as well  *
+ * as providing for priority support and updates.  They also fund the      *
+ * continued development of Nmap.  Please email sales@nmap.com for further *
+ * information.                                                            *
+ *                                                                         *
+ * If you have received a written license agreement or contract for        *
+ * Covered Software stating terms other than these, you may choose to use  *
+ * and redistribute Covered Software under those terms instead of these.   *
+ *                                                                         *
+ * Source is provided to this software because we believe users have a     *
+ * right to know exactly what a program is going to do before they run it. *
+ * This also allows you to audit the software for security holes.          *
+ *                                                                         *
+ * Source code also allows you to port Nmap to new platforms, fix bugs,    *
+ * and add new features.  You are highly encouraged to send your changes   *
+ * to the dev@nmap.org mailing list for possible incorporation into the    *
+ * main distribution.  By sending these changes to Fyodor or one of the    *
+ * Insecure.Org development mailing lists, or checking them into the Nmap  *
+ * source code repository, it is understood (unless you specify            *
+ * otherwise) that you are offering the Nmap Project the unlimited,        *
+ * non-exclusive right to reuse, modify, and relicense the code.  Nmap     *
+ * will always be available Open Source, but this is important because     *
+ * the inability to relicense code has caused devastating problems for     *
+ * other Free Software projects (such as KDE and NASM).  We also           *
+ * occasionally relicense the code to third parties as discussed above.    *
+ * If you wish to specify special license conditions of your               *
+ * contributions, just say so when you send them.                          *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Nmap      *
+ * license file for more details (it's in a COPYING file included with     *
+ * Nmap, and also available from https://svn.nmap.org/nmap/COPYING)        *
+ *                                                                         *
+ ***************************************************************************/
+
+/* $Id$ */
+
+/* Hot-path profiling for Nmap, Nsock and the programs built on them. It is
+ * compiled in only when NBASE_PROFILE is defined, for example with
+ *
+ *   ./configure CPPFLAGS=-DNBASE_PROFILE
+ *
+ * and otherwise all of the macros below expand to nothing.
+ *
+ * NBASE_PROF_BEGIN(var) starts timing a span in a local variable, and
+ * NBASE_PROF_END(var, name) adds the time since then to a counter of that
+ * name and records the span in an in-memory ring of the most recent events.
+ * NBASE_PROF_EVENT(name, arg) records a single moment, such as a probe being
+ * sent, with an integer argument. C++ code can time the rest of a block with
+ * NBASE_PROF_SCOPE(name).
+ *
+ * At exit, the calls and time of each counter are printed to stderr and the
+ * ring is written as Chrome trace event JSON (load it in chrome://tracing or
+ * Perfetto) to the file named by the NBASE_PROFILE_TRACE environment variable,
+ * or nbase-trace.json. Only the process that first used the profiler writes
+ * it, so forked children do not overwrite it. The counters and the ring are
+ * not locked; only time code that runs on one thread. */
+
+#ifndef NBASE_PROF_H
+#define NBASE_PROF_H
+
+#ifdef NBASE_PROFILE
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct nbase_prof_counter {
+  const char *name;
+  unsigned long long calls;
+  unsigned long long ticks;
+  struct nbase_prof_counter *next;
+};
+
+/* Returns the current time in ticks: CPU cycles where they can be read
+ * cheaply, nanoseconds elsewhere. */
+unsigned long long nbase_prof_now(void);
+void nbase_prof_span(struct nbase_prof_counter *counter, unsigned long long start);
+void nbase_prof_event(const char *name, long arg);
+
+#ifdef __cplusplus
+}
+
+class NbaseProfScope {
+public:
+  NbaseProfScope(struct nbase_prof_counter *counter) {
+    this->counter = counter;
+    start = nbase_prof_now();
+  }
+  ~NbaseProfScope() {
+    nbase_prof_span(counter, start);
+  }
+private:
+  struct nbase_prof_counter *counter;
+  unsigned long long start;
+};
+
+#define NBASE_PROF_SCOPE(name) \
+  static struct nbase_prof_counter nbase_prof_scope_counter = { name, 0, 0, NULL }; \
+  NbaseProfScope nbase_prof_scope(&nbase_prof_scope_counter)
+#endif
+
+#define NBASE_PROF_BEGIN(var) unsigned long long var = nbase_prof_now()
+#define NBASE_PROF_END(var, name) do { \
+    static struct nbase_prof_counter nbase_prof_counter_ = { name, 0, 0, NULL }; \
+    nbase_prof_span(&nbase_prof_counter_, var); \
+  } while (0)
+#define NBASE_PROF_EVENT(name, arg) nbase_prof_event(name, arg)
+
+#else
+
+#define NBASE_PROF_BEGIN(var)
+#define NBASE_PROF_END(var, name)
+#define NBASE_PROF_EVENT(name, arg)
+#define NBASE_PROF_SCOPE(name)
+
+#endif /* NBASE_PROFILE */
+
+#endif /* NBASE_PROF_H */
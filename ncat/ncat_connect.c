@@ -162,12 +162,15 @@ struct conn_state {
     nsock_iod stdin_nsi;
     nsock_event_id idle_timer_event_id;
     int crlf_state;
+    /* Bytes sent other than through sock_nsi. */
+    unsigned long sendfile_count;
 };
 
 static struct conn_state cs = {
     NULL,
     NULL,
     0,
+    0,
     0
 };
 
@@ -1068,7 +1071,7 @@ int ncat_connect(void)
         gettimeofday(&end_time, NULL);
         time = TIMEVAL_MSEC_SUBTRACT(end_time, start_time) / 1000.0;
         loguser("%lu bytes sent, %lu bytes received in %.2f seconds.\n",
-            nsock_iod_get_write_count(cs.sock_nsi),
+            nsock_iod_get_write_count(cs.sock_nsi) + cs.sendfile_count,
             nsock_iod_get_read_count(cs.sock_nsi), time);
     }
 
@@ -1151,6 +1154,33 @@ static void post_connect(nsock_pool nsp, nsock_iod iod)
         netexec(&info, o.cmdexec);
     }
 
+#ifdef HAVE_SYS_SENDFILE_H
+    /* In --send-only mode, send stdin with sendfile if it is a file. */
+    if (o.sendonly && o.proto == IPPROTO_TCP && !o.zerobyte) {
+        struct fdinfo info;
+        int rc;
+
+        info.fd = nsock_iod_get_sd(iod);
+#ifdef HAVE_OPENSSL
+        info.ssl = (SSL *)nsock_iod_get_ssl(iod);
+#endif
+        if (ncat_can_splice(&info)) {
+            block_socket(info.fd);
+            rc = ncat_sendfile(info.fd, STDIN_FILENO, &cs.sendfile_count);
+            unblock_socket(info.fd);
+            if (rc == -1) {
+                loguser("%s.\n", socket_strerror(socket_errno()));
+                exit(1);
+            } else if (rc == 1) {
+                /* As on EOF in read_stdin_handler. */
+                shutdown(info.fd, SHUT_WR);
+                nsock_loop_quit(nsp);
+                return;
+            }
+        }
+    }
+#endif
+
     /* Start the initial reads. */
 
     if (!o.sendonly && !o.zerobyte)
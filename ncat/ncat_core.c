@@ -127,6 +127,11 @@
 
 /* $Id$ */
 
+#ifndef WIN32
+/* For splice. */
+#define _GNU_SOURCE
+#endif
+
 #include "ncat.h"
 #include "util.h"
 #include "sys_wrap.h"
@@ -145,6 +150,10 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <time.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#endif
 
 /* Only two for now because we might have to listen on IPV4 and IPV6 */
 union sockaddr_u listenaddrs[NUM_LISTEN_ADDRS];
@@ -385,34 +394,88 @@ int ncat_send(struct fdinfo *fdn, const char *buf, size_t size)
     return n;
 }
 
-/* Broadcast a message to all the descriptors in fds. Returns -1 if any of the
-   sends failed. */
-int ncat_broadcast(fd_set *fds, const fd_list_t *fdlist, const char *msg, size_t size)
+/* Returns true if data to and from fdn may be moved by the kernel, with
+   ncat_splice or ncat_sendfile, instead of passing through our buffers. That
+   is when the connection is not encrypted and nothing needs to see the data:
+   there is no logging, Telnet negotiation, line delay or line ending
+   conversion. */
+int ncat_can_splice(const struct fdinfo *fdn)
 {
-    struct fdinfo *fdn;
-    int i, ret;
+#ifdef HAVE_OPENSSL
+    if (fdn->ssl != NULL)
+        return 0;
+#endif
+    return !o.crlf && !o.telnet && !o.linedelay
+        && o.normlogfd == -1 && o.hexlogfd == -1;
+}
 
-    if (o.recvonly)
-        return size;
+/* The most moved by one call to splice or sendfile. */
+#define SPLICE_LEN (64 * 1024)
+
+#ifdef HAVE_SPLICE
+
+/* Move data from in to out with splice, like an ncat_recv followed by an
+   ncat_send on blocking descriptors. Unless one of in and out is a pipe, the
+   data goes through pipefd, which must be empty. Returns the number of bytes
+   moved, 0 on EOF, or -1 on error. If splice can't be used with these
+   descriptors, it fails with EINVAL before reading anything, and the caller may
+   fall back to copying. */
+ssize_t ncat_splice(int in, int out, int pipefd[2])
+{
+    ssize_t n, m, left;
+
+    do {
+        n = splice(in, NULL, pipefd != NULL ? pipefd[1] : out, NULL,
+            SPLICE_LEN, SPLICE_F_MOVE);
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0 || pipefd == NULL)
+        return n;
 
-    ret = 0;
-    for (i = 0; i <= fdlist->fdmax; i++) {
-        if (!FD_ISSET(i, fds))
-            continue;
-
-        fdn = get_fdinfo(fdlist, i);
-        ncat_assert(fdn != NULL);
-        if (blocking_fdinfo_send(fdn, msg, size) <= 0) {
-            if (o.debug > 1)
-                logdebug("Error sending to fd %d: %s.\n", i, socket_strerror(socket_errno()));
-            ret = -1;
+    for (left = n; left > 0; left -= m) {
+        m = splice(pipefd[0], NULL, out, NULL, left, SPLICE_F_MOVE);
+        if (m == -1 && errno == EINTR) {
+            m = 0;
+        } else if (m <= 0) {
+            /* Too late to fall back; the data has been read. */
+            if (m == 0 || errno == EINVAL)
+                errno = EIO;
+            return -1;
         }
     }
 
-    ncat_log_send(msg, size);
+    return n;
+}
+#endif
 
-    return ret;
+#ifdef HAVE_SYS_SENDFILE_H
+/* Send the rest of in to out with sendfile, if in is a regular file. Returns 1
+   once all of it has been sent, 0 if in is not a regular file or sendfile can't
+   be used (in which case whatever is left can be read from in as usual), or -1
+   on error. The number of bytes sent is added to *count. out must be
+   blocking. */
+int ncat_sendfile(int out, int in, unsigned long *count)
+{
+    struct stat st;
+    ssize_t n;
+
+    if (fstat(in, &st) == -1 || !S_ISREG(st.st_mode))
+        return 0;
+
+    for (;;) {
+        n = sendfile(out, in, NULL, SPLICE_LEN);
+        if (n == 0)
+            return 1;
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EINVAL || errno == ENOSYS)
+                return 0;
+            return -1;
+        }
+        *count += n;
+    }
 }
+#endif
 
 /* Do telnet WILL/WONT DO/DONT negotiations */
 void dotelnet(int s, unsigned char *buf, size_t bufsiz)
@@ -243,9 +243,15 @@ int fdinfo_pending(struct fdinfo *fdn);
 int ncat_recv(struct fdinfo *fdn, char *buf, size_t size, int *pending);
 int ncat_send(struct fdinfo *fdn, const char *buf, size_t size);
 
-/* Broadcast a message to all the descriptors in fds. Returns -1 if any of the
-   sends failed. */
-extern int ncat_broadcast(fd_set *fds, const fd_list_t *fdlist, const char *msg, size_t size);
+/* Whether data to and from fdn can skip our buffers, and the functions that
+   let the kernel move it. */
+int ncat_can_splice(const struct fdinfo *fdn);
+#ifdef HAVE_SPLICE
+ssize_t ncat_splice(int in, int out, int pipefd[2]);
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+int ncat_sendfile(int out, int in, unsigned long *count);
+#endif
 
 /* Do telnet WILL/WONT DO/DONT negotiations */
 extern void dotelnet(int s, unsigned char *buf, size_t bufsiz);
@@ -155,6 +155,10 @@
 #include <openssl/err.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #ifdef WIN32
 /* Define missing constant for shutdown(2).
  * See:
@@ -163,21 +167,70 @@
 #define SHUT_WR SD_SEND
 #endif
 
-/* read_fds is the clients we are accepting data from. broadcast_fds is the
-   clients were are sending data to. broadcast_fds doesn't include the listening
-   socket and stdin. Network clients are not added to read_fds when --send-only
-   is used, because they would be always selected without having data read.
-   write_fds is the list of clients that are waiting for some kind of response
+/* The state of each descriptor we watch is kept in fdstates, indexed by
+   descriptor. FDS_READ marks the descriptors we are accepting data from, and
+   FDS_BROADCAST the clients we are sending data to, which doesn't include the
+   listening sockets and stdin. Network clients are not read from when
+   --send-only is used, because they would be always ready without having data
+   read. FDS_WRITE marks clients that are waiting for some kind of response
    from us, like a pending ssl negotiation. */
-static fd_set master_readfds, master_writefds, master_broadcastfds;
-#ifdef HAVE_OPENSSL
-/* sslpending_fds contains the list of ssl sockets that are waiting to complete
-   the ssl handshake */
-static fd_set sslpending_fds;
+#define FDS_READ        0x01
+#define FDS_WRITE       0x02
+#define FDS_BROADCAST   0x04
+#define FDS_LISTEN      0x08
+/* Waiting to complete the ssl handshake. */
+#define FDS_SSLPENDING  0x10
+/* To be shut down for writing once its send queue is empty. */
+#define FDS_SHUTDOWN    0x20
+/* Can't be polled, like stdin redirected from a regular file. It is always
+   ready. */
+#define FDS_NOPOLL      0x40
+/* Cut off for falling too far behind; waiting to see it close. */
+#define FDS_DROPPED     0x80
+
+/* Readiness reported by wait_ready. */
+#define EV_READ         0x01
+#define EV_WRITE        0x02
+
+/* The most descriptors handled per wait. */
+#define READY_MAX       64
+
+/* Data is sent to clients without blocking, and what a client can't take yet
+   is queued so that it doesn't hold up the others. Once this much is queued
+   for a client, a broker disconnects it; in other modes we wait for it as if
+   sends were blocking. */
+#define MAX_QUEUED      (1024 * 1024)
+
+struct fdstate {
+    unsigned int flags;
+    /* queue_len bytes waiting to be sent, at queue + queue_off. */
+    char *queue;
+    size_t queue_off, queue_len, queue_size;
+    /* The events being watched. */
+    unsigned int events;
+    /* Incremented when the descriptor is released, so that events reported
+       for it are not taken for those of a new descriptor with the same
+       number. */
+    unsigned int gen;
+};
+
+struct ready {
+    int fd;
+    unsigned int events, gen;
+};
+
+static struct fdstate *fdstates = NULL;
+static int fdstates_len = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+static int epoll_fd = -1;
+#else
+static fd_set master_readfds, master_writefds;
 #endif
 
-/* These are bookkeeping data structures that are parallel to read_fds and
-   broadcast_fds. */
+/* The fdinfo of the descriptors we read from (including the listening sockets
+   and stdin) and of the clients we send to. Looking up a descriptor takes
+   constant time. */
 static fd_list_t client_fdlist, broadcast_fdlist;
 
 static int listen_socket[NUM_LISTEN_ADDRS];
@@ -190,6 +243,9 @@ static int read_stdin(void);
 static int read_socket(int recv_fd);
 static void post_handle_connection(struct fdinfo sinfo);
 static void read_and_broadcast(int recv_socket);
+static int broadcast(int except, const char *msg, size_t size);
+static void flush_queue(int fd);
+static void flush_queues(void);
 static void shutdown_sockets(int how);
 static int chat_announce_connect(int fd, const union sockaddr_u *su);
 static int chat_announce_disconnect(int fd);
@@ -233,21 +289,292 @@ static void sigchld_handler(int signum)
 }
 #endif
 
+static struct fdstate *get_fdstate(int fd)
+{
+    ncat_assert(fd >= 0);
+
+    if (fd >= fdstates_len) {
+        int len = MAX(fd + 1, fdstates_len * 2);
+
+        fdstates = (struct fdstate *) safe_realloc(fdstates, len * sizeof(*fdstates));
+        zmem(fdstates + fdstates_len, (len - fdstates_len) * sizeof(*fdstates));
+        fdstates_len = len;
+    }
+
+    return &fdstates[fd];
+}
+
+static int has_flags(int fd, unsigned int flags)
+{
+    return fd >= 0 && fd < fdstates_len && (fdstates[fd].flags & flags) != 0;
+}
+
+/* Registers the events we want from a descriptor with epoll or select. */
+static void update_watch(int fd)
+{
+    struct fdstate *st = get_fdstate(fd);
+    unsigned int events = 0;
+
+    if (st->flags & FDS_READ)
+        events |= EV_READ;
+    if ((st->flags & FDS_WRITE) || st->queue_len > 0)
+        events |= EV_WRITE;
+    if (events == st->events || (st->flags & FDS_NOPOLL))
+        return;
+
+#ifdef HAVE_SYS_EPOLL_H
+    {
+        struct epoll_event ev;
+        int op;
+
+        zmem(&ev, sizeof(ev));
+        if (events & EV_READ)
+            ev.events |= EPOLLIN;
+        if (events & EV_WRITE)
+            ev.events |= EPOLLOUT;
+        ev.data.u64 = ((uint64_t) st->gen << 32) | (uint32_t) fd;
+
+        if (events == 0)
+            op = EPOLL_CTL_DEL;
+        else if (st->events == 0)
+            op = EPOLL_CTL_ADD;
+        else
+            op = EPOLL_CTL_MOD;
+
+        if (epoll_ctl(epoll_fd, op, fd, &ev) == -1) {
+            if (op == EPOLL_CTL_ADD && errno == EPERM) {
+                if (o.debug > 1)
+                    logdebug("fd %d can't be polled, treating it as always ready\n", fd);
+                st->flags |= FDS_NOPOLL;
+                return;
+            }
+            if (op != EPOLL_CTL_DEL)
+                bye("epoll_ctl on fd %d: %s.", fd, strerror(errno));
+        }
+    }
+#else
+    if (events & EV_READ)
+        checked_fd_set(fd, &master_readfds);
+    else
+        checked_fd_clr(fd, &master_readfds);
+    if (events & EV_WRITE)
+        checked_fd_set(fd, &master_writefds);
+    else
+        checked_fd_clr(fd, &master_writefds);
+#endif
+
+    st->events = events;
+}
+
+static void set_flags(int fd, unsigned int flags)
+{
+    get_fdstate(fd)->flags |= flags;
+    update_watch(fd);
+}
+
+static void clear_flags(int fd, unsigned int flags)
+{
+    get_fdstate(fd)->flags &= ~flags;
+    update_watch(fd);
+}
+
+/* Stops watching a descriptor that is about to be closed, dropping anything
+   queued for it. */
+static void release_fd(int fd)
+{
+    struct fdstate *st = get_fdstate(fd);
+
+    st->flags = 0;
+    st->queue_len = 0;
+    update_watch(fd);
+
+    free(st->queue);
+    st->queue = NULL;
+    st->queue_off = 0;
+    st->queue_size = 0;
+    st->gen++;
+}
+
+/* Waits until descriptors are ready and stores up to max of them in ready.
+   Returns the number stored, 0 on timeout, or -1 if interrupted. */
+static int wait_ready(struct ready *ready, int max, struct timeval *tv)
+{
+    int n = 0;
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event evs[READY_MAX];
+    int i, rc, timeout = -1;
+    int stdin_ready = has_flags(STDIN_FILENO, FDS_NOPOLL)
+        && has_flags(STDIN_FILENO, FDS_READ);
+
+    if (tv != NULL)
+        timeout = tv->tv_sec * 1000 + tv->tv_usec / 1000;
+    if (stdin_ready) {
+        timeout = 0;
+        max--;
+    }
+
+    rc = epoll_wait(epoll_fd, evs, MIN(max, READY_MAX), timeout);
+    if (rc == -1) {
+        if (errno == EINTR)
+            return -1;
+        bye("epoll_wait: %s.", strerror(errno));
+    }
+
+    for (i = 0; i < rc; i++) {
+        ready[n].fd = (int) (uint32_t) evs[i].data.u64;
+        ready[n].gen = (unsigned int) (evs[i].data.u64 >> 32);
+        ready[n].events = 0;
+        /* Errors and hangups are noticed when reading or writing. */
+        if (evs[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            ready[n].events |= EV_READ;
+        if (evs[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+            ready[n].events |= EV_WRITE;
+        n++;
+    }
+    if (stdin_ready) {
+        ready[n].fd = STDIN_FILENO;
+        ready[n].gen = fdstates[STDIN_FILENO].gen;
+        ready[n].events = EV_READ;
+        n++;
+    }
+#else
+    /* We pass these temporary descriptor sets to fselect, since fselect
+       modifies the sets it receives. */
+    fd_set readfds = master_readfds, writefds = master_writefds;
+    const fd_list_t *lists[] = { &client_fdlist, &broadcast_fdlist };
+    int i, j, rc;
+
+    rc = fselect(MAX(client_fdlist.fdmax, broadcast_fdlist.fdmax) + 1,
+        &readfds, &writefds, NULL, tv);
+    if (rc <= 0)
+        return rc;
+
+    /* Only look at the descriptors in our lists. Clients we only send to are
+       in broadcast_fdlist alone. */
+    for (i = 0; i < 2 && n < max; i++) {
+        for (j = 0; j < lists[i]->nfds && n < max; j++) {
+            int fd = lists[i]->fds[j].fd;
+
+            if (i > 0 && get_fdinfo(&client_fdlist, fd) != NULL)
+                continue;
+            ready[n].events = 0;
+            if (checked_fd_isset(fd, &readfds))
+                ready[n].events |= EV_READ;
+            if (checked_fd_isset(fd, &writefds))
+                ready[n].events |= EV_WRITE;
+            if (ready[n].events == 0)
+                continue;
+            ready[n].fd = fd;
+            ready[n].gen = get_fdstate(fd)->gen;
+            n++;
+        }
+    }
+#endif
+
+    return n;
+}
+
+/* Handles a ready descriptor. Returns -1 to keep listening, or else the value
+   for ncat_listen_stream to return. */
+static int handle_ready(int i, unsigned int events)
+{
+    int rc;
+
+    if (o.debug > 1)
+        logdebug("fd %d is ready\n", i);
+
+#ifdef HAVE_OPENSSL
+    /* Is this an ssl socket pending a handshake? If so handle it. */
+    if (o.ssl && has_flags(i, FDS_SSLPENDING)) {
+        struct fdinfo *fdi = NULL;
+        clear_flags(i, FDS_READ | FDS_WRITE);
+        fdi = get_fdinfo(&client_fdlist, i);
+        ncat_assert(fdi != NULL);
+        switch (ssl_handshake(fdi)) {
+        case NCAT_SSL_HANDSHAKE_COMPLETED:
+            /* Clear from the pending list once ssl is established */
+            clear_flags(i, FDS_SSLPENDING);
+            post_handle_connection(*fdi);
+            break;
+        case NCAT_SSL_HANDSHAKE_PENDING_WRITE:
+            set_flags(i, FDS_WRITE);
+            break;
+        case NCAT_SSL_HANDSHAKE_PENDING_READ:
+            set_flags(i, FDS_READ);
+            break;
+        case NCAT_SSL_HANDSHAKE_FAILED:
+        default:
+            SSL_free(fdi->ssl);
+            release_fd(fdi->fd);
+            Close(fdi->fd);
+            rm_fd(&client_fdlist, i);
+            /* Are we in single listening mode(without -k)? If so
+               then we should quit also. */
+            if (!o.keepopen && !o.broker)
+                return 1;
+            --conn_inc;
+            break;
+        }
+        return -1;
+    }
+#endif
+
+    if ((events & EV_WRITE) && get_fdstate(i)->queue_len > 0)
+        flush_queue(i);
+    if (!(events & EV_READ))
+        return -1;
+
+    if (has_flags(i, FDS_LISTEN)) {
+        /* we have a new connection request */
+        handle_connection(i);
+    } else if (i == STDIN_FILENO) {
+        if (o.broker) {
+            read_and_broadcast(i);
+        } else {
+            /* Read from stdin and write to all clients. */
+            rc = read_stdin();
+            if (rc == 0) {
+                if (o.proto != IPPROTO_TCP || (o.proto == IPPROTO_TCP && o.sendonly)) {
+                    /* There will be nothing more to send. If we're not
+                       receiving anything, we can quit here. */
+                    return 0;
+                }
+                if (!o.noshutdown) shutdown_sockets(SHUT_WR);
+            }
+            if (rc < 0)
+                return 1;
+        }
+    } else if (!o.sendonly) {
+        if (o.broker) {
+            read_and_broadcast(i);
+        } else {
+            /* Read from a client and write to stdout. */
+            rc = read_socket(i);
+            if (rc <= 0 && !o.keepopen)
+                return rc == 0 ? 0 : 1;
+        }
+    }
+
+    return -1;
+}
+
 static int ncat_listen_stream(int proto)
 {
     int rc, i, fds_ready;
-    fd_set listen_fds;
     struct timeval tv;
     struct timeval *tvp = NULL;
     unsigned int num_sockets;
 
     /* clear out structs */
+#ifdef HAVE_SYS_EPOLL_H
+    epoll_fd = epoll_create(16);
+    if (epoll_fd == -1)
+        bye("epoll_create: %s.", strerror(errno));
+    /* Don't pass it on to commands we run. */
+    fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+#else
     FD_ZERO(&master_readfds);
     FD_ZERO(&master_writefds);
-    FD_ZERO(&master_broadcastfds);
-    FD_ZERO(&listen_fds);
-#ifdef HAVE_OPENSSL
-    FD_ZERO(&sslpending_fds);
 #endif
     zmem(&client_fdlist, sizeof(client_fdlist));
     zmem(&broadcast_fdlist, sizeof(broadcast_fdlist));
@@ -307,12 +634,10 @@ static int ncat_listen_stream(int proto)
          */
         unblock_socket(listen_socket[num_sockets]);
 
-        /* setup select sets and max fd */
-        FD_SET(listen_socket[num_sockets], &master_readfds);
+        /* watch it and keep max fd */
+        set_flags(listen_socket[num_sockets], FDS_LISTEN | FDS_READ);
         add_fd(&client_fdlist, listen_socket[num_sockets]);
 
-        FD_SET(listen_socket[num_sockets], &listen_fds);
-
         num_sockets++;
     }
     if (num_sockets == 0) {
@@ -330,10 +655,7 @@ static int ncat_listen_stream(int proto)
         tvp = &tv;
 
     while (1) {
-        /* We pass these temporary descriptor sets to fselect, since fselect
-           modifies the sets it receives. */
-        fd_set readfds = master_readfds, writefds = master_writefds;
-        
+        struct ready ready[READY_MAX];
 
         if (o.debug > 1)
             logdebug("selecting, fdmax %d\n", client_fdlist.fdmax);
@@ -344,7 +666,7 @@ static int ncat_listen_stream(int proto)
         if (o.idletimeout > 0)
             ms_to_timeval(tvp, o.idletimeout);
 
-        fds_ready = fselect(client_fdlist.fdmax + 1, &readfds, &writefds, NULL, tvp);
+        fds_ready = wait_ready(ready, READY_MAX, tvp);
 
         if (o.debug > 1)
             logdebug("select returned %d fds ready\n", fds_ready);
@@ -352,88 +674,16 @@ static int ncat_listen_stream(int proto)
         if (fds_ready == 0)
             bye("Idle timeout expired (%d ms).", o.idletimeout);
 
-        /*
-         * FIXME: optimize this loop to look only at the fds in the fd list,
-         * doing it this way means that if you have one descriptor that is very
-         * large, say 500, and none close to it, that you'll loop many times for
-         * nothing.
-         */
-        for (i = 0; i <= client_fdlist.fdmax && fds_ready > 0; i++) {
-            /* Loop through descriptors until there's something to read */
-            if (!FD_ISSET(i, &readfds) && !FD_ISSET(i, &writefds))
+        for (i = 0; i < fds_ready; i++) {
+            /* Skip descriptors closed while handling earlier ones. */
+            if (ready[i].gen != get_fdstate(ready[i].fd)->gen)
                 continue;
 
-            if (o.debug > 1)
-                logdebug("fd %d is ready\n", i);
-
-#ifdef HAVE_OPENSSL
-            /* Is this an ssl socket pending a handshake? If so handle it. */
-            if (o.ssl && FD_ISSET(i, &sslpending_fds)) {
-                struct fdinfo *fdi = NULL;
-                FD_CLR(i, &master_readfds);
-                FD_CLR(i, &master_writefds);
-                fdi = get_fdinfo(&client_fdlist, i);
-                ncat_assert(fdi != NULL);
-                switch (ssl_handshake(fdi)) {
-                case NCAT_SSL_HANDSHAKE_COMPLETED:
-                    /* Clear from sslpending_fds once ssl is established */
-                    FD_CLR(i, &sslpending_fds);
-                    post_handle_connection(*fdi);
-                    break;
-                case NCAT_SSL_HANDSHAKE_PENDING_WRITE:
-                    FD_SET(i, &master_writefds);
-                    break;
-                case NCAT_SSL_HANDSHAKE_PENDING_READ:
-                    FD_SET(i, &master_readfds);
-                    break;
-                case NCAT_SSL_HANDSHAKE_FAILED:
-                default:
-                    SSL_free(fdi->ssl);
-                    Close(fdi->fd);
-                    FD_CLR(i, &sslpending_fds);
-                    FD_CLR(i, &master_readfds);
-                    rm_fd(&client_fdlist, i);
-                    /* Are we in single listening mode(without -k)? If so
-                       then we should quit also. */
-                    if (!o.keepopen && !o.broker)
-                        return 1;
-                    --conn_inc;
-                    break;
-                }
-            } else
-#endif
-            if (FD_ISSET(i, &listen_fds)) {
-                /* we have a new connection request */
-                handle_connection(i);
-            } else if (i == STDIN_FILENO) {
-                if (o.broker) {
-                    read_and_broadcast(i);
-                } else {
-                    /* Read from stdin and write to all clients. */
-                    rc = read_stdin();
-                    if (rc == 0) {
-                        if (o.proto != IPPROTO_TCP || (o.proto == IPPROTO_TCP && o.sendonly)) {
-                            /* There will be nothing more to send. If we're not
-                               receiving anything, we can quit here. */
-                            return 0;
-                        }
-                        if (!o.noshutdown) shutdown_sockets(SHUT_WR);
-                    }
-                    if (rc < 0)
-                        return 1;
-                }
-            } else if (!o.sendonly) {
-                if (o.broker) {
-                    read_and_broadcast(i);
-                } else {
-                    /* Read from a client and write to stdout. */
-                    rc = read_socket(i);
-                    if (rc <= 0 && !o.keepopen)
-                        return rc == 0 ? 0 : 1;
-                }
+            rc = handle_ready(ready[i].fd, ready[i].events);
+            if (rc >= 0) {
+                flush_queues();
+                return rc;
             }
-
-            fds_ready--;
         }
     }
 
@@ -481,8 +731,8 @@ static void handle_connection(int socket_accept)
     if (!o.keepopen && !o.broker) {
         int i;
         for (i = 0; i < num_listenaddrs; i++) {
+            release_fd(listen_socket[i]);
             Close(listen_socket[i]);
-            FD_CLR(listen_socket[i], &master_readfds);
             rm_fd(&client_fdlist, listen_socket[i]);
         }
     }
@@ -519,10 +769,8 @@ static void handle_connection(int socket_accept)
 
 #ifdef HAVE_OPENSSL
     if (o.ssl) {
-        /* Add the socket to the necessary descriptor lists. */
-        FD_SET(s.fd, &sslpending_fds);
-        FD_SET(s.fd, &master_readfds);
-        FD_SET(s.fd, &master_writefds);
+        /* Watch the socket until the handshake is done. */
+        set_flags(s.fd, FDS_SSLPENDING | FDS_READ | FDS_WRITE);
         /* Add it to our list of fds too for maintaining maxfd. */
         if (add_fdinfo(&client_fdlist, &s) < 0)
             bye("add_fdinfo() failed.");
@@ -555,10 +803,10 @@ static void post_handle_connection(struct fdinfo sinfo)
     } else {
         /* Now that a client is connected, pay attention to stdin. */
         if (!stdin_eof)
-            FD_SET(STDIN_FILENO, &master_readfds);
+            set_flags(STDIN_FILENO, FDS_READ);
         if (!o.sendonly) {
             /* add to our lists */
-            FD_SET(sinfo.fd, &master_readfds);
+            set_flags(sinfo.fd, FDS_READ);
             /* add it to our list of fds for maintaining maxfd */
 #ifdef HAVE_OPENSSL
             /* Don't add it twice (see handle_connection above) */
@@ -570,9 +818,14 @@ static void post_handle_connection(struct fdinfo sinfo)
             }
 #endif
         }
-        FD_SET(sinfo.fd, &master_broadcastfds);
+        set_flags(sinfo.fd, FDS_BROADCAST);
         if (add_fdinfo(&broadcast_fdlist, &sinfo) < 0)
             bye("add_fdinfo() failed.");
+#ifdef HAVE_OPENSSL
+        /* Sends that can't complete are retried from the send queue. */
+        if (sinfo.ssl != NULL)
+            SSL_set_mode(sinfo.ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#endif
 
         if (o.chat)
             chat_announce_connect(sinfo.fd, &sinfo.remoteaddr);
@@ -595,7 +848,7 @@ int read_stdin(void)
             logdebug("EOF on stdin\n");
 
         /* Don't close the file because that allows a socket to be fd 0. */
-        FD_CLR(STDIN_FILENO, &master_readfds);
+        clear_flags(STDIN_FILENO, FDS_READ);
         /* Buf mark that we've seen EOF so it doesn't get re-added to the
            select list. */
         stdin_eof = 1;
@@ -611,11 +864,11 @@ int read_stdin(void)
 
     /* Write to everything in the broadcast set. */
     if (tempbuf != NULL) {
-        ncat_broadcast(&master_broadcastfds, &broadcast_fdlist, tempbuf, nbytes);
+        broadcast(-1, tempbuf, nbytes);
         free(tempbuf);
         tempbuf = NULL;
     } else {
-        ncat_broadcast(&master_broadcastfds, &broadcast_fdlist, buf, nbytes);
+        broadcast(-1, buf, nbytes);
     }
 
     return nbytes;
@@ -647,15 +900,14 @@ int read_socket(int recv_fd)
                 SSL_free(fdn->ssl);
             }
 #endif
+            release_fd(recv_fd);
             close(recv_fd);
-            FD_CLR(recv_fd, &master_readfds);
             rm_fd(&client_fdlist, recv_fd);
-            FD_CLR(recv_fd, &master_broadcastfds);
             rm_fd(&broadcast_fdlist, recv_fd);
 
             conn_inc--;
             if (get_conn_count() == 0)
-                FD_CLR(STDIN_FILENO, &master_readfds);
+                clear_flags(STDIN_FILENO, FDS_READ);
 
             return n;
         }
@@ -1001,7 +1253,6 @@ static void read_and_broadcast(int recv_fd)
         char buf[DEFAULT_TCP_BUF_LEN];
         char *chatbuf, *outbuf;
         char *tempbuf = NULL;
-        fd_set broadcastfds;
         int n;
 
         /* Behavior differs depending on whether this is stdin or a socket. */
@@ -1015,7 +1266,7 @@ static void read_and_broadcast(int recv_fd)
 
                 /* Don't close the file because that allows a socket to be
                    fd 0. */
-                FD_CLR(recv_fd, &master_readfds);
+                clear_flags(recv_fd, FDS_READ);
                 /* But mark that we've seen EOF so it doesn't get re-added to
                    the select list. */
                 stdin_eof = 1;
@@ -1041,15 +1292,14 @@ static void read_and_broadcast(int recv_fd)
                     SSL_free(fdn->ssl);
                 }
 #endif
+                release_fd(recv_fd);
                 close(recv_fd);
-                FD_CLR(recv_fd, &master_readfds);
                 rm_fd(&client_fdlist, recv_fd);
-                FD_CLR(recv_fd, &master_broadcastfds);
                 rm_fd(&broadcast_fdlist, recv_fd);
 
                 conn_inc--;
                 if (conn_inc == 0)
-                    FD_CLR(STDIN_FILENO, &master_readfds);
+                    clear_flags(STDIN_FILENO, FDS_READ);
 
                 if (o.chat)
                     chat_announce_disconnect(recv_fd);
@@ -1079,9 +1329,7 @@ static void read_and_broadcast(int recv_fd)
         }
 
         /* Send to everyone except the one who sent this message. */
-        broadcastfds = master_broadcastfds;
-        FD_CLR(recv_fd, &broadcastfds);
-        ncat_broadcast(&broadcastfds, &broadcast_fdlist, outbuf, n);
+        broadcast(recv_fd, outbuf, n);
 
         free(chatbuf);
         free(tempbuf);
@@ -1089,18 +1337,197 @@ static void read_and_broadcast(int recv_fd)
     } while (pending);
 }
 
-static void shutdown_sockets(int how)
+/* Sends as much of buf to a client as it takes without blocking. Returns the
+   number of bytes sent, or -1 on error. */
+static int send_nonblock(struct fdinfo *fdn, const char *buf, size_t size)
+{
+    int n;
+
+#ifdef HAVE_OPENSSL
+    if (o.ssl && fdn->ssl != NULL) {
+        n = SSL_write(fdn->ssl, buf, size);
+        if (n > 0)
+            return n;
+        switch (SSL_get_error(fdn->ssl, n)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            return 0;
+        default:
+            return -1;
+        }
+    }
+#endif
+
+    n = send(fdn->fd, buf, size, 0);
+    if (n < 0) {
+        int err = socket_errno();
+
+        if (err == EAGAIN || err == EWOULDBLOCK || err == EINTR)
+            return 0;
+    }
+
+    return n;
+}
+
+/* Sends what is queued for a client, waiting for it to take all of it. */
+static void send_queue_blocking(struct fdinfo *fdn)
+{
+    struct fdstate *st = get_fdstate(fdn->fd);
+
+    block_socket(fdn->fd);
+    while (st->queue_len > 0) {
+        int n = fdinfo_send(fdn, st->queue + st->queue_off, st->queue_len);
+
+        if (n <= 0) {
+            if (o.debug > 1)
+                logdebug("Error sending to fd %d: %s.\n", fdn->fd, socket_strerror(socket_errno()));
+            break;
+        }
+        st->queue_off += n;
+        st->queue_len -= n;
+    }
+    unblock_socket(fdn->fd);
+
+    st->queue_off = 0;
+    st->queue_len = 0;
+    if (st->flags & FDS_SHUTDOWN)
+        shutdown(fdn->fd, SHUT_WR);
+    update_watch(fdn->fd);
+}
+
+/* Sends data to a client after anything already queued for it, queueing what
+   it can't take now. Returns -1 on error. */
+static int queue_send(struct fdinfo *fdn, const char *buf, size_t size)
+{
+    struct fdstate *st = get_fdstate(fdn->fd);
+
+    if (st->flags & FDS_DROPPED)
+        return -1;
+
+    if (st->queue_len == 0) {
+        int n = send_nonblock(fdn, buf, size);
+
+        if (n < 0)
+            return -1;
+        buf += n;
+        size -= n;
+        if (size == 0)
+            return 0;
+    }
+
+    if (st->queue_off + st->queue_len + size > st->queue_size) {
+        memmove(st->queue, st->queue + st->queue_off, st->queue_len);
+        st->queue_off = 0;
+        if (st->queue_len + size > st->queue_size) {
+            st->queue_size = MAX(st->queue_len + size, st->queue_size * 2);
+            st->queue = (char *) safe_realloc(st->queue, st->queue_size);
+        }
+    }
+    memcpy(st->queue + st->queue_off + st->queue_len, buf, size);
+    st->queue_len += size;
+
+    if (st->queue_len > MAX_QUEUED && o.broker && !o.sendonly) {
+        /* It would hold up everyone else. Reading from it will see EOF and
+           close it the usual way. */
+        if (o.verbose)
+            loguser("Disconnecting fd %d, which has %lu bytes queued.\n", fdn->fd, (unsigned long) st->queue_len);
+        st->queue_off = 0;
+        st->queue_len = 0;
+        st->flags |= FDS_DROPPED;
+        shutdown(fdn->fd, SHUT_RDWR);
+        update_watch(fdn->fd);
+        return -1;
+    } else if (st->queue_len > MAX_QUEUED) {
+        if (o.debug > 1)
+            logdebug("fd %d has %lu bytes queued, waiting for it.\n", fdn->fd, (unsigned long) st->queue_len);
+        send_queue_blocking(fdn);
+    } else {
+        update_watch(fdn->fd);
+    }
+
+    return 0;
+}
+
+/* Sends what is queued for a client, as far as it takes it without
+   blocking. */
+static void flush_queue(int fd)
 {
+    struct fdstate *st = get_fdstate(fd);
     struct fdinfo *fdn;
+    int n;
+
+    fdn = get_fdinfo(&broadcast_fdlist, fd);
+    ncat_assert(fdn != NULL);
+
+    n = send_nonblock(fdn, st->queue + st->queue_off, st->queue_len);
+    if (n < 0) {
+        if (o.debug > 1)
+            logdebug("Error sending to fd %d: %s.\n", fd, socket_strerror(socket_errno()));
+        /* It won't be delivered. */
+        n = st->queue_len;
+    }
+    st->queue_off += n;
+    st->queue_len -= n;
+
+    if (st->queue_len == 0) {
+        st->queue_off = 0;
+        if (st->flags & FDS_SHUTDOWN)
+            shutdown(fd, SHUT_WR);
+    }
+    update_watch(fd);
+}
+
+/* Sends everything still queued before we exit. */
+static void flush_queues(void)
+{
     int i;
 
-    for (i = 0; i <= broadcast_fdlist.fdmax; i++) {
-        if (!FD_ISSET(i, &master_broadcastfds))
+    for (i = 0; i < broadcast_fdlist.nfds; i++) {
+        if (get_fdstate(broadcast_fdlist.fds[i].fd)->queue_len > 0)
+            send_queue_blocking(&broadcast_fdlist.fds[i]);
+    }
+}
+
+/* Broadcast a message to all the clients we send to, except the one with
+   descriptor except (-1 for none). Returns -1 if any of the sends failed. */
+static int broadcast(int except, const char *msg, size_t size)
+{
+    struct fdinfo *fdn;
+    int i, ret;
+
+    if (o.recvonly)
+        return size;
+
+    ret = 0;
+    for (i = 0; i < broadcast_fdlist.nfds; i++) {
+        fdn = &broadcast_fdlist.fds[i];
+        if (fdn->fd == except)
             continue;
 
-        fdn = get_fdinfo(&broadcast_fdlist, i);
-        ncat_assert(fdn != NULL);
-        shutdown(fdn->fd, how);
+        if (queue_send(fdn, msg, size) < 0) {
+            if (o.debug > 1)
+                logdebug("Error sending to fd %d: %s.\n", fdn->fd, socket_strerror(socket_errno()));
+            ret = -1;
+        }
+    }
+
+    ncat_log_send(msg, size);
+
+    return ret;
+}
+
+static void shutdown_sockets(int how)
+{
+    struct fdinfo *fdn;
+    int i;
+
+    for (i = 0; i < broadcast_fdlist.nfds; i++) {
+        fdn = &broadcast_fdlist.fds[i];
+        /* Let the client have what is queued for it first. */
+        if (how == SHUT_WR && get_fdstate(fdn->fd)->queue_len > 0)
+            set_flags(fdn->fd, FDS_SHUTDOWN);
+        else
+            shutdown(fdn->fd, how);
     }
 }
 
@@ -1109,18 +1536,19 @@ static int chat_announce_connect(int fd, const union sockaddr_u *su)
 {
     char *buf = NULL;
     size_t size = 0, offset = 0;
-    int i, count, ret;
+    int i, j, count, ret;
 
     strbuf_sprintf(&buf, &size, &offset,
         "<announce> %s is connected as <user%d>.\n", inet_socktop(su), fd);
 
     strbuf_sprintf(&buf, &size, &offset, "<announce> already connected: ");
     count = 0;
-    for (i = 0; i < client_fdlist.fdmax; i++) {
+    for (j = 0; j < broadcast_fdlist.nfds; j++) {
         union sockaddr_u su;
         socklen_t len = sizeof(su.storage);
 
-        if (i == fd || !FD_ISSET(i, &master_broadcastfds))
+        i = broadcast_fdlist.fds[j].fd;
+        if (i == fd)
             continue;
 
         if (getpeername(i, &su.sockaddr, &len) == -1)
@@ -1137,7 +1565,7 @@ static int chat_announce_connect(int fd, const union sockaddr_u *su)
         strbuf_sprintf(&buf, &size, &offset, "nobody");
     strbuf_sprintf(&buf, &size, &offset, ".\n");
 
-    ret = ncat_broadcast(&master_broadcastfds, &broadcast_fdlist, buf, offset);
+    ret = broadcast(-1, buf, offset);
 
     free(buf);
 
@@ -1154,7 +1582,7 @@ static int chat_announce_disconnect(int fd)
     if (n >= sizeof(buf) || n < 0)
         return -1;
 
-    return ncat_broadcast(&master_broadcastfds, &broadcast_fdlist, buf, n);
+    return broadcast(-1, buf, n);
 }
 
 /*
@@ -190,6 +190,7 @@ void netexec(struct fdinfo *info, char *cmdexec)
     int child_stdout[2];
     int pid;
     int crlf_state;
+    int use_splice;
 
     char buf[DEFAULT_TCP_BUF_LEN];
     int maxfd;
@@ -263,6 +264,16 @@ void netexec(struct fdinfo *info, char *cmdexec)
     if (info->fd > maxfd)
         maxfd = info->fd;
 
+    /* When nothing needs to look at the data, it is moved between the socket
+       and the pipes with splice. */
+    use_splice = 0;
+#ifdef HAVE_SPLICE
+    if (ncat_can_splice(info) && !o.recvonly) {
+        use_splice = 1;
+        block_socket(info->fd);
+    }
+#endif
+
     /* This is the parent process. Enter a "caretaker" loop that reads from the
        socket and writes to the subprocess, and reads from the subprocess and
        writes to the socket. We exit the loop on any read error (or EOF). On a
@@ -286,15 +297,37 @@ void netexec(struct fdinfo *info, char *cmdexec)
         if (FD_ISSET(info->fd, &fds)) {
             int pending;
 
-            do {
-                n_r = ncat_recv(info, buf, sizeof(buf), &pending);
-                if (n_r <= 0)
+#ifdef HAVE_SPLICE
+            if (use_splice) {
+                n_r = ncat_splice(info->fd, child_stdin[1], NULL);
+                if (n_r == -1 && errno == EINVAL)
+                    use_splice = 0;
+                else if (n_r <= 0)
                     goto loop_end;
-                write_loop(child_stdin[1], buf, n_r);
-            } while (pending);
+            }
+#endif
+            if (!use_splice) {
+                do {
+                    n_r = ncat_recv(info, buf, sizeof(buf), &pending);
+                    if (n_r <= 0)
+                        goto loop_end;
+                    write_loop(child_stdin[1], buf, n_r);
+                } while (pending);
+            }
         }
         if (FD_ISSET(child_stdout[0], &fds)) {
             char *crlf = NULL, *wbuf;
+#ifdef HAVE_SPLICE
+            if (use_splice) {
+                n_r = ncat_splice(child_stdout[0], info->fd, NULL);
+                if (n_r > 0)
+                    continue;
+                else if (n_r == -1 && errno == EINVAL)
+                    use_splice = 0;
+                else
+                    break;
+            }
+#endif
             n_r = read(child_stdout[0], buf, sizeof(buf));
             if (n_r <= 0)
                 break;
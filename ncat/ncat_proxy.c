@@ -492,6 +492,10 @@ static int handle_connect(struct socket_buffer *client_sock,
     char *line;
     size_t len;
     fd_set m, r;
+    int use_splice;
+#ifdef HAVE_SPLICE
+    int up[2] = { -1, -1 }, down[2] = { -1, -1 };
+#endif
 
     if (request->uri.port == -1) {
         if (o.verbose)
@@ -531,6 +535,14 @@ static int handle_connect(struct socket_buffer *client_sock,
         return 0;
     }
 
+    /* If we can, move the data in each direction with splice, through a pipe
+       of its own. */
+    use_splice = 0;
+#ifdef HAVE_SPLICE
+    if (ncat_can_splice(&client_sock->fdn) && pipe(up) == 0 && pipe(down) == 0)
+        use_splice = 1;
+#endif
+
     maxfd = client_sock->fdn.fd < s ? s : client_sock->fdn.fd;
     FD_ZERO(&m);
     FD_SET(client_sock->fdn.fd, &m);
@@ -549,37 +561,81 @@ static int handle_connect(struct socket_buffer *client_sock,
         zmem(buf, sizeof(buf));
 
         if (FD_ISSET(client_sock->fdn.fd, &r)) {
-            do {
+#ifdef HAVE_SPLICE
+            if (use_splice) {
+                ssize_t n;
+
+                n = ncat_splice(client_sock->fdn.fd, s, up);
+                if (n < 0 && errno == EINVAL) {
+                    use_splice = 0;
+                } else if (n < 0) {
+                    goto end;
+                } else if (n == 0) {
+                    /* EOF from the client. */
+                    goto end;
+                }
+            }
+#endif
+            if (!use_splice) {
                 do {
-                    len = fdinfo_recv(&client_sock->fdn, buf, sizeof(buf));
+                    do {
+                        len = fdinfo_recv(&client_sock->fdn, buf, sizeof(buf));
+                    } while (len == -1 && socket_errno() == EINTR);
+                    if (len <= 0)
+                        goto end;
+
+                    do {
+                        rc = send(s, buf, len, 0);
+                    } while (rc == -1 && socket_errno() == EINTR);
+                    if (rc == -1)
+                        goto end;
+                } while (fdinfo_pending(&client_sock->fdn));
+            }
+        }
+
+        if (FD_ISSET(s, &r)) {
+#ifdef HAVE_SPLICE
+            if (use_splice) {
+                ssize_t n;
+
+                n = ncat_splice(s, client_sock->fdn.fd, down);
+                if (n < 0 && errno == EINVAL) {
+                    use_splice = 0;
+                } else if (n < 0) {
+                    goto end;
+                } else if (n == 0) {
+                    /* EOF from the server. */
+                    goto end;
+                }
+            }
+#endif
+            if (!use_splice) {
+                do {
+                    len = recv(s, buf, sizeof(buf), 0);
                 } while (len == -1 && socket_errno() == EINTR);
                 if (len <= 0)
                     goto end;
 
                 do {
-                    rc = send(s, buf, len, 0);
+                    rc = fdinfo_send(&client_sock->fdn, buf, len);
                 } while (rc == -1 && socket_errno() == EINTR);
                 if (rc == -1)
                     goto end;
-            } while (fdinfo_pending(&client_sock->fdn));
-        }
-
-        if (FD_ISSET(s, &r)) {
-            do {
-                len = recv(s, buf, sizeof(buf), 0);
-            } while (len == -1 && socket_errno() == EINTR);
-            if (len <= 0)
-                goto end;
-
-            do {
-                rc = fdinfo_send(&client_sock->fdn, buf, len);
-            } while (rc == -1 && socket_errno() == EINTR);
-            if (rc == -1)
-                goto end;
+            }
         }
     }
 end:
 
+#ifdef HAVE_SPLICE
+    if (up[0] != -1) {
+        close(up[0]);
+        close(up[1]);
+    }
+    if (down[0] != -1) {
+        close(down[0]);
+        close(down[1]);
+    }
+#endif
     close(s);
 
     return 0;
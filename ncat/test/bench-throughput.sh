@@ -0,0 +1,82 @@
+#!/bin/sh
+
+# Measures the throughput of Ncat relaying bulk data with --sh-exec, through
+# its HTTP proxy, and sending a file with --send-only. Each case is run once
+# as is, which lets the kernel move the data with splice or sendfile where
+# available, and once with -o /dev/null, which makes Ncat copy the data
+# through its own buffers in order to log it.
+#
+# Usage: ./bench-throughput.sh [megabytes]
+
+NCAT=${NCAT:-../ncat}
+SIZE=${1:-512}
+PORT=${PORT:-40321}
+PROXY_PORT=$(expr $PORT + 1)
+FILE=$(mktemp "${TMPDIR:-/tmp}/ncat-bench.XXXXXX")
+PIDS=""
+
+cleanup() {
+	for pid in $PIDS; do
+		kill $pid 2>/dev/null
+	done
+	rm -f "$FILE"
+}
+trap cleanup EXIT INT TERM
+
+now() {
+	date +%s.%N
+}
+
+# Runs the rest of the arguments as a command, discarding its output, and
+# prints the rate at which it moved $SIZE megabytes after the label in the
+# first argument.
+timed() {
+	label=$1
+	shift
+	start=$(now)
+	"$@" > /dev/null
+	end=$(now)
+	echo "$start $end" | awk -v size=$SIZE -v label="$label" \
+		'{ printf "%-40s %8.1f MB/s\n", label, size / ($2 - $1) }'
+}
+
+# Starts an Ncat listener in the background.
+listen() {
+	$NCAT "$@" &
+	PIDS="$PIDS $!"
+	sleep 1
+}
+
+stop() {
+	for pid in $PIDS; do
+		kill $pid 2>/dev/null
+		wait $pid 2>/dev/null
+	done
+	PIDS=""
+}
+
+dd if=/dev/zero of="$FILE" bs=1048576 count=$SIZE 2>/dev/null
+
+for log in "" "-o /dev/null"; do
+	if [ -z "$log" ]; then
+		mode="direct"
+	else
+		mode="copied"
+	fi
+
+	listen -l 127.0.0.1 $PORT $log --sh-exec "cat \"$FILE\""
+	timed "--sh-exec to socket ($mode)" \
+		$NCAT $log --recv-only 127.0.0.1 $PORT
+	stop
+
+	listen -l 127.0.0.1 $PORT $log --sh-exec "cat > /dev/null"
+	timed "socket to --sh-exec ($mode)" \
+		$NCAT $log --send-only 127.0.0.1 $PORT < "$FILE"
+	stop
+
+	listen -l 127.0.0.1 $PORT --recv-only --no-shutdown > /dev/null
+	listen -l 127.0.0.1 $PROXY_PORT $log --proxy-type http
+	timed "HTTP CONNECT tunnel ($mode)" \
+		$NCAT $log --send-only --proxy 127.0.0.1:$PROXY_PORT 127.0.0.1 $PORT < "$FILE"
+	stop
+done
@@ -1502,6 +1502,111 @@ sub {
 };
 kill_children;
 
+# Connect a TCP socket to a server on $HOST:$PORT. If a receive buffer size is
+# given, it is set before connecting, so that a client that doesn't read fills
+# the server's queue for it quickly.
+sub broker_connect {
+	my $rcvbuf = shift;
+	my $sock;
+	# Give the server a moment to listen, as ncat_client does.
+	select(undef, undef, undef, 0.1);
+	socket($sock, PF_INET, SOCK_STREAM, getprotobyname("tcp")) or die;
+	if (defined $rcvbuf) {
+		setsockopt($sock, SOL_SOCKET, SO_RCVBUF, pack("l", $rcvbuf)) or die;
+	}
+	connect($sock, sockaddr_in($PORT, inet_aton($HOST))) or die "Can't connect: $!";
+	binmode($sock);
+	return $sock;
+}
+
+# Write $data to $sender while reading what the server relays to $watcher, so
+# that $watcher never falls behind. Return what $watcher received by the time
+# it has received "done\n", which may come after a chat mode prefix.
+sub broker_relay {
+	my ($sender, $watcher, $data) = @_;
+	my $received = "";
+	my $frag;
+
+	fcntl($sender, F_SETFL, O_NONBLOCK) or die "Can't set flags for the socket: $!";
+	while (length($data) > 0) {
+		my ($rd, $wr) = ("", "");
+		vec($rd, fileno($watcher), 1) = 1;
+		vec($wr, fileno($sender), 1) = 1;
+		select($rd, $wr, undef, 5) or die "Server stopped relaying after " . length($received) . " bytes";
+		if (vec($rd, fileno($watcher), 1)) {
+			sysread($watcher, $frag, 65536) or die "Watching client was disconnected";
+			$received .= $frag;
+		}
+		if (vec($wr, fileno($sender), 1)) {
+			my $n = syswrite($sender, $data, 65536);
+			defined $n or die "Can't send: $!";
+			substr($data, 0, $n) = "";
+		}
+	}
+	while ($received !~ /done\n/) {
+		$frag = timeout_read($watcher, 2);
+		$frag or die "Watching client got " . length($received) . " bytes, not the end";
+		$received .= $frag;
+	}
+	return $received;
+}
+
+# A client that doesn't read must not hold up the others. Once too much is
+# queued for it, it is disconnected.
+for my $mode ("--broker", "--chat") {
+	($s_pid, $s_out, $s_in) = ncat_server($mode);
+	test "$mode client that doesn't read is disconnected",
+	sub {
+		my $slow = broker_connect(4096);
+		my $sender = broker_connect();
+		my $watcher = broker_connect();
+		select(undef, undef, undef, 0.1);
+
+		my $size = 16 * 1024 * 1024;
+		my $received = broker_relay($sender, $watcher, (("x" x 1023) . "\n") x ($size / 1024) . "done\n");
+		length($received) > $size or die "Watching client got " . length($received) . " bytes, not $size";
+		if ($mode eq "--chat") {
+			$received .= timeout_read($watcher) // "";
+			$received =~ /<announce> <user\d+> is disconnected/ or die "Disconnection wasn't announced";
+		}
+
+		my $n = 0;
+		my $frag;
+		for (;;) {
+			$frag = timeout_read($slow, 2);
+			defined $frag or last;
+			$frag or die "Slow client wasn't disconnected after getting $n bytes";
+			$n += length($frag);
+		}
+		$n < $size or die "Slow client got all $n bytes";
+	};
+	kill_children;
+}
+
+# The server must carry on when a client leaves with data still queued for it.
+for my $mode ("--broker", "--chat") {
+	($s_pid, $s_out, $s_in) = ncat_server($mode);
+	test "$mode client disconnects with data queued",
+	sub {
+		my $slow = broker_connect(4096);
+		my $sender = broker_connect();
+		my $watcher = broker_connect();
+		select(undef, undef, undef, 0.1);
+
+		my $line = ("x" x 1023) . "\n";
+		broker_relay($sender, $watcher, $line x 256 . "done\n");
+		close($slow);
+		my $received = broker_relay($sender, $watcher, $line x 256 . "done\n");
+		length($received) > 256 * 1024 or die "Watching client got " . length($received) . " bytes";
+		if ($mode eq "--chat") {
+			$received .= timeout_read($watcher) // "";
+			$received =~ /<announce> <user\d+> is disconnected/ or die "Disconnection wasn't announced";
+		}
+		waitpid($s_pid, WNOHANG) == 0 or die "Server exited";
+	};
+	kill_children;
+}
+
 
 # Source address tests.
 
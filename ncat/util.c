@@ -601,9 +601,18 @@ int add_fdinfo(fd_list_t *fdl, struct fdinfo *s)
     if (fdl->nfds >= fdl->maxfds)
         return -1;
 
+    if (s->fd >= fdl->fdidx_len) {
+        int len = MAX(s->fd + 1, fdl->fdidx_len * 2);
+
+        fdl->fdidx = (int *) safe_realloc(fdl->fdidx, len * sizeof(int));
+        memset(fdl->fdidx + fdl->fdidx_len, 0, (len - fdl->fdidx_len) * sizeof(int));
+        fdl->fdidx_len = len;
+    }
+
     fdl->fds[fdl->nfds] = *s;
 
     fdl->nfds++;
+    fdl->fdidx[s->fd] = fdl->nfds;
 
     if (s->fd > fdl->fdmax)
         fdl->fdmax = s->fd;
@@ -635,19 +644,17 @@ int rm_fd(fd_list_t *fdl, int fd)
         bye("Program bug: Trying to remove fd from list with no fds.");
 
     /* find the fd in the list */
-    for (x = 0; x < last; x++)
-        if (fdl->fds[x].fd == fd)
-            break;
-
-    /* make sure we found it */
-    if (x == last)
+    if (fd < 0 || fd >= fdl->fdidx_len || fdl->fdidx[fd] == 0)
         bye("Program bug: fd (%d) not on list.", fd);
+    x = fdl->fdidx[fd] - 1;
 
     /* remove it, does nothing if (last == 1) */
     if (o.debug > 1)
         logdebug("Swapping fd[%d] (%d) with fd[%d] (%d)\n",
                  x, fdl->fds[x].fd, last - 1, fdl->fds[last - 1].fd);
     fdl->fds[x] = fdl->fds[last - 1];
+    fdl->fdidx[fdl->fds[x].fd] = x + 1;
+    fdl->fdidx[fd] = 0;
 
     fdl->nfds--;
 
@@ -674,13 +681,10 @@ int get_maxfd(fd_list_t *fdl)
 
 struct fdinfo *get_fdinfo(const fd_list_t *fdl, int fd)
 {
-    int x;
-
-    for (x = 0; x < fdl->nfds; x++)
-        if (fdl->fds[x].fd == fd)
-            return &fdl->fds[x];
+    if (fd < 0 || fd >= fdl->fdidx_len || fdl->fdidx[fd] == 0)
+        return NULL;
 
-    return NULL;
+    return &fdl->fds[fdl->fdidx[fd] - 1];
 }
 
 void init_fdlist(fd_list_t *fdl, int maxfds)
@@ -689,6 +693,8 @@ void init_fdlist(fd_list_t *fdl, int maxfds)
     fdl->nfds = 0;
     fdl->fdmax = -1;
     fdl->maxfds = maxfds;
+    fdl->fdidx = NULL;
+    fdl->fdidx_len = 0;
 
     if (o.debug > 1)
         logdebug("Initialized fdlist with %d maxfds\n", maxfds);
@@ -697,6 +703,9 @@ void init_fdlist(fd_list_t *fdl, int maxfds)
 void free_fdlist(fd_list_t *fdl)
 {
     free(fdl->fds);
+    free(fdl->fdidx);
+    fdl->fdidx = NULL;
+    fdl->fdidx_len = 0;
     fdl->nfds = 0;
     fdl->fdmax = -1;
 }
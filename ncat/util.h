@@ -218,6 +218,10 @@ struct fdinfo {
 typedef struct fd_list {
     struct fdinfo *fds;
     int nfds, maxfds, fdmax;
+    /* Position plus one of each descriptor in fds, or 0, indexed by
+       descriptor. */
+    int *fdidx;
+    int fdidx_len;
 } fd_list_t;
 
 int add_fdinfo(fd_list_t *, struct fdinfo *);
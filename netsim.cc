@@ -0,0 +1,725 @@
+/***************************************************************************
+ * netsim.cc -- A simulated network of hosts with configurable port        *
+ * states, round trip times, loss and rate limiting, for measuring the     *
+ * scan engine without raw sockets or a real network.                      *
+ *                                                                         *
+ ***********************IMPORTANT NMAP LICENSE TERMS************************
+ *                                                                         *
+ * The Nmap Security Scanner is (C) 1996-2016 Insecure.Com LLC ("The Nmap  *
+ * Project"). Nmap is also a registered trademark of the Nmap Project.     *
+ * This program is free software; you may redistribute and/or modify it    *
+ * under the terms of the GNU General Public License as published by the   *
+ * Free Software Foundation; Version 2 ("GPL"), BUT ONLY WITH ALL OF THE   *
+ * CLARIFICATIONS AND EXCEPTIONS DESCRIBED HEREIN.  This guarantees your   *
+ * right to use, modify, and redistribute this software under certain      *
+ * conditions.  If you wish to embed Nmap technology into proprietary      *
+ * software, we sell alternative licenses (contact sales@nmap.com).        *
+ * Dozens of software vendors already license Nmap technology such as      *
+ * host discovery, port scanning, OS detection, version detection, and     *
+ * the Nmap Scripting Engine.                                              *
+ *                                                                         *
+ * Note that the GPL places important restrictions on "derivative works",  *
+ * yet it does not provide a detailed definition of that term.  To avoid   *
+ * misunderstandings, we interpret that term as broadly as copyright law   *
+ * allows.  For example, we consider an application to constitute a        *
+ * derivative work for the purpose of this license if it does any of the   *
+ * following with any software or content covered by this license          *
+ * ("Covered Software"):                                                   *
+ *                                                                         *
+ * o Integrates source code from Covered Software.                         *
+ *                                                                         *
+ * o Reads or includes copyrighted data files, such as Nmap's nmap-os-db   *
+ * or nmap-service-probes.                                                 *
+ *                                                                         *
+ * o Is designed specifically to execute Covered Software and parse the    *
+ * results (as opposed to typical shell or execution-menu apps, which will *
+ * execute anything you tell them to).                                     *
+ *                                                                         *
+ * o Includes Covered Software in a proprietary executable installer.  The *
+ * installers produced by InstallShield are an example of this.  Including *
+ * Nmap with other software in compressed or archival form does not        *
+ * trigger this provision, provided appropriate open source decompression  *
+ * or de-archiving software is widely available for no charge.  For the    *
+ * purposes of this license, an installer is considered to include Covered *
+ * Software even if it actually retrieves a copy of Covered Software from  *
+ * another source during runtime (such as by downloading it from the       *
+ * Internet).                                                              *
+ *                                                                         *
+ * o Links (statically or dynamically) to a library which does any of the  *
+ * above.                                                                  *
+ *                                                                         *
+ * o Executes a helper program, module, or script to do any of the above.  *
+ *                                                                         *
+ * This list is not exclusive, but is meant to clarify our interpretation  *
+ * of derived works with some common examples.  Other people may interpret *
+ * the plain GPL differently, so we consider this a special exception to   *
+ * the GPL that we apply to Covered Software.  Works which meet any of     *
+ * these conditions must conform to all of the terms of this license,      *
+ * particularly including the GPL Section 3 requirements of providing      *
+ * source code and allowing free redistribution of the work as a whole.    *
+ *                                                                         *
+ * As another special exception to the GPL terms, the Nmap Project grants  *
+ * permission to link the code of this program with any version of the     *
+ * OpenSSL library which is distributed under a license identical to that  *
+ * listed in the included docs/licenses/OpenSSL.txt file, and distribute   *
+ * linked combinations including the two.                                  *
+ *                                                                         * 
+ * The Nmap Project has permission to redistribute Npcap, a packet         *
+ * capturing driver and library for the Microsoft Windows platform.        *
+ * Npcap is a separate work with it's own license rather than this Nmap    *
+ * license.  Since the Npcap license does not permit redistribution        *
+ * without special permission, our Nmap Windows binary packages which      *
+ * contain Npcap may not be redistributed without special permission.      *
+ *                                                                         *
+ * Any redistribution of Covered Software, including any derived works,    *
+ * must obey and carry forward all of the terms of this license, including *
+ * obeying all GPL rules and restrictions.  For example, source code of    *
+ * the whole work must be provided and free redistribution must be         *
+ * allowed.  All GPL references to "this License", are to be treated as    *
+ * including the terms and conditions of this license text as well.        *
+ *                                                                         *
+ * Because this license imposes special exceptions to the GPL, Covered     *
+ * Work may not be combined (even as part of a larger work) with plain GPL *
+ * software.  The terms, conditions, and exceptions of this license must   *
+ * be included as well.  This license is incompatible with some other open *
+ * source licenses as well.  In some cases we can relicense portions of    *
+ * Nmap or grant special permissions to use it in other open source        *
+ * software.  Please contact fyodor@nmap.org with any such requests.       *
+ * Similarly, we don't incorporate incompatible open source software into  *
+ * Covered Software without special permission from the copyright holders. *
+ *                                                                         *
+ * If you have any questions about the licensing restrictions on using     *
+ * Nmap in other works, are happy to help.  As mentioned above, we also    *
+ * offer alternative license to integrate Nmap into proprietary            *
+ * applications and appliances.  These contracts have been sold to dozens  *
+ * of software vendors, and generally include a perpetual license as well  *
+ * as providing for priority support and updates.  They also fund the      *
+ * continued development of Nmap.  Please email sales@nmap.com for further *
+ * information.                                                            *
+ *                                                                         *
+ * If you have received a written license agreement or contract for        *
+ * Covered Software stating terms other than these, you may choose to use  *
+ * and redistribute Covered Software under those terms instead of these.   *
+ *                                                                         *
+ * Source is provided to this software because we believe users have a     *
+ * right to know exactly what a program is going to do before they run it. *
+ * This also allows you to audit the software for security holes.          *
+ *                                                                         *
+ * Source code also allows you to port Nmap to new platforms, fix bugs,    *
+ * and add new features.  You are highly encouraged to send your changes   *
+ * to the dev@nmap.org mailing list for possible incorporation into the    *
+ * main distribution.  By sending these changes to Fyodor or one of the    *
+ * Insecure.Org development mailing lists, or checking them into the Nmap  *
+ * source code repository, it is understood (unless you specify            *
+ * otherwise) that you are offering the Nmap Project the unlimited,        *
+ * non-exclusive right to reuse, modify, and relicense the code.  Nmap     *
+ * will always be available Open Source, but this is important because     *
+ * the inability to relicense code has caused devastating problems for     *
+ * other Free Software projects (such as KDE and NASM).  We also           *
+ * occasionally relicense the code to third parties as discussed above.    *
+ * If you wish to specify special license conditions of your               *
+ * contributions, just say so when you send them.                          *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Nmap      *
+ * license file for more details (it's in a COPYING file included with     *
+ * Nmap, and also available from https://svn.nmap.org/nmap/COPYING)        *
+ *                                                                         *
+ ***************************************************************************/
+
+/* $Id$ */
+
+#include "netsim.h"
+#include "nmap.h"
+#include "NmapOps.h"
+#include "nmap_error.h"
+#include "output.h"
+#include "services.h"
+#include "tcpip.h"
+#include "libnetutil/netutil.h"
+#include "struct_ip.h"
+
+#include <errno.h>
+#include <math.h>
+#include <map>
+#include <queue>
+#include <vector>
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+
+extern NmapOps o;
+
+enum netsim_state { NETSIM_CLOSED, NETSIM_OPEN, NETSIM_FILTERED };
+
+/* The simulated network. Every address from the first after the network
+   address up to the number of hosts belongs to a host that is up; Nmap itself
+   has the last address of the network. */
+static struct {
+  struct in_addr net, src;
+  int bits;
+  u32 hosts;
+  u8 tcp[65536], udp[65536]; /* netsim_state of each port */
+  long rtt_min, rtt_max; /* Range of the hosts' round trip times, usec */
+  long jitter; /* Mean of the exponentially distributed extra delay, usec */
+  double loss; /* Probability that a probe or its reply is lost */
+  double icmp_rate, rst_rate; /* Replies per second per host, 0 for no limit */
+  u64 seed, rng;
+} sim;
+
+struct netsim_host {
+  long rtt;
+  u16 ipid;
+  double icmp_tokens, rst_tokens;
+  struct timeval icmp_stamp, rst_stamp;
+};
+
+static std::map<u32, struct netsim_host> hosts;
+
+struct netsim_packet {
+  struct timeval due;
+  u8 *data;
+  u32 len;
+};
+
+struct netsim_later {
+  bool operator()(const struct netsim_packet &a, const struct netsim_packet &b) const {
+    return TIMEVAL_AFTER(a.due, b.due);
+  }
+};
+
+/* Replies on their way back to Nmap, earliest first. */
+static std::priority_queue<struct netsim_packet, std::vector<struct netsim_packet>, netsim_later> replies;
+
+/* A simulated connect() socket. A connection that never completes (to a
+   filtered port, or one whose SYN was lost) has done false. */
+struct netsim_conn {
+  bool used, done;
+  struct timeval due;
+  int err;
+};
+
+static std::vector<struct netsim_conn> conns;
+
+static struct {
+  unsigned long sent, rcvd, lost, limited;
+  struct timeval start;
+  double cpu;
+} stats;
+
+/* xorshift64*, so that a given seed gives the same losses and jitter. */
+static double netsim_random(void) {
+  sim.rng ^= sim.rng >> 12;
+  sim.rng ^= sim.rng << 25;
+  sim.rng ^= sim.rng >> 27;
+  return ((sim.rng * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static double cpu_seconds(void) {
+#ifndef WIN32
+  struct rusage ru;
+
+  if (getrusage(RUSAGE_SELF, &ru) == 0)
+    return TIMEVAL_SECS(ru.ru_utime) + TIMEVAL_SECS(ru.ru_stime);
+#endif
+  return 0;
+}
+
+static void netsim_ports(const char *spec, int range_type, u8 *table, u8 state) {
+  unsigned short *list = NULL;
+  int count = 0, i;
+
+  getpts_simple(spec, range_type, &list, &count);
+  for (i = 0; i < count; i++)
+    table[list[i]] = state;
+  free(list);
+}
+
+/* Parses "MIN[-MAX]" milliseconds into microseconds. */
+static void netsim_msecs(const char *key, const char *val, long *min, long *max) {
+  char *end;
+  double a, b;
+
+  a = b = strtod(val, &end);
+  if (*end == '-')
+    b = strtod(end + 1, &end);
+  if (*end != '\0' || a < 0 || b < a)
+    fatal("Bad --netsim %s \"%s\": expected milliseconds or a range like 5-40", key, val);
+  *min = (long) (a * 1000);
+  if (max)
+    *max = (long) (b * 1000);
+}
+
+static double netsim_number(const char *key, const char *val) {
+  char *end;
+  double d = strtod(val, &end);
+
+  if (*end != '\0' || d < 0)
+    fatal("Bad --netsim %s \"%s\": expected a non-negative number", key, val);
+  return d;
+}
+
+void netsim_init(const char *spec) {
+  char *copy, *item, *next, *val;
+  char netstr[64];
+  u32 size;
+
+  memset(&sim, 0, sizeof(sim));
+  inet_pton(AF_INET, "10.0.0.0", &sim.net);
+  sim.bits = 24;
+  sim.hosts = 0;
+  netsim_ports("22,80,443", SCAN_TCP_PORT, sim.tcp, NETSIM_OPEN);
+  sim.rtt_min = sim.rtt_max = 10000;
+  sim.jitter = 2000;
+  sim.seed = 1;
+
+  copy = strdup(spec);
+  for (item = copy; item != NULL; item = next) {
+    next = item + strcspn(item, "; ");
+    if (*next == '\0')
+      next = NULL;
+    else
+      *next++ = '\0';
+    if (*item == '\0')
+      continue;
+    val = strchr(item, '=');
+    if (val == NULL)
+      fatal("Bad --netsim setting \"%s\": expected key=value", item);
+    *val++ = '\0';
+
+    if (strcmp(item, "net") == 0) {
+      char *slash = strchr(val, '/');
+      if (slash != NULL)
+        *slash++ = '\0';
+      if (inet_pton(AF_INET, val, &sim.net) != 1)
+        fatal("Bad --netsim net \"%s\": expected an IPv4 network like 10.0.0.0/24", val);
+      sim.bits = slash ? atoi(slash) : 24;
+      if (sim.bits < 8 || sim.bits > 30)
+        fatal("--netsim net must have a prefix length between 8 and 30");
+    } else if (strcmp(item, "hosts") == 0) {
+      sim.hosts = (u32) netsim_number(item, val);
+    } else if (strcmp(item, "open") == 0) {
+      netsim_ports(val, SCAN_TCP_PORT, sim.tcp, NETSIM_OPEN);
+    } else if (strcmp(item, "filtered") == 0) {
+      netsim_ports(val, SCAN_TCP_PORT, sim.tcp, NETSIM_FILTERED);
+    } else if (strcmp(item, "udp-open") == 0) {
+      netsim_ports(val, SCAN_UDP_PORT, sim.udp, NETSIM_OPEN);
+    } else if (strcmp(item, "udp-filtered") == 0) {
+      netsim_ports(val, SCAN_UDP_PORT, sim.udp, NETSIM_FILTERED);
+    } else if (strcmp(item, "rtt") == 0) {
+      netsim_msecs(item, val, &sim.rtt_min, &sim.rtt_max);
+    } else if (strcmp(item, "jitter") == 0) {
+      netsim_msecs(item, val, &sim.jitter, NULL);
+    } else if (strcmp(item, "loss") == 0) {
+      sim.loss = netsim_number(item, val) / 100;
+      if (sim.loss >= 1)
+        fatal("--netsim loss must be less than 100 (percent)");
+    } else if (strcmp(item, "icmp-rate") == 0) {
+      sim.icmp_rate = netsim_number(item, val);
+    } else if (strcmp(item, "rst-rate") == 0) {
+      sim.rst_rate = netsim_number(item, val);
+    } else if (strcmp(item, "seed") == 0) {
+      sim.seed = strtoull(val, NULL, 0);
+    } else {
+      fatal("Unknown --netsim setting \"%s\"", item);
+    }
+  }
+  free(copy);
+
+  size = 1U << (32 - sim.bits);
+  sim.net.s_addr = htonl(ntohl(sim.net.s_addr) & ~(size - 1));
+  sim.src.s_addr = htonl(ntohl(sim.net.s_addr) + size - 2);
+  if (sim.hosts == 0 || sim.hosts > size - 3)
+    sim.hosts = size - 3;
+  sim.rng = sim.seed ? sim.seed : 1;
+
+  if (o.debugging) {
+    inet_ntop(AF_INET, &sim.net, netstr, sizeof(netstr));
+    log_write(LOG_PLAIN, "Simulated network %s/%d: %u hosts, rtt %.1f-%.1fms, jitter %.1fms, loss %.1f%%\n",
+              netstr, sim.bits, sim.hosts, sim.rtt_min / 1000.0, sim.rtt_max / 1000.0,
+              sim.jitter / 1000.0, sim.loss * 100);
+  }
+
+  gettimeofday(&stats.start, NULL);
+  stats.cpu = cpu_seconds();
+}
+
+/* Returns the host with the given address, or NULL if no host that is up has
+   it. A host's round trip time depends only on the seed and its address. */
+static struct netsim_host *netsim_host(const struct in_addr *addr) {
+  std::map<u32, struct netsim_host>::iterator it;
+  u32 index = ntohl(addr->s_addr) - ntohl(sim.net.s_addr);
+  u64 h;
+
+  if (index < 1 || index > sim.hosts)
+    return NULL;
+
+  it = hosts.find(index);
+  if (it != hosts.end())
+    return &it->second;
+
+  struct netsim_host &host = hosts[index];
+  h = (sim.seed + index) * 0x9E3779B97F4A7C15ULL;
+  h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 31;
+  host.rtt = sim.rtt_min + (long) ((h >> 11) / 9007199254740992.0 * (sim.rtt_max - sim.rtt_min));
+  host.ipid = (u16) h;
+  host.icmp_tokens = MAX(sim.icmp_rate, 1);
+  host.rst_tokens = MAX(sim.rst_rate, 1);
+  gettimeofday(&host.icmp_stamp, NULL);
+  host.rst_stamp = host.icmp_stamp;
+  return &host;
+}
+
+/* Token bucket holding up to a second's worth of replies. */
+static bool netsim_allow(double *tokens, struct timeval *stamp, double rate,
+                         const struct timeval *now) {
+  if (rate <= 0)
+    return true;
+  *tokens = MIN(MAX(rate, 1), *tokens + rate * TIMEVAL_FSEC_SUBTRACT(*now, *stamp));
+  *stamp = *now;
+  if (*tokens < 1) {
+    stats.limited++;
+    return false;
+  }
+  *tokens -= 1;
+  return true;
+}
+
+/* The time a reply from host sent now arrives back at Nmap. */
+static void netsim_arrival(const struct netsim_host *host, const struct timeval *now,
+                           struct timeval *due) {
+  long delay = host->rtt;
+
+  if (sim.jitter > 0)
+    delay += (long) (-log(1 - netsim_random()) * sim.jitter);
+  TIMEVAL_ADD(*due, *now, delay);
+}
+
+static void netsim_queue(const struct netsim_host *host, const struct timeval *now,
+                         u8 *packet, u32 len) {
+  struct netsim_packet p;
+
+  if (packet == NULL)
+    return;
+  netsim_arrival(host, now, &p.due);
+  p.data = packet;
+  p.len = len;
+  replies.push(p);
+}
+
+static void netsim_tcp(struct netsim_host *host, const struct in_addr *addr,
+                       const struct timeval *now, const struct tcp_hdr *tcp,
+                       unsigned int seglen) {
+  u8 state = sim.tcp[ntohs(tcp->th_dport)];
+  u8 flags = tcp->th_flags, rflags;
+  u32 seq, ack, len;
+  u8 mss[4] = { 0x02, 0x04, 0x05, 0xb4 };
+  u8 *reply;
+
+  if ((flags & TH_RST) || state == NETSIM_FILTERED)
+    return;
+
+  if ((flags & (TH_SYN | TH_ACK)) == TH_SYN && state == NETSIM_OPEN) {
+    reply = build_tcp_raw(addr, &sim.src, 64, host->ipid++, 0, true, NULL, 0,
+                          ntohs(tcp->th_dport), ntohs(tcp->th_sport),
+                          (u32) (netsim_random() * 4294967296.0), ntohl(tcp->th_seq) + 1,
+                          0, TH_SYN | TH_ACK, 64240, 0, mss, sizeof(mss), NULL, 0, &len);
+    netsim_queue(host, now, reply, len);
+    return;
+  }
+
+  if (flags & TH_ACK) {
+    /* There is no connection, so any ACK gets a plain reset. */
+    seq = ntohl(tcp->th_ack);
+    ack = 0;
+    rflags = TH_RST;
+  } else if (state == NETSIM_CLOSED) {
+    seq = 0;
+    ack = ntohl(tcp->th_seq) + seglen + ((flags & TH_SYN) ? 1 : 0) + ((flags & TH_FIN) ? 1 : 0);
+    rflags = TH_RST | TH_ACK;
+  } else {
+    /* FIN, NULL and Xmas probes to open ports get no answer. */
+    return;
+  }
+  if (!netsim_allow(&host->rst_tokens, &host->rst_stamp, sim.rst_rate, now))
+    return;
+  reply = build_tcp_raw(addr, &sim.src, 64, host->ipid++, 0, true, NULL, 0,
+                        ntohs(tcp->th_dport), ntohs(tcp->th_sport), seq, ack,
+                        0, rflags, 0, 0, NULL, 0, NULL, 0, &len);
+  netsim_queue(host, now, reply, len);
+}
+
+/* Builds an ICMP message of the given type and code. body is everything after
+   the checksum. */
+static void netsim_icmp(struct netsim_host *host, const struct in_addr *addr,
+                        const struct timeval *now, u8 type, u8 code,
+                        const u8 *body, unsigned int bodylen) {
+  u8 msg[4 + 576];
+  u16 sum;
+  u32 len;
+  u8 *reply;
+
+  bodylen = MIN(bodylen, sizeof(msg) - 4);
+  msg[0] = type;
+  msg[1] = code;
+  msg[2] = msg[3] = 0;
+  memcpy(msg + 4, body, bodylen);
+  sum = in_cksum((u16 *) msg, 4 + bodylen);
+  memcpy(msg + 2, &sum, 2);
+  reply = build_ip_raw(addr, &sim.src, IPPROTO_ICMP, 64, host->ipid++, 0, false,
+                       NULL, 0, (const char *) msg, 4 + bodylen, &len);
+  netsim_queue(host, now, reply, len);
+}
+
+static void netsim_udp(struct netsim_host *host, const struct in_addr *addr,
+                       const struct timeval *now, const u8 *packet,
+                       unsigned int hdrlen, const struct udp_hdr *udp) {
+  u8 state = sim.udp[ntohs(udp->uh_dport)];
+  u8 body[4 + 60 + 8];
+  u32 len;
+  u8 *reply;
+
+  if (state == NETSIM_OPEN) {
+    reply = build_udp_raw(addr, &sim.src, 64, host->ipid++, 0, false, NULL, 0,
+                          ntohs(udp->uh_dport), ntohs(udp->uh_sport),
+                          "netsim", 6, &len);
+    netsim_queue(host, now, reply, len);
+  } else if (state == NETSIM_CLOSED
+             && netsim_allow(&host->icmp_tokens, &host->icmp_stamp, sim.icmp_rate, now)) {
+    /* Port unreachable, quoting the IP header and the UDP header. */
+    memset(body, 0, 4);
+    memcpy(body + 4, packet, hdrlen + 8);
+    netsim_icmp(host, addr, now, 3, 3, body, 4 + hdrlen + 8);
+  }
+}
+
+static void netsim_icmp_request(struct netsim_host *host, const struct in_addr *addr,
+                                const struct timeval *now, const u8 *icmp,
+                                unsigned int icmplen) {
+  u8 body[576];
+  u32 ms;
+
+  if (icmplen < 8)
+    return;
+  icmplen = MIN(icmplen, sizeof(body) + 4);
+  memcpy(body, icmp + 4, icmplen - 4);
+  if (icmp[0] == 8 && icmp[1] == 0) {
+    netsim_icmp(host, addr, now, 0, 0, body, icmplen - 4);
+  } else if (icmp[0] == 13 && icmp[1] == 0 && icmplen >= 20) {
+    /* Receive and transmit timestamps, in milliseconds since midnight UT. */
+    ms = htonl((now->tv_sec % 86400) * 1000 + now->tv_usec / 1000);
+    memcpy(body + 8, &ms, 4);
+    memcpy(body + 12, &ms, 4);
+    netsim_icmp(host, addr, now, 14, 0, body, icmplen - 4);
+  }
+}
+
+int netsim_route(const struct sockaddr_storage *dst, struct route_nfo *rnfo) {
+  const struct sockaddr_in *sin = (const struct sockaddr_in *) dst;
+  struct sockaddr_in *src;
+  u32 mask = htonl(~0U << (32 - sim.bits));
+
+  if (dst->ss_family != AF_INET || (sin->sin_addr.s_addr & mask) != sim.net.s_addr)
+    return 0;
+
+  memset(rnfo, 0, sizeof(*rnfo));
+  Strncpy(rnfo->ii.devname, "netsim", sizeof(rnfo->ii.devname));
+  Strncpy(rnfo->ii.devfullname, "netsim", sizeof(rnfo->ii.devfullname));
+  src = (struct sockaddr_in *) &rnfo->ii.addr;
+  src->sin_family = AF_INET;
+  src->sin_addr = sim.src;
+  rnfo->ii.netmask_bits = sim.bits;
+  rnfo->ii.device_type = devt_other;
+  rnfo->ii.device_up = 1;
+  rnfo->ii.mtu = 1500;
+  rnfo->direct_connect = 1;
+  rnfo->srcaddr = rnfo->ii.addr;
+  return 1;
+}
+
+int netsim_send(const u8 *packet, unsigned int packetlen) {
+  const struct ip *ip = (const struct ip *) packet;
+  struct netsim_host *host;
+  struct timeval now;
+  unsigned int hdrlen, len;
+
+  gettimeofday(&now, NULL);
+  PacketTrace::trace(PacketTrace::SENT, packet, packetlen, &now);
+  stats.sent++;
+
+  /* Only whole IPv4 packets from Nmap's own address get an answer. */
+  if (packetlen < sizeof(struct ip) || ip->ip_v != 4)
+    return packetlen;
+  hdrlen = ip->ip_hl * 4;
+  len = MIN(packetlen, ntohs(ip->ip_len));
+  if (hdrlen < sizeof(struct ip) || len < hdrlen + 8
+      || (ntohs(ip->ip_off) & (IP_MF | IP_OFFMASK)) != 0
+      || ip->ip_src.s_addr != sim.src.s_addr)
+    return packetlen;
+  host = netsim_host(&ip->ip_dst);
+  if (host == NULL)
+    return packetlen;
+  if (sim.loss > 0 && netsim_random() < sim.loss) {
+    stats.lost++;
+    return packetlen;
+  }
+
+  switch (ip->ip_p) {
+  case IPPROTO_TCP:
+    if (len >= hdrlen + sizeof(struct tcp_hdr)) {
+      const struct tcp_hdr *tcp = (const struct tcp_hdr *) (packet + hdrlen);
+      if (len >= hdrlen + tcp->th_off * 4)
+        netsim_tcp(host, &ip->ip_dst, &now, tcp, len - hdrlen - tcp->th_off * 4);
+    }
+    break;
+  case IPPROTO_UDP:
+    netsim_udp(host, &ip->ip_dst, &now, packet, hdrlen,
+               (const struct udp_hdr *) (packet + hdrlen));
+    break;
+  case IPPROTO_ICMP:
+    netsim_icmp_request(host, &ip->ip_dst, &now, packet + hdrlen, len - hdrlen);
+    break;
+  }
+  return packetlen;
+}
+
+char *netsim_read(unsigned int *len, long to_usec, struct timeval *rcvdtime) {
+  static char *buf = NULL;
+  static unsigned int bufsz = 0;
+  struct netsim_packet p;
+  struct timeval now, deadline;
+  long wait;
+
+  gettimeofday(&now, NULL);
+  TIMEVAL_ADD(deadline, now, MAX(to_usec, 0));
+  if (replies.empty() || TIMEVAL_AFTER(replies.top().due, deadline)) {
+    wait = TIMEVAL_SUBTRACT(deadline, now);
+    if (wait > 0)
+      usleep(wait);
+    *len = 0;
+    return NULL;
+  }
+
+  p = replies.top();
+  replies.pop();
+  wait = TIMEVAL_SUBTRACT(p.due, now);
+  if (wait > 0)
+    usleep(wait);
+
+  if (p.len > bufsz) {
+    buf = (char *) safe_realloc(buf, p.len);
+    bufsz = p.len;
+  }
+  memcpy(buf, p.data, p.len);
+  free(p.data);
+  *len = p.len;
+  stats.rcvd++;
+  if (rcvdtime)
+    *rcvdtime = p.due;
+  PacketTrace::trace(PacketTrace::RCVD, (u8 *) buf, *len, &p.due);
+  return buf;
+}
+
+int netsim_socket(void) {
+  unsigned int sd;
+
+  /* Descriptors 0-2 are left alone so that they look like real ones. */
+  for (sd = 3; sd < conns.size() && conns[sd].used; sd++)
+    ;
+  if (sd >= FD_SETSIZE)
+    fatal("Out of simulated sockets");
+  if (sd >= conns.size())
+    conns.resize(sd + 1);
+  conns[sd].used = true;
+  conns[sd].done = false;
+  conns[sd].err = 0;
+  return sd;
+}
+
+int netsim_connect(int sd, const struct sockaddr_storage *dst) {
+  const struct sockaddr_in *sin = (const struct sockaddr_in *) dst;
+  struct netsim_conn *conn = &conns[sd];
+  struct netsim_host *host;
+  struct timeval now;
+  u8 state;
+
+  gettimeofday(&now, NULL);
+  stats.sent++;
+  host = dst->ss_family == AF_INET ? netsim_host(&sin->sin_addr) : NULL;
+  if (host != NULL && !(sim.loss > 0 && netsim_random() < sim.loss)) {
+    state = sim.tcp[ntohs(sin->sin_port)];
+    if (state == NETSIM_OPEN) {
+      conn->done = true;
+      conn->err = 0;
+    } else if (state == NETSIM_CLOSED
+               && netsim_allow(&host->rst_tokens, &host->rst_stamp, sim.rst_rate, &now)) {
+      conn->done = true;
+      conn->err = ECONNREFUSED;
+    }
+    if (conn->done)
+      netsim_arrival(host, &now, &conn->due);
+  } else if (host != NULL) {
+    stats.lost++;
+  }
+  errno = EINPROGRESS;
+  return -1;
+}
+
+/* Like select, but on simulated sockets: waits until one in writefds is
+   connected or refused. */
+int netsim_select(int nfds, fd_set *readfds, fd_set *writefds,
+                  fd_set *exceptfds, struct timeval *timeout) {
+  struct timeval now, first;
+  int sd, n = 0;
+  long wait;
+
+  gettimeofday(&now, NULL);
+  TIMEVAL_ADD(first, now, timeout->tv_sec * 1000000 + timeout->tv_usec);
+  nfds = MIN(nfds, (int) conns.size());
+  for (sd = 0; sd < nfds; sd++) {
+    if (conns[sd].used && conns[sd].done && checked_fd_isset(sd, writefds)
+        && TIMEVAL_BEFORE(conns[sd].due, first))
+      first = conns[sd].due;
+  }
+  wait = TIMEVAL_SUBTRACT(first, now);
+  if (wait > 0)
+    usleep(wait);
+
+  FD_ZERO(readfds);
+  FD_ZERO(exceptfds);
+  for (sd = 0; sd < nfds; sd++) {
+    if (conns[sd].used && conns[sd].done && checked_fd_isset(sd, writefds)
+        && !TIMEVAL_AFTER(conns[sd].due, first)) {
+      n++;
+    } else if (checked_fd_isset(sd, writefds)) {
+      checked_fd_clr(sd, writefds);
+    }
+  }
+  stats.rcvd += n;
+  return n;
+}
+
+int netsim_sockerror(int sd) {
+  return conns[sd].err;
+}
+
+void netsim_close(int sd) {
+  if (sd >= 0 && (unsigned int) sd < conns.size())
+    conns[sd].used = false;
+}
+
+void netsim_print_stats(void) {
+  struct timeval now;
+  double elapsed, cpu;
+
+  gettimeofday(&now, NULL);
+  elapsed = TIMEVAL_FSEC_SUBTRACT(now, stats.start);
+  cpu = cpu_seconds() - stats.cpu;
+  log_write(LOG_STDOUT, "Simulated network: %lu packets sent, %lu received, %lu lost, %lu rate limited\n",
+            stats.sent, stats.rcvd, stats.lost, stats.limited);
+  log_write(LOG_STDOUT, "Simulated network: %.2fs, %.0f packets/s, %.1fus CPU per probe\n",
+            elapsed, elapsed > 0 ? stats.sent / elapsed : 0.0,
+            stats.sent > 0 ? cpu * 1000000 / stats.sent : 0.0);
+}
@@ -137,6 +137,8 @@
 #include "FPEngine.h"
 #include "idle_scan.h"
 #include "timing.h"
+#include "netsim.h"
+#include "telemetry.h"
 #include "NmapOps.h"
 #include "MACLookup.h"
 #include "traceroute.h"
@@ -270,7 +272,7 @@ static void printusage() {
          "  -sU: UDP Scan\n"
          "  -sN/sF/sX: TCP Null, FIN, and Xmas scans\n"
          "  --scanflags <flags>: Customize TCP scan flags\n"
-         "  -sI <zombie host[:probeport]>: Idle scan\n"
+         "  -sI <zombie host[:probeport]>[,...]: Idle scan\n"
          "  -sY/sZ: SCTP INIT/COOKIE-ECHO scans\n"
          "  -sO: IP protocol scan\n"
          "  -b <FTP relay host>: FTP bounce scan\n"
@@ -296,6 +298,7 @@ static void printusage() {
          "  --script-args=<n1=v1,[n2=v2,...]>: provide arguments to scripts\n"
          "  --script-args-file=filename: provide NSE script args in a file\n"
          "  --script-trace: Show all data sent and received\n"
+         "  --script-workers <number>: Run host scripts in <number> processes\n"
          "  --script-updatedb: Update the script database.\n"
          "  --script-help=<Lua scripts>: Show help about scripts.\n"
          "           <Lua scripts> is a comma-separated list of script-files or\n"
@@ -318,6 +321,8 @@ static void printusage() {
          "  --scan-delay/--max-scan-delay <time>: Adjust delay between probes\n"
          "  --min-rate <number>: Send packets no slower than <number> per second\n"
          "  --max-rate <number>: Send packets no faster than <number> per second\n"
+         "  --timing-cache <file>: Remember the timing of scanned networks in <file>\n"
+         "  --congestion-control <reno|bbr>: Choose how the number of probes in flight adapts\n"
          "FIREWALL/IDS EVASION AND SPOOFING:\n"
          "  -f; --mtu <val>: fragment packets (optionally w/given MTU)\n"
          "  -D <decoy1,decoy2[,ME],...>: Cloak a scan with decoys\n"
@@ -602,6 +607,10 @@ void parse_options(int argc, char **argv) {
     {"max-scan-delay", required_argument, 0, 0},
     {"max_retries", required_argument, 0, 0},
     {"max-retries", required_argument, 0, 0},
+    {"timing_cache", required_argument, 0, 0},
+    {"timing-cache", required_argument, 0, 0},
+    {"congestion_control", required_argument, 0, 0},
+    {"congestion-control", required_argument, 0, 0},
     {"oA", required_argument, 0, 0},
     {"oN", required_argument, 0, 0},
     {"oM", required_argument, 0, 0},
@@ -647,6 +656,7 @@ void parse_options(int argc, char **argv) {
     {"ff", no_argument, 0, 0},
     {"privileged", no_argument, 0, 0},
     {"unprivileged", no_argument, 0, 0},
+    {"netsim", required_argument, 0, 0},
     {"mtu", required_argument, 0, 0},
     {"append_output", no_argument, 0, 0},
     {"append-output", no_argument, 0, 0},
@@ -693,6 +703,8 @@ void parse_options(int argc, char **argv) {
     {"script_help", required_argument, 0, 0},
     {"script-timeout", required_argument, 0, 0},
     {"script_timeout", required_argument, 0, 0},
+    {"script-workers", required_argument, 0, 0},
+    {"script_workers", required_argument, 0, 0},
 #endif
     {"ip_options", required_argument, 0, 0},
     {"ip-options", required_argument, 0, 0},
@@ -703,6 +715,8 @@ void parse_options(int argc, char **argv) {
     {"adler32", no_argument, 0, 0},
     {"stats_every", required_argument, 0, 0},
     {"stats-every", required_argument, 0, 0},
+    {"telemetry", required_argument, 0, 0},
+    {"telemetry-interval", required_argument, 0, 0},
     {"disable_arp_ping", no_argument, 0, 0},
     {"disable-arp-ping", no_argument, 0, 0},
     {"route_dst", required_argument, 0, 0},
@@ -736,6 +750,14 @@ void parse_options(int argc, char **argv) {
         if ( l <= 0 )
           fatal("Bogus --script-timeout argument specified");
         o.scripttimeout = l;
+      } else if (optcmp(long_options[option_index].name, "script-workers") == 0) {
+#ifdef WIN32
+        fatal("--script-workers is not supported on Windows");
+#endif
+        l = atoi(optarg);
+        if (l < 1 || l > 64)
+          fatal("Bogus --script-workers argument specified, must be between 1 and 64 (inclusive)");
+        o.scriptworkers = l;
       } else
 #endif
         if (optcmp(long_options[option_index].name, "max-os-tries") == 0) {
@@ -857,6 +879,14 @@ void parse_options(int argc, char **argv) {
           delayed_options.pre_max_retries = atoi(optarg);
           if (delayed_options.pre_max_retries < 0)
             fatal("max-retries must be positive");
+        } else if (optcmp(long_options[option_index].name, "timing-cache") == 0) {
+          if (o.timing_cache)
+            free(o.timing_cache);
+          o.timing_cache = strdup(optarg);
+        } else if (optcmp(long_options[option_index].name, "congestion-control") == 0) {
+          o.congestion_control = congestion_control_by_name(optarg);
+          if (o.congestion_control == NULL)
+            fatal("Unknown congestion control algorithm \"%s\". Use one of: %s", optarg, congestion_control_names());
         } else if (optcmp(long_options[option_index].name, "randomize-hosts") == 0
                    || strcmp(long_options[option_index].name, "rH") == 0) {
           o.randomize_hosts = 1;
@@ -985,8 +1015,12 @@ void parse_options(int argc, char **argv) {
         } else if (strcmp(long_options[option_index].name, "sI") == 0) {
           o.idlescan = 1;
           o.idleProxy = strdup(optarg);
-          if (strlen(o.idleProxy) > FQDN_LEN) {
-            fatal("ERROR: -sI argument must be less than %d characters", FQDN_LEN);
+          /* A comma-separated list of zombies */
+          for (p = o.idleProxy; p != NULL; p = strchr(p, ',')) {
+            if (*p == ',')
+              p++;
+            if (strcspn(p, ",") > FQDN_LEN)
+              fatal("ERROR: -sI zombie names must be less than %d characters", FQDN_LEN);
           }
         } else if (strcmp(long_options[option_index].name, "vv") == 0) {
           /* Compatibility hack ... ugly */
@@ -997,6 +1031,15 @@ void parse_options(int argc, char **argv) {
           o.isr00t = 1;
         } else if (strcmp(long_options[option_index].name, "unprivileged") == 0) {
           o.isr00t = 0;
+        } else if (strcmp(long_options[option_index].name, "netsim") == 0) {
+          if (o.netsim)
+            free(o.netsim);
+          o.netsim = strdup(optarg);
+          /* Raw probes go to the simulated network, so no privileges are
+             needed. Names are not resolved since there is no real DNS. */
+          o.isr00t = 1;
+          o.noresolve = 1;
+          o.sendpref = PACKET_SEND_IP_STRONG;
         } else if (strcmp(long_options[option_index].name, "mtu") == 0) {
           o.fragscan = atoi(optarg);
           if (o.fragscan <= 0 || o.fragscan % 8 != 0)
@@ -1040,6 +1083,15 @@ void parse_options(int argc, char **argv) {
           if (d < 0)
             fatal("Argument to --stats-every cannot be negative.");
           o.stats_interval = d;
+        } else if (optcmp(long_options[option_index].name, "telemetry") == 0) {
+          if (o.telemetry)
+            free(o.telemetry);
+          o.telemetry = strdup(optarg);
+        } else if (optcmp(long_options[option_index].name, "telemetry-interval") == 0) {
+          d = tval2secs(optarg);
+          if (d <= 0)
+            fatal("Argument to --telemetry-interval must be a positive time.");
+          o.telemetry_interval = d;
         } else if (optcmp(long_options[option_index].name, "disable-arp-ping") == 0) {
           o.implicitARPPing = false;
         } else if (optcmp(long_options[option_index].name, "route-dst") == 0) {
@@ -1566,6 +1618,13 @@ void  apply_delayed_options() {
   if (o.traceroute && o.idlescan)
     fatal("Traceroute does not support idle scan");
 
+  if (o.netsim && (o.af() != AF_INET || o.osscan || o.servicescan
+#ifndef NOLUA
+                   || o.script
+#endif
+                   || o.traceroute || o.idlescan || o.bouncescan))
+    fatal("--netsim only simulates IPv4 host discovery and port scans; it cannot be combined with -6, -O, -sV, -sC/--script, --traceroute, -sI or -b");
+
   if ((o.noportscan) && (o.portlist || o.fastscan))
     fatal("You cannot use -F (fast scan) or -p (explicit port selection) when not doing a port scan");
 
@@ -1815,6 +1874,15 @@ int nmap_main(int argc, char *argv[]) {
 
   apply_delayed_options();
 
+  if (o.netsim)
+    netsim_init(o.netsim);
+
+  if (o.telemetry)
+    telemetry_open(o.telemetry);
+
+  if (o.timing_cache)
+    timing_cache_load(o.timing_cache);
+
   for (unsigned int i = 0; i < route_dst_hosts.size(); i++) {
     const char *dst;
     struct sockaddr_storage ss;
@@ -2274,6 +2342,14 @@ int nmap_main(int argc, char *argv[]) {
   if (o.inputfd != NULL)
     fclose(o.inputfd);
 
+  if (o.timing_cache)
+    timing_cache_save(o.timing_cache);
+
+  if (o.netsim)
+    netsim_print_stats();
+
+  telemetry_close();
+
   printdatafilepaths();
 
   printfinaloutput();
@@ -0,0 +1,352 @@
+/* Byte buffer userdata for received data. See nse_buffer.h. */
+
+#include "nse_buffer.h"
+
+#include "nbase.h"
+
+extern "C" {
+  #include "lauxlib.h"
+}
+
+#include <string.h>
+
+#define BUFFER_METATABLE "NSE_BUFFER"
+#define BUFFER_MIN_SIZE 512
+
+/* The characters with a special meaning in Lua patterns, as in lstrlib.c. */
+#define SPECIALS "^$*+?.([%-"
+
+nse_buffer *nse_buffer_check (lua_State *L, int idx)
+{
+  return (nse_buffer *) luaL_checkudata(L, idx, BUFFER_METATABLE);
+}
+
+void nse_buffer_append (nse_buffer *buf, const char *s, size_t len)
+{
+  if (len == 0)
+    return;
+  if (buf->start + buf->len + len > buf->size)
+  {
+    /* Slide the data to the front if at least half the space is consumed,
+     * else grow. Either way a byte is moved a constant number of times on
+     * average. */
+    if (buf->len + len <= buf->size / 2)
+      memmove(buf->data, buf->data + buf->start, buf->len);
+    else
+    {
+      size_t size = buf->size < BUFFER_MIN_SIZE ? BUFFER_MIN_SIZE : buf->size;
+      while (size < 2 * (buf->len + len))
+        size *= 2;
+      char *data = (char *) safe_malloc(size);
+      if (buf->len > 0)
+        memcpy(data, buf->data + buf->start, buf->len);
+      free(buf->data);
+      buf->data = data;
+      buf->size = size;
+    }
+    buf->start = 0;
+  }
+  memcpy(buf->data + buf->start + buf->len, s, len);
+  buf->len += len;
+}
+
+void nse_buffer_consume (nse_buffer *buf, size_t n)
+{
+  if (n >= buf->len)
+    buf->start = buf->len = 0;
+  else
+  {
+    buf->start += n;
+    buf->len -= n;
+  }
+}
+
+ptrdiff_t nse_buffer_find (const nse_buffer *buf, size_t init, const char *p,
+    size_t plen)
+{
+  const char *s = buf->data + buf->start;
+
+  if (plen == 0)
+    return init <= buf->len ? (ptrdiff_t) init : -1;
+  if (init >= buf->len || plen > buf->len - init)
+    return -1;
+  const char *end = s + buf->len - plen + 1;
+  for (const char *c = s + init; c < end; c++)
+  {
+    c = (const char *) memchr(c, p[0], end - c);
+    if (c == NULL)
+      break;
+    if (memcmp(c + 1, p + 1, plen - 1) == 0)
+      return c - s;
+  }
+  return -1;
+}
+
+bool nse_buffer_is_plain (const char *p, size_t plen)
+{
+  for (size_t i = 0; i < plen; i++)
+  {
+    if (p[i] != '\0' && strchr(SPECIALS, p[i]) != NULL)
+      return false;
+  }
+  return true;
+}
+
+nse_buffer *nse_buffer_new (lua_State *L, const char *s, size_t len)
+{
+  nse_buffer *buf = (nse_buffer *) lua_newuserdata(L, sizeof(nse_buffer));
+  buf->data = NULL;
+  buf->start = buf->len = buf->size = 0;
+  luaL_setmetatable(L, BUFFER_METATABLE);
+  nse_buffer_append(buf, s, len);
+  return buf;
+}
+
+/* String positions as in string.sub: negative values count from the end. */
+static size_t posrelat (lua_Integer pos, size_t len)
+{
+  if (pos >= 0)
+    return (size_t) pos;
+  else if ((size_t) -pos > len)
+    return 0;
+  else
+    return len + (size_t) pos + 1;
+}
+
+/* Pushes the bytes from position i to j (both inclusive, as in string.sub). */
+static void push_range (lua_State *L, const nse_buffer *buf, lua_Integer i,
+    lua_Integer j)
+{
+  size_t l = posrelat(i, buf->len), r = posrelat(j, buf->len);
+
+  if (l < 1)
+    l = 1;
+  if (r > buf->len)
+    r = buf->len;
+  if (l > r)
+    lua_pushliteral(L, "");
+  else
+    lua_pushlstring(L, buf->data + buf->start + l - 1, r - l + 1);
+}
+
+int l_nse_buffer_new (lua_State *L)
+{
+  size_t len;
+  const char *s = luaL_optlstring(L, 1, "", &len);
+  nse_buffer_new(L, s, len);
+  return 1;
+}
+
+static int buffer_gc (lua_State *L)
+{
+  nse_buffer *buf = (nse_buffer *) lua_touserdata(L, 1);
+  free(buf->data);
+  buf->data = NULL;
+  buf->start = buf->len = buf->size = 0;
+  return 0;
+}
+
+static int buffer_len (lua_State *L)
+{
+  lua_pushinteger(L, nse_buffer_check(L, 1)->len);
+  return 1;
+}
+
+static int buffer_tostring (lua_State *L)
+{
+  nse_buffer *buf = nse_buffer_check(L, 1);
+  lua_pushlstring(L, buf->len > 0 ? buf->data + buf->start : "", buf->len);
+  return 1;
+}
+
+/* buf:append(...) appends strings and buffers, and returns buf. */
+static int buffer_append (lua_State *L)
+{
+  nse_buffer *buf = nse_buffer_check(L, 1);
+  int n = lua_gettop(L);
+
+  for (int i = 2; i <= n; i++)
+  {
+    if (lua_isuserdata(L, i))
+    {
+      nse_buffer *other = nse_buffer_check(L, i);
+      if (other == buf && buf->len > 0)
+      {
+        /* Appending may move the data being appended. */
+        size_t len = buf->len;
+        lua_pushlstring(L, buf->data + buf->start, len);
+        nse_buffer_append(buf, lua_tostring(L, -1), len);
+        lua_pop(L, 1);
+      }
+      else if (other->len > 0)
+        nse_buffer_append(buf, other->data + other->start, other->len);
+    }
+    else
+    {
+      size_t len;
+      const char *s = luaL_checklstring(L, i, &len);
+      nse_buffer_append(buf, s, len);
+    }
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+/* buf:sub(i [, j]) returns a string, like string.sub. */
+static int buffer_sub (lua_State *L)
+{
+  nse_buffer *buf = nse_buffer_check(L, 1);
+  push_range(L, buf, luaL_checkinteger(L, 2), luaL_optinteger(L, 3, -1));
+  return 1;
+}
+
+/* buf:byte([i [, j]]), like string.byte. */
+static int buffer_byte (lua_State *L)
+{
+  nse_buffer *buf = nse_buffer_check(L, 1);
+  lua_Integer i = luaL_optinteger(L, 2, 1);
+  size_t l = posrelat(i, buf->len);
+  size_t r = posrelat(luaL_optinteger(L, 3, (lua_Integer) l), buf->len);
+
+  if (l < 1)
+    l = 1;
+  if (r > buf->len)
+    r = buf->len;
+  if (l > r)
+    return 0;
+  luaL_checkstack(L, (int) (r - l + 1), "buffer slice too long");
+  for (size_t k = l; k <= r; k++)
+    lua_pushinteger(L, (unsigned char) buf->data[buf->start + k - 1]);
+  return (int) (r - l + 1);
+}
+
+/* buf:find(pattern [, init [, plain]]), like string.find. Patterns without
+ * special characters are searched for in place; others are matched by
+ * string.find against a copy of the buffer. */
+static int buffer_find (lua_State *L)
+{
+  nse_buffer *buf = nse_buffer_check(L, 1);
+  size_t plen;
+  const char *p = luaL_checklstring(L, 2, &plen);
+  size_t init = posrelat(luaL_optinteger(L, 3, 1), buf->len);
+
+  if (init < 1)
+    init = 1;
+  if (init > buf->len + 1)
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  if (lua_toboolean(L, 4) || nse_buffer_is_plain(p, plen))
+  {
+    ptrdiff_t pos = nse_buffer_find(buf, init - 1, p, plen);
+    if (pos < 0)
+    {
+      lua_pushnil(L);
+      return 1;
+    }
+    lua_pushinteger(L, pos + 1);
+    lua_pushinteger(L, pos + (ptrdiff_t) plen);
+    return 2;
+  }
+
+  int top = lua_gettop(L);
+  lua_getglobal(L, "string");
+  lua_getfield(L, -1, "find");
+  lua_replace(L, -2);
+  buffer_tostring(L);
+  lua_pushvalue(L, 2);
+  lua_pushinteger(L, init);
+  lua_call(L, 3, LUA_MULTRET);
+  return lua_gettop(L) - top;
+}
+
+/* buf:take(n) removes the first n bytes and returns them as a string. */
+static int buffer_take (lua_State *L)
+{
+  nse_buffer *buf = nse_buffer_check(L, 1);
+  lua_Integer n = luaL_checkinteger(L, 2);
+
+  luaL_argcheck(L, n >= 0, 2, "negative length");
+  push_range(L, buf, 1, n);
+  nse_buffer_consume(buf, (size_t) n);
+  return 1;
+}
+
+/* buf:consume(n) removes the first n bytes. */
+static int buffer_consume (lua_State *L)
+{
+  nse_buffer *buf = nse_buffer_check(L, 1);
+  lua_Integer n = luaL_checkinteger(L, 2);
+
+  luaL_argcheck(L, n >= 0, 2, "negative length");
+  nse_buffer_consume(buf, (size_t) n);
+  return 0;
+}
+
+/* buf:unpack(fmt [, pos]), like string.unpack. Only the bytes a fixed size
+ * format needs are copied. */
+static int buffer_unpack (lua_State *L)
+{
+  nse_buffer *buf = nse_buffer_check(L, 1);
+  luaL_checkstring(L, 2);
+  size_t pos = posrelat(luaL_optinteger(L, 3, 1), buf->len);
+  size_t avail, n;
+  int top;
+
+  luaL_argcheck(L, pos >= 1 && pos <= buf->len + 1, 3,
+      "initial position out of string");
+  n = avail = buf->len - (pos - 1);
+
+  lua_settop(L, 3);
+  lua_getglobal(L, "string"); /* 4 */
+  lua_getfield(L, 4, "packsize");
+  lua_pushvalue(L, 2);
+  if (lua_pcall(L, 1, 1, 0) == LUA_OK && lua_isinteger(L, -1)
+      && (size_t) lua_tointeger(L, -1) < avail)
+    n = (size_t) lua_tointeger(L, -1);
+  lua_pop(L, 1); /* size or error (variable-length format) */
+
+  top = lua_gettop(L);
+  lua_getfield(L, 4, "unpack");
+  lua_pushvalue(L, 2);
+  lua_pushlstring(L, n > 0 ? buf->data + buf->start + pos - 1 : "", n);
+  lua_call(L, 2, LUA_MULTRET);
+  /* The last result is the position after the data read. */
+  lua_pushinteger(L, lua_tointeger(L, -1) + pos - 1);
+  lua_replace(L, -2);
+  return lua_gettop(L) - top;
+}
+
+static int buffer_clear (lua_State *L)
+{
+  nse_buffer_consume(nse_buffer_check(L, 1), (size_t) -1);
+  return 0;
+}
+
+void nse_nsock_init_buffer (lua_State *L)
+{
+  static const luaL_Reg methods[] = {
+    {"append", buffer_append},
+    {"byte", buffer_byte},
+    {"clear", buffer_clear},
+    {"consume", buffer_consume},
+    {"find", buffer_find},
+    {"sub", buffer_sub},
+    {"take", buffer_take},
+    {"tostring", buffer_tostring},
+    {"unpack", buffer_unpack},
+    {NULL, NULL}
+  };
+
+  luaL_newmetatable(L, BUFFER_METATABLE);
+  luaL_newlib(L, methods);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, buffer_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pushcfunction(L, buffer_len);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, buffer_tostring);
+  lua_setfield(L, -2, "__tostring");
+  lua_pop(L, 1);
+}
@@ -0,0 +1,46 @@
+#ifndef NMAP_NSE_BUFFER_H
+#define NMAP_NSE_BUFFER_H
+
+extern "C" {
+  #include "lua.h"
+}
+
+#include <stddef.h>
+
+/* A byte buffer userdata for received data. Nsock's read buffer is copied in
+ * once per read; appending is amortized constant time per byte and dropping
+ * data from the front only moves an offset. Lua strings are made only for the
+ * parts a script asks for. */
+typedef struct nse_buffer
+{
+  char *data;
+  size_t start; /* offset of the first byte in data */
+  size_t len; /* bytes from start */
+  size_t size; /* allocated size of data */
+} nse_buffer;
+
+/* Creates the buffer metatable. Called by luaopen_nsock. */
+void nse_nsock_init_buffer (lua_State *L);
+
+/* Pushes a new buffer holding the len bytes at s (s may be NULL if len is 0). */
+nse_buffer *nse_buffer_new (lua_State *L, const char *s, size_t len);
+
+nse_buffer *nse_buffer_check (lua_State *L, int idx);
+
+void nse_buffer_append (nse_buffer *buf, const char *s, size_t len);
+
+/* Drops the first n bytes (at most len) of the buffer. */
+void nse_buffer_consume (nse_buffer *buf, size_t n);
+
+/* Returns the first occurrence of the plen bytes at p in the buffer at or
+ * after offset init, or -1. */
+ptrdiff_t nse_buffer_find (const nse_buffer *buf, size_t init, const char *p,
+    size_t plen);
+
+/* Whether a Lua pattern matches only itself, so a plain search will do. */
+bool nse_buffer_is_plain (const char *p, size_t plen);
+
+/* nmap.new_buffer([data]) */
+int l_nse_buffer_new (lua_State *L);
+
+#endif
@@ -0,0 +1,274 @@
+/* Bytecode cache for NSE scripts and libraries. See nse_bytecode.h. */
+
+#include "nse_bytecode.h"
+#include "nse_main.h"
+
+#include "nmap.h"
+#include "nbase.h"
+#include "NmapOps.h"
+#include "output.h"
+
+extern "C" {
+  #include "lauxlib.h"
+}
+
+#include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_PWD_H
+#include <pwd.h>
+#endif
+
+#ifdef WIN32
+#include "winfix.h"
+/* This name collides in the following include. */
+#undef PS_NONE
+#include <shlobj.h>
+#include <direct.h>
+#endif
+
+extern NmapOps o;
+
+/* A cache file starts with this magic, the Lua version number and a hash of
+ * the Lua release, chunk name and source text it was compiled from. */
+#define CACHE_MAGIC "NSEC"
+#define CACHE_HEADER_LEN 16
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/* The cache directory, empty if there is none we may use. */
+static std::string cache_dir;
+static bool cache_dir_checked = false;
+
+static u64 fnv1a (u64 h, const char *s, size_t len)
+{
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char) s[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+static int make_dir (const char *path)
+{
+#ifdef WIN32
+  return _mkdir(path);
+#else
+  return mkdir(path, 0700);
+#endif
+}
+
+/* Finds (creating it if needed) the cache directory. Bytecode is not checked
+ * by Lua before it runs, so on Unix only a directory belonging to the
+ * effective user and not writable by others is used. */
+static const char *get_cache_dir (void)
+{
+  std::string dir;
+
+  if (cache_dir_checked)
+    return cache_dir.empty() ? NULL : cache_dir.c_str();
+  cache_dir_checked = true;
+
+#ifdef WIN32
+  char appdata[MAX_PATH];
+
+  if (SHGetFolderPath(NULL, CSIDL_APPDATA, NULL, SHGFP_TYPE_CURRENT, appdata) != S_OK)
+    return NULL;
+  dir = std::string(appdata) + "\\nmap";
+  make_dir(dir.c_str());
+  dir += "\\cache";
+  make_dir(dir.c_str());
+#else
+  struct passwd *pw;
+  struct stat st;
+
+  pw = getpwuid(geteuid());
+  if (pw == NULL)
+    return NULL;
+  dir = std::string(pw->pw_dir) + "/.nmap";
+  make_dir(dir.c_str());
+  dir += "/cache";
+  make_dir(dir.c_str());
+  if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)
+      || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+    if (o.debugging)
+      log_write(LOG_STDOUT, "%s: Not caching bytecode in %s: not a private directory\n",
+          SCRIPT_ENGINE, dir.c_str());
+    return NULL;
+  }
+#endif
+
+  cache_dir = dir;
+  return cache_dir.c_str();
+}
+
+static bool read_file (FILE *fp, std::string &buf)
+{
+  char chunk[8192];
+  size_t n;
+
+  while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+    buf.append(chunk, n);
+  return !ferror(fp);
+}
+
+/* Reads a cache file, if it belongs to the effective user and only they may
+ * write it. */
+static bool read_cache (const char *path, std::string &buf)
+{
+  FILE *fp;
+  bool ok;
+
+  fp = fopen(path, "rb");
+  if (fp == NULL)
+    return false;
+#ifndef WIN32
+  struct stat st;
+  if (fstat(fileno(fp), &st) != 0 || st.st_uid != geteuid()
+      || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+    fclose(fp);
+    return false;
+  }
+#endif
+  ok = read_file(fp, buf);
+  fclose(fp);
+  return ok;
+}
+
+/* Writes a cache file through a temporary file, so that other Nmap processes
+ * never see it half written. */
+static void write_cache (const char *path, const std::string &data)
+{
+  std::string tmp;
+  FILE *fp;
+  char pid[16];
+
+  Snprintf(pid, sizeof(pid), ".%d", (int) getpid());
+  tmp = std::string(path) + pid;
+#ifdef WIN32
+  fp = fopen(tmp.c_str(), "wb");
+#else
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  fp = fd == -1 ? NULL : fdopen(fd, "wb");
+  if (fp == NULL && fd != -1)
+    close(fd);
+#endif
+  if (fp == NULL)
+    return;
+  if (fwrite(data.data(), 1, data.size(), fp) != data.size()) {
+    fclose(fp);
+    remove(tmp.c_str());
+    return;
+  }
+  if (fclose(fp) != 0) {
+    remove(tmp.c_str());
+    return;
+  }
+#ifdef WIN32
+  remove(path);
+#endif
+  if (rename(tmp.c_str(), path) != 0)
+    remove(tmp.c_str());
+}
+
+static int dump_writer (lua_State *L, const void *p, size_t sz, void *ud)
+{
+  ((std::string *) ud)->append((const char *) p, sz);
+  return 0;
+}
+
+static void put_header (std::string &buf, u64 hash)
+{
+  u32 version = LUA_VERSION_NUM;
+
+  buf.append(CACHE_MAGIC, 4);
+  for (int i = 0; i < 4; i++)
+    buf.push_back((char) (version >> (8 * i)));
+  for (int i = 0; i < 8; i++)
+    buf.push_back((char) (hash >> (8 * i)));
+}
+
+int nse_bytecode_loadfile (lua_State *L, const char *filename,
+    const char *prefix, const char *suffix)
+{
+  std::string source, text, chunkname, header, cached, path;
+  const char *dir;
+  size_t skip = 0;
+  FILE *fp;
+  u64 hash;
+  int status;
+
+  fp = fopen(filename, "rb");
+  if (fp == NULL || !read_file(fp, source)) {
+    lua_pushfstring(L, "cannot read %s: %s", filename, strerror(errno));
+    if (fp != NULL)
+      fclose(fp);
+    return LUA_ERRFILE;
+  }
+  fclose(fp);
+
+  /* Skip a first line comment, keeping its newline, as luaL_loadfile does. */
+  if (source.size() > 0 && source[0] == '#')
+    skip = source.find('\n') == std::string::npos ? source.size() : source.find('\n');
+  if (prefix != NULL)
+    text = prefix;
+  text.append(source, skip, std::string::npos);
+  if (suffix != NULL)
+    text.append(suffix);
+  chunkname = std::string("@") + filename;
+
+  dir = get_cache_dir();
+  if (dir != NULL) {
+    char name[32];
+
+    hash = fnv1a(FNV_OFFSET, LUA_RELEASE, strlen(LUA_RELEASE));
+    hash = fnv1a(hash, chunkname.data(), chunkname.size() + 1);
+    hash = fnv1a(hash, text.data(), text.size());
+    put_header(header, hash);
+    Snprintf(name, sizeof(name), "%016llx.luac",
+        (unsigned long long) fnv1a(FNV_OFFSET, filename, strlen(filename)));
+    path = std::string(dir) + "/" + name;
+
+    if (read_cache(path.c_str(), cached) && cached.size() > CACHE_HEADER_LEN
+        && cached.compare(0, CACHE_HEADER_LEN, header) == 0) {
+      status = luaL_loadbufferx(L, cached.data() + CACHE_HEADER_LEN,
+          cached.size() - CACHE_HEADER_LEN, chunkname.c_str(), "b");
+      if (status == LUA_OK) {
+        if (o.debugging > 2)
+          log_write(LOG_STDOUT, "%s: Loaded %s from %s\n", SCRIPT_ENGINE,
+              filename, path.c_str());
+        return LUA_OK;
+      }
+      lua_pop(L, 1);
+    }
+  }
+
+  status = luaL_loadbufferx(L, text.data(), text.size(), chunkname.c_str(), "t");
+  if (status == LUA_OK && dir != NULL) {
+    std::string data = header;
+    /* Keep debug information for error messages and tracebacks. */
+    if (lua_dump(L, dump_writer, &data, 0) == 0)
+      write_cache(path.c_str(), data);
+  }
+  return status;
+}
+
+int l_nse_bytecode_loadfile (lua_State *L)
+{
+  const char *filename = luaL_checkstring(L, 1);
+  const char *prefix = luaL_optstring(L, 2, NULL);
+  const char *suffix = luaL_optstring(L, 3, NULL);
+
+  if (nse_bytecode_loadfile(L, filename, prefix, suffix) != LUA_OK) {
+    lua_pushnil(L);
+    lua_insert(L, -2);
+    return 2;
+  }
+  return 1;
+}
@@ -0,0 +1,27 @@
+#ifndef NMAP_NSE_BYTECODE_H
+#define NMAP_NSE_BYTECODE_H
+
+extern "C" {
+  #include "lua.h"
+}
+
+/* Scripts and libraries are compiled once and their bytecode kept in the
+ * cache directory of the user's Nmap directory (~/.nmap/cache or
+ * %APPDATA%\nmap\cache), one file per source path. A cached chunk is used only
+ * if it was made by the same Lua version from the same source text. */
+
+/* int nse_bytecode_loadfile (lua_State *L, const char *filename,
+ *                            const char *prefix, const char *suffix)
+ *
+ * Loads filename like luaL_loadfilex in text mode, with prefix and suffix
+ * (which may be NULL) around the contents of the file. Pushes the chunk or an
+ * error message and returns a Lua status code.
+ */
+int nse_bytecode_loadfile (lua_State *L, const char *filename,
+    const char *prefix, const char *suffix);
+
+/* cnse.loadfile(filename[, prefix, suffix]) returns the chunk or nil and an
+ * error message. */
+int l_nse_bytecode_loadfile (lua_State *L);
+
+#endif
@@ -0,0 +1,300 @@
+/* Cache of results shared between scripts. See nse_cache.h. */
+
+#include "nse_cache.h"
+#include "nse_main.h"
+#include "nse_utility.h"
+
+extern "C" {
+  #include "lauxlib.h"
+}
+
+#include "nbase.h"
+#include "nsock.h"
+
+#include <list>
+#include <map>
+#include <string>
+
+/* Upvalues of the library functions. */
+#define VALUES lua_upvalueindex(1) /* key -> cached value */
+#define FLIGHTS lua_upvalueindex(2) /* key -> {owner = thread, waiters...} */
+
+#define DEFAULT_LIMIT (4 * 1024 * 1024)
+#define DEFAULT_MAX_ENTRIES 4096
+
+struct cache_entry {
+  std::string kind;
+  double expires; /* 0 for entries that do not expire */
+  size_t size;
+  std::list<std::string>::iterator lru;
+};
+
+struct cache_kind {
+  size_t size, limit, max_entries;
+  std::list<std::string> lru; /* least recently used first */
+  cache_kind () : size(0), limit(DEFAULT_LIMIT),
+    max_entries(DEFAULT_MAX_ENTRIES) {}
+};
+
+static std::map<std::string, cache_entry> entries;
+static std::map<std::string, cache_kind> kinds;
+
+static struct {
+  unsigned long hits, misses, waits, stores, evictions, expirations;
+} stats;
+
+static double now (void)
+{
+  return TIMEVAL_SECS(*nsock_gettimeofday());
+}
+
+/* Builds the key for the host, port, kind and fingerprint at the bottom of
+ * the stack. The port may be nil for results about the whole host. */
+static std::string checkkey (lua_State *L)
+{
+  const char *address, *targetname, *protocol = "tcp";
+  char port[32];
+  std::string key;
+
+  nseU_checktarget(L, 1, &address, &targetname);
+  if (lua_isnoneornil(L, 2))
+    port[0] = '\0';
+  else {
+    uint16_t number = nseU_checkport(L, 2, &protocol);
+    Snprintf(port, sizeof(port), "%hu/%s", number, protocol);
+  }
+  key.append(address).append("|").append(port).append("|");
+  key.append(luaL_checkstring(L, 3)).append("|");
+  key.append(luaL_checkstring(L, 4));
+  return key;
+}
+
+static void remove_entry (lua_State *L,
+    std::map<std::string, cache_entry>::iterator it)
+{
+  cache_kind &k = kinds[it->second.kind];
+
+  k.size -= it->second.size;
+  k.lru.erase(it->second.lru);
+  lua_pushnil(L);
+  lua_setfield(L, VALUES, it->first.c_str());
+  entries.erase(it);
+}
+
+/* Evicts the least recently used entries of a kind until it fits in its
+ * limits, leaving room for an entry of the given size. */
+static void make_room (lua_State *L, cache_kind &k, size_t size)
+{
+  while (!k.lru.empty()
+      && (k.size + size > k.limit
+        || k.lru.size() + (size ? 1 : 0) > k.max_entries)) {
+    remove_entry(L, entries.find(k.lru.front()));
+    stats.evictions++;
+  }
+}
+
+/* Wakes the threads waiting on the fetch of key and forgets the fetch. */
+static void land (lua_State *L, const std::string &key)
+{
+  lua_getfield(L, FLIGHTS, key.c_str());
+  if (lua_istable(L, -1)) {
+    for (lua_Integer i = 1; lua_rawgeti(L, -1, i) == LUA_TTHREAD; i++) {
+      nse_restore(lua_tothread(L, -1), 0);
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    lua_setfield(L, FLIGHTS, key.c_str());
+  }
+  lua_pop(L, 1);
+}
+
+/* Destructor of a thread that died while fetching an entry. Its upvalues are
+ * those of the library, the key and the flight table; waiting threads are
+ * woken to fetch the entry themselves. */
+static int abandon (lua_State *L)
+{
+  const char *key = lua_tostring(L, lua_upvalueindex(3));
+
+  lua_getfield(L, FLIGHTS, key);
+  if (lua_rawequal(L, -1, lua_upvalueindex(4)))
+    land(L, key);
+  return 0;
+}
+
+static int get_k (lua_State *L, int status, lua_KContext ctx);
+
+/* cache.get(host, port, kind, fingerprint)
+ *
+ * Returns true and the value on a hit. On a miss, returns false and makes the
+ * calling thread responsible for calling cache.put with the key; other threads
+ * asking for the key wait until it does (or dies). */
+static int get (lua_State *L)
+{
+  std::string key;
+  std::map<std::string, cache_entry>::iterator it;
+
+  lua_settop(L, 4);
+  key = checkkey(L);
+  it = entries.find(key);
+  if (it != entries.end() && it->second.expires
+      && it->second.expires <= now()) {
+    remove_entry(L, it);
+    stats.expirations++;
+    it = entries.end();
+  }
+  if (it != entries.end()) {
+    cache_kind &k = kinds[it->second.kind];
+    k.lru.splice(k.lru.end(), k.lru, it->second.lru);
+    stats.hits++;
+    lua_pushboolean(L, 1);
+    lua_getfield(L, VALUES, key.c_str());
+    return 2;
+  }
+
+  lua_getfield(L, FLIGHTS, key.c_str());
+  if (lua_istable(L, -1)) {
+    lua_getfield(L, -1, "owner");
+    lua_pushthread(L);
+    if (!lua_rawequal(L, -1, -2)) {
+      lua_rawseti(L, -3, lua_rawlen(L, -3) + 1);
+      stats.waits++;
+      return nse_yield(L, 0, get_k);
+    }
+    /* The fetching thread asked again; let it fetch again. */
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+
+  stats.misses++;
+  lua_createtable(L, 1, 1);
+  lua_pushthread(L);
+  lua_setfield(L, -2, "owner");
+  lua_pushvalue(L, -1);
+  lua_setfield(L, FLIGHTS, key.c_str());
+  /* The flight table is the destructor key. */
+  lua_pushvalue(L, VALUES);
+  lua_pushvalue(L, FLIGHTS);
+  lua_pushlstring(L, key.data(), key.size());
+  lua_pushvalue(L, -4);
+  lua_pushcclosure(L, abandon, 4);
+  nse_destructor(L, 'a');
+  lua_pushboolean(L, 0);
+  return 1;
+}
+
+static int get_k (lua_State *L, int status, lua_KContext ctx)
+{
+  return get(L);
+}
+
+/* cache.put(host, port, kind, fingerprint, value [, ttl [, size]])
+ *
+ * Stores a value, replacing any entry for the key. If the calling thread was
+ * fetching the value, the threads waiting for it are woken. A nil value
+ * abandons the fetch and leaves the cache as it was. Values larger than the
+ * limit of their kind are not stored. */
+static int put (lua_State *L)
+{
+  std::string key = checkkey(L);
+  std::string kind = lua_tostring(L, 3);
+  lua_Number ttl = luaL_optnumber(L, 6, 0);
+  size_t size;
+
+  if (lua_type(L, 5) == LUA_TSTRING)
+    size = (size_t) luaL_optinteger(L, 7, lua_rawlen(L, 5));
+  else
+    size = (size_t) luaL_optinteger(L, 7, 0);
+
+  cache_kind &k = kinds[kind];
+  if (!lua_isnil(L, 5)) {
+    std::map<std::string, cache_entry>::iterator it = entries.find(key);
+    if (it != entries.end())
+      remove_entry(L, it);
+  }
+  if (!lua_isnil(L, 5) && size <= k.limit && k.max_entries > 0) {
+    make_room(L, k, size);
+    cache_entry &e = entries[key];
+    e.kind = kind;
+    e.expires = ttl > 0 ? now() + ttl : 0;
+    e.size = size;
+    e.lru = k.lru.insert(k.lru.end(), key);
+    k.size += size;
+    lua_pushvalue(L, 5);
+    lua_setfield(L, VALUES, key.c_str());
+    stats.stores++;
+  }
+
+  /* Only the fetching thread ends the fetch; others just store a value. */
+  lua_getfield(L, FLIGHTS, key.c_str());
+  if (lua_istable(L, -1)) {
+    lua_getfield(L, -1, "owner");
+    lua_pushthread(L);
+    if (lua_rawequal(L, -1, -2)) {
+      lua_pushvalue(L, -3);
+      nse_destructor(L, 'r');
+      land(L, key);
+    }
+  }
+  return 0;
+}
+
+/* cache.limit(kind, bytes [, entries]) */
+static int limit (lua_State *L)
+{
+  cache_kind &k = kinds[luaL_checkstring(L, 1)];
+
+  k.limit = (size_t) luaL_checkinteger(L, 2);
+  k.max_entries = (size_t) luaL_optinteger(L, 3, k.max_entries);
+  make_room(L, k, 0);
+  return 0;
+}
+
+/* cache.stats() */
+static int cache_stats (lua_State *L)
+{
+  size_t size = 0;
+
+  for (std::map<std::string, cache_kind>::const_iterator it = kinds.begin();
+      it != kinds.end(); it++)
+    size += it->second.size;
+  lua_createtable(L, 0, 8);
+  nseU_setifield(L, -1, "entries", entries.size());
+  nseU_setifield(L, -1, "size", size);
+  nseU_setifield(L, -1, "hits", stats.hits);
+  nseU_setifield(L, -1, "misses", stats.misses);
+  nseU_setifield(L, -1, "waits", stats.waits);
+  nseU_setifield(L, -1, "stores", stats.stores);
+  nseU_setifield(L, -1, "evictions", stats.evictions);
+  nseU_setifield(L, -1, "expirations", stats.expirations);
+  return 1;
+}
+
+/* cache.clear()
+ *
+ * Drops every entry and resets the statistics. Limits are kept. */
+static int clear (lua_State *L)
+{
+  while (!entries.empty())
+    remove_entry(L, entries.begin());
+  memset(&stats, 0, sizeof(stats));
+  return 0;
+}
+
+int luaopen_cache (lua_State *L)
+{
+  static const luaL_Reg cachelib[] = {
+    {"clear", clear},
+    {"get", get},
+    {"limit", limit},
+    {"put", put},
+    {"stats", cache_stats},
+    {NULL, NULL}
+  };
+
+  luaL_newlibtable(L, cachelib);
+  lua_newtable(L); /* VALUES */
+  lua_newtable(L); /* FLIGHTS */
+  luaL_setfuncs(L, cachelib, 2);
+  return 1;
+}
@@ -0,0 +1,17 @@
+#ifndef NMAP_NSE_CACHE_H
+#define NMAP_NSE_CACHE_H
+
+extern "C" {
+  #include "lua.h"
+}
+
+/* A cache of results that scripts share, such as banners, certificates and
+ * HTTP responses. Entries are keyed by host, port, a kind ("banner", "http",
+ * ...) and a fingerprint of the request, may expire, and are evicted least
+ * recently used first when a kind goes over its size limits. Only one thread
+ * fetches a missing entry; others asking for it meanwhile wait for the result.
+ *
+ * The library is available as nmap.cache. */
+int luaopen_cache (lua_State *L);
+
+#endif
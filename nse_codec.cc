@@ -0,0 +1,287 @@
+/* Byte level parsing helpers for NSE libraries. See nse_codec.h. */
+
+#include "nse_codec.h"
+
+extern "C" {
+  #include "lauxlib.h"
+}
+
+/* Converts a Lua string position (1-based, negative from the end) to an
+ * offset, or returns false if it is not inside the string. */
+static bool check_offset (lua_State *L, int idx, size_t len, size_t *off)
+{
+  lua_Integer pos = luaL_optinteger(L, idx, 1);
+
+  if (pos < 0)
+    pos += (lua_Integer) len + 1;
+  if (pos < 1 || (size_t) pos > len)
+    return false;
+  *off = (size_t) pos - 1;
+  return true;
+}
+
+static void add_utf8 (luaL_Buffer *b, unsigned long cp)
+{
+  char *p;
+
+  if (cp <= 0x7F)
+    luaL_addchar(b, (char) cp);
+  else if (cp <= 0x7FF) {
+    p = luaL_prepbuffsize(b, 2);
+    p[0] = (char) (0xC0 | (cp >> 6));
+    p[1] = (char) (0x80 | (cp & 0x3F));
+    luaL_addsize(b, 2);
+  } else if (cp <= 0xFFFF) {
+    p = luaL_prepbuffsize(b, 3);
+    p[0] = (char) (0xE0 | (cp >> 12));
+    p[1] = (char) (0x80 | ((cp >> 6) & 0x3F));
+    p[2] = (char) (0x80 | (cp & 0x3F));
+    luaL_addsize(b, 3);
+  } else if (cp <= 0x10FFFF) {
+    p = luaL_prepbuffsize(b, 4);
+    p[0] = (char) (0xF0 | (cp >> 18));
+    p[1] = (char) (0x80 | ((cp >> 12) & 0x3F));
+    p[2] = (char) (0x80 | ((cp >> 6) & 0x3F));
+    p[3] = (char) (0x80 | (cp & 0x3F));
+    luaL_addsize(b, 4);
+  }
+  /* Larger values have no encoding and are dropped, as by unicode.utf8_enc. */
+}
+
+static void add_utf16 (luaL_Buffer *b, unsigned long cp, bool bigendian)
+{
+  unsigned int units[2];
+  int n;
+  char *p;
+
+  if (cp <= 0xFFFF) {
+    units[0] = (unsigned int) cp;
+    n = 1;
+  } else if (cp <= 0x10FFFF) {
+    cp -= 0x10000;
+    units[0] = 0xD800 + (unsigned int) (cp >> 10);
+    units[1] = 0xDC00 + (unsigned int) (cp & 0x3FF);
+    n = 2;
+  } else
+    return;
+
+  p = luaL_prepbuffsize(b, 2 * n);
+  for (int i = 0; i < n; i++) {
+    p[2 * i + (bigendian ? 1 : 0)] = (char) (units[i] & 0xFF);
+    p[2 * i + (bigendian ? 0 : 1)] = (char) (units[i] >> 8);
+  }
+  luaL_addsize(b, 2 * n);
+}
+
+static unsigned int get_u16 (const unsigned char *s, bool bigendian)
+{
+  return bigendian ? (s[0] << 8) | s[1] : s[0] | (s[1] << 8);
+}
+
+/* codec.utf16to8(s [, bigendian])
+ *
+ * Surrogates are combined the way unicode.utf16_dec does it, without checking
+ * that a trail surrogate follows a lead one. Returns nil if the string ends in
+ * the middle of a code unit or surrogate pair. */
+static int utf16to8 (lua_State *L)
+{
+  size_t len, i = 0;
+  const unsigned char *s = (const unsigned char *) luaL_checklstring(L, 1, &len);
+  bool bigendian = lua_toboolean(L, 2);
+  const int lo = bigendian ? 1 : 0, hi = bigendian ? 0 : 1;
+  luaL_Buffer b;
+
+  luaL_buffinitsize(L, &b, len / 2);
+  while (i < len) {
+    /* Runs of ASCII are the common case in SMB and LDAP strings. */
+    size_t n = 0;
+    char *p = luaL_prepbuffsize(&b, (len - i) / 2);
+    while (i + 1 < len && s[i + hi] == 0 && s[i + lo] < 0x80) {
+      p[n++] = (char) s[i + lo];
+      i += 2;
+    }
+    luaL_addsize(&b, n);
+    if (i >= len)
+      break;
+
+    if (len - i < 2)
+      return 0;
+    unsigned long cp = get_u16(s + i, bigendian);
+    i += 2;
+    if (cp >= 0xD800 && cp <= 0xDFFF) {
+      if (len - i < 2)
+        return 0;
+      cp = 0x10000 + ((cp - 0xD800) << 10) + get_u16(s + i, bigendian) - 0xDC00;
+      i += 2;
+    }
+    add_utf8(&b, cp);
+  }
+  luaL_pushresult(&b);
+  return 1;
+}
+
+/* codec.utf8to16(s [, bigendian])
+ *
+ * Returns nil for input that unicode.utf8_dec would reject or decode to a
+ * negative value: a continuation byte where a sequence should start, a byte
+ * above 0xF7, or a truncated sequence. */
+static int utf8to16 (lua_State *L)
+{
+  size_t len, i = 0;
+  const unsigned char *s = (const unsigned char *) luaL_checklstring(L, 1, &len);
+  bool bigendian = lua_toboolean(L, 2);
+  const int lo = bigendian ? 1 : 0, hi = bigendian ? 0 : 1;
+  luaL_Buffer b;
+
+  luaL_buffinitsize(L, &b, 2 * len);
+  while (i < len) {
+    size_t n = 0;
+    char *p = luaL_prepbuffsize(&b, 2 * (len - i));
+    while (i < len && s[i] < 0x80) {
+      p[n + lo] = (char) s[i++];
+      p[n + hi] = '\0';
+      n += 2;
+    }
+    luaL_addsize(&b, n);
+    if (i >= len)
+      break;
+
+    unsigned long cp;
+    size_t more;
+    if (s[i] >= 0xC0 && s[i] <= 0xDF) {
+      cp = s[i] - 0xC0;
+      more = 1;
+    } else if (s[i] >= 0xE0 && s[i] <= 0xEF) {
+      cp = s[i] - 0xE0;
+      more = 2;
+    } else if (s[i] >= 0xF0 && s[i] <= 0xF7) {
+      cp = s[i] - 0xF0;
+      more = 3;
+    } else
+      return 0;
+    if (len - i <= more)
+      return 0;
+    for (size_t k = 1; k <= more; k++) {
+      if (s[i + k] < 0x80 || s[i + k] > 0xBF)
+        return 0;
+      cp = (cp << 6) | (s[i + k] & 0x3F);
+    }
+    i += more + 1;
+    add_utf16(&b, cp, bigendian);
+  }
+  luaL_pushresult(&b);
+  return 1;
+}
+
+/* Reads a DER/BER length at *off, advancing it. Returns false if the length
+ * is truncated, uses the indefinite form or does not fit in an integer. */
+static bool get_der_length (const unsigned char *s, size_t len, size_t *off,
+    lua_Integer *elen)
+{
+  if (*off >= len)
+    return false;
+  *elen = s[(*off)++];
+  if (*elen == 0x80)
+    return false;
+  if (*elen > 0x80) {
+    size_t n = (size_t) *elen - 0x80;
+    if (n >= sizeof(lua_Integer) || len - *off < n)
+      return false;
+    *elen = 0;
+    for (size_t k = 0; k < n; k++)
+      *elen = (*elen << 8) | s[(*off)++];
+  }
+  return true;
+}
+
+/* codec.der_length(s [, pos])
+ *
+ * Returns the DER/BER length at pos and the position after it, or nil. */
+static int der_length (lua_State *L)
+{
+  size_t len, off;
+  const unsigned char *s = (const unsigned char *) luaL_checklstring(L, 1, &len);
+  lua_Integer elen;
+
+  if (!check_offset(L, 2, len, &off) || !get_der_length(s, len, &off, &elen))
+    return 0;
+  lua_pushinteger(L, elen);
+  lua_pushinteger(L, (lua_Integer) off + 1);
+  return 2;
+}
+
+/* codec.der_header(s [, pos])
+ *
+ * Returns the identifier octet and content length of the DER/BER TLV at pos,
+ * and the position of its contents, or nil. Only single octet identifiers are
+ * read, as by the asn1 library. */
+static int der_header (lua_State *L)
+{
+  size_t len, off;
+  const unsigned char *s = (const unsigned char *) luaL_checklstring(L, 1, &len);
+  unsigned int tag;
+  lua_Integer elen;
+
+  if (!check_offset(L, 2, len, &off))
+    return 0;
+  tag = s[off++];
+  if (!get_der_length(s, len, &off, &elen))
+    return 0;
+  lua_pushinteger(L, tag);
+  lua_pushinteger(L, elen);
+  lua_pushinteger(L, (lua_Integer) off + 1);
+  return 3;
+}
+
+/* codec.tls_record(s [, pos])
+ *
+ * Returns the content type, protocol version and length of the TLS record
+ * header at pos, and the position of the record body, or nil if fewer than 5
+ * bytes are left. */
+static int tls_record (lua_State *L)
+{
+  size_t len, off;
+  const unsigned char *s = (const unsigned char *) luaL_checklstring(L, 1, &len);
+
+  if (!check_offset(L, 2, len, &off) || len - off < 5)
+    return 0;
+  lua_pushinteger(L, s[off]);
+  lua_pushinteger(L, (s[off + 1] << 8) | s[off + 2]);
+  lua_pushinteger(L, (s[off + 3] << 8) | s[off + 4]);
+  lua_pushinteger(L, (lua_Integer) off + 6);
+  return 4;
+}
+
+/* codec.tls_handshake(s [, pos])
+ *
+ * Returns the message type and length of the handshake message header at pos,
+ * and the position of the message body, or nil if fewer than 4 bytes are
+ * left. */
+static int tls_handshake (lua_State *L)
+{
+  size_t len, off;
+  const unsigned char *s = (const unsigned char *) luaL_checklstring(L, 1, &len);
+
+  if (!check_offset(L, 2, len, &off) || len - off < 4)
+    return 0;
+  lua_pushinteger(L, s[off]);
+  lua_pushinteger(L, (s[off + 1] << 16) | (s[off + 2] << 8) | s[off + 3]);
+  lua_pushinteger(L, (lua_Integer) off + 5);
+  return 3;
+}
+
+LUALIB_API int luaopen_codec (lua_State *L)
+{
+  static const luaL_Reg codec[] = {
+    {"der_header", der_header},
+    {"der_length", der_length},
+    {"tls_handshake", tls_handshake},
+    {"tls_record", tls_record},
+    {"utf16to8", utf16to8},
+    {"utf8to16", utf8to16},
+    {NULL, NULL}
+  };
+
+  luaL_newlib(L, codec);
+  return 1;
+}
@@ -0,0 +1,16 @@
+#ifndef NSE_CODEC
+#define NSE_CODEC
+
+#define NSE_CODECLIBNAME "codec"
+
+extern "C" {
+  #include "lua.h"
+}
+
+/* Byte level parsing helpers for the unicode, asn1 and tls libraries. Each
+ * function handles the well-formed inputs those libraries see in practice and
+ * returns nil for anything else, so that the Lua code keeps its own behaviour
+ * for the unusual cases. */
+LUALIB_API int luaopen_codec (lua_State *L);
+
+#endif
@@ -2,12 +2,14 @@
 #include "nbase.h"
 #include "nmap_error.h"
 #include "portlist.h"
+#include "protocols.h"
 #include "nsock.h"
 #include "NmapOps.h"
 #include "timing.h"
 #include "Target.h"
 #include "nmap_tty.h"
 #include "xml.h"
+#include "libnetutil/netutil.h"
 
 #include "nse_main.h"
 #include "nse_utility.h"
@@ -18,7 +20,14 @@
 #include "nse_openssl.h"
 #include "nse_debug.h"
 #include "nse_lpeg.h"
-
+#include "nse_workers.h"
+#include "nse_bytecode.h"
+#include "nse_codec.h"
+#include "telemetry.h"
+#include "nbase_prof.h"
+
+#include <algorithm>
+#include <vector>
 #include <math.h>
 
 #define NSE_MAIN "NSE_MAIN" /* the main function */
@@ -75,17 +84,94 @@ static int stopTimeOutClock (lua_State *L)
 
 static int next_port (lua_State *L)
 {
-  lua_settop(L, 2);
-  lua_pushvalue(L, lua_upvalueindex(1));
-  lua_pushvalue(L, 2);
-  if (lua_next(L, -2) == 0)
+  lua_Integer i = lua_tointeger(L, lua_upvalueindex(2));
+  if (i >= lua_tointeger(L, lua_upvalueindex(3)))
     return 0;
-  else {
-    lua_pop(L, 1); /* pop boolean value */
-    return 1;
+  lua_pushinteger(L, i + 2);
+  lua_replace(L, lua_upvalueindex(2));
+  lua_rawgeti(L, lua_upvalueindex(1), i + 1); /* port */
+  lua_rawgeti(L, lua_upvalueindex(1), i + 2); /* candidates */
+  return 2;
+}
+
+/* Pushes index[field][key], or nil if index[field] is not a table. */
+static int get_index_field (lua_State *L, int index, const char *field,
+    const char *key)
+{
+  if (lua_getfield(L, index, field) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    lua_pushnil(L);
+  } else {
+    lua_getfield(L, -1, key);
+    lua_remove(L, -2);
+  }
+  return lua_type(L, -1);
+}
+
+/* Marks the script positions listed in the array on top of the stack (if it
+ * is one) and pops it. */
+static void mark_candidates (lua_State *L, std::vector<bool> &candidates)
+{
+  if (lua_istable(L, -1)) {
+    for (lua_Integer i = 1; lua_rawgeti(L, -1, i) != LUA_TNIL; i++) {
+      lua_Integer n = lua_tointeger(L, -1);
+      if (n >= 1 && (size_t) n < candidates.size())
+        candidates[n] = true;
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+}
+
+/* Looks up the scripts that may want port in the portrule index at the given
+ * stack index (see portrule_index in nse_main.lua). Pushes an array of their
+ * positions, or nothing and returns false if there are none. */
+static bool push_candidates (lua_State *L, int index, const Target *target,
+    const Port *port, std::vector<bool> &candidates)
+{
+  struct serviceDeductions sd;
+  const char *proto = IPPROTO2STR(port->proto);
+  lua_Integer n = 0;
+
+  target->ports.getServiceDeductions(port->portno, port->proto, &sd);
+  std::fill(candidates.begin(), candidates.end(), false);
+  lua_getfield(L, index, "any");
+  mark_candidates(L, candidates);
+  if (get_index_field(L, index, "ports", proto) == LUA_TTABLE) {
+    lua_rawgeti(L, -1, port->portno);
+    mark_candidates(L, candidates);
+  }
+  lua_pop(L, 1);
+  if (sd.name != NULL) {
+    if (get_index_field(L, index, "services", proto) == LUA_TTABLE) {
+      lua_getfield(L, -1, sd.name);
+      mark_candidates(L, candidates);
+    }
+    lua_pop(L, 1);
+  }
+  if (sd.service_tunnel == SERVICE_TUNNEL_SSL) {
+    lua_getfield(L, index, "ssl");
+    mark_candidates(L, candidates);
+  }
+
+  for (size_t i = 1; i < candidates.size(); i++) {
+    if (candidates[i]) {
+      if (n == 0)
+        lua_newtable(L);
+      lua_pushinteger(L, i);
+      lua_rawseti(L, -2, ++n);
+    }
   }
+  return n > 0;
 }
 
+/* for port, candidates in ports(host[, index]) do ... end
+ *
+ * Iterates over the open, open|filtered and unfiltered ports of host. Given a
+ * portrule index, ports no script may want are skipped and candidates lists
+ * the positions of the scripts that may.
+ */
 static int ports (lua_State *L)
 {
   static const int states[] = {
@@ -96,22 +182,39 @@ static int ports (lua_State *L)
   };
   Target *target = nseU_gettarget(L, 1);
   PortList *plist = &(target->ports);
+  bool indexed = !lua_isnoneornil(L, 2);
+  std::vector<bool> candidates;
   Port *current = NULL;
   Port port;
-  lua_newtable(L);
+  lua_Integer n = 0;
+
+  if (indexed) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_getfield(L, 2, "n");
+    candidates.resize(luaL_checkinteger(L, -1) + 1);
+    lua_pop(L, 1);
+  }
+  lua_newtable(L); /* port and candidates, in turn */
   for (int i = 0; states[i] != PORT_HIGHEST_STATE; i++)
     while ((current = plist->nextPort(current, &port, TCPANDUDPANDSCTP,
             states[i])) != NULL)
     {
+      if (indexed) {
+        if (!push_candidates(L, 2, target, current, candidates))
+          continue;
+      } else {
+        lua_pushnil(L);
+      }
       lua_newtable(L);
       set_portinfo(L, target, current);
-      lua_pushboolean(L, 1);
-      lua_rawset(L, -3);
+      lua_rawseti(L, -3, n + 1);
+      lua_rawseti(L, -2, n + 2);
+      n += 2;
     }
-  lua_pushcclosure(L, next_port, 1);
-  lua_pushnil(L);
-  lua_pushnil(L);
-  return 3;
+  lua_pushinteger(L, 0);
+  lua_pushinteger(L, n);
+  lua_pushcclosure(L, next_port, 3);
+  return 1;
 }
 
 static int script_set_output (lua_State *L)
@@ -137,6 +240,8 @@ static int host_set_output (lua_State *L)
     lua_len(L, 4);
     sr.set_output_str(luaL_checkstring(L, 4), luaL_checkinteger(L,-1));
   }
+  if (nse_worker_active())
+    nse_worker_record_output(L, target, NULL, sr.get_id(), 3, 4);
   target->scriptResults.push_back(sr);
   return 0;
 }
@@ -154,6 +259,8 @@ static int port_set_output (lua_State *L)
     lua_len(L, 5);
     sr.set_output_str(luaL_checkstring(L, 5), luaL_checkinteger(L,-1));
   }
+  if (nse_worker_active())
+    nse_worker_record_output(L, target, p, sr.get_id(), 4, 5);
   target->ports.addScriptResult(p->portno, p->proto, sr);
   target->ports.numscriptresults++;
   return 0;
@@ -165,6 +272,27 @@ static int key_was_pressed (lua_State *L)
   return 1;
 }
 
+/* Writes a --telemetry record with the number of script threads if one is
+ * due, or if the fourth argument (the end of the phase) is true. */
+static int telemetry (lua_State *L)
+{
+  struct timeval now;
+
+  if (o.telemetry == NULL)
+    return 0;
+  gettimeofday(&now, NULL);
+  if (lua_toboolean(L, 4) || telemetry_due(&now))
+  {
+    telemetry_start("NSE", &now);
+    telemetry_int("threads", luaL_checkinteger(L, 1));
+    telemetry_int("waiting", luaL_checkinteger(L, 2));
+    telemetry_int("total", luaL_checkinteger(L, 3));
+    telemetry_int("nsock_events", nse_nsock_events_pending());
+    telemetry_end();
+  }
+  return 0;
+}
+
 static int scp (lua_State *L)
 {
   static const char * const ops[] = {"printStats", "printStatsIfNecessary",
@@ -355,8 +483,10 @@ static void open_cnse (lua_State *L)
 {
   static const luaL_Reg nse[] = {
     {"fetchfile_absolute", fetchfile_absolute},
+    {"loadfile", l_nse_bytecode_loadfile},
     {"fetchscript", fetchscript},
     {"key_was_pressed", key_was_pressed},
+    {"telemetry", telemetry},
     {"scan_progress_meter", scan_progress_meter},
     {"timedOut", timedOut},
     {"startTimeOutClock", startTimeOutClock},
@@ -385,6 +515,8 @@ static void open_cnse (lua_State *L)
   nseU_setsfield(L, -1, "scriptargsfile", o.scriptargsfile);
   nseU_setsfield(L, -1, "NMAP_URL", NMAP_URL);
   nseU_setnfield(L, -1, "script_timeout", o.scripttimeout);
+  nseU_setnfield(L, -1, "host_timeout", o.host_timeout);
+  nseU_setnfield(L, -1, "max_descriptors", max_sd());
 
 }
 
@@ -545,6 +677,7 @@ static void set_nmap_libraries (lua_State *L)
     {NSE_NMAPLIBNAME, luaopen_nmap},
     {LFSLIBNAME, luaopen_lfs},
     {LPEGLIBNAME, luaopen_lpeg},
+    {NSE_CODECLIBNAME, luaopen_codec},
 #ifdef HAVE_OPENSSL
     {OPENSSLLIBNAME, luaopen_openssl},
 #endif
@@ -572,7 +705,7 @@ static int init_main (lua_State *L)
 
   if (nmap_fetchfile(path, sizeof(path), "nse_main.lua") != 1)
     luaL_error(L, "could not locate nse_main.lua");
-  if (luaL_loadfile(L, path) != 0)
+  if (nse_bytecode_loadfile(L, path, NULL, NULL) != 0)
     luaL_error(L, "could not load nse_main.lua: %s", lua_tostring(L, -1));
 
   /* The first argument to the NSE Main Lua code is the private nse
@@ -598,8 +731,11 @@ static int init_main (lua_State *L)
   return 0;
 }
 
+/* With NBASE_PROFILE, the time spent in Lua during a phase is that of run_main
+ * less that of NSE nsock_loop (in nse_nsock.cc). */
 static int run_main (lua_State *L)
 {
+  NBASE_PROF_SCOPE("NSE run_main");
   std::vector<Target *> *targets = (std::vector<Target*> *)
       lua_touserdata(L, 1);
 
@@ -664,6 +800,7 @@ static int run_main (lua_State *L)
  */
 int nse_yield (lua_State *L, lua_KContext ctx, lua_KFunction k)
 {
+  NBASE_PROF_EVENT("NSE thread yield", 0);
   lua_getfield(L, LUA_REGISTRYINDEX, NSE_YIELD);
   lua_pushthread(L);
   lua_call(L, 1, 1); /* returns NSE_YIELD_VALUE */
@@ -679,6 +816,7 @@ int nse_yield (lua_State *L, lua_KContext ctx, lua_KFunction k)
  */
 void nse_restore (lua_State *L, int number)
 {
+  NBASE_PROF_EVENT("NSE thread restore", number);
   luaL_checkstack(L, 5, "nse_restore: stack overflow");
   lua_pushthread(L);
   lua_getfield(L, LUA_REGISTRYINDEX, NSE_WAITING_TO_RUNNING);
@@ -688,6 +826,8 @@ void nse_restore (lua_State *L, int number)
      other arguments. */
   if (lua_pcall(L, number+1, 0, 0) != 0)
     fatal("%s: WAITING_TO_RUNNING error!\n%s", __func__, lua_tostring(L, -1));
+  /* The thread is ready, so let NSE resume it rather than wait for Nsock. */
+  nse_nsock_loop_quit();
 }
 
 /* void nse_destructor (lua_State *L, char what)           [-(1|2), +0, e]
@@ -798,10 +938,8 @@ void open_nse (void)
   }
 }
 
-void script_scan (std::vector<Target *> &targets, stype scantype)
+static void script_scan_targets (std::vector<Target *> &targets)
 {
-  o.current_scantype = scantype;
-
   assert(L_NSE != NULL);
   lua_settop(L_NSE, 0); /* clear the stack */
 
@@ -814,6 +952,18 @@ void script_scan (std::vector<Target *> &targets, stype scantype)
   lua_settop(L_NSE, 0);
 }
 
+void script_scan (std::vector<Target *> &targets, stype scantype)
+{
+  o.current_scantype = scantype;
+
+  /* Only host and port scripts are split among workers; prerule and postrule
+     scripts have no hosts to share out. */
+  if (scantype == SCRIPT_SCAN && o.scriptworkers > 1 && targets.size() > 1)
+    nse_workers_scan(L_NSE, targets, o.scriptworkers, script_scan_targets);
+  else
+    script_scan_targets(targets);
+}
+
 void close_nse (void)
 {
   if (L_NSE != NULL)
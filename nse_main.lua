@@ -61,6 +61,14 @@ local ACTION_STARTING = {};
 -- count worker threads started by scripts.
 local CONCURRENCY_LIMIT = 1000;
 
+-- No new script instance threads are started while the Lua heap is larger
+-- than this many kilobytes, unless none are running.
+local MEMORY_LIMIT = 1024 * 1024;
+
+-- Longest time, in milliseconds, Nsock is run between two passes over the
+-- threads when none is ready or due to time out. Restored threads end it early.
+local LOOP_TIMEOUT = 250;
+
 -- Table of different supported rules.
 local NSE_SCRIPT_RULES = {
   prerule = "prerule",
@@ -103,11 +111,12 @@ local traceback = debug.traceback;
 local _R = debug.getregistry();
 
 local io = require "io";
-local lines = io.lines;
 local open = io.open;
 
 local math = require "math";
+local ceil = math.ceil;
 local max = math.max;
+local min = math.min;
 
 local package = require "package";
 
@@ -135,7 +144,7 @@ do -- Add loader to look in nselib/?.lua (nselib/ can be in multiple places)
     local name = "nselib/"..lib..".lua";
     local type, path = cnse.fetchfile_absolute(name);
     if type == "file" then
-      return assert(loadfile(path));
+      return assert(cnse.loadfile(path));
     else
       return "\n\tNSE failed to find "..name.." in search paths.";
     end
@@ -158,6 +167,7 @@ local Cg = lpeg.Cg;
 local Ct = lpeg.Ct;
 
 local nmap = require "nmap";
+local clock = nmap.clock;
 local lfs = require "lfs";
 
 local socket = require "nmap.socket";
@@ -235,24 +245,11 @@ local function log_error (fmt, ...)
   log_write("stderr", format(fmt, ...));
 end
 
-local function table_size (t)
-  local n = 0; for _ in pairs(t) do n = n + 1; end return n;
-end
-
 local function loadscript (filename)
-  local source = "@"..filename;
-  local function ld ()
-    -- header for scripts to allow setting the environment
-    yield [[return function (_ENV) return function (...)]];
-    -- actual script
-    for line in lines(filename, 2^15) do
-      yield(line);
-    end
-    -- footer...
-    yield [[ end end]];
-    return nil;
-  end
-  return assert(load(wrap(ld), source, "t"))();
+  -- The script is wrapped in a header and footer allowing to set its
+  -- environment. The compiled chunk is cached by cnse.loadfile.
+  return assert(cnse.loadfile(filename,
+      [[return function (_ENV) return function (...)]], [[ end end]]))();
 end
 
 -- recursively copy a table, for host/port tables
@@ -382,21 +379,6 @@ do
     end
   end
 
-  -- prerule/postrule scripts may be timed out in the future
-  -- based on start time and script lifetime?
-  function Thread:timed_out ()
-    local host_timeout, script_timeout = false, false;
-    -- checking whether user gave --script-timeout option or not
-    if cnse.script_timeout and cnse.script_timeout > 0 then
-      -- comparing script's timeout with time elapsed
-      script_timeout = cnse.script_timeout < os.difftime(os.time(), self.start_time)
-    end
-    if self.type == "hostrule" or self.type == "portrule" then
-      host_timeout = cnse.timedOut(self.host);
-    end
-    return script_timeout or host_timeout;
-  end
-
   function Thread:start_time_out_clock ()
     if self.type == "hostrule" or self.type == "portrule" then
       cnse.startTimeOutClock(self.host);
@@ -419,7 +401,11 @@ do
     if self.worker then
       self.start_time = self.parent.start_time
     else
-      self.start_time = os.time()
+      self.start_time = clock()
+    end
+    -- checking whether user gave --script-timeout option or not
+    if cnse.script_timeout and cnse.script_timeout > 0 then
+      self.deadline = self.start_time + cnse.script_timeout;
     end
   end
 
@@ -558,6 +544,39 @@ do
     [REQUIRE_ERROR] = true,
   }
 
+  -- filter = portrule_filter(filename, filter, strict)
+  -- Checks the static portrule filter of a script and turns its lists into
+  -- sets. The fields and defaults are those of the shortport functions. Values
+  -- of the wrong type are an error if strict (the script declared the filter)
+  -- and are otherwise dropped, as shortport rules never match them.
+  local function portrule_filter (filename, filter, strict)
+    assert(type(filter) == "table",
+        filename.." field 'portrule_filter' must be a table");
+    local function set (field, expected, default)
+      local list = filter[field];
+      if list == nil then list = default end
+      if list == nil then return nil end
+      if type(list) ~= "table" then list = {list} end
+      local set = {};
+      for _, value in ipairs(list) do
+        if type(value) == expected then
+          set[value] = true;
+        else
+          assert(not strict, filename.." has non-"..expected..
+              " entries in 'portrule_filter."..field.."'");
+        end
+      end
+      return set;
+    end
+    return {
+      ports = set("ports", "number"),
+      services = set("services", "string"),
+      protos = set("protos", "string", "tcp"),
+      states = set("states", "string", {"open", "open|filtered"}),
+      ssl = not not filter.ssl,
+    };
+  end
+
   -- script = Script.new(filename)
   -- Creates a new Script Class for the script.
   -- Arguments:
@@ -638,6 +657,21 @@ do
     local hostrule = rules.hostrule;
     local portrule = rules.portrule;
     local postrule = rules.postrule;
+    -- A portrule only accepts the ports matching its filter, either declared
+    -- by the script or known for the shortport rules. Forced scripts run
+    -- against every port.
+    local filter;
+    if portrule and not script_params.forced then
+      filter = rawget(env, "portrule_filter");
+      local strict = filter ~= nil;
+      local shortport = package.loaded.shortport;
+      if filter == nil and type(shortport) == "table" then
+        filter = shortport.rule_filter(portrule);
+      end
+      if filter ~= nil then
+        filter = portrule_filter(filename, filter, strict);
+      end
+    end
     -- Assert that categories is an array of strings
     for i, category in ipairs(rawget(env, "categories")) do
       assert(type(category) == "string",
@@ -658,6 +692,7 @@ do
       prerule = prerule,
       hostrule = hostrule,
       portrule = portrule,
+      portrule_filter = filter,
       postrule = postrule,
       args = {n = 0};
       description = rawget(env, "description"),
@@ -728,64 +763,135 @@ local function get_chosen_scripts (rules)
     rules[i] = rule;
   end
 
-  -- Checks if a given script, script_entry, should be loaded. A script_entry
-  -- should be in the form: { filename = "name.nse", categories = { ... } }
-  function db_env.Entry (script_entry)
-    local categories = rawget(script_entry, "categories");
-    local filename = rawget(script_entry, "filename");
-    assert(type(categories) == "table" and type(filename) == "string", "script database appears corrupt, try `nmap --script-updatedb`");
-    local escaped_basename = match(filename, "([^/\\]-)%.nse$") or match(filename, "([^/\\]-)$");
-    local selected_by_name = false;
-    -- The script selection parameters table.
-    local script_params = {};
-
-    -- Test if path is a glob pattern that matches script_entry.filename.
+  -- Compiles a rule into a function of a script database entry telling
+  -- whether the rule selects the entry, and whether one of the file names or
+  -- patterns in the rule matched it.
+  local function compile_rule (rule)
     local function match_script (path)
       path = gsub(path, "%.nse$", ""); -- remove optional extension
       path = gsub(path, "[%^%$%(%)%%%.%[%]%+%-%?]", "%%%1"); -- esc magic
       path = gsub(path, "%*", ".*"); -- change to Lua wildcard
       path = "^"..path.."$"; -- anchor to beginning and end
-      local found = not not find(escaped_basename, path);
-      selected_by_name = selected_by_name or found;
-      return found;
+      return function (entry)
+        local found = not not find(entry.basename, path);
+        entry.selected_by_name = entry.selected_by_name or found;
+        return found;
+      end
+    end
+    -- A word is a category of the entry, or else a file name or pattern.
+    local function word (w)
+      local category, script = lower(w), match_script(w);
+      return function (entry)
+        return category == "all" or entry.categories[category] or script(entry);
+      end
+    end
+    local function constant (value)
+      return function () return value end
+    end
+    -- Both operands are always evaluated so that selected_by_name is set by
+    -- any matching name.
+    local function disjunct (a, b)
+      return function (entry)
+        local x, y = a(entry), b(entry);
+        return x or y;
+      end
+    end
+    local function conjunct (a, b)
+      return function (entry)
+        local x, y = a(entry), b(entry);
+        return x and y;
+      end
+    end
+    local function negate (a)
+      return function (entry) return not a(entry) end
     end
 
     local T = locale {
       V "space"^0 * V "expression" * V "space"^0 * P(-1);
 
       expression = V "disjunct" + V "conjunct" + V "value";
-      disjunct = (V "conjunct" + V "value") * V "space"^0 * K "or" * V "space"^0 * V "expression" / function (a, b) return a or b end;
-      conjunct = V "value" * V "space"^0 * K "and" * V "space"^0 * V "expression" / function (a, b) return a and b end;
-      value = K "not" * V "space"^0 * V "value" / function (a) return not a end +
+      disjunct = (V "conjunct" + V "value") * V "space"^0 * K "or" * V "space"^0 * V "expression" / disjunct;
+      conjunct = V "value" * V "space"^0 * K "and" * V "space"^0 * V "expression" / conjunct;
+      value = K "not" * V "space"^0 * V "value" / negate +
               P "(" * V "space"^0 * V "expression" * V "space"^0 * P ")" +
-              K "true" * Cc(true) +
-              K "false" * Cc(false) +
-              V "category" +
-              V "path";
+              K "true" * Cc(constant(true)) +
+              K "false" * Cc(constant(false)) +
+              V "word";
 
-      category = K "all" * Cc(true); -- pseudo-category "all" matches everything
-      path = R("\033\039", "\042\126")^1 / match_script; -- all graphical characters not '(', ')'
+      word = R("\033\039", "\042\126")^1 / word; -- all graphical characters not '(', ')'
     };
+    return P(T):match(rule);
+  end
 
+  -- Read the script database, indexing the entries by category and name.
+  local entries, by_category, by_name = {}, {}, {};
+  function db_env.Entry (script_entry)
+    local categories = rawget(script_entry, "categories");
+    local filename = rawget(script_entry, "filename");
+    assert(type(categories) == "table" and type(filename) == "string", "script database appears corrupt, try `nmap --script-updatedb`");
+    local entry = {
+      filename = filename,
+      basename = match(filename, "([^/\\]-)%.nse$") or match(filename, "([^/\\]-)$"),
+      categories = {},
+      position = #entries + 1,
+    };
     for i, category in ipairs(categories) do
       assert(type(category) == "string", "bad entry in script database");
-      T.category = T.category + K(category) * Cc(true);
+      category = lower(category);
+      entry.categories[category] = true;
+      by_category[category] = by_category[category] or {};
+      insert(by_category[category], entry);
     end
+    entries[entry.position] = entry;
+    by_name[entry.basename] = entry;
+  end
 
-    T = P(T);
+  db_closure(); -- Load the database
+
+  -- Find the entries each rule may select: those in the category or with the
+  -- name if the rule is a single word, or else all of them.
+  local keywords = {all = true, ["true"] = true, ["false"] = true,
+      ["not"] = true, ["and"] = true, ["or"] = true};
+  local compiled, selected = {}, {};
+  for i, rule in ipairs(rules) do
+    compiled[i] = compile_rule(rule);
+    local word = match(rule, "^%s*([%w%-_]+)%s*$");
+    if word and not keywords[lower(word)] then
+      for _, entry in ipairs(by_category[lower(word)] or {}) do
+        selected[entry] = true;
+      end
+      if by_name[word] then
+        selected[by_name[word]] = true;
+      end
+    else
+      for _, entry in ipairs(entries) do
+        selected[entry] = true;
+      end
+    end
+  end
+  local candidates = {};
+  for entry in pairs(selected) do
+    candidates[#candidates+1] = entry;
+  end
+  sort(candidates, function (a, b) return a.position < b.position end);
+
+  -- Checks if a candidate entry should be loaded.
+  for _, entry in ipairs(candidates) do
+    -- The script selection parameters table.
+    local script_params = {};
 
     for i, rule in ipairs(rules) do
-      selected_by_name = false;
-      if T:match(rule) then
+      entry.selected_by_name = false;
+      if compiled[i] and compiled[i](entry) then
         used_rules[rule] = true;
         script_params.forced = not not forced_rules[rule];
-        if selected_by_name then
+        if entry.selected_by_name then
           script_params.selection = "name"
           script_params.verbosity = true
         else
           script_params.selection = "category"
         end
-        local t, path = cnse.fetchscript(filename);
+        local t, path = cnse.fetchscript(entry.filename);
         if t == "file" then
           if not files_loaded[path] then
             local script = Script.new(path, script_params)
@@ -794,15 +900,13 @@ local function get_chosen_scripts (rules)
             -- do not break so other rules can be marked as used
           end
         else
-          log_error("Warning: Could not load '%s': %s", filename, path);
+          log_error("Warning: Could not load '%s': %s", entry.filename, path);
           break;
         end
       end
     end
   end
 
-  db_closure(); -- Load the scripts
-
   -- Now load any scripts listed by name rather than by category.
   for rule, loaded in pairs(used_rules) do
     if not loaded then -- attempt to load the file/directory
@@ -868,6 +972,99 @@ local function get_chosen_scripts (rules)
   return chosen_scripts;
 end
 
+-- index = portrule_index(scripts)
+-- Builds the index cnse.ports uses to pair the ports of a host with the
+-- portrule scripts whose filter they may match, so that rules which could
+-- only reject a port are never run against it.
+-- Arguments:
+--   scripts  An array of scripts (a runlevel).
+-- Returns:
+--   index  A table of the positions in scripts of those without a filter
+--          (any), by protocol and port number (ports), by protocol and
+--          service name (services) and of those accepting any SSL port (ssl).
+local function portrule_index (scripts)
+  local index = {n = #scripts, any = {}, ports = {}, services = {}, ssl = {}};
+  local function add (t, proto, key, i)
+    t[proto] = t[proto] or {};
+    t[proto][key] = t[proto][key] or {};
+    insert(t[proto][key], i);
+  end
+  for i, script in ipairs(scripts) do
+    local filter = script.portrule_filter;
+    if script.portrule and not filter then
+      insert(index.any, i);
+    elseif filter then
+      for proto in pairs(filter.protos) do
+        for number in pairs(filter.ports or {}) do
+          add(index.ports, proto, number, i);
+        end
+        for service in pairs(filter.services or {}) do
+          add(index.services, proto, service, i);
+        end
+      end
+      if filter.ssl then
+        insert(index.ssl, i);
+      end
+    end
+  end
+  return index;
+end
+
+-- Binary min-heap of threads ordered by their deadline. Each thread in the
+-- heap keeps its position in heap_index (read with rawget, as workers would
+-- otherwise see their parent's) so that it can be removed when it ends.
+local function heap_set (heap, i, thread)
+  heap[i] = thread;
+  thread.heap_index = i;
+end
+
+local function heap_up (heap, i)
+  local thread = heap[i];
+  while i > 1 do
+    local parent = i // 2;
+    if heap[parent].deadline <= thread.deadline then break end
+    heap_set(heap, i, heap[parent]);
+    i = parent;
+  end
+  heap_set(heap, i, thread);
+end
+
+local function heap_down (heap, i)
+  local thread, n = heap[i], #heap;
+  while true do
+    local child = 2 * i;
+    if child > n then break end
+    if child < n and heap[child+1].deadline < heap[child].deadline then
+      child = child + 1;
+    end
+    if thread.deadline <= heap[child].deadline then break end
+    heap_set(heap, i, heap[child]);
+    i = child;
+  end
+  heap_set(heap, i, thread);
+end
+
+local function heap_push (heap, thread)
+  heap_set(heap, #heap + 1, thread);
+  heap_up(heap, #heap);
+end
+
+local function heap_remove (heap, thread)
+  local i = rawget(thread, "heap_index");
+  if not i then return end
+  local last = heap[#heap];
+  heap[#heap] = nil;
+  thread.heap_index = false;
+  if last ~= thread then
+    heap_set(heap, i, last);
+    heap_up(heap, i);
+    heap_down(heap, last.heap_index);
+  end
+end
+
+-- Connection pool check-ins already reported by run.
+local pool_checkins = 0;
+
 -- run(threads)
 -- The main loop function for NSE. It handles running all the script threads.
 -- Arguments:
@@ -883,7 +1080,10 @@ local function run (threads_iter, hosts)
   local current; -- The currently running Thread.
   local total = 0; -- Number of threads, for record keeping.
   local timeouts = {}; -- A list to save and to track scripts timeout.
+  local deadlines = {}; -- Heap of threads with a script timeout.
+  local overdue = {}; -- Threads past their deadline while not waiting.
   local num_threads = 0; -- Number of script instances currently running.
+  local num_waiting = 0; -- Number of those in waiting.
 
   -- Map of yielded threads to the base Thread
   local yielded_base = setmetatable({}, {__mode = "kv"});
@@ -903,6 +1103,7 @@ local function run (threads_iter, hosts)
       if waiting[co] then -- ignore a thread not waiting
         pending[co], waiting[co] = waiting[co], nil;
         pending[co].args = pack(...);
+        num_waiting = num_waiting - 1;
       end
     end
   end
@@ -932,6 +1133,9 @@ local function run (threads_iter, hosts)
     local worker, info = current:new_worker(main, ...);
     total, all[worker.co], pending[worker.co], num_threads = total+1, worker, worker, num_threads+1;
     worker:start(timeouts);
+    if worker.deadline then
+      heap_push(deadlines, worker);
+    end
     return worker.co, info;
   end);
 
@@ -958,10 +1162,28 @@ local function run (threads_iter, hosts)
 
   local progress = cnse.scan_progress_meter(NAME);
 
+  -- Ends a waiting thread that ran out of time.
+  local function time_out (co, thread)
+    waiting[co], all[co], overdue[co] = nil, nil, nil;
+    num_threads, num_waiting = num_threads-1, num_waiting-1;
+    heap_remove(deadlines, thread);
+    thread:d("%THREAD %stimed out", thread.host
+        and format("%s%s ", thread.host.ip,
+                thread.port and ":"..thread.port.number or "")
+        or "");
+    thread:close(timeouts, "timed out");
+  end
+
+  -- May another thread be started now?
+  local function can_start ()
+    return threads_iter and num_threads < CONCURRENCY_LIMIT and
+        (num_threads == 0 or collectgarbage "count" < MEMORY_LIMIT);
+  end
+
   -- Loop while any thread is running or waiting.
   while next(running) or next(waiting) or threads_iter do
     -- Start as many new threads as possible.
-    while threads_iter and num_threads < CONCURRENCY_LIMIT do
+    while can_start() do
       local thread = threads_iter()
       if not thread then
         threads_iter = nil;
@@ -970,14 +1192,18 @@ local function run (threads_iter, hosts)
       all[thread.co], running[thread.co], total = thread, thread, total+1;
       num_threads = num_threads + 1;
       thread:start(timeouts);
+      if thread.deadline then
+        heap_push(deadlines, thread);
+      end
     end
 
-    local nr, nw = table_size(running), table_size(waiting);
+    local nw = num_waiting;
+    cnse.telemetry(num_threads, nw, total);
     -- total may be 0 if no scripts are running in this phase
     if total > 0 and cnse.key_was_pressed() then
       print_verbose(1, "Active NSE Script Threads: %d (%d waiting)",
-          nr+nw, nw);
-      progress("printStats", 1-(nr+nw)/total);
+          num_threads, nw);
+      progress("printStats", 1-num_threads/total);
       if debugging() >= 2 then
         for co, thread in pairs(running) do
           thread:d("Running: %THREAD_AGAINST\n\t%s",
@@ -990,21 +1216,37 @@ local function run (threads_iter, hosts)
       end
     elseif total > 0 and progress "mayBePrinted" then
       if verbosity() > 1 or debugging() > 0 then
-        progress("printStats", 1-(nr+nw)/total);
+        progress("printStats", 1-num_threads/total);
       else
-        progress("printStatsIfNecessary", 1-(nr+nw)/total);
+        progress("printStatsIfNecessary", 1-num_threads/total);
       end
     end
 
-    -- Checked for timed-out scripts and hosts.
-    for co, thread in pairs(waiting) do
-      if thread:timed_out() then
-        waiting[co], all[co], num_threads = nil, nil, num_threads-1;
-        thread:d("%THREAD %stimed out", thread.host
-            and format("%s%s ", thread.host.ip,
-                    thread.port and ":"..thread.port.number or "")
-            or "");
-        thread:close(timeouts, "timed out");
+    -- Check for timed-out scripts, in deadline order. A thread that is not
+    -- waiting is timed out once it waits again.
+    local now = clock();
+    while deadlines[1] and deadlines[1].deadline < now do
+      local thread = deadlines[1];
+      heap_remove(deadlines, thread);
+      overdue[thread.co] = thread;
+    end
+    for co, thread in pairs(overdue) do
+      if waiting[co] then
+        time_out(co, thread);
+      elseif not all[co] then
+        overdue[co] = nil;
+      end
+    end
+    -- Check for timed-out hosts.
+    if cnse.host_timeout > 0 then
+      for host, threads in pairs(timeouts) do
+        if cnse.timedOut(host) then
+          for co in pairs(threads) do
+            if waiting[co] then
+              time_out(co, waiting[co]);
+            end
+          end
+        end
       end
     end
 
@@ -1013,14 +1255,23 @@ local function run (threads_iter, hosts)
       thread:start_time_out_clock();
 
       if thread:resume(timeouts) then
-        waiting[co] = thread;
+        waiting[co], num_waiting = thread, num_waiting+1;
       else
         all[co], num_threads = nil, num_threads-1;
+        heap_remove(deadlines, thread);
       end
       current = nil;
     end
 
-    loop(50); -- Allow nsock to perform any pending callbacks
+    -- Allow nsock to perform any pending callbacks. Only poll if threads are
+    -- ready, else run until one is restored or the next deadline.
+    local timeout = LOOP_TIMEOUT;
+    if next(pending) or can_start() then
+      timeout = 0;
+    elseif deadlines[1] then
+      timeout = min(timeout, max(0, ceil((deadlines[1].deadline - clock()) * 1000)));
+    end
+    loop(timeout);
     -- Move pending threads back to running.
     for co, thread in pairs(pending) do
       pending[co], running[co] = nil, thread;
@@ -1028,6 +1279,28 @@ local function run (threads_iter, hosts)
 
     collectgarbage "step";
   end
+  if total > 0 then
+    cnse.telemetry(num_threads, num_waiting, total, true);
+  end
+
+  -- Idle pooled connections do not outlive the hosts of this phase.
+  local stats = socket.get_stats();
+  if stats.pool_checkins > pool_checkins then
+    print_debug(1, "Connection pool: %d checked in, %d reused, %d expired, %d idle.",
+        stats.pool_checkins, stats.pool_reuses, stats.pool_discards,
+        stats.pool_idle);
+    pool_checkins = stats.pool_checkins;
+  end
+  socket.pool_clear();
+
+  -- Neither are cached results.
+  local cache = nmap.cache.stats();
+  if cache.hits + cache.misses > 0 then
+    print_debug(1, "Result cache: %d hits, %d misses, %d waits, %d entries (%d bytes), %d evicted, %d expired.",
+        cache.hits, cache.misses, cache.waits, cache.entries, cache.size,
+        cache.evictions, cache.expirations);
+  end
+  nmap.cache.clear();
 
   progress "endTask";
 end
@@ -1324,6 +1597,12 @@ local function main (hosts, scantype)
     insert(runlevels[script.runlevel], script);
   end
 
+  -- Threads may hold descriptors besides their connected sockets (pcap, dnet,
+  -- unconnected sockets), so do not run more than half as many as Nmap may
+  -- open.
+  if cnse.max_descriptors > 0 then
+    CONCURRENCY_LIMIT = max(20, min(CONCURRENCY_LIMIT, cnse.max_descriptors // 2));
+  end
   if _R[PARALLELISM] > CONCURRENCY_LIMIT then
     CONCURRENCY_LIMIT = _R[PARALLELISM];
   end
@@ -1341,6 +1620,7 @@ local function main (hosts, scantype)
   end
 
   for runlevel, scripts in ipairs(runlevels) do
+    local index = scantype == NSE_SCAN and portrule_index(scripts);
     -- This iterator is passed to the run function. It returns one new script
     -- thread on demand until exhausted.
     local function threads_iter ()
@@ -1363,13 +1643,19 @@ local function main (hosts, scantype)
               yield(thread);
             end
           end
-          -- Check portrules for this host.
-          for port in cnse.ports(host) do
-            for _, script in ipairs(scripts) do
-              local thread = script:new_thread("portrule", host_copy(host), tcopy(port));
-              if thread then
-                thread.host, thread.port = host, port;
-                yield(thread);
+          -- Check portrules for this host, against the scripts whose filter
+          -- the port matches.
+          for port, candidates in cnse.ports(host, index) do
+            for _, i in ipairs(candidates) do
+              local script = scripts[i];
+              local filter = script.portrule_filter;
+              if not filter or filter.states[port.state] or
+                  filter.ssl and port.version.service_tunnel == "ssl" then
+                local thread = script:new_thread("portrule", host_copy(host), tcopy(port));
+                if thread then
+                  thread.host, thread.port = host, port;
+                  yield(thread);
+                end
               end
             end
           end
@@ -24,6 +24,8 @@ extern "C" {
 #include "nse_utility.h"
 #include "nse_nsock.h"
 #include "nse_dnet.h"
+#include "nse_workers.h"
+#include "nse_cache.h"
 
 extern NmapOps o;
 
@@ -521,11 +523,15 @@ static int l_set_port_state (lua_State *L)
         if (p->state == PORT_OPEN)
           return 0;
         target->ports.setPortState(p->portno, p->proto, PORT_OPEN);
+        if (nse_worker_active())
+          nse_worker_record_port_state(target, p->portno, p->proto, PORT_OPEN);
         break;
       case PORT_CLOSED:
         if (p->state == PORT_CLOSED)
           return 0;
         target->ports.setPortState(p->portno, p->proto, PORT_CLOSED);
+        if (nse_worker_active())
+          nse_worker_record_port_state(target, p->portno, p->proto, PORT_CLOSED);
         break;
     }
     target->ports.setStateReason(p->portno, p->proto, ER_SCRIPT, 0, NULL);
@@ -598,6 +604,12 @@ static int l_set_port_version (lua_State *L)
       version, extrainfo, hostname, ostype, devicetype,
       (cpe.size() > 0) ? &cpe : NULL,
       probestate==PROBESTATE_FINISHED_HARDMATCHED ? NULL : service_fp);
+  if (nse_worker_active())
+    nse_worker_record_port_version(target, p->portno, p->proto,
+        probestate, name, tunnel, product,
+        version, extrainfo, hostname, ostype, devicetype,
+        (cpe.size() > 0) ? &cpe : NULL,
+        probestate==PROBESTATE_FINISHED_HARDMATCHED ? NULL : service_fp);
   return 0;
 }
 
@@ -753,6 +765,8 @@ static int l_add_targets (lua_State *L)
     for (n = 1; n <= lua_gettop(L); n++) {
       if (!NewTargets::insert(luaL_checkstring(L, n)))
         break;
+      if (nse_worker_active())
+        nse_worker_record_new_target(lua_tostring(L, n));
       ntarget++;
     }
     /* was able to add some targets */
@@ -982,6 +996,7 @@ int luaopen_nmap (lua_State *L)
     {"new_dnet", nseU_placeholder}, /* imported from nmap.dnet */
     {"get_interface_info", nseU_placeholder}, /* imported from nmap.dnet */
     {"new_socket", nseU_placeholder}, /* imported from nmap.socket */
+    {"new_buffer", nseU_placeholder}, /* imported from nmap.socket */
     {"mutex", nseU_placeholder}, /* placeholder */
     {"condvar", nseU_placeholder}, /* placeholder */
     {NULL, NULL}
@@ -1007,6 +1022,9 @@ int luaopen_nmap (lua_State *L)
   /* nmap.socket.new -> nmap.new_socket. */
   lua_getfield(L, -1, "new");
   lua_setfield(L, nmap_idx, "new_socket");
+  /* nmap.socket.new_buffer -> nmap.new_buffer. */
+  lua_getfield(L, -1, "new_buffer");
+  lua_setfield(L, nmap_idx, "new_buffer");
   /* Store nmap.socket; used by nse_main.lua. */
   lua_setfield(L, nmap_idx, "socket");
 
@@ -1020,6 +1038,9 @@ int luaopen_nmap (lua_State *L)
   /* Store nmap.socket. */
   lua_setfield(L, nmap_idx, "dnet");
 
+  luaL_requiref(L, "nmap.cache", luaopen_cache, 0);
+  lua_setfield(L, nmap_idx, "cache");
+
   lua_settop(L, nmap_idx);
 
   return 1;
@@ -9,6 +9,8 @@
 #include "nse_main.h"
 #include "nse_utility.h"
 #include "nse_ssl_cert.h"
+#include "nse_buffer.h"
+#include "nbase_prof.h"
 
 #if HAVE_OPENSSL
 /* See the comments in service_scan.cc for the reason for _WINSOCKAPI_. */
@@ -32,12 +34,14 @@ enum {
   PCAP_SOCKET = lua_upvalueindex(3), /* pcap socket metatable */
   THREAD_SOCKETS = lua_upvalueindex(4), /* <Thread, Table of Sockets (keys)> */
   CONNECT_WAITING = lua_upvalueindex(5), /* Threads waiting to lock */
-  KEY_PCAP = lua_upvalueindex(6) /* Keys to pcap sockets */
+  KEY_PCAP = lua_upvalueindex(6), /* Keys to pcap sockets */
+  IDLE_SOCKETS = lua_upvalueindex(7) /* <Pool Key, Array of idle sockets> */
 };
 
 /* Integer keys in the Nsock userdata environments */
 #define THREAD_I  1 /* The thread that yielded */
-#define BUFFER_I  2 /* Location of Userdata Buffer */
+#define BUFFER_I  2 /* Location of Userdata Buffer (an nse_buffer, once used) */
+#define POOL_KEY_I 3 /* Idle pool key of a connected socket, if it may be pooled */
 
 extern NmapOps o;
 
@@ -54,8 +58,15 @@ typedef struct nse_nsock_udata
   const char *direction;
   const char *action;
 
+  /* Buffer a pending read appends to, rather than returning a string */
+  nse_buffer *into;
+
   void *ssl_session;
 
+  /* Idle in the connection pool until idle_expire */
+  int idle;
+  struct timeval idle_expire;
+
   struct sockaddr_storage source_addr;
   size_t source_addrlen;
 
@@ -66,12 +77,49 @@ typedef struct nse_nsock_udata
 
 } nse_nsock_udata;
 
+/* The pool userdata of the NSE state, for nse_nsock_reinit_engine and
+ * nse_nsock_loop_quit. */
+static nsock_pool *nse_pool = NULL;
+
+/* Whether l_loop is running nsock_loop on nse_pool. */
+static bool in_loop = false;
+
+/* A connected TCP or SSL socket whose peer keeps the connection open (an HTTP
+ * keep-alive connection, for instance) may be checked in once a thread is done
+ * with it. It then belongs to no thread and is kept in IDLE_SOCKETS under the
+ * address, target name, port and protocol it was connected to, until a thread
+ * checks out a connection to the same place or it has been idle too long.
+ * Each key's array holds the most recently checked in socket last.
+ */
+#define POOL_IDLE_TIMEOUT     5000  /* default idle time (ms) */
+#define POOL_MAX_IDLE_TIMEOUT 60000
+#define POOL_MAX_PER_TARGET   4
+#define POOL_MAX_IDLE         32
+
+static struct {
+  unsigned int idle; /* sockets in the pool */
+  unsigned long checkins;
+  unsigned long reuses;
+  unsigned long discards; /* closed on expiry or to make room */
+} pool_stats;
+
+static void pool_sweep (lua_State *L, bool all);
+
+static void push_pool_key (lua_State *L, const char *addr,
+    const char *targetname, unsigned short port, const char *proto)
+{
+  lua_pushfstring(L, "%s|%s|%d|%s", addr, targetname ? targetname : "",
+      (int) port, proto);
+}
+
 static int gc_pool (lua_State *L)
 {
   nsock_pool *nsp = (nsock_pool *) lua_touserdata(L, 1);
   assert(*nsp != NULL);
   nsock_pool_delete(*nsp);
   *nsp = NULL;
+  if (nse_pool == nsp)
+    nse_pool = NULL;
   return 0;
 }
 
@@ -91,8 +139,12 @@ static nsock_pool new_pool (lua_State *L)
 
   nsock_pool_set_broadcast(nsp, true);
 
+  /* Scripts schedule lots of socket timeouts that rarely fire */
+  nsock_pool_set_timer_wheel(nsp, 1);
+
   nspp = (nsock_pool *) lua_newuserdata(L, sizeof(nsock_pool));
   *nspp = nsp;
+  nse_pool = nspp;
   lua_newtable(L);
   lua_pushcfunction(L, gc_pool);
   lua_setfield(L, -2, "__gc");
@@ -100,6 +152,25 @@ static nsock_pool new_pool (lua_State *L)
   return nsp;
 }
 
+void nse_nsock_reinit_engine (void)
+{
+  if (nse_pool != NULL && *nse_pool != NULL)
+    nsock_pool_reinit_engine(*nse_pool);
+}
+
+void nse_nsock_loop_quit (void)
+{
+  if (in_loop && nse_pool != NULL && *nse_pool != NULL)
+    nsock_loop_quit(*nse_pool);
+}
+
+int nse_nsock_events_pending (void)
+{
+  if (nse_pool != NULL && *nse_pool != NULL)
+    return nsock_pool_get_events_pending(*nse_pool);
+  return 0;
+}
+
 static nsock_pool get_pool (lua_State *L)
 {
   nsock_pool *nspp;
@@ -163,13 +234,15 @@ static std::string hexify (const unsigned char *str, size_t len)
  */
 #define MAX_PARALLELISM   20
 
-/* int socket_lock (lua_State *L)
+/* int socket_lock (lua_State *L, int idx, bool wait)
  *
  * This function is called by l_connect to get a "lock" on a socket.
  * When connect calls this function, it expects socket_lock to yield forcing
  * connect to be restarted when resumed or it succeeds returning normally.
+ * l_checkout calls it with wait false, to fail without queuing the thread
+ * in CONNECT_WAITING.
  */
-static int socket_lock (lua_State *L, int idx)
+static int socket_lock (lua_State *L, int idx, bool wait)
 {
   unsigned p = o.max_parallelism == 0 ? MAX_PARALLELISM : o.max_parallelism;
   int top = lua_gettop(L);
@@ -194,9 +267,12 @@ static int socket_lock (lua_State *L, int idx)
                                     * to THREAD_SOCKETS */
   } else
   {
-    nse_base(L);
-    lua_pushboolean(L, true);
-    lua_rawset(L, CONNECT_WAITING);
+    if (wait)
+    {
+      nse_base(L);
+      lua_pushboolean(L, true);
+      lua_rawset(L, CONNECT_WAITING);
+    }
     lua_settop(L, top); /* restore stack to original condition for l_connect */
     return 0;
   }
@@ -418,6 +494,8 @@ static nse_nsock_udata *check_nsock_udata (lua_State *L, int idx, bool open)
 do { \
   if (nu->nsiod == NULL) \
     return nseU_safeerror(L, "socket must be connected"); \
+  if (nu->idle) \
+    return nseU_safeerror(L, "socket is idle in the connection pool"); \
 } while (0)
 
 static int l_loop (lua_State *L)
@@ -426,9 +504,16 @@ static int l_loop (lua_State *L)
   int tout = luaL_checkinteger(L, 1);
 
   socket_unlock(L); /* clean up old socket locks */
+  if (pool_stats.idle > 0)
+    pool_sweep(L, false); /* close expired idle connections */
 
   nmap_adjust_loglevel(o.scriptTrace());
-  if (nsock_loop(nsp, tout) == NSOCK_LOOP_ERROR)
+  in_loop = true;
+  NBASE_PROF_BEGIN(loop_start);
+  enum nsock_loopstatus status = nsock_loop(nsp, tout);
+  NBASE_PROF_END(loop_start, "NSE nsock_loop");
+  in_loop = false;
+  if (status == NSOCK_LOOP_ERROR)
     return luaL_error(L, "a fatal error occurred in nsock_loop");
   return 0;
 }
@@ -478,7 +563,10 @@ static int connect (lua_State *L, int status, lua_KContext ctx)
   struct addrinfo *dest;
   int error_id;
 
-  if (!socket_lock(L, 1)) /* we cannot get a socket lock */
+  if (nu->idle)
+    return luaL_argerror(L, 1, "socket is idle in the connection pool");
+
+  if (!socket_lock(L, 1, true)) /* we cannot get a socket lock */
     return nse_yield(L, 0, connect); /* restart on continuation */
 
 #ifndef HAVE_OPENSSL
@@ -528,6 +616,16 @@ static int connect (lua_State *L, int status, lua_KContext ctx)
   nu->action = "PRECONNECT";
   nu->direction = TO;
 
+  /* Remember where a stream socket goes, so it may be reused from the idle
+   * pool. Sockets bound to a source address are never pooled. */
+  lua_getuservalue(L, 1);
+  if (what != UDP && nu->source_addr.ss_family == AF_UNSPEC)
+    push_pool_key(L, addr, targetname, port, op[what]);
+  else
+    lua_pushnil(L);
+  lua_rawseti(L, -2, POOL_KEY_I);
+  lua_pop(L, 1);
+
   switch (what)
   {
     case TCP:
@@ -619,6 +717,31 @@ static void receive_callback (nsock_pool nsp, nsock_event nse, void *udata)
     status(L, nse_status(nse)); /* will also restore the thread */
 }
 
+/* Appends the data read to nu->into, and restores the thread with true and
+ * the number of bytes read. */
+static void receive_into_callback (nsock_pool nsp, nsock_event nse, void *udata)
+{
+  nse_nsock_udata *nu = (nse_nsock_udata *) udata;
+  lua_State *L = nu->thread;
+  assert(lua_status(L) == LUA_YIELD);
+  if (nse_status(nse) == NSE_STATUS_SUCCESS)
+  {
+    int len;
+    const char *str = nse_readbuf(nse, &len);
+    trace(nse_iod(nse), hexify((const unsigned char *) str, len).c_str(), FROM);
+    nse_buffer_append(nu->into, str, len);
+    nu->into = NULL;
+    lua_pushboolean(L, true);
+    lua_pushinteger(L, len);
+    nse_restore(L, 2);
+  }
+  else
+  {
+    nu->into = NULL;
+    status(L, nse_status(nse)); /* will also restore the thread */
+  }
+}
+
 static int l_receive (lua_State *L)
 {
   nsock_pool nsp = get_pool(L);
@@ -648,6 +771,23 @@ static int l_receive_bytes (lua_State *L)
   return yield(L, nu, "RECEIVE BYTES", FROM, 0, NULL);
 }
 
+/* socket:receive_into(buffer) appends the data of one read to buffer and
+ * returns true and the number of bytes read. */
+static int l_receive_into (lua_State *L)
+{
+  nsock_pool nsp = get_pool(L);
+  nse_nsock_udata *nu = check_nsock_udata(L, 1, true);
+  NSOCK_UDATA_ENSURE_OPEN(L, nu);
+  nu->into = nse_buffer_check(L, 2); /* kept alive on the thread's stack */
+  nsock_read(nsp, nu->nsiod, receive_into_callback, nu->timeout, nu);
+  return yield(L, nu, "RECEIVE", FROM, 0, NULL);
+}
+
+/* Received data is appended to the socket's buffer and returned data dropped
+ * from its front, so each byte is copied a constant number of times however
+ * many reads or matches it takes. A plain string delimiter is searched for
+ * only in the data it could not have matched before; ctx is the length of
+ * the buffer already searched. */
 static int receive_buf (lua_State *L, int status, lua_KContext ctx)
 {
   nsock_pool nsp = get_pool(L);
@@ -661,55 +801,81 @@ static int receive_buf (lua_State *L, int status, lua_KContext ctx)
     lua_settop(L, 3); /* clear top */
     lua_getuservalue(L, 1); /* 4 */
     lua_rawgeti(L, 4, BUFFER_I); /* 5 */
+    if (lua_isnil(L, 5))
+    {
+      lua_pop(L, 1);
+      nse_buffer_new(L, NULL, 0);
+      lua_pushvalue(L, 5);
+      lua_rawseti(L, 4, BUFFER_I);
+    }
+    ctx = 0;
   } else {
     /* Here we are returning from nsock_read below.
-     * We have two extra values on the stack pushed by receive_callback.
+     * We have two extra values on the stack pushed by receive_into_callback.
      */
     assert(lua_gettop(L) == 7);
-    if (lua_toboolean(L, 6)) /* success? */
-    {
-      lua_replace(L, 6); /* remove boolean */
-      lua_concat(L, 2); /* concat BUFFER_I with received data */
-    }
-    else /* receive_callback encountered an error */
+    if (!lua_toboolean(L, 6)) /* receive_into_callback encountered an error */
       return 2;
+    lua_settop(L, 5);
   }
+  nse_buffer *buf = (nse_buffer *) lua_touserdata(L, 5);
+  size_t plen;
+  const char *p = lua_tolstring(L, 2, &plen);
 
-  if (lua_isfunction(L, 2))
+  if (p != NULL && nse_buffer_is_plain(p, plen))
   {
-    lua_pushvalue(L, 2);
-    lua_pushvalue(L, 5);
-    lua_call(L, 1, 2); /* we do not allow yields */
+    size_t init = (size_t) ctx > plen ? (size_t) ctx - plen + 1 : 0;
+    ptrdiff_t pos = nse_buffer_find(buf, init, p, plen);
+    if (pos >= 0)
+    {
+      lua_pushinteger(L, pos + 1);
+      lua_pushinteger(L, pos + (ptrdiff_t) plen);
+    }
+    else
+    {
+      lua_pushnil(L);
+      lua_pushnil(L);
+    }
   }
-  else /* string */
+  else
   {
-    lua_getglobal(L, "string");
-    lua_getfield(L, -1, "find");
-    lua_replace(L, -2);
-    lua_pushvalue(L, 5);
-    lua_pushvalue(L, 2);
-    lua_call(L, 2, 2); /* we do not allow yields */
+    if (lua_isfunction(L, 2))
+      lua_pushvalue(L, 2);
+    else /* string */
+    {
+      lua_getglobal(L, "string");
+      lua_getfield(L, -1, "find");
+      lua_replace(L, -2);
+    }
+    lua_pushlstring(L, buf->len > 0 ? buf->data + buf->start : "", buf->len);
+    if (lua_isfunction(L, 2))
+      lua_call(L, 1, 2); /* we do not allow yields */
+    else
+    {
+      lua_pushvalue(L, 2);
+      lua_call(L, 2, 2); /* we do not allow yields */
+    }
   }
 
   if (lua_isnumber(L, -2) && lua_isnumber(L, -1)) /* found end? */
   {
     lua_Integer l = lua_tointeger(L, -2), r = lua_tointeger(L, -1);
-    if (l > r || r > (lua_Integer) lua_rawlen(L, 5))
+    if (l > r || r > (lua_Integer) buf->len)
       return luaL_error(L, "invalid indices for match");
     lua_pushboolean(L, 1);
     if (lua_toboolean(L, 3))
-      lua_pushlstring(L, lua_tostring(L, 5), r);
+      lua_pushlstring(L, buf->data + buf->start, r);
     else
-      lua_pushlstring(L, lua_tostring(L, 5), l-1);
-    lua_pushlstring(L, lua_tostring(L, 5)+r, lua_rawlen(L, 5)-r);
-    lua_rawseti(L, 4, BUFFER_I);
+      lua_pushlstring(L, buf->data + buf->start, l-1);
+    nse_buffer_consume(buf, r);
     return 2;
   }
   else
   {
     lua_pop(L, 2); /* pop 2 results */
-    nsock_read(nsp, nu->nsiod, receive_callback, nu->timeout, nu);
-    return yield(L, nu, "RECEIVE BUF", FROM, 0, receive_buf);
+    nu->into = buf; /* kept alive in the socket's user value */
+    nsock_read(nsp, nu->nsiod, receive_into_callback, nu->timeout, nu);
+    return yield(L, nu, "RECEIVE BUF", FROM, buf->len, receive_buf);
   }
 }
 
@@ -874,9 +1040,7 @@ static void initialize (lua_State *L, int idx, nse_nsock_udata *nu,
   int proto, int af)
 {
 
-  lua_createtable(L, 2, 0); /* room for thread in array */
-  lua_pushliteral(L, "");
-  lua_rawseti(L, -2, BUFFER_I);
+  lua_createtable(L, 3, 0); /* room for thread, buffer and pool key */
   lua_setuservalue(L, idx);
   nu->nsiod = NULL;
   nu->proto = proto;
@@ -886,8 +1050,10 @@ static void initialize (lua_State *L, int idx, nse_nsock_udata *nu,
   nu->source_addrlen = sizeof(nu->source_addr);
   nu->timeout = DEFAULT_TIMEOUT;
   nu->is_pcap = 0;
+  nu->idle = 0;
   nu->thread = NULL;
   nu->direction = nu->action = NULL;
+  nu->into = NULL;
 }
 
 static int l_new (lua_State *L)
@@ -933,6 +1099,8 @@ static int l_close (lua_State *L)
   nse_nsock_udata *nu = check_nsock_udata(L, 1, false);
   if (nu->nsiod == NULL)
     return nseU_safeerror(L, "socket already closed");
+  if (nu->idle) /* the pool closes its own sockets */
+    return nseU_safeerror(L, "socket is idle in the connection pool");
   close_internal(L, nu);
   initialize(L, 1, nu, nu->proto, nu->af);
   return nseU_success(L);
@@ -941,12 +1109,202 @@ static int l_close (lua_State *L)
 static int nsock_gc (lua_State *L)
 {
   nse_nsock_udata *nu = check_nsock_udata(L, 1, false);
+  nu->idle = 0;
   if (nu->nsiod)
     return l_close(L);
   return 0;
 }
 
 
+/****************** IDLE CONNECTION POOL **************************************/
+
+/* Closes the idle socket at idx, which the caller removes from its array. */
+static void pool_discard (lua_State *L, int idx)
+{
+  nse_nsock_udata *nu = (nse_nsock_udata *) lua_touserdata(L, idx);
+
+  idx = lua_absindex(L, idx);
+  nu->idle = 0;
+  close_internal(L, nu);
+  initialize(L, idx, nu, nu->proto, nu->af);
+  pool_stats.idle--;
+}
+
+/* Closes the expired idle sockets, or all of them. */
+static void pool_sweep (lua_State *L, bool all)
+{
+  const struct timeval *now = nsock_gettimeofday();
+  int top = lua_gettop(L);
+
+  for (lua_pushnil(L); lua_next(L, IDLE_SOCKETS); lua_pop(L, 1))
+  {
+    int list = lua_gettop(L);
+    lua_Integer n = lua_rawlen(L, list), kept = 0;
+
+    for (lua_Integer i = 1; i <= n; i++)
+    {
+      lua_rawgeti(L, list, i);
+      nse_nsock_udata *nu = (nse_nsock_udata *) lua_touserdata(L, -1);
+      if (all || TIMEVAL_AFTER(*now, nu->idle_expire))
+      {
+        pool_discard(L, -1);
+        if (!all)
+          pool_stats.discards++;
+        lua_pop(L, 1);
+      }
+      else
+        lua_rawseti(L, list, ++kept);
+    }
+    for (lua_Integer i = kept + 1; i <= n; i++)
+    {
+      lua_pushnil(L);
+      lua_rawseti(L, list, i);
+    }
+    if (kept == 0) /* clearing a field during traversal is allowed */
+    {
+      lua_pushvalue(L, list - 1);
+      lua_pushnil(L);
+      lua_rawset(L, IDLE_SOCKETS);
+    }
+  }
+  lua_settop(L, top);
+}
+
+/* socket:checkin([idle_timeout]) hands a connected socket to the idle pool.
+ * The caller must not use the socket afterwards. A socket that may not be
+ * pooled, or does not fit, is closed instead. */
+static int l_checkin (lua_State *L)
+{
+  nse_nsock_udata *nu = check_nsock_udata(L, 1, false);
+  lua_Integer timeout = luaL_optinteger(L, 2, POOL_IDLE_TIMEOUT);
+  NSOCK_UDATA_ENSURE_OPEN(L, nu);
+
+  lua_settop(L, 1);
+  lua_getuservalue(L, 1); /* 2 */
+  lua_rawgeti(L, 2, POOL_KEY_I); /* 3 */
+  lua_rawgeti(L, 2, BUFFER_I); /* 4, data receive_buf has not returned */
+  if (lua_isnil(L, 3)
+      || (!lua_isnil(L, 4) && ((nse_buffer *) lua_touserdata(L, 4))->len > 0)
+      || timeout <= 0
+      || pool_stats.idle >= POOL_MAX_IDLE)
+  {
+    close_internal(L, nu);
+    initialize(L, 1, nu, nu->proto, nu->af);
+    return nseU_success(L);
+  }
+  if (timeout > POOL_MAX_IDLE_TIMEOUT)
+    timeout = POOL_MAX_IDLE_TIMEOUT;
+
+  /* The socket no longer belongs to any thread. */
+  for (lua_pushnil(L); lua_next(L, THREAD_SOCKETS); lua_pop(L, 1))
+  {
+    lua_pushvalue(L, 1);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+  }
+  lua_pushnil(L);
+  lua_rawseti(L, 2, THREAD_I);
+  nu->thread = NULL;
+
+  lua_pushvalue(L, 3);
+  lua_rawget(L, IDLE_SOCKETS); /* 5 */
+  if (!lua_istable(L, 5))
+  {
+    lua_pop(L, 1);
+    lua_createtable(L, POOL_MAX_PER_TARGET, 0);
+    lua_pushvalue(L, 3);
+    lua_pushvalue(L, 5);
+    lua_rawset(L, IDLE_SOCKETS);
+  }
+  lua_Integer n = lua_rawlen(L, 5);
+  if (n >= POOL_MAX_PER_TARGET)
+  {
+    /* Make room by closing the socket idle the longest. */
+    lua_rawgeti(L, 5, 1);
+    pool_discard(L, -1);
+    pool_stats.discards++;
+    lua_pop(L, 1);
+    for (lua_Integer i = 1; i < n; i++)
+    {
+      lua_rawgeti(L, 5, i + 1);
+      lua_rawseti(L, 5, i);
+    }
+    n--;
+  }
+  lua_pushvalue(L, 1);
+  lua_rawseti(L, 5, n + 1);
+
+  nu->idle = 1;
+  TIMEVAL_ADD(nu->idle_expire, *nsock_gettimeofday(), timeout * 1000);
+  pool_stats.idle++;
+  pool_stats.checkins++;
+  trace(nu->nsiod, "CHECKIN", TO);
+  return nseU_success(L);
+}
+
+/* nmap.socket.checkout(host, port[, protocol]) returns an idle socket
+ * connected to host and port with protocol ("tcp" or "ssl"), or nil if there
+ * is none the thread may use now. */
+static int l_checkout (lua_State *L)
+{
+  static const char * const op[] = {"tcp", "ssl", NULL};
+  const char *addr, *targetname; nseU_checktarget(L, 1, &addr, &targetname);
+  const char *default_proto = NULL;
+  unsigned short port = nseU_checkport(L, 2, &default_proto);
+  int what = luaL_checkoption(L, 3, "tcp", op);
+  int found = 0;
+
+  lua_settop(L, 3);
+  push_pool_key(L, addr, targetname, port, op[what]); /* 4 */
+  lua_pushvalue(L, 4);
+  lua_rawget(L, IDLE_SOCKETS); /* 5 */
+  if (!lua_istable(L, 5))
+    return 0;
+
+  for (lua_Integer n = lua_rawlen(L, 5); n > 0 && !found; n--)
+  {
+    lua_rawgeti(L, 5, n); /* 6 */
+    nse_nsock_udata *nu = (nse_nsock_udata *) lua_touserdata(L, 6);
+    if (TIMEVAL_AFTER(*nsock_gettimeofday(), nu->idle_expire))
+    {
+      pool_discard(L, 6);
+      pool_stats.discards++;
+      lua_pop(L, 1);
+    }
+    else if (socket_lock(L, 6, false))
+    {
+      nu->idle = 0;
+      nu->timeout = DEFAULT_TIMEOUT;
+      pool_stats.idle--;
+      pool_stats.reuses++;
+      trace(nu->nsiod, "CHECKOUT", FROM);
+      found = 1;
+    }
+    else /* the thread may not have another socket yet */
+    {
+      lua_pop(L, 1);
+      break;
+    }
+    lua_pushnil(L);
+    lua_rawseti(L, 5, n);
+  }
+  if (lua_rawlen(L, 5) == 0)
+  {
+    lua_pushvalue(L, 4);
+    lua_pushnil(L);
+    lua_rawset(L, IDLE_SOCKETS);
+  }
+  return found;
+}
+
+/* nmap.socket.pool_clear() closes all idle sockets. */
+static int l_pool_clear (lua_State *L)
+{
+  pool_sweep(L, true);
+  return 0;
+}
+
+
 /****************** PCAP_SOCKET ***********************************************/
 
 static void dnet_to_pcap_device_name (lua_State *L, const char *device)
@@ -1070,10 +1428,20 @@ static int l_get_stats (lua_State *L) {
   lua_newtable(L);
   int idx = lua_gettop(L);
 
-  /* the only field so far is
-     connect_waiting - number of threads waiting for connection */
+  /* connect_waiting - number of threads waiting for connection
+     pool_idle - number of idle sockets in the connection pool
+     pool_checkins, pool_reuses - sockets checked in and out of the pool
+     pool_discards - idle sockets closed on expiry or to make room */
   lua_pushinteger(L, nseU_tablen(L, CONNECT_WAITING));
   lua_setfield(L, idx, "connect_waiting");
+  lua_pushinteger(L, pool_stats.idle);
+  lua_setfield(L, idx, "pool_idle");
+  lua_pushinteger(L, pool_stats.checkins);
+  lua_setfield(L, idx, "pool_checkins");
+  lua_pushinteger(L, pool_stats.reuses);
+  lua_setfield(L, idx, "pool_reuses");
+  lua_pushinteger(L, pool_stats.discards);
+  lua_setfield(L, idx, "pool_discards");
 
   return 1;
 }
@@ -1082,6 +1450,7 @@ LUALIB_API int luaopen_nsock (lua_State *L)
 {
   static const luaL_Reg metatable_index[] = {
     {"bind", l_bind},
+    {"checkin", l_checkin},
     {"close", l_close},
     {"connect", l_connect},
     {"get_info", l_get_info},
@@ -1094,6 +1463,7 @@ LUALIB_API int luaopen_nsock (lua_State *L)
     {"receive", l_receive},
     {"receive_buf", l_receive_buf},
     {"receive_bytes", l_receive_bytes},
+    {"receive_into", l_receive_into},
     {"receive_lines", l_receive_lines},
     {"reconnect_ssl", l_reconnect_ssl},
     {"set_timeout", l_set_timeout},
@@ -1101,8 +1471,11 @@ LUALIB_API int luaopen_nsock (lua_State *L)
   };
 
   static const luaL_Reg l_nsock[] = {
+    {"checkout", l_checkout},
     {"loop", l_loop},
     {"new", l_new},
+    {"new_buffer", l_nse_buffer_new},
+    {"pool_clear", l_pool_clear},
     {"sleep", l_sleep},
     {"parse_ssl_certificate", l_parse_ssl_certificate},
     {"get_stats", l_get_stats},
@@ -1124,6 +1497,7 @@ LUALIB_API int luaopen_nsock (lua_State *L)
   nseU_weaktable(L, 0, MAX_PARALLELISM, "k"); /* THREAD_SOCKETS */
   nseU_weaktable(L, 0, 1000, "k"); /* CONNECT_WAITING */
   nseU_weaktable(L, 0, 0, "v"); /* KEY_PCAP */
+  lua_newtable(L); /* IDLE_SOCKETS */
   int nupvals = lua_gettop(L)-top;
 
   /* Create the nsock metatable for sockets */
@@ -1151,6 +1525,8 @@ LUALIB_API int luaopen_nsock (lua_State *L)
   nse_nsock_init_ssl_cert(L);
 #endif
 
+  nse_nsock_init_buffer(L);
+
 #if HAVE_OPENSSL
   /* Value speed over security in SSL connections. */
   nsock_pool_ssl_init(nsp, NSOCK_SSL_MAX_SPEED);
@@ -7,5 +7,15 @@ extern "C" {
 
 LUALIB_API int luaopen_nsock (lua_State *);
 
+/* Give the NSE Nsock pool its own IO engine in a forked script worker. */
+void nse_nsock_reinit_engine (void);
+
+/* End the running nsock_loop of the NSE pool, if any, so that NSE can resume
+ * a thread Nsock just restored. */
+void nse_nsock_loop_quit (void);
+
+/* The number of events pending in the NSE Nsock pool, for --telemetry. */
+int nse_nsock_events_pending (void);
+
 #endif
 
@@ -181,6 +181,18 @@ SSL *nse_nsock_get_ssl(lua_State *L);
    global table of certificate functions like digest. */
 static int ssl_cert_methods_index_ref = LUA_NOREF;
 
+/* This is a reference to a table of already parsed certificates, keyed by the
+   X509 pointer. A resumed TLS session hands out the same X509 as the session
+   it resumes, so scripts connecting again to a service get the certificate
+   without parsing it again. The cached objects are never handed out; each
+   caller gets a copy of the attribute tables, so a script that changes its
+   certificate does not change anyone else's. Every entry holds a reference
+   to its X509, which keeps the pointer from being reused. The table is
+   replaced when it holds SSL_CERT_CACHE_MAX entries. */
+#define SSL_CERT_CACHE_MAX 64
+static int ssl_cert_cache_ref = LUA_NOREF;
+static int ssl_cert_cache_count = 0;
+
 /* Calculate the digest of the certificate using the given algorithm. */
 static int ssl_cert_digest(lua_State *L)
 {
@@ -563,10 +575,33 @@ int l_parse_ssl_certificate(lua_State *L)
   return parse_ssl_cert(L, cert);
 }
 
+/* Pushes a copy of the table at index idx and of the tables in it. Keys,
+   other values and metatables are shared with the original. */
+static void copy_table(lua_State *L, int idx)
+{
+  idx = lua_absindex(L, idx);
+  lua_newtable(L);
+  lua_pushnil(L);
+  while (lua_next(L, idx) != 0) {
+    if (lua_type(L, -1) == LUA_TTABLE) {
+      copy_table(L, -1);
+      lua_replace(L, -2);
+    }
+    lua_pushvalue(L, -2);
+    lua_insert(L, -2);
+    lua_rawset(L, -4);
+  }
+  if (lua_getmetatable(L, idx))
+    lua_setmetatable(L, -2);
+}
+
 int l_get_ssl_certificate(lua_State *L)
 {
   SSL *ssl;
   X509 *cert;
+  struct cert_userdata *cached, *udata;
+
+  int n;
 
   ssl = nse_nsock_get_ssl(L);
   cert = SSL_get_peer_certificate(ssl);
@@ -574,7 +609,43 @@ int l_get_ssl_certificate(lua_State *L)
     lua_pushnil(L);
     return 1;
   }
-  return parse_ssl_cert(L, cert);
+
+  if (ssl_cert_cache_count >= SSL_CERT_CACHE_MAX) {
+    lua_newtable(L);
+    lua_rawseti(L, LUA_REGISTRYINDEX, ssl_cert_cache_ref);
+    ssl_cert_cache_count = 0;
+  }
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ssl_cert_cache_ref);
+  if (lua_rawgetp(L, -1, cert) == LUA_TNIL) {
+    lua_pop(L, 1);
+    /* The cached object takes a reference of its own. */
+#if HAVE_OPAQUE_STRUCTS
+    X509_up_ref(cert);
+#else
+    CRYPTO_add(&cert->references, 1, CRYPTO_LOCK_X509);
+#endif
+    n = parse_ssl_cert(L, cert);
+    if (n != 1) {
+      X509_free(cert);
+      return n;
+    }
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, -3, cert);
+    ssl_cert_cache_count++;
+  }
+  cached = (struct cert_userdata *) lua_touserdata(L, -1);
+
+  /* The copy owns the reference from SSL_get_peer_certificate. */
+  udata = (struct cert_userdata *) lua_newuserdata(L, sizeof(*udata));
+  udata->cert = cert;
+  lua_rawgeti(L, LUA_REGISTRYINDEX, cached->attributes_table);
+  copy_table(L, -1);
+  udata->attributes_table = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_pop(L, 1);
+  luaL_getmetatable(L, "SSL_CERT");
+  lua_setmetatable(L, -2);
+
+  return 1;
 }
 
 static int parse_ssl_cert(lua_State *L, X509 *cert)
@@ -718,4 +789,8 @@ void nse_nsock_init_ssl_cert(lua_State *L)
   luaL_setfuncs(L, ssl_cert_methods, 0);
   lua_setfield(L, -2, "__index");
   ssl_cert_methods_index_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+  lua_newtable(L);
+  ssl_cert_cache_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  ssl_cert_cache_count = 0;
 }
@@ -0,0 +1,770 @@
+
+/* Script workers: the script scan of a host group split among forked
+ * processes. See nse_workers.h. */
+
+#include "nse_workers.h"
+#include "nse_main.h"
+#include "nse_nsock.h"
+#include "nse_utility.h"
+
+#include "nmap.h"
+#include "nbase.h"
+#include "nmap_error.h"
+#include "NmapOps.h"
+#include "Target.h"
+#include "TargetGroup.h"
+#include "output.h"
+
+extern "C" {
+  #include "lauxlib.h"
+}
+
+#include <map>
+#include <string>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+extern NmapOps o;
+
+/* Journal record types */
+#define REC_HOST_OUTPUT  'H'
+#define REC_PORT_OUTPUT  'P'
+#define REC_PORT_STATE   'S'
+#define REC_PORT_VERSION 'V'
+#define REC_NEW_TARGET   'T'
+#define REC_REGISTRY     'R'
+
+/* Tags of serialized Lua values. Ordered tables are those made by
+ * stdnse.output_table(), whose key order matters for script output. */
+#define VAL_NIL     'n'
+#define VAL_BOOLEAN 'b'
+#define VAL_INTEGER 'i'
+#define VAL_FLOAT   'd'
+#define VAL_STRING  's'
+#define VAL_TABLE   't'
+#define VAL_ORDERED 'o'
+#define VAL_END     'e'
+
+/* Deeper tables are cut off rather than risking the C stack. */
+#define MAX_DEPTH 100
+
+static bool worker_active = false;
+static std::string journal;
+/* Position of the worker's hosts in its share of the host group */
+static std::map<const Target *, u32> worker_targets;
+
+bool nse_worker_active (void)
+{
+  return worker_active;
+}
+
+/* ---- Journal encoding ---- */
+
+static void put_u8 (std::string &b, u8 v)
+{
+  b.push_back((char) v);
+}
+
+static void put_u32 (std::string &b, u32 v)
+{
+  for (int i = 0; i < 4; i++)
+    put_u8(b, (v >> (8 * i)) & 0xFF);
+}
+
+static void put_u64 (std::string &b, u64 v)
+{
+  put_u32(b, (u32) v);
+  put_u32(b, (u32) (v >> 32));
+}
+
+static void put_bytes (std::string &b, const char *s, size_t len)
+{
+  put_u32(b, (u32) len);
+  b.append(s, len);
+}
+
+/* A string that may be NULL */
+static void put_str (std::string &b, const char *s)
+{
+  if (s == NULL) {
+    put_u8(b, 0);
+  } else {
+    put_u8(b, 1);
+    put_bytes(b, s, strlen(s));
+  }
+}
+
+static void put_target (std::string &b, const Target *target)
+{
+  std::map<const Target *, u32>::const_iterator it = worker_targets.find(target);
+
+  assert(it != worker_targets.end());
+  put_u32(b, it->second);
+}
+
+static bool is_key_type (int type)
+{
+  return type == LUA_TSTRING || type == LUA_TNUMBER || type == LUA_TBOOLEAN;
+}
+
+static bool is_value_type (int type)
+{
+  return type == LUA_TNIL || is_key_type(type) || type == LUA_TTABLE;
+}
+
+static void put_value (lua_State *L, std::string &b, int idx, int path, bool strict, int depth);
+
+static void put_pair (lua_State *L, std::string &b, int k, int v, int path, bool strict, int depth)
+{
+  if (!is_key_type(lua_type(L, k)) || (strict && !is_value_type(lua_type(L, v))))
+    return;
+  put_value(L, b, k, path, strict, depth);
+  put_value(L, b, v, path, strict, depth);
+}
+
+/* Serialize the value at idx. Tables already being serialized further up
+ * (listed in the table at path) are cycles and written as nil. Other types
+ * are dropped as nil in strict mode, or converted with tostring otherwise. */
+static void put_value (lua_State *L, std::string &b, int idx, int path, bool strict, int depth)
+{
+  idx = lua_absindex(L, idx);
+  luaL_checkstack(L, 8, "serializing script worker data");
+
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL:
+      put_u8(b, VAL_NIL);
+      break;
+    case LUA_TBOOLEAN:
+      put_u8(b, VAL_BOOLEAN);
+      put_u8(b, lua_toboolean(L, idx));
+      break;
+    case LUA_TNUMBER:
+      if (lua_isinteger(L, idx)) {
+        put_u8(b, VAL_INTEGER);
+        put_u64(b, (u64) lua_tointeger(L, idx));
+      } else {
+        lua_Number n = lua_tonumber(L, idx);
+        u64 bits;
+        memcpy(&bits, &n, sizeof(bits));
+        put_u8(b, VAL_FLOAT);
+        put_u64(b, bits);
+      }
+      break;
+    case LUA_TSTRING: {
+      size_t len;
+      const char *s = lua_tolstring(L, idx, &len);
+      put_u8(b, VAL_STRING);
+      put_bytes(b, s, len);
+      break;
+    }
+    case LUA_TTABLE:
+      lua_pushvalue(L, idx);
+      if (depth >= MAX_DEPTH || lua_rawget(L, path) != LUA_TNIL) {
+        lua_pop(L, 1);
+        put_u8(b, VAL_NIL);
+        break;
+      }
+      lua_pop(L, 1);
+      lua_pushvalue(L, idx);
+      lua_pushboolean(L, 1);
+      lua_rawset(L, path);
+
+      if (luaL_getmetafield(L, idx, "__pairs") != LUA_TNIL) {
+        /* Iterate in the order the table's __pairs gives */
+        put_u8(b, VAL_ORDERED);
+        lua_pushvalue(L, idx);
+        lua_call(L, 1, 3);
+        for (;;) {
+          lua_pushvalue(L, -3);
+          lua_pushvalue(L, -3);
+          lua_pushvalue(L, -3);
+          lua_call(L, 2, 2);
+          if (lua_isnil(L, -2)) {
+            lua_pop(L, 5);
+            break;
+          }
+          put_pair(L, b, -2, -1, path, strict, depth + 1);
+          lua_pop(L, 1);
+          lua_replace(L, -2);
+        }
+      } else {
+        put_u8(b, VAL_TABLE);
+        for (lua_pushnil(L); lua_next(L, idx); lua_pop(L, 1))
+          put_pair(L, b, -2, -1, path, strict, depth + 1);
+      }
+      put_u8(b, VAL_END);
+
+      lua_pushvalue(L, idx);
+      lua_pushnil(L);
+      lua_rawset(L, path);
+      break;
+    default:
+      if (strict) {
+        put_u8(b, VAL_NIL);
+      } else {
+        size_t len;
+        const char *s = luaL_tolstring(L, idx, &len);
+        put_u8(b, VAL_STRING);
+        put_bytes(b, s, len);
+        lua_pop(L, 1);
+      }
+      break;
+  }
+}
+
+static void put_lua_value (lua_State *L, std::string &b, int idx, bool strict)
+{
+  idx = lua_absindex(L, idx);
+  lua_newtable(L);
+  put_value(L, b, idx, lua_gettop(L), strict, 0);
+  lua_pop(L, 1);
+}
+
+/* ---- Recording, in the worker ---- */
+
+void nse_worker_record_output (lua_State *L, const Target *target,
+    const Port *port, const char *id, int tab, int str)
+{
+  size_t len;
+  const char *s;
+
+  put_u8(journal, port == NULL ? REC_HOST_OUTPUT : REC_PORT_OUTPUT);
+  put_target(journal, target);
+  if (port != NULL) {
+    put_u32(journal, port->portno);
+    put_u32(journal, port->proto);
+  }
+  put_bytes(journal, id, strlen(id));
+  put_lua_value(L, journal, tab, false);
+  if (lua_isnil(L, str)) {
+    put_u8(journal, 0);
+  } else {
+    s = lua_tolstring(L, str, &len);
+    put_u8(journal, 1);
+    put_bytes(journal, s, len);
+  }
+}
+
+void nse_worker_record_port_state (const Target *target, u16 portno,
+    int protocol, int state)
+{
+  put_u8(journal, REC_PORT_STATE);
+  put_target(journal, target);
+  put_u32(journal, portno);
+  put_u32(journal, protocol);
+  put_u32(journal, state);
+}
+
+void nse_worker_record_port_version (const Target *target, u16 portno,
+    int protocol, enum serviceprobestate sres, const char *sname,
+    enum service_tunnel_type tunnel, const char *product, const char *version,
+    const char *extrainfo, const char *hostname, const char *ostype,
+    const char *devicetype, const std::vector<const char *> *cpe,
+    const char *fingerprint)
+{
+  put_u8(journal, REC_PORT_VERSION);
+  put_target(journal, target);
+  put_u32(journal, portno);
+  put_u32(journal, protocol);
+  put_u32(journal, sres);
+  put_str(journal, sname);
+  put_u32(journal, tunnel);
+  put_str(journal, product);
+  put_str(journal, version);
+  put_str(journal, extrainfo);
+  put_str(journal, hostname);
+  put_str(journal, ostype);
+  put_str(journal, devicetype);
+  put_u32(journal, cpe != NULL ? cpe->size() : 0);
+  if (cpe != NULL) {
+    for (size_t i = 0; i < cpe->size(); i++)
+      put_str(journal, (*cpe)[i]);
+  }
+  put_str(journal, fingerprint);
+}
+
+void nse_worker_record_new_target (const char *target)
+{
+  put_u8(journal, REC_NEW_TARGET);
+  put_str(journal, target);
+}
+
+/* ---- Replay, in the main process ---- */
+
+struct journal_reader {
+  const std::string *buf;
+  size_t pos;
+  lua_State *L;
+};
+
+static void reader_error (journal_reader *r)
+{
+  luaL_error(r->L, "truncated or corrupt worker journal at byte %d", (int) r->pos);
+}
+
+static u8 get_u8 (journal_reader *r)
+{
+  if (r->pos >= r->buf->size())
+    reader_error(r);
+  return (u8) (*r->buf)[r->pos++];
+}
+
+static u32 get_u32 (journal_reader *r)
+{
+  u32 v = 0;
+
+  for (int i = 0; i < 4; i++)
+    v |= (u32) get_u8(r) << (8 * i);
+  return v;
+}
+
+static u64 get_u64 (journal_reader *r)
+{
+  u64 lo = get_u32(r);
+  u64 hi = get_u32(r);
+
+  return lo | (hi << 32);
+}
+
+static std::string get_bytes (journal_reader *r)
+{
+  u32 len = get_u32(r);
+  std::string s;
+
+  if (len > r->buf->size() - r->pos)
+    reader_error(r);
+  s = r->buf->substr(r->pos, len);
+  r->pos += len;
+  return s;
+}
+
+/* Strings that may be NULL are kept in strs, and a pointer to the copy or NULL
+ * is returned. */
+static const char *get_str (journal_reader *r, std::vector<std::string> &strs, size_t i)
+{
+  if (!get_u8(r))
+    return NULL;
+  strs[i] = get_bytes(r);
+  return strs[i].c_str();
+}
+
+static void push_output_table (lua_State *L)
+{
+  lua_getglobal(L, "require");
+  lua_pushliteral(L, "stdnse");
+  lua_call(L, 1, 1);
+  lua_getfield(L, -1, "output_table");
+  lua_call(L, 0, 1);
+  lua_remove(L, -2);
+}
+
+/* Push the next serialized value */
+static void get_value (journal_reader *r, int depth)
+{
+  lua_State *L = r->L;
+  u8 tag = get_u8(r);
+
+  luaL_checkstack(L, 4, "reading script worker data");
+  switch (tag) {
+    case VAL_NIL:
+      lua_pushnil(L);
+      break;
+    case VAL_BOOLEAN:
+      lua_pushboolean(L, get_u8(r));
+      break;
+    case VAL_INTEGER:
+      lua_pushinteger(L, (lua_Integer) get_u64(r));
+      break;
+    case VAL_FLOAT: {
+      u64 bits = get_u64(r);
+      lua_Number n;
+      memcpy(&n, &bits, sizeof(n));
+      lua_pushnumber(L, n);
+      break;
+    }
+    case VAL_STRING: {
+      std::string s = get_bytes(r);
+      lua_pushlstring(L, s.data(), s.size());
+      break;
+    }
+    case VAL_TABLE:
+    case VAL_ORDERED:
+      if (depth > MAX_DEPTH)
+        reader_error(r);
+      if (tag == VAL_ORDERED)
+        push_output_table(L);
+      else
+        lua_newtable(L);
+      while (r->pos < r->buf->size() && (*r->buf)[r->pos] != VAL_END) {
+        get_value(r, depth + 1);
+        get_value(r, depth + 1);
+        if (lua_isnil(L, -2))
+          lua_pop(L, 2);
+        else
+          lua_settable(L, -3);
+      }
+      get_u8(r); /* VAL_END */
+      break;
+    default:
+      reader_error(r);
+  }
+}
+
+/* Record in bases that the table at idx, and the tables in it, did not exist
+ * before the workers ran. */
+static void mark_new_tables (lua_State *L, int idx, int bases, int depth)
+{
+  idx = lua_absindex(L, idx);
+  if (depth > MAX_DEPTH)
+    return;
+  luaL_checkstack(L, 4, "merging script worker registry");
+  lua_pushvalue(L, idx);
+  lua_pushinteger(L, 0);
+  lua_rawset(L, bases);
+  for (lua_pushnil(L); lua_next(L, idx); lua_pop(L, 1)) {
+    if (lua_istable(L, -1))
+      mark_new_tables(L, -1, bases, depth + 1);
+  }
+}
+
+static void merge_table (lua_State *L, int dst, int src, int bases, int depth);
+
+/* dst[key] = value, merging tables into tables */
+static void merge_value (lua_State *L, int dst, int key, int value, int bases, int depth)
+{
+  key = lua_absindex(L, key);
+  value = lua_absindex(L, value);
+  lua_pushvalue(L, key);
+  if (lua_rawget(L, dst) == LUA_TTABLE && lua_istable(L, value)) {
+    merge_table(L, lua_gettop(L), value, bases, depth + 1);
+  } else {
+    if (lua_istable(L, value))
+      mark_new_tables(L, value, bases, depth + 1);
+    lua_pushvalue(L, key);
+    lua_pushvalue(L, value);
+    lua_rawset(L, dst);
+  }
+  lua_pop(L, 1);
+}
+
+/* Merge a worker's copy src of a table into dst. Array entries past the length
+ * dst had before any worker was merged (kept in bases) were appended by the
+ * worker, and are appended to dst in turn. */
+static void merge_table (lua_State *L, int dst, int src, int bases, int depth)
+{
+  lua_Integer base, n, i;
+
+  dst = lua_absindex(L, dst);
+  src = lua_absindex(L, src);
+  if (depth > MAX_DEPTH)
+    return;
+  luaL_checkstack(L, 8, "merging script worker registry");
+
+  lua_pushvalue(L, dst);
+  if (lua_rawget(L, bases) == LUA_TNUMBER) {
+    base = lua_tointeger(L, -1);
+  } else {
+    base = lua_rawlen(L, dst);
+    lua_pushvalue(L, dst);
+    lua_pushinteger(L, base);
+    lua_rawset(L, bases);
+  }
+  lua_pop(L, 1);
+
+  n = lua_rawlen(L, src);
+  for (i = 1; i <= n; i++) {
+    lua_pushinteger(L, i);
+    lua_rawgeti(L, src, i);
+    if (i <= base) {
+      merge_value(L, dst, -2, -1, bases, depth);
+    } else {
+      if (lua_istable(L, -1))
+        mark_new_tables(L, -1, bases, depth + 1);
+      lua_pushvalue(L, -1);
+      lua_rawseti(L, dst, lua_rawlen(L, dst) + 1);
+    }
+    lua_pop(L, 2);
+  }
+
+  for (lua_pushnil(L); lua_next(L, src); lua_pop(L, 1)) {
+    if (lua_isinteger(L, -2)) {
+      lua_Integer k = lua_tointeger(L, -2);
+      if (k >= 1 && k <= n)
+        continue;
+    }
+    merge_value(L, dst, -2, -1, bases, depth);
+  }
+}
+
+static void push_registry (lua_State *L)
+{
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, "_LOADED");
+  lua_getfield(L, -1, "nmap");
+  lua_getfield(L, -1, "registry");
+  lua_replace(L, -3);
+  lua_pop(L, 1);
+}
+
+/* Set up the script result read from the journal: id, output value and
+ * optional output string. */
+static void get_result (journal_reader *r, ScriptResult &sr)
+{
+  std::string id = get_bytes(r);
+
+  sr.set_id(id.c_str());
+  get_value(r, 0);
+  sr.set_output_tab(r->L, -1);
+  lua_pop(r->L, 1);
+  if (get_u8(r)) {
+    std::string out = get_bytes(r);
+    sr.set_output_str(out.data(), out.size());
+  }
+}
+
+/* Applies one worker's journal: L is the main NSE state, upvalues are the
+ * journal, the worker's targets and the registry merge bases. */
+static int replay (lua_State *L)
+{
+  const std::string *buf = (const std::string *) lua_touserdata(L, 1);
+  std::vector<Target *> *targets = (std::vector<Target *> *) lua_touserdata(L, 2);
+  int bases = 3;
+  journal_reader r;
+
+  r.buf = buf;
+  r.pos = 0;
+  r.L = L;
+
+  while (r.pos < buf->size()) {
+    u8 type = get_u8(&r);
+    Target *target = NULL;
+    u16 portno = 0;
+    int proto = 0;
+
+    if (type != REC_NEW_TARGET && type != REC_REGISTRY) {
+      u32 idx = get_u32(&r);
+      if (idx >= targets->size())
+        reader_error(&r);
+      target = (*targets)[idx];
+    }
+    if (type == REC_PORT_OUTPUT || type == REC_PORT_STATE || type == REC_PORT_VERSION) {
+      portno = (u16) get_u32(&r);
+      proto = (int) get_u32(&r);
+    }
+
+    switch (type) {
+      case REC_HOST_OUTPUT: {
+        ScriptResult sr;
+        get_result(&r, sr);
+        target->scriptResults.push_back(sr);
+        break;
+      }
+      case REC_PORT_OUTPUT: {
+        ScriptResult sr;
+        get_result(&r, sr);
+        target->ports.addScriptResult(portno, proto, sr);
+        target->ports.numscriptresults++;
+        break;
+      }
+      case REC_PORT_STATE:
+        target->ports.setPortState(portno, proto, (int) get_u32(&r));
+        target->ports.setStateReason(portno, proto, ER_SCRIPT, 0, NULL);
+        break;
+      case REC_PORT_VERSION: {
+        std::vector<std::string> strs(8);
+        enum serviceprobestate sres = (enum serviceprobestate) get_u32(&r);
+        const char *sname = get_str(&r, strs, 0);
+        enum service_tunnel_type tunnel = (enum service_tunnel_type) get_u32(&r);
+        const char *product = get_str(&r, strs, 1);
+        const char *version = get_str(&r, strs, 2);
+        const char *extrainfo = get_str(&r, strs, 3);
+        const char *hostname = get_str(&r, strs, 4);
+        const char *ostype = get_str(&r, strs, 5);
+        const char *devicetype = get_str(&r, strs, 6);
+        u32 ncpe = get_u32(&r);
+        std::vector<std::string> cpestrs(ncpe);
+        std::vector<const char *> cpe;
+        for (u32 i = 0; i < ncpe; i++) {
+          const char *c = get_str(&r, cpestrs, i);
+          if (c != NULL)
+            cpe.push_back(c);
+        }
+        const char *fingerprint = get_str(&r, strs, 7);
+        target->ports.setServiceProbeResults(portno, proto, sres, sname,
+            tunnel, product, version, extrainfo, hostname, ostype, devicetype,
+            cpe.size() > 0 ? &cpe : NULL, fingerprint);
+        break;
+      }
+      case REC_NEW_TARGET: {
+        std::vector<std::string> strs(1);
+        const char *name = get_str(&r, strs, 0);
+        if (name != NULL)
+          NewTargets::insert(name);
+        break;
+      }
+      case REC_REGISTRY:
+        get_value(&r, 0);
+        push_registry(L);
+        if (lua_istable(L, -1) && lua_istable(L, -2))
+          merge_table(L, -1, -2, bases, 0);
+        lua_pop(L, 2);
+        break;
+      default:
+        reader_error(&r);
+    }
+  }
+
+  return 0;
+}
+
+/* ---- Workers ---- */
+
+#ifndef WIN32
+static void write_all (int fd, const std::string &buf)
+{
+  size_t off = 0;
+
+  while (off < buf.size()) {
+    ssize_t n = write(fd, buf.data() + off, buf.size() - off);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      pfatal("%s: failed to send script worker results", SCRIPT_ENGINE);
+    }
+    off += n;
+  }
+}
+
+static void read_all (int fd, std::string &buf)
+{
+  char chunk[65536];
+
+  for (;;) {
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      pfatal("%s: failed to read script worker results", SCRIPT_ENGINE);
+    }
+    if (n == 0)
+      break;
+    buf.append(chunk, n);
+  }
+}
+
+static void worker_main (lua_State *L, std::vector<Target *> &targets,
+    int fd, unsigned int seed, void (*scan)(std::vector<Target *> &))
+{
+  worker_active = true;
+  for (size_t i = 0; i < targets.size(); i++)
+    worker_targets[targets[i]] = i;
+
+  /* Workers would otherwise share the random sequence of math.random and
+   * compete for key presses. */
+  srand(seed);
+  o.noninteractive = true;
+  nse_nsock_reinit_engine();
+
+  scan(targets);
+
+  put_u8(journal, REC_REGISTRY);
+  push_registry(L);
+  put_lua_value(L, journal, -1, true);
+  lua_pop(L, 1);
+
+  write_all(fd, journal);
+  close(fd);
+  log_flush_all();
+  _exit(0);
+}
+#endif
+
+void nse_workers_scan (lua_State *L, std::vector<Target *> &targets,
+    int nworkers, void (*scan)(std::vector<Target *> &))
+{
+#ifdef WIN32
+  scan(targets);
+#else
+  std::vector<std::vector<Target *> > shares;
+  std::vector<std::string> journals;
+  std::vector<pid_t> pids;
+  std::vector<int> fds;
+  int i;
+
+  if (nworkers > (int) targets.size())
+    nworkers = targets.size();
+  shares.resize(nworkers);
+  journals.resize(nworkers);
+  pids.resize(nworkers);
+  fds.resize(nworkers);
+
+  /* Deal out hosts in turn, which spreads out neighbours that often run the
+   * same services. */
+  for (size_t t = 0; t < targets.size(); t++)
+    shares[t % nworkers].push_back(targets[t]);
+
+  if (o.debugging)
+    log_write(LOG_STDOUT, "%s: Script scanning %u hosts in %d workers.\n",
+              SCRIPT_ENGINE, (unsigned int) targets.size(), nworkers);
+
+  /* Don't let workers inherit and write out buffered output again */
+  log_flush_all();
+
+  for (i = 0; i < nworkers; i++) {
+    unsigned int seed = get_random_uint();
+    int pfd[2];
+
+    if (pipe(pfd) == -1)
+      pfatal("%s: failed to create a pipe for a script worker", SCRIPT_ENGINE);
+    pids[i] = fork();
+    if (pids[i] == -1)
+      pfatal("%s: failed to start a script worker", SCRIPT_ENGINE);
+    if (pids[i] == 0) {
+      close(pfd[0]);
+      for (int j = 0; j < i; j++)
+        close(fds[j]);
+      worker_main(L, shares[i], pfd[1], seed, scan);
+    }
+    close(pfd[1]);
+    fds[i] = pfd[0];
+  }
+
+  for (i = 0; i < nworkers; i++) {
+    int status;
+
+    read_all(fds[i], journals[i]);
+    close(fds[i]);
+    while (waitpid(pids[i], &status, 0) == -1) {
+      if (errno != EINTR)
+        pfatal("%s: failed to wait for a script worker", SCRIPT_ENGINE);
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      error("%s: Script worker %d failed; its %u hosts were not script scanned.",
+            SCRIPT_ENGINE, i, (unsigned int) shares[i].size());
+      journals[i].clear();
+    }
+  }
+
+  /* Apply the journals in worker order, so that results and registry merges
+   * don't depend on which worker finished first. */
+  lua_settop(L, 0);
+  lua_newtable(L); /* registry merge bases, shared by all workers */
+  for (i = 0; i < nworkers; i++) {
+    lua_pushcfunction(L, nseU_traceback);
+    lua_pushcfunction(L, replay);
+    lua_pushlightuserdata(L, &journals[i]);
+    lua_pushlightuserdata(L, &shares[i]);
+    lua_pushvalue(L, 1);
+    if (lua_pcall(L, 3, 0, 2) != 0) {
+      error("%s: Failed to apply the results of script worker %d: %s",
+            SCRIPT_ENGINE, i, lua_tostring(L, -1));
+      lua_pop(L, 1);
+    }
+    lua_settop(L, 1);
+  }
+  lua_settop(L, 0);
+#endif
+}
@@ -0,0 +1,55 @@
+#ifndef NMAP_NSE_WORKERS_H
+#define NMAP_NSE_WORKERS_H
+
+#include <vector>
+
+extern "C" {
+  #include "lua.h"
+}
+
+#include "portlist.h"
+
+class Target;
+
+/* Script workers (--script-workers) run the script scan of a host group in
+ * forked processes, each taking every Nth host of the group. Whatever a worker
+ * does that must outlive it (script output, port states and versions, new
+ * targets, the registry) is recorded in a journal that the main process
+ * replays once the worker is done. */
+
+/* bool nse_worker_active (void)
+ *
+ * Returns true in a worker process, where the functions below record their
+ * arguments to be replayed by the main process.
+ */
+bool nse_worker_active (void);
+
+/* Output of a host or port script. The output table and string are at index
+ * tab and str of L; str may refer to nil. port is NULL for host scripts. */
+void nse_worker_record_output (lua_State *L, const Target *target,
+    const Port *port, const char *id, int tab, int str);
+
+void nse_worker_record_port_state (const Target *target, u16 portno,
+    int protocol, int state);
+
+/* Mirrors PortList::setServiceProbeResults. */
+void nse_worker_record_port_version (const Target *target, u16 portno,
+    int protocol, enum serviceprobestate sres, const char *sname,
+    enum service_tunnel_type tunnel, const char *product, const char *version,
+    const char *extrainfo, const char *hostname, const char *ostype,
+    const char *devicetype, const std::vector<const char *> *cpe,
+    const char *fingerprint);
+
+void nse_worker_record_new_target (const char *target);
+
+/* void nse_workers_scan (lua_State *L, std::vector<Target *> &targets,
+ *                        int nworkers, void (*scan)(std::vector<Target *> &))
+ *
+ * Splits targets among nworkers processes which each call scan on their
+ * share, then applies their journals to targets and to the state L in worker
+ * order.
+ */
+void nse_workers_scan (lua_State *L, std::vector<Target *> &targets,
+    int nworkers, void (*scan)(std::vector<Target *> &));
+
+#endif
@@ -19,12 +19,37 @@
 
 local bin = require "bin"
 local bit = require "bit"
+local codec = require "codec"
 local math = require "math"
 local stdnse = require "stdnse"
 local string = require "string"
 local table = require "table"
 _ENV = stdnse.module("asn1", stdnse.seeall)
 
+local der_header = codec.der_header
+local der_length = codec.der_length
+
+---
+-- Makes the decoders use the codec library (the default) or their Lua code to
+-- read identifiers and lengths. This is for tests and benchmarks.
+-- @param enable <code>false</code> to use the Lua code.
+function use_codec(enable)
+  if enable == false then
+    -- The Lua code reads what the codec functions return nil for.
+    der_header = function() return nil end
+    der_length = der_header
+  else
+    der_header = codec.der_header
+    der_length = codec.der_length
+  end
+end
+
+-- Identifier octets as the hex strings that index the decoder table.
+local tag_hex = {}
+for i = 0, 255 do
+  tag_hex[i] = string.format("%02X", i)
+end
+
 BERCLASS = {
   Universal = 0,
   Application = 64,
@@ -76,6 +101,9 @@ ASN1Decoder = {
 
     -- Octet String
     self.decoder["04"] = function( self, encStr, elen, pos )
+      if pos + elen - 1 <= #encStr then
+        return pos + elen, encStr:sub(pos, pos + elen - 1)
+      end
       return bin.unpack("A" .. elen, encStr, pos)
     end
 
@@ -133,11 +161,14 @@ ASN1Decoder = {
   -- @return The decoded value(s).
   decode = function(self, encStr, pos)
 
-    local etype, elen
-    local newpos = pos
-
-    newpos, etype = bin.unpack("H1", encStr, newpos)
-    newpos, elen = self.decodeLength(encStr, newpos)
+    local etype, elen, newpos
+    etype, elen, newpos = der_header(encStr, pos)
+    if etype then
+      etype = tag_hex[etype]
+    else
+      newpos, etype = bin.unpack("H1", encStr, pos)
+      newpos, elen = self.decodeLength(encStr, newpos)
+    end
 
     if self.decoder[etype] then
       return self.decoder[etype]( self, encStr, elen, newpos )
@@ -156,7 +187,11 @@ ASN1Decoder = {
   -- @return The position after decoding.
   -- @return The length of the following value.
   decodeLength = function(encStr, pos)
-    local elen
+    local elen, newpos = der_length(encStr, pos)
+    if elen then
+      return newpos, elen
+    end
+    -- Truncated and indefinite lengths
     pos, elen = bin.unpack('C', encStr, pos)
     if (elen > 128) then
       elen = elen - 128
@@ -184,7 +219,11 @@ ASN1Decoder = {
     local seq = {}
     local sPos = 1
     local sStr
-    pos, sStr = bin.unpack("A" .. len, encStr, pos)
+    if pos + len - 1 <= #encStr then
+      pos, sStr = pos + len, encStr:sub(pos, pos + len - 1)
+    else
+      pos, sStr = bin.unpack("A" .. len, encStr, pos)
+    end
     while (sPos < len) do
       local newSeq
       sPos, newSeq = self:decode(sStr, sPos)
@@ -204,7 +243,8 @@ ASN1Decoder = {
     local n = 0
 
     repeat
-      pos, octet = bin.unpack("C", encStr, pos)
+      octet = string.byte(encStr, pos)
+      pos = pos + 1
       n = n * 128 + bit.band(0x7F, octet)
     until octet < 128
 
@@ -226,7 +266,8 @@ ASN1Decoder = {
     last = pos + len - 1
     if pos <= last then
       oid._snmp = '06'
-      pos, octet = bin.unpack("C", encStr, pos)
+      octet = string.byte(encStr, pos)
+      pos = pos + 1
       oid[2] = math.fmod(octet, 40)
       octet = octet - oid[2]
       oid[1] = octet/40
@@ -250,9 +291,14 @@ ASN1Decoder = {
   -- @return The position after decoding.
   -- @return The decoded integer.
   decodeInt = function(encStr, len, pos)
-    local hexStr
-    pos, hexStr = bin.unpack("H" .. len, encStr, pos)
-    local value = tonumber(hexStr, 16)
+    local value
+    if len >= 1 and len <= 8 and pos + len - 1 <= #encStr then
+      value, pos = string.unpack(">I" .. len, encStr, pos)
+    else
+      local hexStr
+      pos, hexStr = bin.unpack("H" .. len, encStr, pos)
+      value = tonumber(hexStr, 16)
+    end
     if (value >= (256^len)/2) then
       value = value - 256^len
     end
@@ -6,9 +6,10 @@
 -- a number of working threads and increasing that number gradually until
 -- brute.threads limit is reached. The starting number of threads can be set
 -- with brute.start argument, it defaults to 5. The brute.threads argument
--- defaults to 20. It is worth noticing that the number of working threads
--- will grow exponentially until any error occurs, after that the engine
--- will switch to linear growth.
+-- defaults to 20. The number of working threads is a congestion window, as
+-- used by Nmap's port scanner: it grows exponentially until any error occurs,
+-- after that the engine will switch to linear growth. Errors halve it, and it
+-- shrinks slowly while guesses take much longer than the fastest ones did.
 --
 -- The library contains the following classes:
 -- * <code>Engine</code>
@@ -304,6 +305,9 @@ local unpwdb = require "unpwdb"
 local math = require "math"
 _ENV = stdnse.module("brute", stdnse.seeall)
 
+-- Credential files read by Iterators.credfile_iterator, by file name
+local credfiles = {}
+
 -- Engine options that can be set by scripts
 -- Supported options are:
 --   * firstonly     - stop after finding the first correct password
@@ -500,65 +504,75 @@ Error = {
   end,
 }
 
--- Auxillary data structure
-Batch = {
-  new = function (self, lim, stime)
+-- The number of worker threads of an Engine, kept as a congestion window
+-- following ultra_timing_vals in timing.cc. The window grows by a thread for
+-- every guess in slow start and by a thread per window's worth of guesses in
+-- congestion avoidance. An error halves it and ends slow start. While guesses
+-- take several times longer than the fastest one seen, the service is
+-- queueing them rather than handling them in parallel, and the window shrinks
+-- by a thread per window's worth of guesses instead.
+Window = {
+  -- Guesses slower than this many times the fastest count as queued
+  LATENCY_FACTOR = 2,
+  -- ...and only if they are this many milliseconds slower
+  LATENCY_SLACK = 100,
+
+  new = function (self, low, initial, max)
     local o = {
-      limit = lim or 3, -- maximum number of items
-      full = false,
-      data = {}, -- storage
-      size = 0, -- current number of items
-      start_time = stime or 0,
+      low = low,
+      max = max,
+      cwnd = math.max(low, math.min(initial, max)),
+      ssthresh = max,
+      srtt = nil, -- smoothed guess time, in milliseconds
+      min_rtt = nil,
+      last_drop = nil,
     }
     setmetatable(o, self)
     self.__index = self
     return o
   end,
 
-  --- Adds new item to the vault (if possible)
+  --- Updates the window for a finished guess
   --
-  -- @param obj, new object
-  -- @return true if insert is successful, false if the vault is full
-  add = function (self, obj)
-    if self.size < self.limit then
-      self.data[self.size + 1] = obj
-      self.size = self.size + 1
-      return true
+  -- @param rtt number of milliseconds the guess took
+  ack = function (self, rtt)
+    self.min_rtt = math.min(self.min_rtt or rtt, rtt)
+    self.srtt = self.srtt and self.srtt + (rtt - self.srtt) / 8 or rtt
+    if self.srtt > math.max(self.min_rtt * self.LATENCY_FACTOR,
+        self.min_rtt + self.LATENCY_SLACK) then
+      self.ssthresh = math.min(self.ssthresh, math.max(self:size(), 2))
+      self.cwnd = math.max(self.low, self.cwnd - 1 / self.cwnd)
+      return
     end
-
-    return false
-  end,
-
-  isFull = function (self)
-    if self.size >= self.limit then
-      return true
+    if self.cwnd < self.ssthresh then
+      self.cwnd = math.min(self.cwnd + 1, self.ssthresh)
+    else
+      self.cwnd = self.cwnd + 1 / self.cwnd
     end
-
-    return false
+    self.cwnd = math.min(self.cwnd, self.max)
   end,
 
-  getData = function (self)
-    return self.data
-  end,
-
-  getSize = function (self)
-    return self.size
-  end,
-
-  getStartTime = function (self)
-    return self.start_time
-  end,
-
-  getLimit = function (self)
-    return self.limit
+  --- Updates the window for an error
+  --
+  -- Errors from one overload of the service reach the engine from several
+  -- threads, so the window is cut at most once per guess time.
+  -- @param in_flight number of running threads
+  drop = function (self, in_flight)
+    local now = nmap.clock_ms()
+    if self.last_drop and now - self.last_drop < (self.srtt or 0) then
+      return
+    end
+    self.cwnd = math.max(self.low, self.cwnd / 2)
+    self.ssthresh = math.max(math.floor(in_flight / 2), 2)
+    self.last_drop = now
   end,
 
-  setLimit = function (self, lim)
-    self.limit = lim
+  --- Returns the number of threads the window allows
+  size = function (self)
+    return math.floor(self.cwnd)
   end,
 }
 
-
 -- The brute engine, doing all the nasty work
 Engine = {
   STAT_INTERVAL = 20,
@@ -600,8 +614,7 @@ Engine = {
 
       retry_accounts = {},
       initial_accounts_exhausted = false,
-      batch = nil,
-      tick = 0,
+      window = nil,
     }
     setmetatable(o, self)
     self.__index = self
@@ -671,8 +684,13 @@ Engine = {
         -- makes sure the credentials have not been tested before
         self.used_creds = self.used_creds or {}
         pass = pass or "nil"
-        if not self.used_creds[user .. pass] then
-          self.used_creds[user .. pass] = true
+        local used = self.used_creds[user]
+        if not used then
+          used = {}
+          self.used_creds[user] = used
+        end
+        if not used[pass] then
+          used[pass] = true
           coroutine.yield(user, pass)
         end
       end
@@ -790,21 +808,14 @@ Engine = {
         break
       end
 
-      -- Updtae tick and add this thread to the batch
-      self.tick = self.tick + 1
-
-      if not (self.batch:isFull()) and not thread_data.in_batch then
-        self.batch:add(coroutine.running())
-
-        thread_data.in_batch = true
-        thread_data.ready = false
-      end
-
       -- We expect doAuthenticate to pass the report variable received from the script
+      local guess_start = nmap.clock_ms()
+      thread_data.guess_error = nil
       local status, response, ret_creds = self:doAuthenticate()
 
-      if thread_data.in_batch then
-        thread_data.ready = true
+      -- Only guesses that were made and had no errors are timed
+      if (status or response) and not (ret_creds or thread_data.guess_error) then
+        self.window:ack(nmap.clock_ms() - guess_start)
       end
 
       if status then
@@ -890,9 +901,6 @@ Engine = {
     self.threads[co] = {
       running = true,
       protocol_error = nil,
-      attempt = 0,
-      in_batch = false,
-      ready = false,
 
       connection_error = nil,
       con_error_reason = nil,
@@ -910,43 +918,36 @@ Engine = {
     end
   end,
 
-  renewBatch = function (self)
-    if self.batch then
-      local size = self.batch:getSize()
-      local data = self.batch:getData()
-
-      for i = 1, size do
-        if self.threads[data[i]] then
-          self.threads[data[i]].in_batch = false
-          self.threads[data[i]].ready = false
-        end
+  --- Returns the number of threads that have not been told to terminate
+  --
+  -- @return count number of non-dead, non-terminating threads
+  runningThreads = function (self)
+    local count = 0
+    for thread, v in pairs(self.threads) do
+      if not v.terminate and coroutine.status(thread) ~= "dead" then
+        count = count + 1
       end
     end
-
-    self.batch = Batch:new(math.min(self:threadCount(), 3), self.tick)
+    return count
   end,
 
-  readyBatch = function (self)
-    if not self.batch then
-      return false
-    end
-
-    local n = self.batch:getSize()
-    local data = self.batch:getData()
-
-    if n == 0 then
-      return false
-    end
-
-    for i = 1, n do
-      if self.threads[data[i]] and coroutine.status(data[i]) ~= "dead" and self.threads[data[i]].in_batch then
-        if not self.threads[data[i]].ready then
-          return false
+  --- Tells n threads to finish their current guess and terminate, preferring
+  -- threads that have just had errors
+  --
+  -- @param n number of threads to terminate
+  terminateWorkerN = function (self, n)
+    for pass = 1, 2 do
+      for co, v in pairs(self.threads) do
+        if n <= 0 then
+          return
+        end
+        if not v.terminate and coroutine.status(co) ~= "dead"
+          and (pass == 2 or v.had_error) then
+          v.terminate = true
+          n = n - 1
         end
       end
     end
-
-    return true
   end,
 
   --- Starts the brute-force
@@ -1010,12 +1011,10 @@ Engine = {
         return false, "No credential file specified (see brute.credfile)"
       end
 
-      local f = io.open(credfile, "r")
-      if not f then
+      self.iterator = Iterators.credfile_iterator(credfile)
+      if not self.iterator then
         return false, ("Failed to open credfile (%s)"):format(credfile)
       end
-
-      self.iterator = Iterators.credential_iterator(f)
     elseif mode and mode == 'user' then
       self.iterator = self.iterator or Iterators.user_pw_iterator(usernames, passwords)
     elseif mode and mode == 'pass' then
@@ -1058,15 +1057,11 @@ Engine = {
       start_threads = 1
     end
 
-    -- Start `start_threads` number of threads
-    self:addWorkerN(cvar, start_threads)
-    self:renewBatch()
+    self.window = Window:new(1, start_threads, self.max_threads)
+    self:addWorkerN(cvar, self.window:size())
 
     local revive = false
-    local killed_one = false
-    local error_since_batch_start = false
     local stagnation_count = 0 -- number of times when all threads are stopped because of exceptions
-    local quick_start = true
     local stagnated = true
 
     -- Main logic loop
@@ -1083,48 +1078,36 @@ Engine = {
         end
       end
 
-      -- Reset flags
-      killed_one = false
-      error_since_batch_start = false
-
       -- Are all the threads have any kind of mistake?
       -- if not, then this variable will change to false after next loop
       stagnated = true
 
-      -- Run through all coroutines and check their statuses
-      -- if any mistake has happened kill one coroutine.
-      -- We do not actually kill a coroutine right-away, we just
-      -- signal it to finish work until some point an then die.
+      -- Run through all coroutines and check their statuses. Any error
+      -- shrinks the window, and threads above the window are signalled to
+      -- finish their work and then die.
+      local errors = false
       for co, v in pairs(self.threads) do
         if not v.connection_error then
           stagnated = false
         end
 
-        if v.protocol_error or v.connection_error then
-          if v.attempt >= self.batch:getStartTime() then
-            error_since_batch_start = true
-          end
-
-          if not killed_one then
-            v.terminate = true
-            killed_one = true
-
-            if v.protocol_error then
-              stdnse.debug2("Killed one thread because of PROTOCOL exception")
-            else
-              stdnse.debug2("Killed one thread because of CONNECTION exception")
-            end
+        v.had_error = v.protocol_error or v.connection_error
+        if v.had_error then
+          errors = true
+          if v.protocol_error then
+            stdnse.debug2("Reducing threads because of PROTOCOL exception")
+          else
+            stdnse.debug2("Reducing threads because of CONNECTION exception")
           end
 
           -- Remove error flags of the thread to let it continue to run
           v.protocol_error = nil
           v.connection_error = nil
-        else
-          -- If we got here, then at least one thread is running fine
-          -- and there is no connection stagnation
-          --stagnated = false
         end
       end
+      if errors then
+        self.window:drop(thread_count)
+      end
 
       if stagnated == true then
         stagnation_count = stagnation_count + 1
@@ -1144,63 +1127,25 @@ Engine = {
         stagnation_count = 0
       end
 
-      -- `quick_start` changes to false only once since Engine starts
-      -- `auick_start` remains false till the end of the bruteforce.
-      if killed_one then
-        quick_start = false
-      end
-
       -- Check if we possibly exhaust resources.
-      if not killed_one then
-        local waiting = nmap.socket.get_stats().connect_waiting
-
-        if waiting ~= 0 then
-          local kill_count = 1
-          if waiting > 5 then
-            kill_count = math.max(math.floor(thread_count / 2), 1)
-          end
-
-          for co, v in pairs(self.threads) do
-            if coroutine.status(co) ~= "dead" then
-              stdnse.debug2("Killed one because of RESOURCE management")
-              v.terminate = true
-              killed_one = true
-
-              kill_count = kill_count - 1
-              if kill_count == 0 then
-                break
-              end
-            end
-          end
-        end
-
-      end
-
-      -- Renew the batch if there was an error since we started to assemble the batch
-      -- or the batch's limit is unreachable with current number of threads
-      -- or when some thread does not change state to ready for too long
-      if error_since_batch_start
-        or not killed_one and thread_count < self.batch:getLimit()
-        or (thread_count > 0 and self.tick - self.batch:getStartTime() > 10) then
-        self:renewBatch()
+      if nmap.socket.get_stats().connect_waiting ~= 0 then
+        stdnse.debug2("Reducing threads because of RESOURCE management")
+        self.window:drop(thread_count)
       end
 
-      if (not killed_one and self.batch:isFull() and thread_count < self.max_threads)
-        or revive then
-
-        local num_to_add = 1
-        if quick_start then
-          num_to_add = math.min(self.max_threads - thread_count, thread_count)
-        end
-
-        self:addWorkerN(cvar, num_to_add)
-        self:renewBatch()
+      -- Bring the number of threads to the size of the window
+      local running = self:runningThreads()
+      local target = math.min(self.window:size(), self.max_threads)
+      if running > target then
+        self:terminateWorkerN(running - target)
+      elseif running < target or revive then
+        self:addWorkerN(cvar, math.max(target - running, 1))
         revive = false
       end
 
 
-      stdnse.debug2("Status: #threads = %d, #retry_accounts = %d, initial_accounts_exhausted = %s, waiting = %d",
-        self:threadCount(), #self.retry_accounts, tostring(self.initial_accounts_exhausted),
+      stdnse.debug2("Status: #threads = %d, window = %.1f, #retry_accounts = %d, initial_accounts_exhausted = %s, waiting = %d",
+        self:threadCount(), self.window.cwnd, #self.retry_accounts, tostring(self.initial_accounts_exhausted),
         nmap.socket.get_stats().connect_waiting)
 
       -- wake up other threads
@@ -1425,6 +1370,44 @@ Iterators = {
     return coroutine.wrap(next_credential)
   end,
 
+  --- Credential iterator over a file of known user/pass combinations
+  --
+  -- Each file is read once and the credentials are shared by all iterators
+  -- over it, so that the engines of all targets only keep a position in it.
+  -- As with <code>credential_iterator</code>, a line that is not a
+  -- credential pair ends the list.
+  -- @param filename name of a file containing credentials separated by '/'
+  -- @return function iterator, or nil if the file could not be opened
+  credfile_iterator = function (filename)
+    local list = credfiles[filename]
+    if not list then
+      local f = io.open(filename, "r")
+      if not f then
+        return nil
+      end
+      list = { users = {}, passwords = {} }
+      for line in f:lines() do
+        if not (line:match "^#!comment:") then
+          line = line:match '^()%s*$' and '' or line:match '^%s*(.*%S)'
+          local user, pass = line:match "^([^%/]*)%/(.*)$"
+          if not user then
+            break
+          end
+          list.users[#list.users + 1] = user
+          list.passwords[#list.passwords + 1] = pass
+        end
+      end
+      f:close()
+      credfiles[filename] = list
+    end
+
+    local i = 0
+    return function ()
+      i = i + 1
+      return list.users[i], list.passwords[i]
+    end
+  end,
+
   unpwdb_iterator = function (mode)
     local status, users, passwords
 
@@ -1496,6 +1479,7 @@ BruteSocket = {
       }
 
       thread_data.connection_error = true
+      thread_data.guess_error = true
       thread_data.con_error_reason = err
     end
   end,
@@ -98,6 +98,10 @@ end
 -- The first return value is true to signal success or false to signal
 -- failure. On success the second return value is the response from the
 -- remote host. On failure the second return value is an error message.
+--
+-- Banners are shared through <code>nmap.cache</code>, so scripts asking for
+-- the banner of the same port with the same <code>bytes</code>,
+-- <code>lines</code> and <code>proto</code> options connect only once.
 -- @param host The host to connect to.
 -- @param port The port on the host.
 -- @param opts The options. See the module description.
@@ -106,11 +110,19 @@ end
 get_banner = function(host, port, opts)
   opts = opts or {}
   opts.recv_before = true
-  local socket, nothing, correct, banner = tryssl(host, port, "", opts)
+  local key = ("%s %s %s"):format(opts.proto or "", opts.lines or "", opts.bytes or "")
+  local cached, banner = nmap.cache.get(host, port, "banner", key)
+  if cached then
+    return true, banner
+  end
+  local socket, nothing, correct
+  socket, nothing, correct, banner = tryssl(host, port, "", opts)
   if socket then
     socket:close()
+    nmap.cache.put(host, port, "banner", key, banner)
     return true, banner
   end
+  nmap.cache.put(host, port, "banner", key, nil)
   return false, banner
 end
 
@@ -93,6 +93,11 @@
 -- <code>"Mozilla/5.0 (compatible; Nmap Scripting Engine; https://nmap.org/book/nse.html)"</code>.
 -- A value of the empty string disables sending the User-Agent header field.
 --
+-- @args http.keepalive Set to <code>false</code> to close the connection after
+-- each request. By default, connections the server keeps open are kept idle
+-- for a few seconds and reused by later requests to the same port, from any
+-- script.
+--
 -- @args http.pipeline If set, it represents the number of HTTP requests that'll be
 -- sent on one connection. This can be set low to make debugging easier, or it
 -- can be set high to test how a server reacts (its chosen max is ignored).
@@ -110,6 +115,7 @@ local bin = require "bin"
 local bit = require "bit"
 local comm = require "comm"
 local coroutine = require "coroutine"
+local math = require "math"
 local nmap = require "nmap"
 local os = require "os"
 local sasl = require "sasl"
@@ -129,6 +135,13 @@ local have_ssl, openssl = pcall(require,'openssl')
 USER_AGENT = stdnse.get_script_args('http.useragent') or "Mozilla/5.0 (compatible; Nmap Scripting Engine; https://nmap.org/book/nse.html)"
 local MAX_REDIRECT_COUNT = 5
 
+local KEEPALIVE = stdnse.get_script_args("http.keepalive")
+KEEPALIVE = not (KEEPALIVE == "false" or KEEPALIVE == "0")
+-- Default request timeout, as in comm.lua.
+local REQUEST_TIMEOUT = 6000
+-- How long an idle connection is kept if the server doesn't say.
+local IDLE_TIMEOUT = 4000
+
 -- Recursively copy a table.
 -- Only recurs when a value is a table, other values are copied by assignment.
 local function tcopy (t)
@@ -355,47 +368,49 @@ local function validate_options(options)
 end
 
 
--- The following recv functions, and the function <code>next_response</code>
--- follow a common pattern. They each take a <code>partial</code> argument
--- whose value is data that has been read from the socket but not yet used in
--- parsing, and they return as their second return value a new value for
--- <code>partial</code>. The idea is that, for example, in reading from the
--- socket to get the Status-Line, you will probably read too much and read part
--- of the header. That part (the "partial") has to be retained when you go to
--- parse the header. The common use pattern is this:
+-- The following recv functions follow a common pattern. They each take a
+-- <code>partial</code> argument, a buffer (see <code>nmap.new_buffer</code>)
+-- holding data that has been read from the socket but not yet used in
+-- parsing, and they return it as their second return value. The idea is that,
+-- for example, in reading from the socket to get the Status-Line, you will
+-- probably read too much and read part of the header. That part (the
+-- "partial") has to be retained when you go to parse the header. Reads are
+-- appended to the buffer and what is parsed is taken from its front, so a
+-- body is not copied again for each chunk or line read. The common use
+-- pattern is this:
 -- <code>
--- local partial
+-- local partial = nmap.new_buffer()
 -- status_line, partial = recv_line(socket, partial)
 -- ...
 -- header, partial = recv_header(socket, partial)
 -- ...
 -- </code>
 -- On error, the functions return <code>nil</code> and the second return value
--- is an error message.
+-- is an error message. The buffer is changed in place, so callers must not
+-- assign the error message over it; whatever was read before the error stays
+-- in the buffer. <code>next_response</code> takes and returns the partial data
+-- as a string.
 
 -- Receive a single line (up to <code>\n</code>).
 local function recv_line(s, partial)
   local _, e
-  local status, data
+  local status, err
   local pos
 
-  partial = partial or ""
-
   pos = 1
   while true do
-    _, e = string.find(partial, "\n", pos, true)
+    _, e = partial:find("\n", pos, true)
     if e then
       break
     end
-    status, data = s:receive()
+    pos = #partial + 1
+    status, err = s:receive_into(partial)
     if not status then
-      return status, data
+      return nil, err
     end
-    pos = #partial
-    partial = partial .. data
   end
 
-  return string.sub(partial, 1, e), string.sub(partial, e + 1)
+  return partial:take(e), partial
 end
 
 local function line_is_empty(line)
@@ -407,13 +422,10 @@ end
 local function recv_header(s, partial)
   local lines = {}
 
-  partial = partial or ""
-
   while true do
-    local line
-    line, partial = recv_line(s, partial)
+    local line, err = recv_line(s, partial)
     if not line then
-      return line, partial
+      return nil, err
     end
     if line_is_empty(line) then
       break
@@ -426,52 +438,23 @@ end
 
 -- Receive until the connection is closed.
 local function recv_all(s, partial)
-  local parts
-
-  partial = partial or ""
-
-  parts = {partial}
-  while true do
-    local status, part = s:receive()
-    if not status then
-      break
-    else
-      parts[#parts + 1] = part
-    end
+  while s:receive_into(partial) do
   end
 
-  return table.concat(parts), ""
+  return partial:take(#partial), partial
 end
 
 -- Receive exactly <code>length</code> bytes. Returns <code>nil</code> if that
 -- many aren't available.
 local function recv_length(s, length, partial)
-  local parts, last
-
-  partial = partial or ""
-
-  parts = {}
-  last = partial
-  length = length - #last
-  while length > 0 do
-    local status
-
-    parts[#parts + 1] = last
-    status, last = s:receive()
+  while #partial < length do
+    local status, err = s:receive_into(partial)
     if not status then
-      return nil
+      return nil, err
     end
-    length = length - #last
   end
 
-  -- At this point length is 0 or negative, and indicates the degree to which
-  -- the last read "overshot" the desired length.
-
-  if length == 0 then
-    return table.concat(parts) .. last, ""
-  else
-    return table.concat(parts) .. string.sub(last, 1, length - 1), string.sub(last, length)
-  end
+  return partial:take(length), partial
 end
 
 -- Receive until the end of a chunked message body, and return the dechunked
@@ -483,11 +466,11 @@ local function recv_chunked(s, partial)
 
   chunks = {}
   repeat
-    local line, hex, _, i
+    local line, hex, _, i, err
 
-    line, partial = recv_line(s, partial)
+    line, err = recv_line(s, partial)
     if not line then
-      return nil, partial
+      return nil, err
     end
 
     pos = 1
@@ -514,13 +497,15 @@ local function recv_chunked(s, partial)
     -- starting with "...". We don't allow *LWS here, only ( SP | HT ), so the
     -- first interpretation will prevail.
 
-    chunk, partial = recv_length(s, chunk_size, partial)
+    chunk, err = recv_length(s, chunk_size, partial)
     if not chunk then
-      return nil, partial
+      return nil, err
     end
     chunks[#chunks + 1] = chunk
 
-    line, partial = recv_line(s, partial)
+    -- recv_line leaves the buffer as it was if it fails, so anything received
+    -- before the end of the connection is still there.
+    line = recv_line(s, partial)
     if not line then
       -- this warning message was initially an error but was adapted
       -- to support broken servers, such as the Citrix XML Service
@@ -536,19 +521,11 @@ end
 -- Receive a message body, assuming that the header has already been read by
 -- <code>recv_header</code>. The handling is sensitive to the request method
 -- and the status code of the response.
-local function recv_body(s, response, method, partial)
-  local connection_close, connection_keepalive
-  local version_major, version_minor
-  local transfer_encoding
-  local content_length
-  local err
-
-  partial = partial or ""
+-- Returns whether the Connection header field of a response has the "close"
+-- and "keep-alive" tokens.
+local function connection_tokens(response)
+  local connection_close, connection_keepalive = false, false
 
-  -- First check for Connection: close and Connection: keep-alive. This is
-  -- necessary to handle some servers that don't follow the protocol.
-  connection_close = false
-  connection_keepalive = false
   if response.header.connection then
     local offset, token
     offset = 0
@@ -565,6 +542,20 @@ local function recv_body(s, response, method, partial)
     end
   end
 
+  return connection_close, connection_keepalive
+end
+
+local function recv_body(s, response, method, partial)
+  local connection_close, connection_keepalive
+  local version_major, version_minor
+  local transfer_encoding
+  local content_length
+  local err
+
+  -- First check for Connection: close and Connection: keep-alive. This is
+  -- necessary to handle some servers that don't follow the protocol.
+  connection_close, connection_keepalive = connection_tokens(response)
+
   -- The HTTP version may also affect our decisions.
   version_major, version_minor = string.match(response["status-line"], "^HTTP/(%d+)%.(%d+)")
 
@@ -797,7 +788,7 @@ local function next_response(s, method, partial)
   local status_line, header, body
   local status, err
 
-  partial = partial or ""
+  partial = nmap.new_buffer(partial)
   response = {
     status=nil,
     ["status-line"]=nil,
@@ -807,31 +798,31 @@ local function next_response(s, method, partial)
     body=""
   }
 
-  status_line, partial = recv_line(s, partial)
+  status_line, err = recv_line(s, partial)
   if not status_line then
-    return nil, partial
+    return nil, err
   end
   status, err = parse_status_line(status_line, response)
   if not status then
     return nil, err
   end
 
-  header, partial = recv_header(s, partial)
+  header, err = recv_header(s, partial)
   if not header then
-    return nil, partial
+    return nil, err
   end
   status, err = parse_header(header, response)
   if not status then
     return nil, err
   end
 
-  body, partial = recv_body(s, response, method, partial)
+  body, err = recv_body(s, response, method, partial)
   if not body then
-    return nil, partial
+    return nil, err
   end
   response.body = body
 
-  return response, partial
+  return response, tostring(partial)
 end
 
 --- Tries to extract the max number of requests that should be made on
@@ -889,45 +880,12 @@ local function buildCookies(cookies, path)
 end
 
 -- HTTP cache.
--- Cache of GET and HEAD requests. Uses <"host:port:path", record>.
--- record is in the format:
---   result: The result from http.get or http.head
---   last_used: The time the record was last accessed or made.
---   get: Was the result received from a request to get or recently wiped?
---   size: The size of the record, equal to #record.result.body.
-local cache = {size = 0};
-
-local function check_size (cache)
-  local max_size = tonumber(stdnse.get_script_args({'http.max-cache-size', 'http-max-cache-size'}) or 1e6);
-
-  local size = cache.size;
-
-  if size > max_size then
-    stdnse.debug1(
-        "Current http cache size (%d bytes) exceeds max size of %d",
-        size, max_size);
-    table.sort(cache, function(r1, r2)
-      return (r1.last_used or 0) < (r2.last_used or 0);
-    end);
-
-    for i, record in ipairs(cache) do
-      if size <= max_size then break end
-      local result = record.result;
-      if type(result.body) == "string" then
-        size = size - record.size;
-        record.size, record.get, result.body = 0, false, "";
-      end
-    end
-    cache.size = size;
-  end
-  stdnse.debug2("Final http cache size (%d bytes) of max size of %d",
-      size, max_size);
-  return size;
-end
-
--- Unique value to signal value is being retrieved.
--- Also holds <mutex, thread> pairs, working thread is value
-local WORKING = setmetatable({}, {__mode = "v"});
+-- GET and HEAD responses are kept in nmap.cache, shared with other libraries,
+-- under the kind "http" and the key "<method> <hostname>:<path>". Entries are
+-- evicted least recently used first once their bodies add up to
+-- http.max-cache-size bytes.
+nmap.cache.limit("http",
+  tonumber(stdnse.get_script_args({'http.max-cache-size', 'http-max-cache-size'}) or 1e6));
 
 local function lookup_cache (method, host, port, path, options)
   if(not(validate_options(options))) then
@@ -935,44 +893,24 @@ local function lookup_cache (method, host, port, path, options)
   end
 
   options = options or {};
-  local bypass_cache = options.bypass_cache; -- do not lookup
-  local no_cache = options.no_cache; -- do not save result
-  local no_cache_body = options.no_cache_body; -- do not save body
-
-  if type(port) == "table" then port = port.number end
-
-  local key = stdnse.get_hostname(host)..":"..port..":"..path;
-  local mutex = nmap.mutex(tostring(lookup_cache)..key);
 
   local state = {
-    mutex = mutex,
-    key = key,
-    method = method,
-    bypass_cache = bypass_cache,
-    no_cache = no_cache,
-    no_cache_body = no_cache_body,
+    host = host,
+    port = port,
+    key = method.." "..stdnse.get_hostname(host)..":"..path,
+    bypass_cache = options.bypass_cache, -- do not lookup
+    no_cache = options.no_cache, -- do not save result
+    no_cache_body = options.no_cache_body, -- do not save body
   };
 
-  while true do
-    mutex "lock";
-    local record = cache[key];
-    if bypass_cache or record == nil or method ~= record.method then
-      WORKING[mutex] = coroutine.running();
-      cache[key], state.old_record = WORKING, record;
-      return nil, state;
-    elseif record == WORKING then
-      local working = WORKING[mutex];
-      if working == nil or coroutine.status(working) == "dead" then
-        -- thread died before insert_cache could be called
-        cache[key] = nil; -- reset
-      end
-      mutex "done";
-    else
-      mutex "done";
-      record.last_used = os.time();
-      return tcopy(record.result), state;
+  if not state.bypass_cache then
+    -- Waits while another thread fetches the same response.
+    local cached, record = nmap.cache.get(host, port, "http", state.key);
+    if cached then
+      return tcopy(record), state;
     end
   end
+  return nil, state;
 end
 
 local function response_is_cacheable(response)
@@ -1006,29 +944,15 @@ local function response_is_cacheable(response)
 end
 
 local function insert_cache (state, response)
-  local key = assert(state.key);
-  local mutex = assert(state.mutex);
-
-  if response == nil or state.no_cache or not response_is_cacheable(response) then
-    cache[key] = state.old_record;
-  else
-    local record = {
-      result = tcopy(response),
-      last_used = os.time(),
-      method = state.method,
-      size = type(response.body) == "string" and #response.body or 0,
-    };
-    response = record.result; -- only modify copy
-    cache[key], cache[#cache+1] = record, record;
+  local record;
+  if response ~= nil and not state.no_cache and response_is_cacheable(response) then
+    record = tcopy(response);
     if state.no_cache_body then
-      response.body = "";
-    end
-    if type(response.body) == "string" then
-      cache.size = cache.size + #response.body;
-      check_size(cache);
+      record.body = "";
     end
   end
-  mutex "done";
+  nmap.cache.put(state.host, state.port, "http", state.key, record, nil,
+    record and type(record.body) == "string" and #record.body or 0);
 end
 
 -- Return true if the given method requires a body in the request. In case no
@@ -1080,7 +1004,7 @@ local function build_request(host, port, method, path, options)
   -- Private copy of the options table, used to add default header fields.
   local mod_options = {
     header = {
-      Connection = "close",
+      Connection = KEEPALIVE and "keep-alive" or "close",
       Host = get_host_field(host, port),
       ["User-Agent"]  = USER_AGENT
     }
@@ -1159,6 +1083,85 @@ local function build_request(host, port, method, path, options)
   return request_line .. "\r\n" .. stdnse.strjoin("\r\n", header) .. "\r\n\r\n" .. (body or "")
 end
 
+-- Methods that may be sent again if a reused connection fails before any of
+-- the response arrives, as the server may have closed it just before the
+-- request reached it. See RFC 7230, section 6.3.1.
+local retry_methods = {GET = true, HEAD = true, OPTIONS = true}
+
+-- Sends a request on an idle connection to host and port that an earlier
+-- request left open. Returns the socket, the first data received and the
+-- protocol, like comm.tryssl. Returns nil if there is no such connection, or
+-- if the request may be sent again on a new one: the send failed, or nothing
+-- was received in answer to an idempotent request. Otherwise a failure
+-- returns false and an error message, as the server may have acted on the
+-- request.
+local function send_pooled(host, port, data, method, options)
+  if not KEEPALIVE then
+    return nil
+  end
+  for _, proto in ipairs({"tcp", "ssl"}) do
+    local socket = nmap.socket.checkout(host, port, proto)
+    if socket then
+      -- The same request timeout as comm.tryssl would set.
+      socket:set_timeout((options.timeout or REQUEST_TIMEOUT)
+        + (options.timeout or stdnse.get_timeout(host)))
+      local status, err = socket:send(data)
+      if not status then
+        stdnse.debug2("http: reused connection failed (%s), reconnecting", err)
+        socket:close()
+        return nil
+      end
+      local response
+      status, response = socket:receive()
+      if status then
+        return socket, response, proto
+      end
+      socket:close()
+      if retry_methods[string.upper(method)] then
+        stdnse.debug2("http: reused connection failed (%s), reconnecting", response)
+        return nil
+      end
+      stdnse.debug2("http: reused connection failed (%s) after sending a %s request", response, method)
+      return false, response
+    end
+  end
+  return nil
+end
+
+-- Returns how long (in milliseconds) the connection a response came on may be
+-- kept idle for another request, or nil if it may not be reused: when either
+-- side asked to close it, or the end of the response body was only marked by
+-- the server closing the connection.
+local function reusable(data, response, method)
+  local connection_close, connection_keepalive = connection_tokens(response)
+  local version_major, version_minor = string.match(response["status-line"], "^HTTP/(%d+)%.(%d+)")
+
+  if connection_close or (version_major == "1" and version_minor == "0" and not connection_keepalive) then
+    return nil
+  end
+  local request_header = string.match(data, "^(.-)\r\n\r\n") or data
+  if string.find(string.lower(request_header), "\nconnection:[^\n]*close") then
+    return nil
+  end
+
+  if not (string.upper(method) == "HEAD"
+    or (response.status >= 100 and response.status <= 199)
+    or response.status == 204 or response.status == 304
+    or (response.header["transfer-encoding"] and response.header["transfer-encoding"] ~= "identity")
+    or (response.header["transfer-coding"] and response.header["transfer-coding"] ~= "identity")
+    or tonumber(response.header["content-length"] or "")) then
+    return nil
+  end
+
+  -- Leave a second's margin on the server's own idle timeout.
+  local timeout = string.match(response.header["keep-alive"] or "", "timeout=(%d+)")
+  if timeout then
+    timeout = (tonumber(timeout) - 1) * 1000
+    return timeout > 0 and math.min(timeout, IDLE_TIMEOUT) or nil
+  end
+  return IDLE_TIMEOUT
+end
+
 --- Send a string to a host and port and return the HTTP result. This function
 -- is like <code>generic_request</code>, to be used when you have a ready-made
 -- request, not a collection of request parameters.
@@ -1197,7 +1200,10 @@ local function request(host, port, data, options)
     host = addrs[1] or host
   end
 
-  local socket, partial, opts = comm.tryssl(host, port, data, { timeout = options.timeout })
+  local socket, partial, opts = send_pooled(host, port, data, method, options)
+  if socket == nil then
+    socket, partial, opts = comm.tryssl(host, port, data, { timeout = options.timeout })
+  end
 
   if not socket then
     stdnse.debug1("http.request socket error: %s", partial)
@@ -1214,7 +1220,12 @@ local function request(host, port, data, options)
     -- sending the real response. If we got one of those, skip over it.
   until not (response.status >= 100 and response.status <= 199)
 
-  socket:close()
+  local idle_timeout = KEEPALIVE and partial == "" and reusable(data, response, method)
+  if idle_timeout then
+    socket:checkin(idle_timeout)
+  else
+    socket:close()
+  end
 
   -- if SSL was used to retrieve the URL mark this in the response
   response.ssl = ( opts == 'ssl' )
@@ -2865,4 +2876,52 @@ function save_path(host, port, path, status, links_to, linked_from, contenttype)
   end
 end
 
+local unittest = require "unittest"
+if not unittest.testing() then
+  return _ENV
+end
+
+-- A socket that returns each string in data from one call to receive_into,
+-- then EOF.
+local function fake_socket(data)
+  local i = 0
+  return {
+    receive_into = function(self, buffer)
+      i = i + 1
+      if not data[i] then
+        return false, "EOF"
+      end
+      buffer:append(data[i])
+      return true, #data[i]
+    end,
+  }
+end
+
+-- Returns the results of next_response on a fake socket.
+local function fake_response(method, ...)
+  local response, partial = next_response(fake_socket({...}), method)
+  return response and response.body, partial
+end
+
+test_suite = unittest.TestSuite:new()
+test_suite:add_test(unittest.table_equal({fake_response("GET",
+      "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhel", "loHTTP/1.1")},
+    {"hello", "HTTP/1.1"}), "Content-Length body")
+test_suite:add_test(unittest.table_equal({fake_response("GET",
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n",
+      "3\r\nabc\r\n", "2\r\nde\r\n0\r\n\r\n")},
+    {"abcde", ""}), "chunked body")
+-- The Citrix XML Service ends the last chunk at EOF with no CRLF.
+test_suite:add_test(unittest.table_equal({fake_response("GET",
+      "HTTP/1.1 200 OK\r\nTransfer-Coding: chunked\r\n\r\n",
+      "3\r\nabc\r\n0\r\n")},
+    {"abc", ""}), "chunked body ending at EOF with no CRLF")
+local body, err = fake_response("GET",
+  "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n", "5\r\nab")
+test_suite:add_test(unittest.is_nil(body), "chunked body cut short")
+test_suite:add_test(unittest.equal(err, "EOF"), "chunked body cut short error")
+body, err = fake_response("GET", "HTTP/1.1 200 OK\r\n")
+test_suite:add_test(unittest.is_nil(body), "header cut short")
+test_suite:add_test(unittest.equal(err, "EOF"), "header cut short error")
+
 return _ENV;
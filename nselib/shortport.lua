@@ -24,6 +24,29 @@ local function includes(t, value)
   return false
 end
 
+-- Static filters of the portrules built by this module, see rule_filter.
+local rule_filters = setmetatable({}, {__mode = "k"})
+
+local function set_filter(rule, filter)
+  rule_filters[rule] = filter
+  return rule
+end
+
+--- Return the static filter of a portrule built by this module.
+--
+-- The filter is a table with the fields <code>ports</code>,
+-- <code>services</code>, <code>protos</code> and <code>states</code>
+-- holding the lists the rule was built from, and <code>ssl</code> if the rule
+-- also matches any port found to be tunneled over SSL. The rule can only
+-- return true for ports matching the filter, which lets NSE skip the rule for
+-- all other ports. This is the form a script may export itself as
+-- <code>portrule_filter</code> when it has a portrule of its own.
+-- @param rule A portrule function.
+-- @return The filter table, or nil if <code>rule</code> has none.
+rule_filter = function(rule)
+  return rule_filters[rule]
+end
+
 --- Check if the port and its protocol are in the exclude directive.
 --
 -- @param port A port number.
@@ -58,11 +81,11 @@ portnumber = function(ports, protos, states)
     states = {states}
   end
 
-  return function(host, port)
+  return set_filter(function(host, port)
     return includes(ports, port.number)
       and includes(protos, port.protocol)
       and includes(states, port.state)
-  end
+  end, {ports = ports, protos = protos, states = states})
 end
 
 --- Return a portrule that returns true when given an open port with a
@@ -95,11 +118,11 @@ service = function(services, protos, states)
     states = {states}
   end
 
-  return function(host, port)
+  return set_filter(function(host, port)
     return includes(services, port.service)
     and includes(protos, port.protocol)
     and includes(states, port.state)
-  end
+  end, {services = services, protos = protos, states = states})
 end
 
 --- Return a portrule that returns true when given an open port matching
@@ -119,11 +142,17 @@ end
 -- {<code>"open"</code>, <code>"open|filtered"</code>}.
 -- @return Function for the portrule.
 port_or_service = function(ports, services, protos, states)
-  return function(host, port)
-    local port_checker = portnumber(ports, protos, states)
-    local service_checker = service(services, protos, states)
+  local port_checker = portnumber(ports, protos, states)
+  local service_checker = service(services, protos, states)
+  local port_filter = rule_filters[port_checker]
+  return set_filter(function(host, port)
     return port_checker(host, port) or service_checker(host, port)
-  end
+  end, {
+    ports = port_filter.ports,
+    services = rule_filters[service_checker].services,
+    protos = port_filter.protos,
+    states = port_filter.states,
+  })
 end
 
 --- Return a portrule that returns true when given an open port matching
@@ -149,12 +178,12 @@ end
 -- which the function always returns false, default 7.
 -- @return Function for the portrule.
 version_port_or_service = function(ports, services, protos, states, rarity)
-  return function(host, port)
-    local p_s_check = port_or_service(ports, services, protos, states)
+  local p_s_check = port_or_service(ports, services, protos, states)
+  return set_filter(function(host, port)
     return p_s_check(host, port)
       and not(port_is_excluded(port.number, port.protocol))
       and (nmap.version_intensity() >= (rarity or 7))
-  end
+  end, rule_filters[p_s_check])
 end
 
 --[[
@@ -219,9 +248,16 @@ local LIKELY_SSL_SERVICES = {
 -- <code>false</code> otherwise.
 -- @usage
 -- portrule = shortport.ssl
+local ssl_checker = port_or_service(LIKELY_SSL_PORTS, LIKELY_SSL_SERVICES, {"tcp", "sctp"})
 function ssl(host, port)
   return (port.version and port.version.service_tunnel == "ssl") or
-    port_or_service(LIKELY_SSL_PORTS, LIKELY_SSL_SERVICES, {"tcp", "sctp"})(host, port)
+    ssl_checker(host, port)
 end
+set_filter(ssl, {
+  ports = LIKELY_SSL_PORTS,
+  services = LIKELY_SSL_SERVICES,
+  protos = {"tcp", "sctp"},
+  ssl = true,
+})
 
 return _ENV;
@@ -282,19 +282,25 @@ function start(host)
   end
 
   -- Store the name of the server
-  local nbcache_mutex = nmap.mutex("Netbios lookup mutex")
-  nbcache_mutex "lock"
-  if ( not(host.registry['netbios_name']) ) then
+  local cached
+  if ( host.registry['netbios_name'] ) then
+    cached, result = true, host.registry['netbios_name']
+  else
+    cached, result = nmap.cache.get(host, nil, "netbios-name", "")
+  end
+  if cached then
+    stdnse.debug2("SMB: Resolved netbios name from cache")
+    state['name'] = result
+  else
     status, result = netbios.get_server_name(host.ip)
     if(status == true) then
       host.registry['netbios_name'] = result
       state['name'] = result
+    else
+      result = nil
     end
-  else
-    stdnse.debug2("SMB: Resolved netbios name from cache")
-    state['name'] = host.registry['netbios_name']
+    nmap.cache.put(host, nil, "netbios-name", "", result)
   end
-  nbcache_mutex "done"
 
   stdnse.debug2("SMB: Starting SMB session for %s (%s)", host.name, host.ip)
 
@@ -3267,28 +3273,8 @@ function get_windows_version(os)
 
 end
 
----Retrieve information about the host's operating system. This should always be possible to call, as long as there isn't already
--- a SMB session established.
---
--- The returned table has the following keys (shown here with sample values).
--- * <code>os</code>: <code>"Windows 7 Professional 7601 Service Pack 1"</code>
--- * <code>lanmanager</code>: <code>"Windows 7 Professional 6.1"</code>
--- * <code>domain</code>: <code>"WORKGROUP"</code>
--- * <code>server</code>: <code>"COMPUTERNAME"</code>
--- * <code>time</code>: <code>1347121470.0462</code>
--- * <code>date</code>: <code>"2012-09-08 09:24:30"</code>
--- * <code>timezone</code>: <code>-7</code>
--- * <code>timezone_str</code>: <code>UTC-7</code>
--- * <code>port</code>: <code>445</code>
--- The table may also contain these additional keys:
--- * <code>fqdn</code>: <code>"Sql2008.lab.test.local"</code>
--- * <code>domain_dns</code>: <code>"lab.test.local"</code>
--- * <code>forest_dns</code>: <code>"test.local"</code>
--- * <code>workgroup</code>
---
---@param host The host object
---@return (status, data) If status is true, data is a table of values; otherwise, data is an error message.
-function get_os(host)
+-- Sets up the SMB sessions for get_os.
+local function fetch_os(host)
   local state
   local status, smbstate
 
@@ -3347,6 +3333,48 @@ function get_os(host)
   return true, response
 end
 
+---Retrieve information about the host's operating system. This should always be possible to call, as long as there isn't already
+-- a SMB session established.
+--
+-- The returned table has the following keys (shown here with sample values).
+-- * <code>os</code>: <code>"Windows 7 Professional 7601 Service Pack 1"</code>
+-- * <code>lanmanager</code>: <code>"Windows 7 Professional 6.1"</code>
+-- * <code>domain</code>: <code>"WORKGROUP"</code>
+-- * <code>server</code>: <code>"COMPUTERNAME"</code>
+-- * <code>time</code>: <code>1347121470.0462</code>
+-- * <code>date</code>: <code>"2012-09-08 09:24:30"</code>
+-- * <code>timezone</code>: <code>-7</code>
+-- * <code>timezone_str</code>: <code>UTC-7</code>
+-- * <code>port</code>: <code>445</code>
+-- The table may also contain these additional keys:
+-- * <code>fqdn</code>: <code>"Sql2008.lab.test.local"</code>
+-- * <code>domain_dns</code>: <code>"lab.test.local"</code>
+-- * <code>forest_dns</code>: <code>"test.local"</code>
+-- * <code>workgroup</code>
+--
+-- The details are shared through <code>nmap.cache</code>, so the two SMB
+-- sessions are only set up once per host.
+--
+--@param host The host object
+--@return (status, data) If status is true, data is a table of values; otherwise, data is an error message.
+function get_os(host)
+  local cached, response = nmap.cache.get(host, nil, "smb-os", "")
+  if not cached then
+    local status
+    status, response = fetch_os(host)
+    nmap.cache.put(host, nil, "smb-os", "", status and response or nil)
+    if not status then
+      return false, response
+    end
+  end
+
+  local copy = {}
+  for k, v in pairs(response) do
+    copy[k] = v
+  end
+  return true, copy
+end
+
 ---Basically a wrapper around <code>socket:get_info</code>, except that it also makes a SMB connection before calling the
 -- <code>get_info</code> function. Returns the mac address as well, for convenience.
 --
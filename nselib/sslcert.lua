@@ -809,24 +809,8 @@ local function get_record_iter(sock)
   end
 end
 
---- Gets a certificate for the given host and port
--- The function will attempt to START-TLS for the ports known to require it.
--- @param host table as received by the script action function
--- @param port table as received by the script action function
--- @return status true on success, false on failure
--- @return cert userdata containing the SSL certificate, or error message on
---         failure.
-function getCertificate(host, port)
-  local mutex = nmap.mutex("sslcert-cache-mutex")
-  mutex "lock"
-
-  if ( host.registry["ssl-cert"] and
-    host.registry["ssl-cert"][port.number] ) then
-    stdnse.debug2("sslcert: Returning cached SSL certificate")
-    mutex "done"
-    return true, host.registry["ssl-cert"][port.number]
-  end
-
+-- Connects to the port and reads the certificate, without caching.
+local function fetch_certificate(host, port)
   local cert
 
   -- If we don't already know the service is TLS wrapped check to see if we
@@ -839,7 +823,6 @@ function getCertificate(host, port)
   if wrapper then
     local status, socket = wrapper(host, port)
     if not status then
-      mutex "done"
       return false, socket
     end
 
@@ -847,7 +830,6 @@ function getCertificate(host, port)
     local hello = tls.client_hello()
     local status, err = socket:send(hello)
     if not status then
-      mutex "done"
       return false, "Failed to connect to server"
     end
 
@@ -878,7 +860,6 @@ function getCertificate(host, port)
 
     local handshake = records.handshake
     if not handshake then
-      mutex "done"
       return false, "Server did not handshake"
     end
 
@@ -890,13 +871,11 @@ function getCertificate(host, port)
       end
     end
     if not certs or not next(certs.certificates) then
-      mutex "done"
       return false, "Server sent no certificate"
     end
 
     cert, err = parse_ssl_certificate(certs.certificates[1])
     if not cert then
-      mutex "done"
       return false, ("Unable to get cert: %s"):format(err)
     end
   else
@@ -911,28 +890,60 @@ function getCertificate(host, port)
     if specialized then
       status, socket = specialized(host, port)
       if not status then
-        mutex "done"
         stdnse.debug1("Specialized function error: %s", socket)
         return false, "Failed to connect to server"
       end
     else
       status = socket:connect(host, port, "ssl")
       if ( not(status) ) then
-        mutex "done"
         return false, "Failed to connect to server"
       end
     end
     cert = socket:get_ssl_certificate()
     if ( cert == nil ) then
-      mutex "done"
       return false, "Unable to get cert"
     end
   end
 
+  return true, cert
+end
+
+--- Gets a certificate for the given host and port
+-- The function will attempt to START-TLS for the ports known to require it.
+--
+-- Certificates are shared through <code>nmap.cache</code>; scripts asking for
+-- the same certificate at once wait for the first one to fetch it. Fetched
+-- certificates are also stored in <code>host.registry["ssl-cert"]</code>, and
+-- a certificate already found there, for instance one put there by another
+-- script, is returned without looking in the cache.
+-- @param host table as received by the script action function
+-- @param port table as received by the script action function
+-- @return status true on success, false on failure
+-- @return cert userdata containing the SSL certificate, or error message on
+--         failure.
+function getCertificate(host, port)
+  if ( host.registry["ssl-cert"] and
+    host.registry["ssl-cert"][port.number] ) then
+    stdnse.debug2("sslcert: Returning cached SSL certificate")
+    return true, host.registry["ssl-cert"][port.number]
+  end
+
+  local cached, cert = nmap.cache.get(host, port, "ssl-cert", "")
+  if cached then
+    stdnse.debug2("sslcert: Returning cached SSL certificate")
+    return true, cert
+  end
+
+  local status
+  status, cert = fetch_certificate(host, port)
+  if not status then
+    nmap.cache.put(host, port, "ssl-cert", "", nil)
+    return false, cert
+  end
+
   host.registry["ssl-cert"] = host.registry["ssl-cert"] or {}
-  host.registry["ssl-cert"][port.number] = host.registry["ssl-cert"][port.number] or {}
   host.registry["ssl-cert"][port.number] = cert
-  mutex "done"
+  nmap.cache.put(host, port, "ssl-cert", "", cert)
   return true, cert
 end
 
@@ -6,6 +6,7 @@
 --
 -- @author Daniel Miller
 
+local codec = require "codec"
 local stdnse = require "stdnse"
 local string = require "string"
 local math = require "math"
@@ -1205,7 +1206,7 @@ message_parse = {
 
       -- Parse body.
       local btype, len
-      btype, len, j = unpack("B>I3", buffer, j)
+      btype, len, j = codec.tls_handshake(buffer, j)
       local msg_end = len + j
 
       -- Convert to human-readable form.
@@ -1286,7 +1287,7 @@ function record_read(buffer, i, fragment)
 
   -- Parse header.
   local h = {}
-  local typ, proto, rlength, j = unpack(">B I2 I2", buffer, i)
+  local typ, proto, rlength, j = codec.tls_record(buffer, i)
   h.length = rlength
   local name = find_key(TLS_CONTENTTYPE_REGISTRY, typ)
   if name == nil then
@@ -1501,7 +1502,7 @@ end
 function record_buffer(sock, buffer, i)
   buffer = buffer or ""
   i = i or 1
-  local count = #buffer:sub(i)
+  local count = math.max(#buffer - i + 1, 0)
   local status, resp, rem
   if count < TLS_RECORD_HEADER_LENGTH then
     status, resp, rem = read_atleast(sock, TLS_RECORD_HEADER_LENGTH - count)
@@ -1512,7 +1513,7 @@ function record_buffer(sock, buffer, i)
     count = count + #resp
   end
   -- ContentType, ProtocolVersion, length
-  local _, _, len = unpack(">BI2I2", buffer, i)
+  local _, _, len = codec.tls_record(buffer, i)
   if count < TLS_RECORD_HEADER_LENGTH + len then
     status, resp = read_atleast(sock, TLS_RECORD_HEADER_LENGTH + len - count)
     if not status then
@@ -7,6 +7,7 @@
 
 local bit = require "bit"
 local bin = require "bin"
+local codec = require "codec"
 local string = require "string"
 local table = require "table"
 local stdnse = require "stdnse"
@@ -67,7 +68,19 @@ end
 --@param bigendian_enc Set this to true to force big-endian encoding.
 --@return An encoded string
 function transcode(buf, decoder, encoder, bigendian_dec, bigendian_enc)
-  local out = {}
+  -- The UTF-16/UTF-8 pairs are done natively for the input they handle the
+  -- same way as the Lua functions.
+  local out
+  if decoder == utf16_dec and encoder == utf8_enc then
+    out = codec.utf16to8(buf, bigendian_dec)
+  elseif decoder == utf8_dec and encoder == utf16_enc then
+    out = codec.utf8to16(buf, bigendian_enc)
+  end
+  if out then
+    return out
+  end
+
+  out = {}
   local cp
   local pos = 1
   while pos <= #buf do
@@ -426,6 +439,28 @@ test_suite:add_test(unittest.table_equal(decode("\x08\xD8\x45\xDF=\0R\0a\0", utf
 test_suite:add_test(unittest.table_equal(decode("\xD8\x08\xDF\x45\0=\0R\0a", utf16_dec, true), {0x12345,61,82,97}),"decode utf-16, big-endian")
 test_suite:add_test(unittest.equal(utf16to8("\x08\xD8\x45\xDF=\0R\0a\0"), "\xF0\x92\x8D\x85=Ra"),"utf16to8")
 test_suite:add_test(unittest.equal(utf8to16("\xF0\x92\x8D\x85=Ra"), "\x08\xD8\x45\xDF=\0R\0a\0"),"utf8to16")
+-- The native transcoders must match the Lua code. Wrapping a decoder hides it
+-- from transcode, which then uses the Lua loop.
+local function lua_utf16_dec(...) return utf16_dec(...) end
+local function lua_utf8_dec(...) return utf8_dec(...) end
+for _, s in ipairs({"", "a\0", "\xe9\0t\0\xe9\0", "\x08\xD8\x45\xDF", "\x45\xDF\x08\xD8",
+    "\x00\xDC\x00\x9C", "\xFF\xDB\xFF\xFF", "\xAC\x20=\0"}) do
+  test_suite:add_test(unittest.equal(utf16to8(s), transcode(s, lua_utf16_dec, utf8_enc)),
+    "native utf16to8 " .. stdnse.tohex(s))
+  test_suite:add_test(unittest.equal(transcode(s, utf16_dec, utf8_enc, true),
+      transcode(s, lua_utf16_dec, utf8_enc, true)),
+    "native utf16to8, big-endian " .. stdnse.tohex(s))
+end
+for _, s in ipairs({"", "abc", "\xC3\xA9t\xC3\xA9", "\xE2\x82\xAC", "\xF0\x92\x8D\x85",
+    "\xC0\x80", "\xED\xA0\x80", "\xF7\xBF\xBF\xBF"}) do
+  test_suite:add_test(unittest.equal(utf8to16(s), transcode(s, lua_utf8_dec, utf16_enc)),
+    "native utf8to16 " .. stdnse.tohex(s))
+  test_suite:add_test(unittest.equal(transcode(s, utf8_dec, utf16_enc, nil, true),
+      transcode(s, lua_utf8_dec, utf16_enc, nil, true)),
+    "native utf8to16, big-endian " .. stdnse.tohex(s))
+end
+test_suite:add_test(unittest.is_false(pcall(utf16to8, "a\0b")), "utf16to8 odd length")
+test_suite:add_test(unittest.is_false(pcall(utf8to16, "\xE2\x82")), "utf8to16 truncated")
 test_suite:add_test(unittest.equal(encode({0x221e, 0x2248, 0x30}, cp437_enc), "\xec\xf70"), "encode cp437")
 test_suite:add_test(unittest.table_equal(decode("\x81ber", cp437_dec), {0xfc, 0x62, 0x65, 0x72}), "decode cp437")
 
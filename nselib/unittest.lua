@@ -43,6 +43,7 @@ local libs = {
 "cassandra",
 "citrixxml",
 "coap",
+"codec",
 "comm",
 "creds",
 "cvs",
@@ -202,6 +202,9 @@ void nsock_loop_quit(nsock_pool nsp);
  * if the status is NSOCK_LOOP_ERROR was returned by nsock_loop() */
 int nsock_pool_get_error(nsock_pool nsp);
 
+/* Returns the number of events that are pending in the pool, for statistics. */
+int nsock_pool_get_events_pending(nsock_pool nsp);
+
 nsock_ssl nsock_iod_get_ssl(nsock_iod nsockiod);
 
 /* Note that nsock_iod_get_ssl_session will increment the usage count of the
@@ -227,6 +230,20 @@ void nsock_pool_set_broadcast(nsock_pool nsp, int optval);
 /* Sets the name of the interface for new sockets to bind to. */
 void nsock_pool_set_device(nsock_pool nsp, const char *device);
 
+/* Keeps expirable events in a hashed timing wheel rather than in a binary heap
+ * when enable is non-zero. Scheduling and cancelling a timeout become O(1),
+ * which pays off when a large number of timeouts are pending and most of them
+ * get cancelled, at the cost of a millisecond resolution. It can be changed at
+ * any time. Default is off (0, false). */
+void nsock_pool_set_timer_wheel(nsock_pool nsp, int enable);
+
+/* Gives the pool an IO engine instance of its own in a child process created
+ * by fork(). The engine state inherited from the parent (such as an epoll or
+ * io_uring instance) is shared with it at the kernel level, so it is abandoned
+ * rather than torn down, and open iods are registered again with the new one.
+ * Must not be called with events pending. */
+void nsock_pool_reinit_engine(nsock_pool nsp);
+
 /* Initializes an Nsock pool to create SSL connections. This sets an internal
  * SSL_CTX, which is like a template that sets options for all connections that
  * are made from it. Returns the SSL_CTX so you can set your own options.
@@ -567,7 +584,9 @@ nsock_event_id nsock_connect_udp(nsock_pool nsp, nsock_iod nsiod, nsock_ev_handl
  * the normal read/write calls and decryption will happen transparently. ss
  * should be a sockaddr_storage, sockaddr_in6, or sockaddr_in as appropriate
  * (just like what you would pass to connect).  sslen should be the sizeof the
- * structure you are passing in. */
+ * structure you are passing in.  ssl_session is a session to resume; when it is
+ * NULL, the pool offers the last session it got from the same address, port
+ * and SNI name, if any. */
 nsock_event_id nsock_connect_ssl(nsock_pool nsp, nsock_iod nsiod, nsock_ev_handler handler, int timeout_msecs,
                                  void *userdata, struct sockaddr *ss, size_t sslen, int proto, unsigned short port, nsock_ssl_session ssl_session);
 
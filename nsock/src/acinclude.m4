@@ -103,6 +103,29 @@ $1],[AC_MSG_RESULT([no])
 $2])
 ])dnl
 
+AC_DEFUN([AX_HAVE_IO_URING], [dnl
+  AC_MSG_CHECKING([for Linux io_uring(7) interface])
+  AC_CACHE_VAL([ax_cv_have_io_uring], [dnl
+    AC_COMPILE_IFELSE([dnl
+      AC_LANG_PROGRAM([dnl
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if !defined(__NR_io_uring_setup) || !defined(__NR_io_uring_enter)
+#  error no io_uring system calls
+#endif
+], [dnl
+struct io_uring_params p;
+struct io_uring_getevents_arg arg;
+int feat = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+int op = IORING_OP_READ_FIXED + IORING_OP_POLL_ADD + IORING_OP_ASYNC_CANCEL;])],
+      [ax_cv_have_io_uring=yes],
+      [ax_cv_have_io_uring=no])])
+  AS_IF([test "${ax_cv_have_io_uring}" = "yes"],
+    [AC_MSG_RESULT([yes])
+$1],[AC_MSG_RESULT([no])
+$2])
+])dnl
+
 AC_DEFUN([AX_HAVE_POLL], [dnl
   AC_MSG_CHECKING([for poll(2)])
   AC_CACHE_VAL([ax_cv_have_poll], [dnl
@@ -290,9 +290,6 @@ int iocp_loop(struct npool *nsp, int msec_timeout) {
   if (nsp->events_pending == 0)
     return 0; /* No need to wait on 0 events ... */
 
-
-  struct nevent *nse;
-
   /* Make sure the preallocated space for the retrieved events is big enough */
   total_events = gh_list_count(&nsp->connect_events) + gh_list_count(&nsp->read_events) + gh_list_count(&nsp->write_events);
   if (iinfo->capacity < total_events) {
@@ -302,11 +299,8 @@ int iocp_loop(struct npool *nsp, int msec_timeout) {
 
   nsock_log_debug_all("wait for events");
 
-  nse = next_expirable_event(nsp);
-  if (!nse)
-    event_msecs = -1; /* None of the events specified a timeout */
-  else
-    event_msecs = MAX(0, TIMEVAL_MSEC_SUBTRACT(nse->timeout, nsock_tod));
+  /* -1 if none of the events specified a timeout */
+  event_msecs = next_expirable_msecs(nsp);
 
 #if HAVE_PCAP
 #ifndef PCAP_CAN_DO_SELECT
@@ -422,7 +416,7 @@ void iterate_through_event_lists(struct npool *nsp) {
       gh_list_append(&nsp->free_events, &nse->nodeq_io);
 
       if (nse->timeout.tv_sec)
-        gh_heap_remove(&nsp->expirables, &nse->expire);
+        expirable_remove(nsp, nse);
     } else
       initiate_overlapped_event(nsp, nse);
 
@@ -0,0 +1,1079 @@
+/***************************************************************************
+ * engine_iouring.c -- io_uring(7) based IO engine.                        *
+ *                                                                         *
+ ***********************IMPORTANT NSOCK LICENSE TERMS***********************
+ *                                                                         *
+ * The nsock parallel socket event library is (C) 1999-2016 Insecure.Com   *
+ * LLC This library is free software; you may redistribute and/or          *
+ * modify it under the terms of the GNU General Public License as          *
+ * published by the Free Software Foundation; Version 2.  This guarantees  *
+ * your right to use, modify, and redistribute this software under certain *
+ * conditions.  If this license is unacceptable to you, Insecure.Com LLC   *
+ * may be willing to sell alternative licenses (contact                    *
+ * sales@insecure.com ).                                                   *
+ *                                                                         *
+ * As a special exception to the GPL terms, Insecure.Com LLC grants        *
+ * permission to link the code of this program with any version of the     *
+ * OpenSSL library which is distributed under a license identical to that  *
+ * listed in the included docs/licenses/OpenSSL.txt file, and distribute   *
+ * linked combinations including the two. You must obey the GNU GPL in all *
+ * respects for all of the code used other than OpenSSL.  If you modify    *
+ * this file, you may extend this exception to your version of the file,   *
+ * but you are not obligated to do so.                                     *
+ *                                                                         *
+ * If you received these files with a written license agreement stating    *
+ * terms other than the (GPL) terms above, then that alternative license   *
+ * agreement takes precedence over this comment.                           *
+ *                                                                         *
+ * Source is provided to this software because we believe users have a     *
+ * right to know exactly what a program is going to do before they run it. *
+ * This also allows you to audit the software for security holes.          *
+ *                                                                         *
+ * Source code also allows you to port Nmap to new platforms, fix bugs,    *
+ * and add new features.  You are highly encouraged to send your changes   *
+ * to the dev@nmap.org mailing list for possible incorporation into the    *
+ * main distribution.  By sending these changes to Fyodor or one of the    *
+ * Insecure.Org development mailing lists, or checking them into the Nmap  *
+ * source code repository, it is understood (unless you specify otherwise) *
+ * that you are offering the Nmap Project (Insecure.Com LLC) the           *
+ * unlimited, non-exclusive right to reuse, modify, and relicense the      *
+ * code.  Nmap will always be available Open Source, but this is important *
+ * because the inability to relicense code has caused devastating problems *
+ * for other Free Software projects (such as KDE and NASM).  We also       *
+ * occasionally relicense the code to third parties as discussed above.    *
+ * If you wish to specify special license conditions of your               *
+ * contributions, just say so when you send them.                          *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * General Public License v2.0 for more details                            *
+ * (http://www.gnu.org/licenses/gpl-2.0.html).                             *
+ *                                                                         *
+ ***************************************************************************/
+
+
+/* $Id$ */
+
+#ifdef HAVE_CONFIG_H
+#include "nsock_config.h"
+#endif
+
+#if HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <endian.h>
+#include <poll.h>
+#include <errno.h>
+
+#include "nsock_internal.h"
+#include "nsock_log.h"
+
+#if HAVE_PCAP
+#include "nsock_pcap.h"
+#endif
+
+/* Number of submission queue entries. The completion queue is twice as large
+ * and the kernel buffers overflowing completions (IORING_FEAT_NODROP). */
+#define IOURING_ENTRIES   1024
+
+/* Number of READ_BUFFER_SZ chunks registered with the kernel for fixed reads
+ * and writes. Operations fall back to heap buffers when they run out. */
+#define IOURING_BUFFERS   128
+
+#define INITIAL_SLOT_COUNT  128
+
+#define POLL_R_FLAGS (POLLIN | POLLPRI)
+#define POLL_W_FLAGS POLLOUT
+#ifdef POLLRDHUP
+  #define POLL_X_FLAGS (POLLERR | POLLRDHUP | POLLHUP)
+#else
+  #define POLL_X_FLAGS (POLLERR | POLLHUP)
+#endif /* POLLRDHUP */
+
+
+/* --- ENGINE INTERFACE PROTOTYPES --- */
+static int iouring_init(struct npool *nsp);
+static void iouring_destroy(struct npool *nsp);
+static int iouring_iod_register(struct npool *nsp, struct niod *iod, struct nevent *nse, int ev);
+static int iouring_iod_unregister(struct npool *nsp, struct niod *iod);
+static int iouring_iod_modify(struct npool *nsp, struct niod *iod, struct nevent *nse, int ev_set, int ev_clr);
+static int iouring_loop(struct npool *nsp, int msec_timeout);
+
+int posix_iod_connect(struct npool *nsp, int sockfd, const struct sockaddr *addr, socklen_t addrlen);
+int iouring_iod_read(struct npool *nsp, int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen);
+int iouring_iod_write(struct npool *nsp, int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen);
+
+/* Connections are still initiated with a non-blocking connect(2): an
+ * IORING_OP_CONNECT would consume the pending socket error that
+ * handle_connect_result() reads back through SO_ERROR. Completion of the
+ * connection is waited for through the ring like any other readiness. */
+struct io_operations iouring_io_operations = {
+  posix_iod_connect,
+  iouring_iod_read,
+  iouring_iod_write
+};
+
+/* ---- ENGINE DEFINITION ---- */
+struct io_engine engine_iouring = {
+  "iouring",
+  iouring_init,
+  iouring_destroy,
+  iouring_iod_register,
+  iouring_iod_unregister,
+  iouring_iod_modify,
+  iouring_loop,
+  &iouring_io_operations
+};
+
+
+/* --- INTERNAL PROTOTYPES --- */
+static void iterate_through_event_lists(struct npool *nsp);
+
+/* defined in nsock_core.c */
+void process_iod_events(struct npool *nsp, struct niod *nsi, int ev);
+void process_event(struct npool *nsp, gh_list_t *evlist, struct nevent *nse, int ev);
+void process_expired_events(struct npool *nsp);
+#if HAVE_PCAP
+#ifndef PCAP_CAN_DO_SELECT
+int pcap_read_on_nonselect(struct npool *nsp);
+#endif
+#endif
+
+/* defined in nsock_event.c */
+void update_first_events(struct nevent *nse);
+
+
+extern struct timeval nsock_tod;
+
+
+/*
+ * Engine specific data structures
+ */
+enum uring_op_type {
+  UOP_READ,
+  UOP_WRITE,
+  UOP_POLL
+};
+
+/* A request submitted to the ring. Its address is the SQE user_data. */
+struct uring_op {
+  enum uring_op_type type;
+  /* descriptor this operation was submitted for */
+  int sd;
+  /* set once the IOD went away and the operation is only waiting for its
+   * completion to be released */
+  unsigned int orphan: 1;
+  unsigned int inflight: 1;
+  unsigned int cancelled: 1;
+  /* completion result (bytes transferred, revents or -errno) */
+  int res;
+
+  /* data buffer, either a registered chunk (bufidx >= 0) or the heap */
+  char *buf;
+  int bufidx;
+  int buflen;
+  /* bytes already handed over to nsock_core (reads) */
+  int consumed;
+  /* caller's buffer, used to recognize the retry of a write (writes) */
+  const void *src;
+
+  struct msghdr msg;
+  struct iovec iov;
+  struct sockaddr_storage addr;
+
+  gh_lnode_t node;
+};
+
+/* Per descriptor state, indexed by sd like the poll engine's pollfd array. */
+struct uring_slot {
+  struct niod *iod;
+  /* outstanding or completed-but-unconsumed read */
+  struct uring_op *rd;
+  /* outstanding or completed-but-unreported write */
+  struct uring_op *wr;
+  /* outstanding readiness poll, armed for poll_mask */
+  struct uring_op *poll;
+  int poll_mask;
+  /* events to report to nsock_core on the next dispatch */
+  int ready;
+  unsigned int dirty: 1;
+  unsigned int queued: 1;
+  unsigned int notsock: 1;
+};
+
+struct iouring_engine_info {
+  int ring_fd;
+
+  void *sq_ring;
+  size_t sq_ring_sz;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_entries;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  size_t sqes_sz;
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  /* registered buffer arena, nbufs chunks of READ_BUFFER_SZ bytes */
+  char *arena;
+  int nbufs;
+  int *free_bufs;
+  int nfree;
+
+  /* descriptor slots */
+  struct uring_slot *slots;
+  int capacity;
+  /* descriptors whose watched events changed since the last submission */
+  int *dirty;
+  int ndirty;
+  /* descriptors with events to report */
+  int *ready;
+  int nready;
+
+  /* submitted operations, including orphaned ones */
+  gh_list_t inflight;
+  /* recycled operation structures */
+  gh_list_t free_ops;
+};
+
+
+/* ---- RING HELPERS ---- */
+static inline unsigned load_acquire(unsigned *p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(unsigned *p, unsigned v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                                     unsigned flags, void *arg, size_t argsz) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static inline int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static inline unsigned sq_pending(struct iouring_engine_info *uinfo) {
+  return *uinfo->sq_tail - load_acquire(uinfo->sq_head);
+}
+
+/* Submit and optionally wait for completions. msec_timeout follows the
+ * engine loop convention: -1 waits forever, 0 does not wait at all. */
+static int ring_enter(struct iouring_engine_info *uinfo, int msec_timeout) {
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  unsigned flags = 0, min_complete = 0;
+  void *argp = NULL;
+  size_t argsz = 0;
+  unsigned to_submit = sq_pending(uinfo);
+  int rc;
+
+  if (msec_timeout != 0) {
+    flags |= IORING_ENTER_GETEVENTS;
+    min_complete = 1;
+    if (msec_timeout > 0) {
+      memset(&arg, 0, sizeof(arg));
+      ts.tv_sec = msec_timeout / 1000;
+      ts.tv_nsec = (msec_timeout % 1000) * 1000000LL;
+      arg.ts = (unsigned long long)(uintptr_t)&ts;
+      argp = &arg;
+      argsz = sizeof(arg);
+      flags |= IORING_ENTER_EXT_ARG;
+    }
+  } else if (to_submit == 0) {
+    return 0;
+  }
+
+  rc = sys_io_uring_enter(uinfo->ring_fd, to_submit, min_complete, flags, argp, argsz);
+  if (rc == -1 && errno == ETIME)
+    rc = 0;
+  return rc;
+}
+
+static struct io_uring_sqe *get_sqe(struct iouring_engine_info *uinfo) {
+  struct io_uring_sqe *sqe;
+  unsigned tail = *uinfo->sq_tail;
+  unsigned idx;
+
+  while (tail - load_acquire(uinfo->sq_head) >= *uinfo->sq_entries) {
+    /* The submission queue is full, flush it without waiting. */
+    if (ring_enter(uinfo, 0) == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+      fatal("Unable to submit io_uring requests: %s", strerror(errno));
+  }
+
+  idx = tail & *uinfo->sq_mask;
+  sqe = &uinfo->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  uinfo->sq_array[idx] = idx;
+  return sqe;
+}
+
+static inline void commit_sqe(struct iouring_engine_info *uinfo) {
+  store_release(uinfo->sq_tail, *uinfo->sq_tail + 1);
+}
+
+
+/* ---- OPERATIONS ---- */
+static struct uring_op *op_new(struct iouring_engine_info *uinfo, int sd, enum uring_op_type type) {
+  struct uring_op *op;
+  gh_lnode_t *lnode;
+
+  lnode = gh_list_pop(&uinfo->free_ops);
+  if (lnode)
+    op = container_of(lnode, struct uring_op, node);
+  else
+    op = (struct uring_op *)safe_malloc(sizeof(struct uring_op));
+
+  memset(op, 0, sizeof(*op));
+  op->type = type;
+  op->sd = sd;
+  op->bufidx = -1;
+  return op;
+}
+
+/* Attach a data buffer to an operation, preferring a registered chunk. */
+static void op_set_buffer(struct iouring_engine_info *uinfo, struct uring_op *op, int len) {
+  if (len <= READ_BUFFER_SZ && uinfo->nfree > 0) {
+    op->bufidx = uinfo->free_bufs[--uinfo->nfree];
+    op->buf = uinfo->arena + (size_t)op->bufidx * READ_BUFFER_SZ;
+  } else {
+    op->bufidx = -1;
+    op->buf = (char *)safe_malloc(len > 0 ? len : 1);
+  }
+  op->buflen = len;
+}
+
+static void op_free(struct iouring_engine_info *uinfo, struct uring_op *op) {
+  assert(!op->inflight);
+
+  if (op->bufidx >= 0)
+    uinfo->free_bufs[uinfo->nfree++] = op->bufidx;
+  else
+    free(op->buf);
+
+  gh_list_prepend(&uinfo->free_ops, &op->node);
+}
+
+static void op_submit(struct iouring_engine_info *uinfo, struct uring_op *op, struct io_uring_sqe *sqe) {
+  sqe->user_data = (unsigned long long)(uintptr_t)op;
+  commit_sqe(uinfo);
+  op->inflight = 1;
+  gh_list_append(&uinfo->inflight, &op->node);
+}
+
+static void op_cancel(struct iouring_engine_info *uinfo, struct uring_op *op) {
+  struct io_uring_sqe *sqe;
+
+  if (!op->inflight || op->cancelled)
+    return;
+
+  sqe = get_sqe(uinfo);
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = (unsigned long long)(uintptr_t)op;
+  /* user_data 0 marks completions nobody is waiting for */
+  sqe->user_data = 0;
+  commit_sqe(uinfo);
+  op->cancelled = 1;
+}
+
+/* Detach an operation from its descriptor. Reads and polls still in the
+ * kernel's hands get cancelled, writes are left to complete so that data we
+ * already accepted reaches the socket. The completion releases the operation. */
+static void op_orphan(struct iouring_engine_info *uinfo, struct uring_op *op) {
+  op->orphan = 1;
+  if (!op->inflight)
+    op_free(uinfo, op);
+  else if (op->type != UOP_WRITE)
+    op_cancel(uinfo, op);
+}
+
+static void arm_read(struct iouring_engine_info *uinfo, int sd, struct uring_slot *slot) {
+  struct io_uring_sqe *sqe;
+  struct uring_op *op;
+
+  op = op_new(uinfo, sd, UOP_READ);
+  op_set_buffer(uinfo, op, READ_BUFFER_SZ);
+
+  sqe = get_sqe(uinfo);
+  sqe->fd = sd;
+  if (slot->iod->peerlen == 0 && !slot->notsock) {
+    /* Unconnected socket: do_actual_read() wants to know the sender. */
+    op->iov.iov_base = op->buf;
+    op->iov.iov_len = op->buflen;
+    op->msg.msg_name = &op->addr;
+    op->msg.msg_namelen = sizeof(op->addr);
+    op->msg.msg_iov = &op->iov;
+    op->msg.msg_iovlen = 1;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->addr = (unsigned long long)(uintptr_t)&op->msg;
+    sqe->len = 1;
+  } else {
+    sqe->opcode = (op->bufidx >= 0) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->addr = (unsigned long long)(uintptr_t)op->buf;
+    sqe->len = op->buflen;
+    /* use the current file position, should this not be a socket */
+    sqe->off = (unsigned long long)-1;
+  }
+  op_submit(uinfo, op, sqe);
+  slot->rd = op;
+}
+
+static void arm_poll(struct iouring_engine_info *uinfo, int sd, struct uring_slot *slot, int ev) {
+  struct io_uring_sqe *sqe;
+  struct uring_op *op;
+  unsigned mask = POLL_X_FLAGS;
+
+  if (ev & EV_READ)
+    mask |= POLL_R_FLAGS;
+  if (ev & EV_WRITE)
+    mask |= POLL_W_FLAGS;
+#if __BYTE_ORDER == __BIG_ENDIAN
+  mask = (mask << 16) | (mask >> 16);
+#endif
+
+  op = op_new(uinfo, sd, UOP_POLL);
+  sqe = get_sqe(uinfo);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = sd;
+  sqe->poll32_events = mask;
+  op_submit(uinfo, op, sqe);
+  slot->poll = op;
+  slot->poll_mask = ev;
+}
+
+
+/* ---- DESCRIPTOR SLOTS ---- */
+static struct uring_slot *get_slot(struct iouring_engine_info *uinfo, int sd) {
+  if (sd >= uinfo->capacity) {
+    int i = uinfo->capacity;
+
+    if (uinfo->capacity == 0)
+      uinfo->capacity = INITIAL_SLOT_COUNT;
+    while (uinfo->capacity < sd + 1)
+      uinfo->capacity *= 2;
+
+    uinfo->slots = (struct uring_slot *)safe_realloc(uinfo->slots, sizeof(struct uring_slot) * uinfo->capacity);
+    uinfo->dirty = (int *)safe_realloc(uinfo->dirty, sizeof(int) * uinfo->capacity);
+    uinfo->ready = (int *)safe_realloc(uinfo->ready, sizeof(int) * uinfo->capacity);
+    memset(uinfo->slots + i, 0, sizeof(struct uring_slot) * (uinfo->capacity - i));
+  }
+  return &uinfo->slots[sd];
+}
+
+/* Returns the slot of a descriptor registered with the engine, or NULL. */
+static inline struct uring_slot *lookup_slot(struct iouring_engine_info *uinfo, int sd) {
+  if (sd < 0 || sd >= uinfo->capacity || uinfo->slots[sd].iod == NULL)
+    return NULL;
+  return &uinfo->slots[sd];
+}
+
+static inline void mark_dirty(struct iouring_engine_info *uinfo, int sd) {
+  struct uring_slot *slot = &uinfo->slots[sd];
+
+  if (!slot->dirty) {
+    slot->dirty = 1;
+    uinfo->dirty[uinfo->ndirty++] = sd;
+  }
+}
+
+static inline void mark_ready(struct iouring_engine_info *uinfo, int sd, int ev) {
+  struct uring_slot *slot = &uinfo->slots[sd];
+
+  slot->ready |= ev;
+  if (!slot->queued) {
+    slot->queued = 1;
+    uinfo->ready[uinfo->nready++] = sd;
+  }
+}
+
+/* IODs that nsock_core drives with readiness notifications rather than
+ * through iod_read/iod_write: pending connections (whose outcome is read with
+ * SO_ERROR), SSL (OpenSSL does its own I/O) and pcap descriptors. */
+static inline int needs_poll(struct niod *iod) {
+  if (iod->first_connect != NULL)
+    return 1;
+#if HAVE_OPENSSL
+  if (iod->ssl != NULL)
+    return 1;
+#endif
+#if HAVE_PCAP
+  if (iod->pcap != NULL)
+    return 1;
+#endif
+  return 0;
+}
+
+/* Bring the requests in flight for a descriptor in line with the events
+ * nsock_core is currently watching. Called once per loop for the descriptors
+ * that changed, so that every request ends up in a single submission. */
+static void sync_slot(struct iouring_engine_info *uinfo, int sd) {
+  struct uring_slot *slot = &uinfo->slots[sd];
+  int want;
+
+  slot->dirty = 0;
+  if (slot->iod == NULL)
+    return;
+
+  want = slot->iod->watched_events;
+
+  if (needs_poll(slot->iod)) {
+    int mask = want & (EV_READ | EV_WRITE);
+
+    if (slot->rd) {
+      op_orphan(uinfo, slot->rd);
+      slot->rd = NULL;
+    }
+    if (slot->wr) {
+      op_orphan(uinfo, slot->wr);
+      slot->wr = NULL;
+    }
+    if (slot->poll && slot->poll_mask != mask) {
+      op_orphan(uinfo, slot->poll);
+      slot->poll = NULL;
+    }
+    if (!slot->poll && mask)
+      arm_poll(uinfo, sd, slot, mask);
+    return;
+  }
+
+  if (slot->poll) {
+    op_orphan(uinfo, slot->poll);
+    slot->poll = NULL;
+  }
+
+  if (want & EV_READ) {
+    if (!slot->rd)
+      arm_read(uinfo, sd, slot);
+    else if (!slot->rd->inflight)
+      mark_ready(uinfo, sd, EV_READ);
+  } else if (slot->rd) {
+    /* Nobody wants to read anymore (the read timed out or was cancelled).
+     * Data that still arrives is kept for the next read. */
+    op_cancel(uinfo, slot->rd);
+  }
+
+  /* Writes are issued from iod_write() itself, as long as none is in flight
+   * the descriptor is writable as far as nsock_core is concerned. */
+  if ((want & EV_WRITE) && (!slot->wr || !slot->wr->inflight))
+    mark_ready(uinfo, sd, EV_WRITE);
+}
+
+static void release_slot(struct iouring_engine_info *uinfo, struct uring_slot *slot) {
+  if (slot->rd)
+    op_orphan(uinfo, slot->rd);
+  if (slot->wr)
+    op_orphan(uinfo, slot->wr);
+  if (slot->poll)
+    op_orphan(uinfo, slot->poll);
+
+  slot->iod = NULL;
+  slot->rd = NULL;
+  slot->wr = NULL;
+  slot->poll = NULL;
+  slot->poll_mask = 0;
+  slot->ready = 0;
+  slot->notsock = 0;
+}
+
+
+/* ---- COMPLETIONS ---- */
+static inline int get_evmask(int revents) {
+  int evmask = EV_NONE;
+
+  if (revents & POLL_R_FLAGS)
+    evmask |= EV_READ;
+  if (revents & POLL_W_FLAGS)
+    evmask |= EV_WRITE;
+  if (revents & POLL_X_FLAGS)
+    evmask |= (EV_READ | EV_WRITE | EV_EXCEPT);
+
+  return evmask;
+}
+
+static void handle_completion(struct iouring_engine_info *uinfo, struct uring_op *op, int res) {
+  struct uring_slot *slot;
+  int sd = op->sd;
+
+  gh_list_remove(&uinfo->inflight, &op->node);
+  op->inflight = 0;
+  op->res = res;
+
+  if (op->orphan) {
+    op_free(uinfo, op);
+    return;
+  }
+
+  slot = &uinfo->slots[sd];
+  assert(slot->iod != NULL);
+
+  switch (op->type) {
+    case UOP_READ:
+      if (res == -ECANCELED || res == -EINTR || res == -EAGAIN ||
+          (res == -ENOTSOCK && op->msg.msg_iov != NULL)) {
+        /* Nothing was read, re-arm if still needed. */
+        if (res == -ENOTSOCK)
+          slot->notsock = 1;
+        slot->rd = NULL;
+        op_free(uinfo, op);
+        mark_dirty(uinfo, sd);
+      } else if (slot->iod->watched_events & EV_READ) {
+        mark_ready(uinfo, sd, EV_READ);
+      }
+      break;
+
+    case UOP_WRITE:
+      if (slot->iod->watched_events & EV_WRITE) {
+        mark_ready(uinfo, sd, EV_WRITE);
+      } else {
+        slot->wr = NULL;
+        op_free(uinfo, op);
+      }
+      break;
+
+    case UOP_POLL:
+      /* Polls are one-shot, have the descriptor re-armed if needed. */
+      slot->poll = NULL;
+      op_free(uinfo, op);
+      if (res > 0)
+        mark_ready(uinfo, sd, get_evmask(res));
+      mark_dirty(uinfo, sd);
+      break;
+  }
+}
+
+static void reap_completions(struct iouring_engine_info *uinfo) {
+  unsigned head = *uinfo->cq_head;
+
+  while (head != load_acquire(uinfo->cq_tail)) {
+    struct io_uring_cqe *cqe = &uinfo->cqes[head & *uinfo->cq_mask];
+    struct uring_op *op = (struct uring_op *)(uintptr_t)cqe->user_data;
+    int res = cqe->res;
+
+    store_release(uinfo->cq_head, ++head);
+    if (op != NULL)
+      handle_completion(uinfo, op, res);
+  }
+}
+
+
+/* ---- ENGINE INTERFACE ---- */
+int iouring_init(struct npool *nsp) {
+  struct iouring_engine_info *uinfo;
+  struct io_uring_params params;
+  size_t sq_sz, cq_sz;
+  char *ring;
+  int n;
+
+  uinfo = (struct iouring_engine_info *)safe_zalloc(sizeof(struct iouring_engine_info));
+
+  memset(&params, 0, sizeof(params));
+  uinfo->ring_fd = sys_io_uring_setup(IOURING_ENTRIES, &params);
+  if (uinfo->ring_fd < 0)
+    fatal("Unable to create io_uring instance: %s", strerror(errno));
+
+  /* IORING_FEAT_EXT_ARG (Linux 5.11) gives us timed waits without a timeout
+   * request and implies the single ring mapping. */
+  if (!(params.features & IORING_FEAT_EXT_ARG) ||
+      !(params.features & IORING_FEAT_NODROP) ||
+      !(params.features & IORING_FEAT_SINGLE_MMAP))
+    fatal("The iouring engine needs Linux 5.11 or later");
+
+  sq_sz = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_sz = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  uinfo->sq_ring_sz = MAX(sq_sz, cq_sz);
+  uinfo->sq_ring = mmap(NULL, uinfo->sq_ring_sz, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, uinfo->ring_fd, IORING_OFF_SQ_RING);
+  if (uinfo->sq_ring == MAP_FAILED)
+    fatal("Unable to map io_uring: %s", strerror(errno));
+
+  uinfo->sqes_sz = params.sq_entries * sizeof(struct io_uring_sqe);
+  uinfo->sqes = (struct io_uring_sqe *)mmap(NULL, uinfo->sqes_sz, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, uinfo->ring_fd, IORING_OFF_SQES);
+  if (uinfo->sqes == MAP_FAILED)
+    fatal("Unable to map io_uring: %s", strerror(errno));
+
+  ring = (char *)uinfo->sq_ring;
+  uinfo->sq_head = (unsigned *)(ring + params.sq_off.head);
+  uinfo->sq_tail = (unsigned *)(ring + params.sq_off.tail);
+  uinfo->sq_mask = (unsigned *)(ring + params.sq_off.ring_mask);
+  uinfo->sq_entries = (unsigned *)(ring + params.sq_off.ring_entries);
+  uinfo->sq_array = (unsigned *)(ring + params.sq_off.array);
+  uinfo->cq_head = (unsigned *)(ring + params.cq_off.head);
+  uinfo->cq_tail = (unsigned *)(ring + params.cq_off.tail);
+  uinfo->cq_mask = (unsigned *)(ring + params.cq_off.ring_mask);
+  uinfo->cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+
+  /* Register the buffer arena. Pinned memory counts against RLIMIT_MEMLOCK,
+   * so retry with fewer chunks and live without fixed buffers if needed. */
+  uinfo->arena = (char *)safe_malloc((size_t)IOURING_BUFFERS * READ_BUFFER_SZ);
+  for (n = IOURING_BUFFERS; n >= 8; n /= 2) {
+    struct iovec iov;
+
+    iov.iov_base = uinfo->arena;
+    iov.iov_len = (size_t)n * READ_BUFFER_SZ;
+    if (sys_io_uring_register(uinfo->ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0)
+      break;
+  }
+  if (n < 8) {
+    nsock_log_info("io_uring buffer registration failed (%s), using plain buffers",
+                   strerror(errno));
+    free(uinfo->arena);
+    uinfo->arena = NULL;
+    n = 0;
+  }
+  uinfo->nbufs = n;
+  uinfo->free_bufs = (int *)safe_malloc(sizeof(int) * (n > 0 ? n : 1));
+  for (uinfo->nfree = 0; uinfo->nfree < n; uinfo->nfree++)
+    uinfo->free_bufs[uinfo->nfree] = n - 1 - uinfo->nfree;
+
+  gh_list_init(&uinfo->inflight);
+  gh_list_init(&uinfo->free_ops);
+  get_slot(uinfo, 0);
+
+  nsp->engine_data = (void *)uinfo;
+
+  return 1;
+}
+
+void iouring_destroy(struct npool *nsp) {
+  struct iouring_engine_info *uinfo = (struct iouring_engine_info *)nsp->engine_data;
+  gh_lnode_t *lnode;
+  int tries;
+
+  assert(uinfo != NULL);
+
+  /* Cancel whatever is still in flight and give the kernel a chance to let go
+   * of our buffers before releasing them. */
+  for (lnode = gh_list_first_elem(&uinfo->inflight); lnode; lnode = gh_lnode_next(lnode)) {
+    struct uring_op *op = container_of(lnode, struct uring_op, node);
+
+    op->orphan = 1;
+    op_cancel(uinfo, op);
+  }
+  for (tries = 0; gh_list_count(&uinfo->inflight) > 0 && tries < 10; tries++) {
+    if (ring_enter(uinfo, 100) == -1 && errno != EINTR)
+      break;
+    reap_completions(uinfo);
+  }
+
+  close(uinfo->ring_fd);
+  munmap(uinfo->sqes, uinfo->sqes_sz);
+  munmap(uinfo->sq_ring, uinfo->sq_ring_sz);
+
+  /* Don't hand memory the kernel may still write to back to the allocator. */
+  if (gh_list_count(&uinfo->inflight) == 0) {
+    while ((lnode = gh_list_pop(&uinfo->free_ops)) != NULL)
+      free(container_of(lnode, struct uring_op, node));
+    free(uinfo->arena);
+  }
+
+  free(uinfo->free_bufs);
+  free(uinfo->slots);
+  free(uinfo->dirty);
+  free(uinfo->ready);
+  free(uinfo);
+}
+
+int iouring_iod_register(struct npool *nsp, struct niod *iod, struct nevent *nse, int ev) {
+  struct iouring_engine_info *uinfo = (struct iouring_engine_info *)nsp->engine_data;
+  struct uring_slot *slot;
+  int sd;
+
+  assert(!IOD_PROPGET(iod, IOD_REGISTERED));
+
+  iod->watched_events = ev;
+
+  sd = nsock_iod_get_sd(iod);
+  slot = get_slot(uinfo, sd);
+  assert(slot->iod == NULL);
+  slot->iod = iod;
+  mark_dirty(uinfo, sd);
+
+  IOD_PROPSET(iod, IOD_REGISTERED);
+  return 1;
+}
+
+int iouring_iod_unregister(struct npool *nsp, struct niod *iod) {
+  iod->watched_events = EV_NONE;
+
+  /* some IODs can be unregistered here if they're associated to an event that was
+   * immediately completed */
+  if (IOD_PROPGET(iod, IOD_REGISTERED)) {
+    struct iouring_engine_info *uinfo = (struct iouring_engine_info *)nsp->engine_data;
+    int sd;
+
+    sd = nsock_iod_get_sd(iod);
+    release_slot(uinfo, &uinfo->slots[sd]);
+
+    /* The descriptor is about to be closed and its number reused: requests
+     * still sitting in the submission queue must reach the kernel now. */
+    if (sq_pending(uinfo) > 0)
+      ring_enter(uinfo, 0);
+
+    IOD_PROPCLR(iod, IOD_REGISTERED);
+  }
+  return 1;
+}
+
+int iouring_iod_modify(struct npool *nsp, struct niod *iod, struct nevent *nse, int ev_set, int ev_clr) {
+  struct iouring_engine_info *uinfo = (struct iouring_engine_info *)nsp->engine_data;
+
+  assert((ev_set & ev_clr) == 0);
+  assert(IOD_PROPGET(iod, IOD_REGISTERED));
+
+  iod->watched_events |= ev_set;
+  iod->watched_events &= ~ev_clr;
+
+  /* Even without a change in the watched events, the IOD may have switched
+   * to SSL or finished connecting. Requests are issued by the next loop. */
+  mark_dirty(uinfo, nsock_iod_get_sd(iod));
+  return 1;
+}
+
+int iouring_loop(struct npool *nsp, int msec_timeout) {
+  int results_left = 0;
+  int event_msecs; /* msecs before an event goes off */
+  int combined_msecs;
+  int sock_err = 0;
+  int i;
+  struct iouring_engine_info *uinfo = (struct iouring_engine_info *)nsp->engine_data;
+
+  assert(msec_timeout >= -1);
+
+  if (nsp->events_pending == 0)
+    return 0; /* No need to wait on 0 events ... */
+
+  for (i = 0; i < uinfo->ndirty; i++)
+    sync_slot(uinfo, uinfo->dirty[i]);
+  uinfo->ndirty = 0;
+
+  do {
+    nsock_log_debug_all("wait for events");
+
+    /* -1 if none of the events specified a timeout */
+    event_msecs = next_expirable_msecs(nsp);
+
+#if HAVE_PCAP
+#ifndef PCAP_CAN_DO_SELECT
+    /* Force a low timeout when capturing packets on systems where
+     * the pcap descriptor is not select()able. */
+    if (gh_list_count(&nsp->pcap_read_events) > 0)
+      if (event_msecs > PCAP_POLL_INTERVAL)
+        event_msecs = PCAP_POLL_INTERVAL;
+#endif
+#endif
+
+    /* We cast to unsigned because we want -1 to be very high (since it means no
+     * timeout) */
+    combined_msecs = MIN((unsigned)event_msecs, (unsigned)msec_timeout);
+
+    /* Don't sleep if there is already something to report. */
+    if (uinfo->nready > 0 || *uinfo->cq_head != load_acquire(uinfo->cq_tail))
+      combined_msecs = 0;
+
+#if HAVE_PCAP
+#ifndef PCAP_CAN_DO_SELECT
+    /* do non-blocking read on pcap devices that doesn't support select()
+     * If there is anything read, just leave this loop. */
+    if (pcap_read_on_nonselect(nsp)) {
+      /* okay, something was read. */
+      ring_enter(uinfo, 0);
+    } else
+#endif
+#endif
+    {
+      /* Submit everything queued since the last iteration and wait, in a
+       * single system call. */
+      results_left = ring_enter(uinfo, combined_msecs);
+      if (results_left == -1)
+        sock_err = socket_errno();
+    }
+
+    gettimeofday(&nsock_tod, NULL); /* Due to io_uring delay */
+  } while (results_left == -1 && sock_err == EINTR); /* repeat only if signal occurred */
+
+  if (results_left == -1 && sock_err != EINTR) {
+    nsock_log_error("nsock_loop error %d: %s", sock_err, socket_strerror(sock_err));
+    nsp->errnum = sock_err;
+    return -1;
+  }
+
+  reap_completions(uinfo);
+  iterate_through_event_lists(nsp);
+
+  return 1;
+}
+
+
+/* ---- I/O OPERATIONS ---- */
+int posix_iod_write(struct npool *nsp, int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen);
+
+/* Hand over data that a completed read request brought in. Descriptors
+ * without such a request (e.g. notified through a poll) are read directly. */
+int iouring_iod_read(struct npool *nsp, int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen) {
+  struct iouring_engine_info *uinfo = (struct iouring_engine_info *)nsp->engine_data;
+  struct uring_slot *slot;
+  struct uring_op *op;
+  size_t n;
+
+  slot = lookup_slot(uinfo, sockfd);
+  if (slot == NULL || slot->rd == NULL)
+    return recvfrom(sockfd, (char *)buf, len, flags, src_addr, addrlen);
+
+  op = slot->rd;
+  if (op->inflight) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  /* Have the next read issued, if nsock_core still wants one. */
+  mark_dirty(uinfo, sockfd);
+
+  if (op->res < 0) {
+    errno = -op->res;
+    slot->rd = NULL;
+    op_free(uinfo, op);
+    return -1;
+  }
+
+  n = MIN(len, (size_t)(op->res - op->consumed));
+  memcpy(buf, op->buf + op->consumed, n);
+  op->consumed += n;
+
+  if (addrlen != NULL) {
+    socklen_t namelen = (op->msg.msg_iov != NULL) ? op->msg.msg_namelen : 0;
+
+    if (src_addr != NULL && namelen > 0)
+      memcpy(src_addr, &op->addr, MIN(namelen, *addrlen));
+    *addrlen = namelen;
+  }
+
+  if (op->consumed >= op->res) {
+    slot->rd = NULL;
+    op_free(uinfo, op);
+  }
+  return (int)n;
+}
+
+/* Writes complete in two steps: the first call copies the data and queues a
+ * request, reporting EAGAIN. Once the request completed the IOD is reported
+ * writable again and nsock_core's retry with the same data gets the result. */
+int iouring_iod_write(struct npool *nsp, int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen) {
+  struct iouring_engine_info *uinfo = (struct iouring_engine_info *)nsp->engine_data;
+  struct sockaddr_storage *dest = (struct sockaddr_storage *)dest_addr;
+  struct io_uring_sqe *sqe;
+  struct uring_slot *slot;
+  struct uring_op *op;
+
+  slot = lookup_slot(uinfo, sockfd);
+  if (slot == NULL)
+    return posix_iod_write(nsp, sockfd, buf, len, flags, dest_addr, addrlen);
+
+  op = slot->wr;
+  if (op != NULL) {
+    int res = op->res;
+
+    if (op->inflight) {
+      errno = EAGAIN;
+      return -1;
+    }
+
+    slot->wr = NULL;
+    mark_dirty(uinfo, sockfd);
+    if (op->src == buf && (size_t)op->buflen <= len && memcmp(op->buf, buf, op->buflen) == 0
+        && res != -EAGAIN && res != -EINTR) {
+      op_free(uinfo, op);
+      if (res < 0) {
+        errno = -res;
+        return -1;
+      }
+      return res;
+    }
+    /* Stale result (the write it belonged to is gone) or nothing written. */
+    op_free(uinfo, op);
+  }
+
+  op = op_new(uinfo, sockfd, UOP_WRITE);
+  op_set_buffer(uinfo, op, (int)len);
+  memcpy(op->buf, buf, len);
+  op->src = buf;
+
+  sqe = get_sqe(uinfo);
+  sqe->fd = sockfd;
+  if (dest->ss_family == AF_UNSPEC) {
+    sqe->opcode = (op->bufidx >= 0) ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->addr = (unsigned long long)(uintptr_t)op->buf;
+    sqe->len = op->buflen;
+    sqe->off = (unsigned long long)-1;
+  } else {
+    assert(addrlen <= sizeof(op->addr));
+    memcpy(&op->addr, dest_addr, addrlen);
+    op->iov.iov_base = op->buf;
+    op->iov.iov_len = op->buflen;
+    op->msg.msg_name = &op->addr;
+    op->msg.msg_namelen = addrlen;
+    op->msg.msg_iov = &op->iov;
+    op->msg.msg_iovlen = 1;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->addr = (unsigned long long)(uintptr_t)&op->msg;
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+  }
+  op_submit(uinfo, op, sqe);
+  slot->wr = op;
+
+  errno = EAGAIN;
+  return -1;
+}
+
+
+/* ---- INTERNAL FUNCTIONS ---- */
+
+/* Iterate through all the event lists (such as connect_events, read_events,
+ * timer_events, etc) and take action for those that have completed (due to
+ * timeout, i/o, etc) */
+void iterate_through_event_lists(struct npool *nsp) {
+  struct iouring_engine_info *uinfo = (struct iouring_engine_info *)nsp->engine_data;
+  int n;
+
+  for (n = 0; n < uinfo->nready; n++) {
+    struct uring_slot *slot = &uinfo->slots[uinfo->ready[n]];
+    struct niod *nsi = slot->iod;
+    int ev = slot->ready;
+
+    slot->ready = 0;
+    slot->queued = 0;
+    if (nsi == NULL || ev == EV_NONE)
+      continue;
+
+    /* process all the pending events for this IOD */
+    process_iod_events(nsp, nsi, ev);
+
+    if (nsi->state == NSIOD_STATE_DELETED) {
+      gh_list_remove(&nsp->active_iods, &nsi->nodeq);
+      gh_list_prepend(&nsp->free_iods, &nsi->nodeq);
+    }
+  }
+  uinfo->nready = 0;
+
+  /* iterate through timers and expired events */
+  process_expired_events(nsp);
+}
+
+#endif /* HAVE_IO_URING */
@@ -62,15 +62,82 @@
 
 #define FS_INITSIZE_DEFAULT 1024
 
+static const int fs_pool_class_size[FS_POOL_CLASSES] = {
+  1024, 4096, 16384, 65536
+};
+
+
+/* Returns the index of the smallest size class fitting size, or -1. */
+static int fs_pool_class(int size) {
+  int i;
+
+  for (i = 0; i < FS_POOL_CLASSES; i++)
+    if (size <= fs_pool_class_size[i])
+      return i;
+  return -1;
+}
+
+/* Get a buffer of at least *size bytes, updating *size to the actual size. */
+static char *fs_buf_get(struct fs_pool *pool, int *size) {
+  int cls;
+
+  if (pool == NULL)
+    return (char *)safe_malloc(*size);
+
+  cls = fs_pool_class(*size);
+  if (cls < 0) {
+    pool->oversized++;
+    return (char *)safe_malloc(*size);
+  }
+
+  *size = fs_pool_class_size[cls];
+  if (pool->count[cls] > 0) {
+    pool->hits[cls]++;
+    return pool->bufs[cls][--pool->count[cls]];
+  }
+  pool->misses[cls]++;
+  return (char *)safe_malloc(*size);
+}
+
+static void fs_buf_put(struct fs_pool *pool, char *buf, int size) {
+  int cls;
+
+  if (pool != NULL) {
+    cls = fs_pool_class(size);
+    if (cls >= 0 && fs_pool_class_size[cls] == size && pool->count[cls] < FS_POOL_DEPTH) {
+      pool->bufs[cls][pool->count[cls]++] = buf;
+      return;
+    }
+  }
+  free(buf);
+}
+
+void fs_pool_init(struct fs_pool *pool) {
+  memset(pool, 0, sizeof(struct fs_pool));
+}
+
+void fs_pool_free(struct fs_pool *pool) {
+  int i;
+
+  for (i = 0; i < FS_POOL_CLASSES; i++) {
+    while (pool->count[i] > 0)
+      free(pool->bufs[i][--pool->count[i]]);
+  }
+}
 
 /* Assumes space for fs has already been allocated */
 int filespace_init(struct filespace *fs, int initial_size) {
+  return filespace_init_pooled(fs, initial_size, NULL);
+}
+
+int filespace_init_pooled(struct filespace *fs, int initial_size, struct fs_pool *pool) {
   memset(fs, 0, sizeof(struct filespace));
   if (initial_size == 0)
     initial_size = FS_INITSIZE_DEFAULT;
 
+  fs->pool = pool;
   fs->current_alloc = initial_size;
-  fs->str = (char *)safe_malloc(fs->current_alloc);
+  fs->str = fs_buf_get(pool, &fs->current_alloc);
   fs->str[0] = '\0';
   fs->pos = fs->str;
   return 0;
@@ -78,13 +145,37 @@ int filespace_init(struct filespace *fs, int initial_size) {
 
 int fs_free(struct filespace *fs) {
   if (fs->str)
-    free(fs->str);
+    fs_buf_put(fs->pool, fs->str, fs->current_alloc);
 
   fs->current_alloc = fs->current_size = 0;
   fs->pos = fs->str = NULL;
   return 0;
 }
 
+/* Grow the filespace so that it can take len more bytes and a terminating
+ * NUL. */
+static void fs_grow(struct filespace *fs, int len) {
+  char *tmpstr;
+  int newalloc;
+
+  if (fs->current_alloc - fs->current_size >= len + 2)
+    return;
+
+  newalloc = (int)(fs->current_alloc * 1.4 + 1);
+  newalloc += 100 + len;
+
+  tmpstr = fs_buf_get(fs->pool, &newalloc);
+  memcpy(tmpstr, fs->str, fs->current_size);
+
+  fs->pos = (fs->pos - fs->str) + tmpstr;
+
+  if (fs->str)
+    fs_buf_put(fs->pool, fs->str, fs->current_alloc);
+
+  fs->str = tmpstr;
+  fs->current_alloc = newalloc;
+}
+
 /* Concatenate a string to the end of a filespace */
 int fs_cat(struct filespace *fs, const char *str, int len) {
   if (len < 0)
@@ -93,22 +184,7 @@ int fs_cat(struct filespace *fs, const char *str, int len) {
   if (len == 0)
     return 0;
 
-  if (fs->current_alloc - fs->current_size < len + 2) {
-    char *tmpstr;
-
-    fs->current_alloc = (int)(fs->current_alloc * 1.4 + 1);
-    fs->current_alloc += 100 + len;
-
-    tmpstr = (char *)safe_malloc(fs->current_alloc);
-    memcpy(tmpstr, fs->str, fs->current_size);
-
-    fs->pos = (fs->pos - fs->str) + tmpstr;
-
-    if (fs->str)
-      free(fs->str);
-
-    fs->str = tmpstr;
-  }
+  fs_grow(fs, len);
   memcpy(fs->str + fs->current_size, str, len);
 
   fs->current_size += len;
@@ -116,3 +192,13 @@ int fs_cat(struct filespace *fs, const char *str, int len) {
   return 0;
 }
 
+char *fs_reserve(struct filespace *fs, int len) {
+  fs_grow(fs, len);
+  return fs->str + fs->current_size;
+}
+
+void fs_commit(struct filespace *fs, int n) {
+  assert(n >= 0 && fs->current_size + n < fs->current_alloc);
+  fs->current_size += n;
+  fs->str[fs->current_size] = '\0';
+}
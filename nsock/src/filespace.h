@@ -77,6 +77,24 @@
 #endif
 
 
+/* Number of buffer sizes recycled by a struct fs_pool (1KB to 64KB) and
+ * number of buffers kept for each of them. */
+#define FS_POOL_CLASSES 4
+#define FS_POOL_DEPTH   64
+
+/* Size-classed cache of filespace buffers, so that read-heavy users don't go
+ * through malloc()/free() for every event. */
+struct fs_pool {
+  char *bufs[FS_POOL_CLASSES][FS_POOL_DEPTH];
+  int count[FS_POOL_CLASSES];
+
+  /* Statistics: buffers served from / missing in the cache, and requests too
+   * large for any size class */
+  unsigned long hits[FS_POOL_CLASSES];
+  unsigned long misses[FS_POOL_CLASSES];
+  unsigned long oversized;
+};
+
 struct filespace {
   int current_size;
   int current_alloc;
@@ -84,6 +102,9 @@ struct filespace {
   /* Current position in the filespace */
   char *pos;
   char *str;
+
+  /* Buffer cache str comes from and returns to, NULL for plain malloc() */
+  struct fs_pool *pool;
 };
 
 
@@ -98,9 +119,22 @@ static inline char *fs_str(const struct filespace *fs) {
 
 int filespace_init(struct filespace *fs, int initial_size);
 
+int filespace_init_pooled(struct filespace *fs, int initial_size, struct fs_pool *pool);
+
 int fs_free(struct filespace *fs);
 
 int fs_cat(struct filespace *fs, const char *str, int len);
 
+/* Make room for len more bytes and return where they should be written, so
+ * that data can be received straight into the filespace. fs_commit() then
+ * accounts for the n bytes actually written. */
+char *fs_reserve(struct filespace *fs, int len);
+
+void fs_commit(struct filespace *fs, int n);
+
+void fs_pool_init(struct fs_pool *pool);
+
+void fs_pool_free(struct fs_pool *pool);
+
 #endif /* FILESPACE_H */
 
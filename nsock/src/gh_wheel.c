@@ -0,0 +1,391 @@
+/***************************************************************************
+ * gh_wheel.c -- hashed hierarchical timing wheel.                         *
+ *                                                                         *
+ ***********************IMPORTANT NSOCK LICENSE TERMS***********************
+ *                                                                         *
+ * The nsock parallel socket event library is (C) 1999-2016 Insecure.Com   *
+ * LLC This library is free software; you may redistribute and/or          *
+ * modify it under the terms of the GNU General Public License as          *
+ * published by the Free Software Foundation; Version 2.  This guarantees  *
+ * your right to use, modify, and redistribute this software under certain *
+ * conditions.  If this license is unacceptable to you, Insecure.Com LLC   *
+ * may be willing to sell alternative licenses (contact                    *
+ * sales@insecure.com ).                                                   *
+ *                                                                         *
+ * As a special exception to the GPL terms, Insecure.Com LLC grants        *
+ * permission to link the code of this program with any version of the     *
+ * OpenSSL library which is distributed under a license identical to that  *
+ * listed in the included docs/licenses/OpenSSL.txt file, and distribute   *
+ * linked combinations including the two. You must obey the GNU GPL in all *
+ * respects for all of the code used other than OpenSSL.  If you modify    *
+ * this file, you may extend this exception to your version of the file,   *
+ * but you are not obligated to do so.                                     *
+ *                                                                         *
+ * If you received these files with a written license agreement stating    *
+ * terms other than the (GPL) terms above, then that alternative license   *
+ * agreement takes precedence over this comment.                           *
+ *                                                                         *
+ * Source is provided to this software because we believe users have a     *
+ * right to know exactly what a program is going to do before they run it. *
+ * This also allows you to audit the software for security holes.          *
+ *                                                                         *
+ * Source code also allows you to port Nmap to new platforms, fix bugs,    *
+ * and add new features.  You are highly encouraged to send your changes   *
+ * to the dev@nmap.org mailing list for possible incorporation into the    *
+ * main distribution.  By sending these changes to Fyodor or one of the    *
+ * Insecure.Org development mailing lists, or checking them into the Nmap  *
+ * source code repository, it is understood (unless you specify otherwise) *
+ * that you are offering the Nmap Project (Insecure.Com LLC) the           *
+ * unlimited, non-exclusive right to reuse, modify, and relicense the      *
+ * code.  Nmap will always be available Open Source, but this is important *
+ * because the inability to relicense code has caused devastating problems *
+ * for other Free Software projects (such as KDE and NASM).  We also       *
+ * occasionally relicense the code to third parties as discussed above.    *
+ * If you wish to specify special license conditions of your               *
+ * contributions, just say so when you send them.                          *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * General Public License v2.0 for more details                            *
+ * (http://www.gnu.org/licenses/gpl-2.0.html).                             *
+ *                                                                         *
+ ***************************************************************************/
+
+/* $Id$ */
+
+#ifdef HAVE_CONFIG_H
+#include "nsock_config.h"
+#include "nbase_config.h"
+#endif
+
+#ifdef WIN32
+#include "nbase_winconfig.h"
+#endif
+
+#include <nbase.h>
+#include "gh_wheel.h"
+
+#define LEVEL_SHIFT(level)  ((level) * GH_WHEEL_SLOT_BITS)
+#define SLOT_BIT(slot)      ((uint64_t)1 << (slot))
+
+/* Number of ticks covered by the whole wheel */
+#define WHEEL_SPAN          ((uint64_t)1 << LEVEL_SHIFT(GH_WHEEL_LEVELS))
+
+
+static int first_bit(uint64_t bits) {
+  assert(bits != 0);
+#if defined(__GNUC__)
+  return __builtin_ctzll(bits);
+#else
+  {
+    int i = 0;
+
+    while (!(bits & 1)) {
+      bits >>= 1;
+      i++;
+    }
+    return i;
+  }
+#endif
+}
+
+/* Rotate bits right so that bit number pos ends up in position zero */
+static uint64_t rotate_bits(uint64_t bits, unsigned int pos) {
+  pos &= GH_WHEEL_SLOT_MASK;
+  if (pos == 0)
+    return bits;
+  return (bits >> pos) | (bits << (GH_WHEEL_SLOTS - pos));
+}
+
+static void queue_init(gh_wnode_t *head, unsigned int queue) {
+  head->next = head;
+  head->prev = head;
+  head->expires = 0;
+  head->queue = queue;
+}
+
+static int queue_is_empty(const gh_wnode_t *head) {
+  return head->next == head;
+}
+
+static int node_is_head(gh_wheel_t *wheel, const gh_wnode_t *node) {
+  return node == &wheel->queues[node->queue];
+}
+
+static void queue_append(gh_wnode_t *head, gh_wnode_t *node) {
+  node->next = head;
+  node->prev = head->prev;
+  head->prev->next = node;
+  head->prev = node;
+  node->queue = head->queue;
+}
+
+static void queue_unlink(gh_wnode_t *node) {
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  node->next = NULL;
+  node->prev = NULL;
+}
+
+/* Move all the nodes of src at the end of dst */
+static void queue_splice(gh_wnode_t *dst, gh_wnode_t *src) {
+  gh_wnode_t *node;
+
+  if (queue_is_empty(src))
+    return;
+
+  for (node = src->next; node != src; node = node->next)
+    node->queue = dst->queue;
+
+  src->next->prev = dst->prev;
+  dst->prev->next = src->next;
+  src->prev->next = dst;
+  dst->prev = src->prev;
+  queue_init(src, src->queue);
+}
+
+/* Link node in the slot matching its expiration time, relatively to the
+ * current position of the wheel. Does not update the node count. */
+static void wheel_place(gh_wheel_t *wheel, gh_wnode_t *node) {
+  uint64_t delta, when;
+  unsigned int level, slot;
+
+  if (node->expires < wheel->now) {
+    /* Already due */
+    queue_append(&wheel->queues[GH_WHEEL_EXPIRED], node);
+    return;
+  }
+
+  when = node->expires;
+  delta = when - wheel->now;
+  if (delta >= WHEEL_SPAN) {
+    /* Too far ahead, park it in the last level. It will be placed again when
+     * its slot gets cascaded. */
+    delta = WHEEL_SPAN - 1;
+    when = wheel->now + delta;
+  }
+
+  for (level = 0; level < GH_WHEEL_LEVELS - 1; level++) {
+    if (delta < ((uint64_t)1 << LEVEL_SHIFT(level + 1)))
+      break;
+  }
+
+  slot = (unsigned int)(when >> LEVEL_SHIFT(level)) & GH_WHEEL_SLOT_MASK;
+  queue_append(&wheel->queues[level * GH_WHEEL_SLOTS + slot], node);
+  wheel->occupied[level] |= SLOT_BIT(slot);
+}
+
+/* Called when the wheel enters a new level 0 round: redistribute the nodes of
+ * the upper level slots that are now current into the lower levels. */
+static void wheel_cascade(gh_wheel_t *wheel) {
+  unsigned int level;
+
+  for (level = 1; level < GH_WHEEL_LEVELS; level++) {
+    unsigned int slot;
+
+    slot = (unsigned int)(wheel->now >> LEVEL_SHIFT(level)) & GH_WHEEL_SLOT_MASK;
+
+    if (wheel->occupied[level] & SLOT_BIT(slot)) {
+      gh_wnode_t *head = &wheel->queues[level * GH_WHEEL_SLOTS + slot];
+      gh_wnode_t *node, *next;
+
+      /* Detach the chain first, as nodes may be placed in this very slot
+       * again */
+      node = head->next;
+      head->prev->next = NULL;
+      queue_init(head, head->queue);
+      wheel->occupied[level] &= ~SLOT_BIT(slot);
+
+      for (; node != NULL; node = next) {
+        next = node->next;
+        wheel_place(wheel, node);
+      }
+    }
+
+    if (slot != 0)
+      break;
+  }
+}
+
+/* Move every node expiring up to tick now (included) to the expired queue */
+static void wheel_advance(gh_wheel_t *wheel, uint64_t now) {
+  gh_wnode_t *expired = &wheel->queues[GH_WHEEL_EXPIRED];
+
+  while (wheel->now <= now) {
+    unsigned int level, slot;
+    uint64_t bits, next;
+
+    for (level = 0; level < GH_WHEEL_LEVELS; level++) {
+      if (wheel->occupied[level])
+        break;
+    }
+
+    if (level == GH_WHEEL_LEVELS) {
+      /* Nothing scheduled, no need to turn the wheel tick by tick */
+      wheel->now = now + 1;
+      break;
+    }
+
+    slot = (unsigned int)wheel->now & GH_WHEEL_SLOT_MASK;
+    if (slot == 0)
+      wheel_cascade(wheel);
+
+    if (wheel->occupied[0] & SLOT_BIT(slot)) {
+      queue_splice(expired, &wheel->queues[slot]);
+      wheel->occupied[0] &= ~SLOT_BIT(slot);
+    }
+
+    /* Skip empty slots up to the next occupied one or to the end of the
+     * round, where upper levels need to be cascaded. */
+    bits = wheel->occupied[0] >> slot;
+    if (bits)
+      next = wheel->now + first_bit(bits);
+    else
+      next = (wheel->now | GH_WHEEL_SLOT_MASK) + 1;
+
+    wheel->now = MIN(next, now + 1);
+  }
+}
+
+int gh_wheel_init(gh_wheel_t *wheel, uint64_t now) {
+  unsigned int i;
+
+  wheel->now = now;
+  wheel->count = 0;
+
+  for (i = 0; i < GH_WHEEL_LEVELS; i++)
+    wheel->occupied[i] = 0;
+
+  for (i = 0; i < GH_WHEEL_QUEUES; i++)
+    queue_init(&wheel->queues[i], i);
+
+  return 0;
+}
+
+void gh_wheel_free(gh_wheel_t *wheel) {
+  memset(wheel, 0, sizeof(gh_wheel_t));
+}
+
+int gh_wheel_add(gh_wheel_t *wheel, gh_wnode_t *node, uint64_t expires) {
+  assert(!gh_wnode_is_valid(node));
+
+  node->expires = expires;
+  wheel_place(wheel, node);
+  wheel->count++;
+  return 0;
+}
+
+int gh_wheel_remove(gh_wheel_t *wheel, gh_wnode_t *node) {
+  unsigned int queue = node->queue;
+
+  assert(gh_wnode_is_valid(node));
+  assert(queue < GH_WHEEL_QUEUES);
+  assert(wheel->count > 0);
+
+  queue_unlink(node);
+
+  if (queue != GH_WHEEL_EXPIRED && queue_is_empty(&wheel->queues[queue]))
+    wheel->occupied[queue / GH_WHEEL_SLOTS] &= ~SLOT_BIT(queue % GH_WHEEL_SLOTS);
+
+  gh_wnode_invalidate(node);
+  wheel->count--;
+  return 0;
+}
+
+gh_wnode_t *gh_wheel_pop_expired(gh_wheel_t *wheel, uint64_t now) {
+  gh_wnode_t *expired = &wheel->queues[GH_WHEEL_EXPIRED];
+  gh_wnode_t *node;
+
+  if (queue_is_empty(expired))
+    wheel_advance(wheel, now);
+
+  if (queue_is_empty(expired))
+    return NULL;
+
+  node = expired->next;
+  gh_wheel_remove(wheel, node);
+  return node;
+}
+
+gh_wnode_t *gh_wheel_pop(gh_wheel_t *wheel) {
+  gh_wnode_t *head = &wheel->queues[GH_WHEEL_EXPIRED];
+  gh_wnode_t *node;
+  unsigned int level;
+
+  if (wheel->count == 0)
+    return NULL;
+
+  if (queue_is_empty(head)) {
+    for (level = 0; level < GH_WHEEL_LEVELS; level++) {
+      if (wheel->occupied[level]) {
+        head = &wheel->queues[level * GH_WHEEL_SLOTS + first_bit(wheel->occupied[level])];
+        break;
+      }
+    }
+  }
+
+  assert(!queue_is_empty(head));
+  node = head->next;
+  gh_wheel_remove(wheel, node);
+  return node;
+}
+
+int gh_wheel_next_expiry(gh_wheel_t *wheel, uint64_t *tick) {
+  uint64_t best = 0;
+  unsigned int level;
+  int found = 0;
+
+  if (wheel->count == 0)
+    return 0;
+
+  if (!queue_is_empty(&wheel->queues[GH_WHEEL_EXPIRED])) {
+    /* Something is already due */
+    *tick = 0;
+    return 1;
+  }
+
+  for (level = 0; level < GH_WHEEL_LEVELS; level++) {
+    uint64_t bits = wheel->occupied[level];
+    uint64_t round = wheel->now >> LEVEL_SHIFT(level);
+    uint64_t offset = wheel->now & (((uint64_t)1 << LEVEL_SHIFT(level)) - 1);
+    uint64_t candidate;
+    unsigned int slot = (unsigned int)round & GH_WHEEL_SLOT_MASK;
+
+    if (!bits)
+      continue;
+
+    if (offset == 0) {
+      /* The wheel is at the very beginning of this slot, which has not been
+       * cascaded yet (always the case for level 0). */
+      candidate = round + first_bit(rotate_bits(bits, slot));
+    } else {
+      /* The current slot has been cascaded already, whatever it holds belongs
+       * to the next turn. */
+      candidate = round + 1 + first_bit(rotate_bits(bits, slot + 1));
+    }
+    candidate <<= LEVEL_SHIFT(level);
+
+    if (!found || candidate < best) {
+      best = candidate;
+      found = 1;
+    }
+  }
+
+  assert(found);
+  *tick = best;
+  return 1;
+}
+
+gh_wnode_t *gh_wheel_next(gh_wheel_t *wheel, gh_wnode_t *prev) {
+  gh_wnode_t *node;
+
+  node = (prev != NULL) ? prev->next : wheel->queues[0].next;
+
+  while (node_is_head(wheel, node)) {
+    if (node->queue + 1 >= GH_WHEEL_QUEUES)
+      return NULL;
+    node = wheel->queues[node->queue + 1].next;
+  }
+  return node;
+}
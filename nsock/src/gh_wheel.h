@@ -0,0 +1,168 @@
+/***************************************************************************
+ * gh_wheel.h -- hashed hierarchical timing wheel.                         *
+ *                                                                         *
+ ***********************IMPORTANT NSOCK LICENSE TERMS***********************
+ *                                                                         *
+ * The nsock parallel socket event library is (C) 1999-2016 Insecure.Com   *
+ * LLC This library is free software; you may redistribute and/or          *
+ * modify it under the terms of the GNU General Public License as          *
+ * published by the Free Software Foundation; Version 2.  This guarantees  *
+ * your right to use, modify, and redistribute this software under certain *
+ * conditions.  If this license is unacceptable to you, Insecure.Com LLC   *
+ * may be willing to sell alternative licenses (contact                    *
+ * sales@insecure.com ).                                                   *
+ *                                                                         *
+ * As a special exception to the GPL terms, Insecure.Com LLC grants        *
+ * permission to link the code of this program with any version of the     *
+ * OpenSSL library which is distributed under a license identical to that  *
+ * listed in the included docs/licenses/OpenSSL.txt file, and distribute   *
+ * linked combinations including the two. You must obey the GNU GPL in all *
+ * respects for all of the code used other than OpenSSL.  If you modify    *
+ * this file, you may extend this exception to your version of the file,   *
+ * but you are not obligated to do so.                                     *
+ *                                                                         *
+ * If you received these files with a written license agreement stating    *
+ * terms other than the (GPL) terms above, then that alternative license   *
+ * agreement takes precedence over this comment.                           *
+ *                                                                         *
+ * Source is provided to this software because we believe users have a     *
+ * right to know exactly what a program is going to do before they run it. *
+ * This also allows you to audit the software for security holes.          *
+ *                                                                         *
+ * Source code also allows you to port Nmap to new platforms, fix bugs,    *
+ * and add new features.  You are highly encouraged to send your changes   *
+ * to the dev@nmap.org mailing list for possible incorporation into the    *
+ * main distribution.  By sending these changes to Fyodor or one of the    *
+ * Insecure.Org development mailing lists, or checking them into the Nmap  *
+ * source code repository, it is understood (unless you specify otherwise) *
+ * that you are offering the Nmap Project (Insecure.Com LLC) the           *
+ * unlimited, non-exclusive right to reuse, modify, and relicense the      *
+ * code.  Nmap will always be available Open Source, but this is important *
+ * because the inability to relicense code has caused devastating problems *
+ * for other Free Software projects (such as KDE and NASM).  We also       *
+ * occasionally relicense the code to third parties as discussed above.    *
+ * If you wish to specify special license conditions of your               *
+ * contributions, just say so when you send them.                          *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU       *
+ * General Public License v2.0 for more details                            *
+ * (http://www.gnu.org/licenses/gpl-2.0.html).                             *
+ *                                                                         *
+ ***************************************************************************/
+
+/* $Id$ */
+
+#ifndef GH_WHEEL_H
+#define GH_WHEEL_H
+
+#ifdef HAVE_CONFIG_H
+#include "nsock_config.h"
+#include "nbase_config.h"
+#endif
+
+#ifdef WIN32
+#include "nbase_winconfig.h"
+#endif
+
+#include "error.h"
+#include <assert.h>
+#include <stdint.h>
+
+
+#if !defined(container_of)
+#include <stddef.h>
+
+#define container_of(ptr, type, member) \
+        ((type *)((char *)(ptr) - offsetof(type, member)))
+#endif
+
+
+/* The wheel is made of GH_WHEEL_LEVELS levels of GH_WHEEL_SLOTS slots each.
+ * Level 0 has a resolution of one tick, level n of GH_WHEEL_SLOTS^n ticks.
+ * With 1ms ticks, four levels of 64 slots cover a bit more than four hours;
+ * timers set further in the future are parked in the last level and
+ * re-inserted as the wheel turns. */
+#define GH_WHEEL_LEVELS     4
+#define GH_WHEEL_SLOT_BITS  6
+#define GH_WHEEL_SLOTS      (1 << GH_WHEEL_SLOT_BITS)
+#define GH_WHEEL_SLOT_MASK  (GH_WHEEL_SLOTS - 1)
+
+/* Total number of list heads: one per slot plus the queue of expired nodes */
+#define GH_WHEEL_QUEUES     (GH_WHEEL_LEVELS * GH_WHEEL_SLOTS + 1)
+#define GH_WHEEL_EXPIRED    (GH_WHEEL_QUEUES - 1)
+
+/* POISON value, set wheel node queue to this value to indicate that the node
+ * is inactive (not part of a wheel) */
+#define GH_WHEEL_GUARD      0x19890721
+
+
+typedef struct gh_wheel_node {
+  struct gh_wheel_node *next;
+  struct gh_wheel_node *prev;
+  /* Absolute expiration time, in ticks */
+  uint64_t expires;
+  /* Index of the queue the node is linked in */
+  unsigned int queue;
+} gh_wnode_t;
+
+typedef struct gh_wheel {
+  /* Next tick to process. Everything before has been moved to the expired
+   * queue already. */
+  uint64_t now;
+  /* Number of nodes in the wheel, expired queue included */
+  unsigned int count;
+  /* One bit per non-empty slot, for each level */
+  uint64_t occupied[GH_WHEEL_LEVELS];
+  /* Circular list heads */
+  gh_wnode_t queues[GH_WHEEL_QUEUES];
+} gh_wheel_t;
+
+
+int gh_wheel_init(gh_wheel_t *wheel, uint64_t now);
+
+void gh_wheel_free(gh_wheel_t *wheel);
+
+/* Schedule node to expire at the given tick. Insertion is O(1). */
+int gh_wheel_add(gh_wheel_t *wheel, gh_wnode_t *node, uint64_t expires);
+
+/* Unlink node from the wheel, wherever it currently is. Removal is O(1). */
+int gh_wheel_remove(gh_wheel_t *wheel, gh_wnode_t *node);
+
+/* Turn the wheel up to tick now (included) and return the first node that
+ * expired, or NULL if none did. Slots are moved to the expired queue as a
+ * whole, so every node of a tick is expired in one batch. */
+gh_wnode_t *gh_wheel_pop_expired(gh_wheel_t *wheel, uint64_t now);
+
+/* Remove and return any node of the wheel, NULL if the wheel is empty. */
+gh_wnode_t *gh_wheel_pop(gh_wheel_t *wheel);
+
+/* Return 1 and store into *tick a lower bound of the next expiration time, or
+ * return 0 if the wheel is empty. The bound is exact for timers that expire
+ * within GH_WHEEL_SLOTS ticks. */
+int gh_wheel_next_expiry(gh_wheel_t *wheel, uint64_t *tick);
+
+/* Iterate over the nodes of the wheel, in no particular order. Pass NULL to
+ * get the first node. Returns NULL when done. The wheel must not be modified
+ * while iterating. */
+gh_wnode_t *gh_wheel_next(gh_wheel_t *wheel, gh_wnode_t *prev);
+
+
+static inline size_t gh_wheel_count(gh_wheel_t *wheel) {
+  return wheel->count;
+}
+
+static inline int gh_wheel_is_empty(gh_wheel_t *wheel) {
+  return wheel->count == 0;
+}
+
+static inline void gh_wnode_invalidate(gh_wnode_t *node) {
+  node->queue = GH_WHEEL_GUARD;
+}
+
+static inline int gh_wnode_is_valid(const gh_wnode_t *node) {
+  return (node && node->queue != GH_WHEEL_GUARD);
+}
+
+#endif /* GH_WHEEL_H */
@@ -59,8 +59,10 @@
 #include "gh_list.h"
 #include "filespace.h"
 #include "nsock_log.h"
+#include "nbase_prof.h"
 
 #include <assert.h>
+#include <limits.h>
 #if HAVE_ERRNO_H
 #include <errno.h>
 #endif
@@ -398,6 +400,13 @@ void handle_connect_result(struct npool *ms, struct nevent *nse, enum nse_status
       }
 #endif
 
+      /* Let the session cache find its way back to the iod. Unless the caller
+       * supplied a session, try to resume the last one we had with this
+       * peer. */
+      SSL_set_app_data(iod->ssl, iod);
+      if (iod->ssl_session == NULL)
+        ssl_session_cache_lookup(ms, iod);
+
       /* Associate our new SSL with the connected socket.  It will inherit the
        * non-blocking nature of the sd */
       if (SSL_set_fd(iod->ssl, iod->sd) != 1)
@@ -453,6 +462,8 @@ void handle_connect_result(struct npool *ms, struct nevent *nse, enum nse_status
     if (rc == 1) {
       /* Woop!  Connect is done! */
       nse->event_done = 1;
+      if (SSL_session_reused(iod->ssl))
+        ms->sslcache.resumed++;
       /* Check that certificate verification was okay, if requested. */
       if (nsi_ssl_post_connect_verify(iod)) {
         nse->status = NSE_STATUS_SUCCESS;
@@ -506,6 +517,8 @@ void handle_connect_result(struct npool *ms, struct nevent *nse, enum nse_status
       } else {
         nsock_log_info("EID %li %s",
                        nse->id, ERR_error_string(ERR_get_error(), NULL));
+        /* Don't offer a session again to a server that just failed us */
+        ssl_session_cache_evict(ms, iod);
         nse->event_done = 1;
         nse->status = NSE_STATUS_ERROR;
         nse->errnum = EIO;
@@ -610,7 +623,7 @@ void handle_timer_result(struct npool *ms, struct nevent *nse, enum nse_status s
 
 /* Returns -1 if an error, otherwise the number of newly written bytes */
 static int do_actual_read(struct npool *ms, struct nevent *nse) {
-  char buf[READ_BUFFER_SZ];
+  char *buf;
   int buflen = 0;
   struct niod *iod = nse->iod;
   int err = 0;
@@ -626,7 +639,10 @@ static int do_actual_read(struct npool *ms, struct nevent *nse) {
       socklen_t peerlen;
       peerlen = sizeof(peer);
 
-      buflen = ms->engine->io_operations->iod_read(ms, iod->sd, buf, sizeof(buf), 0, (struct sockaddr *)&peer, &peerlen);
+      /* Receive straight into the event's buffer, which is what nse_readbuf()
+       * hands out. */
+      buf = fs_reserve(&nse->iobuf, READ_BUFFER_SZ);
+      buflen = ms->engine->io_operations->iod_read(ms, iod->sd, buf, READ_BUFFER_SZ, 0, (struct sockaddr *)&peer, &peerlen);
 
       /* Using recv() was failing, at least on UNIX, for non-network sockets
        * (i.e. stdin) in this case, a read() is done - as on ENOTSOCK we may
@@ -635,7 +651,7 @@ static int do_actual_read(struct npool *ms, struct nevent *nse) {
         if (socket_errno() == ENOTSOCK) {
           peer.ss_family = AF_UNSPEC;
           peerlen = 0;
-          buflen = read(iod->sd, buf, sizeof(buf));
+          buflen = read(iod->sd, buf, READ_BUFFER_SZ);
         }
       }
       if (buflen == -1) {
@@ -652,12 +668,7 @@ static int do_actual_read(struct npool *ms, struct nevent *nse) {
         iod->peerlen = peerlen;
       }
       if (buflen > 0) {
-        if (fs_cat(&nse->iobuf, buf, buflen) == -1) {
-          nse->event_done = 1;
-          nse->status = NSE_STATUS_ERROR;
-          nse->errnum = ENOMEM;
-          return -1;
-        }
+        fs_commit(&nse->iobuf, buflen);
 
         /* Sometimes a service just spews and spews data.  So we return after a
          * somewhat large amount to avoid monopolizing resources and avoid DOS
@@ -670,7 +681,7 @@ static int do_actual_read(struct npool *ms, struct nevent *nse) {
          * return only one datagram at a time. The consistency of the above
          * assignment of iod->peer depends on not consolidating more than one
          * UDP read buffer. */
-        if (buflen > 0 && buflen < sizeof(buf))
+        if (buflen > 0 && buflen < READ_BUFFER_SZ)
           return fs_length(&nse->iobuf) - startlen;
       }
     } while (buflen > 0 || (buflen == -1 && err == EINTR));
@@ -686,14 +697,13 @@ static int do_actual_read(struct npool *ms, struct nevent *nse) {
   } else {
 #if HAVE_OPENSSL
     /* OpenSSL read */
-    while ((buflen = SSL_read(iod->ssl, buf, sizeof(buf))) > 0) {
+    for (;;) {
+      buf = fs_reserve(&nse->iobuf, READ_BUFFER_SZ);
+      buflen = SSL_read(iod->ssl, buf, READ_BUFFER_SZ);
+      if (buflen <= 0)
+        break;
 
-      if (fs_cat(&nse->iobuf, buf, buflen) == -1) {
-        nse->event_done = 1;
-        nse->status = NSE_STATUS_ERROR;
-        nse->errnum = ENOMEM;
-        return -1;
-      }
+      fs_commit(&nse->iobuf, buflen);
 
       /* Sometimes a service just spews and spews data.  So we return
        * after a somewhat large amount to avoid monopolizing resources
@@ -937,10 +947,12 @@ enum nsock_loopstatus nsock_loop(nsock_pool nsp, int msec_timeout) {
       }
     }
 
+    NBASE_PROF_BEGIN(engine_start);
     if (nsock_engine_loop(ms, msecs_left) == -1) {
       quitstatus = NSOCK_LOOP_ERROR;
       break;
     }
+    NBASE_PROF_END(engine_start, "nsock_engine_loop");
 
     gettimeofday(&nsock_tod, NULL); /* we do this at end because there is one
                                      * at beginning of function */
@@ -955,6 +967,7 @@ void process_event(struct npool *nsp, gh_list_t *evlist, struct nevent *nse, int
 #if HAVE_OPENSSL
   int desire_r = 0, desire_w = 0;
 #endif
+  NBASE_PROF_BEGIN(process_start);
 
   nsock_log_debug_all("Processing event %lu (timeout in %ldms, done=%d)",
                       nse->id,
@@ -1072,6 +1085,7 @@ void process_event(struct npool *nsp, gh_list_t *evlist, struct nevent *nse, int
     /* WooHoo!  The event is ready to be sent */
     event_dispatch_and_delete(nsp, nse, 1);
   }
+  NBASE_PROF_END(process_start, "nsock process_event");
 }
 
 void process_iod_events(struct npool *nsp, struct niod *nsi, int ev) {
@@ -1146,7 +1160,7 @@ void process_iod_events(struct npool *nsp, struct niod *nsi, int ev) {
         gh_list_append(&nsp->free_events, &nse->nodeq_io);
 
         if (nse->timeout.tv_sec)
-          gh_heap_remove(&nsp->expirables, &nse->expire);
+          expirable_remove(nsp, nse);
       }
     }
   }
@@ -1201,7 +1215,27 @@ static int nevent_unref(struct npool *nsp, struct nevent *nse) {
   return 0;
 }
 
+static void process_expired_event(struct npool *nsp, struct nevent *nse) {
+  NBASE_PROF_EVENT("nsock event expired", nse->type);
+  process_event(nsp, NULL, nse, EV_NONE);
+  assert(nse->event_done);
+  update_first_events(nse);
+  nevent_unref(nsp, nse);
+}
+
 void process_expired_events(struct npool *nsp) {
+  if (nsp->use_timer_wheel) {
+    uint64_t now = timeval_to_tick(&nsock_tod);
+    gh_wnode_t *wnode;
+
+    /* The wheel hands expired events out one tick worth at a time, and new
+     * events that are already due go straight to its expired queue, so this
+     * loop behaves like the heap one below. */
+    while ((wnode = gh_wheel_pop_expired(&nsp->expirables_wheel, now)) != NULL)
+      process_expired_event(nsp, container_of(wnode, struct nevent, expire_wheel));
+    return;
+  }
+
   for (;;) {
     gh_hnode_t *hnode;
     struct nevent *nse;
@@ -1215,10 +1249,46 @@ void process_expired_events(struct npool *nsp) {
       break;
 
     gh_heap_pop(&nsp->expirables);
-    process_event(nsp, NULL, nse, EV_NONE);
-    assert(nse->event_done);
-    update_first_events(nse);
-    nevent_unref(nsp, nse);
+    process_expired_event(nsp, nse);
+  }
+}
+
+struct nevent *expirable_pop(struct npool *nsp) {
+  if (nsp->use_timer_wheel) {
+    gh_wnode_t *wnode = gh_wheel_pop(&nsp->expirables_wheel);
+
+    return wnode ? container_of(wnode, struct nevent, expire_wheel) : NULL;
+  } else {
+    gh_hnode_t *hnode = gh_heap_pop(&nsp->expirables);
+
+    if (!hnode)
+      return NULL;
+    /* gh_heap_remove() leaves the last node marked as valid */
+    gh_hnode_invalidate(hnode);
+    return container_of(hnode, struct nevent, expire);
+  }
+}
+
+int next_expirable_msecs(struct npool *nsp) {
+  if (nsp->use_timer_wheel) {
+    uint64_t next, now;
+
+    if (!gh_wheel_next_expiry(&nsp->expirables_wheel, &next))
+      return -1;
+
+    now = timeval_to_tick(&nsock_tod);
+    if (next <= now)
+      return 0;
+    return (int)MIN(next - now, INT_MAX);
+  } else {
+    gh_hnode_t *hnode = gh_heap_min(&nsp->expirables);
+    struct nevent *nse;
+
+    if (!hnode)
+      return -1;
+
+    nse = container_of(hnode, struct nevent, expire);
+    return MAX(0, TIMEVAL_MSEC_SUBTRACT(nse->timeout, nsock_tod));
   }
 }
 
@@ -1252,7 +1322,7 @@ void nsock_pool_add_event(struct npool *nsp, struct nevent *nse) {
 
   if (!nse->event_done && nse->timeout.tv_sec) {
     /* This event is expirable, add it to the queue */
-    gh_heap_push(&nsp->expirables, &nse->expire);
+    expirable_add(nsp, nse);
   }
 
   /* Now we do the event type specific actions */
@@ -77,6 +77,13 @@
   #define ENGINE_EPOLL
 #endif /* HAVE_EPOLL */
 
+#if HAVE_IO_URING
+  extern struct io_engine engine_iouring;
+  #define ENGINE_IOURING &engine_iouring,
+#else
+  #define ENGINE_IOURING
+#endif /* HAVE_IO_URING */
+
 #if HAVE_KQUEUE
   extern struct io_engine engine_kqueue;
   #define ENGINE_KQUEUE &engine_kqueue,
@@ -99,6 +106,7 @@ extern struct io_engine engine_select;
  * available on your system. Engines must be sorted by order of preference */
 static struct io_engine *available_engines[] = {
   ENGINE_EPOLL
+  ENGINE_IOURING
   ENGINE_KQUEUE
   ENGINE_POLL
   ENGINE_IOCP
@@ -180,6 +188,9 @@ const char *nsock_list_engines(void) {
 #if HAVE_EPOLL
   "epoll "
 #endif
+#if HAVE_IO_URING
+  "iouring "
+#endif
 #if HAVE_KQUEUE
   "kqueue "
 #endif
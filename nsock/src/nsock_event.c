@@ -211,6 +211,17 @@ int nsock_event_cancel(nsock_pool ms_pool, nsock_event_id id, int notify) {
       break;
 
     case NSE_TYPE_TIMER:
+      if (nsp->use_timer_wheel) {
+        gh_wnode_t *wnode = NULL;
+
+        while ((wnode = gh_wheel_next(&nsp->expirables_wheel, wnode)) != NULL) {
+          nse = container_of(wnode, struct nevent, expire_wheel);
+          if (nse->id == id)
+            return nevent_delete(nsp, nse, NULL, NULL, notify);
+        }
+        return 0;
+      }
+
       for (i = 0; i < gh_heap_count(&nsp->expirables); i++) {
         gh_hnode_t *hnode;
 
@@ -307,7 +318,7 @@ int nevent_delete(struct npool *nsp, struct nevent *nse, gh_list_t *event_list,
   assert(nse->event_done);
 
   if (nse->timeout.tv_sec)
-    gh_heap_remove(&nsp->expirables, &nse->expire);
+    expirable_remove(nsp, nse);
 
   if (event_list) {
     update_first_events(nse);
@@ -427,10 +438,14 @@ struct nevent *event_new(struct npool *nsp, enum nse_type type,
 
   /* First we check if one is available from the free list ... */
   lnode = gh_list_pop(&nsp->free_events);
-  if (!lnode)
-    nse = (struct nevent *)safe_malloc(sizeof(*nse));
-  else
-    nse = lnode_nevent(lnode);
+  if (!lnode) {
+    nsock_pool_slab_refill(nsp, &nsp->free_events, sizeof(*nse),
+                           offsetof(struct nevent, nodeq_io));
+    nsp->stats.events_slab += NSOCK_SLAB_OBJS;
+    lnode = gh_list_pop(&nsp->free_events);
+  }
+  nse = lnode_nevent(lnode);
+  nsp->stats.events++;
 
   memset(nse, 0, sizeof(*nse));
 
@@ -438,12 +453,17 @@ struct nevent *event_new(struct npool *nsp, enum nse_type type,
   nse->type = type;
   nse->status = NSE_STATUS_NONE;
   gh_hnode_invalidate(&nse->expire);
+  gh_wnode_invalidate(&nse->expire_wheel);
 #if HAVE_OPENSSL
   nse->sslinfo.ssl_desire = SSL_ERROR_NONE;
 #endif
 
-  if (type == NSE_TYPE_READ || type ==  NSE_TYPE_WRITE)
-    filespace_init(&(nse->iobuf), 1024);
+  /* Reads get room for a whole READ_BUFFER_SZ chunk, which do_actual_read()
+   * receives straight into iobuf. */
+  if (type == NSE_TYPE_READ)
+    filespace_init_pooled(&(nse->iobuf), READ_BUFFER_SZ + 2, &nsp->bufpool);
+  else if (type == NSE_TYPE_WRITE)
+    filespace_init_pooled(&(nse->iobuf), 1024, &nsp->bufpool);
 
 #if HAVE_PCAP
   if (type == NSE_TYPE_PCAP_READ) {
@@ -455,7 +475,7 @@ struct nevent *event_new(struct npool *nsp, enum nse_type type,
     assert(mp);
 
     sz = mp->snaplen+1 + sizeof(nsock_pcap);
-    filespace_init(&(nse->iobuf), sz);
+    filespace_init_pooled(&(nse->iobuf), sz, &nsp->bufpool);
   }
 #endif
 
@@ -73,6 +73,7 @@
 
 #include "gh_list.h"
 #include "gh_heap.h"
+#include "gh_wheel.h"
 #include "filespace.h"
 #include "nsock.h" /* The public interface -- I need it for some enum defs */
 #include "nsock_ssl.h"
@@ -150,6 +151,19 @@ struct writeinfo {
   int written_so_far;
 };
 
+/* Number of events or iods allocated at once when the free lists are empty */
+#define NSOCK_SLAB_OBJS 32
+
+struct npool_stats {
+  /* Events and iods handed out, and how many slots slabs were carved into */
+  unsigned long events;
+  unsigned long events_slab;
+  unsigned long iods;
+  unsigned long iods_slab;
+  /* Number of slabs allocated */
+  unsigned long slabs;
+};
+
 /* Remember that callers of this library should NOT be accessing these
  * fields directly */
 struct npool {
@@ -170,6 +184,12 @@ struct npool {
 #endif
   gh_heap_t expirables;
 
+  /* Timing wheel holding expirable events instead of the heap above, when
+   * enabled with nsock_pool_set_timer_wheel(). Insertion and removal are O(1)
+   * at the cost of a millisecond resolution. */
+  gh_wheel_t expirables_wheel;
+  int use_timer_wheel;
+
   /* Active iods and related lists of events */
   gh_list_t active_iods;
 
@@ -178,6 +198,18 @@ struct npool {
   /* When an event is deleted, we stick it here for later reuse */
   gh_list_t free_events;
 
+  /* Events and iods are carved out of slabs of NSOCK_SLAB_OBJS objects, which
+   * are only released with the pool. */
+  void **slabs;
+  int nslabs;
+  int slabs_alloc;
+
+  /* Recycled event I/O buffers */
+  struct fs_pool bufpool;
+
+  /* Allocation statistics, logged when the pool is deleted */
+  struct npool_stats stats;
+
   /* Number of events pending (total) on all lists */
   int events_pending;
 
@@ -203,6 +235,8 @@ struct npool {
 #if HAVE_OPENSSL
   /* The SSL Context (options and such) */
   SSL_CTX *sslctx;
+  /* Sessions of previous handshakes, for resumption */
+  struct ssl_session_cache sslcache;
 #endif
 
   /* Optional proxy chain (NULL is not set). Can only be set once per NSP (using
@@ -342,6 +376,8 @@ struct nevent {
 
   /* slot in the expirable binheap */
   gh_hnode_t expire;
+  /* slot in the expirable timing wheel */
+  gh_wnode_t expire_wheel;
 
   /* For some reasons (see nsock_pcap.c) we register pcap events as both read
    * and pcap_read events when in PCAP_BSD_SELECT_HACK mode. We then need two
@@ -473,6 +509,11 @@ void event_delete(struct npool *nsp, struct nevent *nse);
  * etc. */
 void nsock_pool_add_event(struct npool *nsp, struct nevent *nse);
 
+/* Allocate a slab of NSOCK_SLAB_OBJS zeroed objects of objsize bytes and add
+ * them to freelist, through the gh_lnode_t found node_offset bytes into each
+ * object. */
+void nsock_pool_slab_refill(struct npool *nsp, gh_list_t *freelist, size_t objsize, size_t node_offset);
+
 void nsock_connect_internal(struct npool *ms, struct nevent *nse, int type, int proto, struct sockaddr_storage *ss, size_t sslen, unsigned short port);
 
 /* Comments on using the following handle_*_result functions are available in nsock_core.c */
@@ -501,16 +542,45 @@ void nsock_trace_handler_callback(struct npool *ms, struct nevent *nse);
 void nsi_set_ssl_session(struct niod *iod, SSL_SESSION *sessid);
 #endif
 
-static inline struct nevent *next_expirable_event(struct npool *nsp) {
-  gh_hnode_t *hnode;
+/* Timing wheel ticks are milliseconds. Expiration times are rounded up so
+ * that an event never fires before its deadline. */
+static inline uint64_t timeval_to_tick(const struct timeval *tv) {
+  return (uint64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
 
-  hnode = gh_heap_min(&nsp->expirables);
-  if (!hnode)
-    return NULL;
+static inline uint64_t timeval_to_tick_ceil(const struct timeval *tv) {
+  return (uint64_t)tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+}
+
+/* Register an event with a timeout in the expirables queue in use */
+static inline void expirable_add(struct npool *nsp, struct nevent *nse) {
+  if (nsp->use_timer_wheel)
+    gh_wheel_add(&nsp->expirables_wheel, &nse->expire_wheel,
+                 timeval_to_tick_ceil(&nse->timeout));
+  else
+    gh_heap_push(&nsp->expirables, &nse->expire);
+}
 
-  return container_of(hnode, struct nevent, expire);
+static inline void expirable_remove(struct npool *nsp, struct nevent *nse) {
+  if (nsp->use_timer_wheel)
+    gh_wheel_remove(&nsp->expirables_wheel, &nse->expire_wheel);
+  else
+    gh_heap_remove(&nsp->expirables, &nse->expire);
 }
 
+static inline size_t expirable_count(struct npool *nsp) {
+  if (nsp->use_timer_wheel)
+    return gh_wheel_count(&nsp->expirables_wheel);
+  return gh_heap_count(&nsp->expirables);
+}
+
+/* Remove and return any expirable event, NULL if there is none left */
+struct nevent *expirable_pop(struct npool *nsp);
+
+/* Number of milliseconds until the next expirable event times out, zero if it
+ * already did or -1 if no event has a timeout. */
+int next_expirable_msecs(struct npool *nsp);
+
 static inline struct nevent *lnode_nevent(gh_lnode_t *lnode) {
   return container_of(lnode, struct nevent, nodeq_io);
 }
@@ -91,11 +91,13 @@ nsock_iod nsock_iod_new2(nsock_pool nsockp, int sd, void *userdata) {
 
   lnode = gh_list_pop(&nsp->free_iods);
   if (!lnode) {
-    nsi = (struct niod *)safe_malloc(sizeof(*nsi));
-    memset(nsi, 0, sizeof(*nsi));
-  } else {
-    nsi = container_of(lnode, struct niod, nodeq);
+    nsock_pool_slab_refill(nsp, &nsp->free_iods, sizeof(*nsi),
+                           offsetof(struct niod, nodeq));
+    nsp->stats.iods_slab += NSOCK_SLAB_OBJS;
+    lnode = gh_list_pop(&nsp->free_iods);
   }
+  nsi = container_of(lnode, struct niod, nodeq);
+  nsp->stats.iods++;
 
   if (sd == -1) {
     nsi->sd = -1;
@@ -106,7 +108,7 @@ nsock_iod nsock_iod_new2(nsock_pool nsockp, int sd, void *userdata) {
   } else {
     nsi->sd = dup_socket(sd);
     if (nsi->sd == -1) {
-      free(nsi);
+      gh_list_prepend(&nsp->free_iods, &nsi->nodeq);
       return NULL;
     }
     unblock_socket(nsi->sd);
@@ -94,6 +94,11 @@ int nsock_pool_get_error(nsock_pool nsp) {
   return mt->errnum;
 }
 
+int nsock_pool_get_events_pending(nsock_pool nsp) {
+  struct npool *mt = (struct npool *)nsp;
+  return mt->events_pending;
+}
+
 /* Sometimes it is useful to store a pointer to information inside
  * the NSP so you can retrieve it during a callback. */
 void nsock_pool_set_udata(nsock_pool nsp, void *data) {
@@ -122,6 +127,56 @@ void nsock_pool_set_device(nsock_pool nsp, const char *device) {
   mt->device = device;
 }
 
+/* Switches expirable events between the binary heap and the timing wheel.
+ * Pending events are moved over to the new queue. */
+void nsock_pool_set_timer_wheel(nsock_pool nsp, int enable) {
+  struct npool *ms = (struct npool *)nsp;
+  struct nevent **pending;
+  size_t count, i;
+
+  enable = !!enable;
+  if (ms->use_timer_wheel == enable)
+    return;
+
+  count = expirable_count(ms);
+  pending = (struct nevent **)safe_malloc((count + 1) * sizeof(*pending));
+  for (i = 0; i < count; i++)
+    pending[i] = expirable_pop(ms);
+
+  ms->use_timer_wheel = enable;
+
+  for (i = 0; i < count; i++)
+    expirable_add(ms, pending[i]);
+
+  free(pending);
+}
+
+void nsock_pool_reinit_engine(nsock_pool nsp) {
+  struct npool *ms = (struct npool *)nsp;
+  gh_lnode_t *current;
+
+  assert(ms->events_pending == 0);
+
+  /* Don't call the engine's destroy(), which could act on kernel objects that
+   * the parent still uses. */
+  ms->engine_data = NULL;
+  nsock_engine_init(ms);
+
+  for (current = gh_list_first_elem(&ms->active_iods);
+       current != NULL;
+       current = gh_lnode_next(current)) {
+    struct niod *nsi = container_of(current, struct niod, nodeq);
+    int ev = nsi->watched_events;
+
+    if (!IOD_PROPGET(nsi, IOD_REGISTERED))
+      continue;
+
+    IOD_PROPCLR(nsi, IOD_REGISTERED);
+    nsi->watched_events = EV_NONE;
+    nsock_engine_iod_register(ms, nsi, NULL, ev);
+  }
+}
+
 static int expirable_cmp(gh_hnode_t *n1, gh_hnode_t *n2) {
   struct nevent *nse1;
   struct nevent *nse2;
@@ -163,8 +218,10 @@ nsock_pool nsock_pool_new(void *userdata) {
   gh_list_init(&nsp->pcap_read_events);
 #endif
 
-  /* initialize timer heap */
+  /* initialize timer heap and wheel */
   gh_heap_init(&nsp->expirables, expirable_cmp);
+  gh_wheel_init(&nsp->expirables_wheel, timeval_to_tick(&nsock_tod));
+  nsp->use_timer_wheel = 0;
 
   /* initialize the list of IODs */
   gh_list_init(&nsp->active_iods);
@@ -172,6 +229,7 @@ nsock_pool nsock_pool_new(void *userdata) {
   /* initialize caches */
   gh_list_init(&nsp->free_iods);
   gh_list_init(&nsp->free_events);
+  fs_pool_init(&nsp->bufpool);
 
   nsp->next_event_serial = 1;
 
@@ -186,6 +244,47 @@ nsock_pool nsock_pool_new(void *userdata) {
   return (nsock_pool)nsp;
 }
 
+void nsock_pool_slab_refill(struct npool *nsp, gh_list_t *freelist, size_t objsize, size_t node_offset) {
+  char *slab;
+  int i;
+
+  if (nsp->nslabs == nsp->slabs_alloc) {
+    nsp->slabs_alloc = nsp->slabs_alloc ? nsp->slabs_alloc * 2 : 16;
+    nsp->slabs = (void **)safe_realloc(nsp->slabs, nsp->slabs_alloc * sizeof(void *));
+  }
+
+  slab = (char *)safe_zalloc(NSOCK_SLAB_OBJS * objsize);
+  nsp->slabs[nsp->nslabs++] = slab;
+  nsp->stats.slabs++;
+
+  /* Objects are handed out in address order */
+  for (i = 0; i < NSOCK_SLAB_OBJS; i++)
+    gh_list_append(freelist, (gh_lnode_t *)(slab + i * objsize + node_offset));
+}
+
+static void nsock_pool_log_stats(struct npool *nsp) {
+  static const char *class_names[FS_POOL_CLASSES] = { "1K", "4K", "16K", "64K" };
+  struct fs_pool *bp = &nsp->bufpool;
+  char buf[256];
+  int i, off = 0;
+
+  nsock_log_info("Pool stats: %lu events and %lu iods handed out from %lu slabs (%lu event and %lu iod slots)",
+                 nsp->stats.events, nsp->stats.iods, nsp->stats.slabs,
+                 nsp->stats.events_slab, nsp->stats.iods_slab);
+
+  for (i = 0; i < FS_POOL_CLASSES; i++)
+    off += Snprintf(buf + off, sizeof(buf) - off, " %s %lu/%lu", class_names[i],
+                    bp->hits[i], bp->hits[i] + bp->misses[i]);
+  nsock_log_info("Buffer pool stats (reused/total):%s, %lu oversized", buf, bp->oversized);
+
+#if HAVE_OPENSSL
+  if (nsp->sslctx != NULL)
+    nsock_log_info("TLS session cache stats: %lu lookups, %lu hits, %lu resumed, %lu stored",
+                   nsp->sslcache.lookups, nsp->sslcache.hits,
+                   nsp->sslcache.resumed, nsp->sslcache.stored);
+#endif
+}
+
 /* If nsock_pool_new returned success, you must free the nsp when you are done with it
  * to conserve memory (and in some cases, sockets).  After this call, nsp may no
  * longer be used.  Any pending events are sent an NSE_STATUS_KILL callback and
@@ -238,12 +337,7 @@ void nsock_pool_delete(nsock_pool ms_pool) {
   }
 
   /* Kill timers too, they're not in event lists */
-  while (gh_heap_count(&nsp->expirables) > 0) {
-    gh_hnode_t *hnode;
-
-    hnode = gh_heap_pop(&nsp->expirables);
-    nse = container_of(hnode, struct nevent, expire);
-
+  while ((nse = expirable_pop(nsp)) != NULL) {
     if (nse->type == NSE_TYPE_TIMER) {
       nse->status = NSE_STATUS_KILL;
       nsock_trace_handler_callback(nsp, nse);
@@ -254,6 +348,7 @@ void nsock_pool_delete(nsock_pool ms_pool) {
   }
 
   gh_heap_free(&nsp->expirables);
+  gh_wheel_free(&nsp->expirables_wheel);
 
   /* foreach struct niod */
   for (current = gh_list_first_elem(&nsp->active_iods);
@@ -268,24 +363,23 @@ void nsock_pool_delete(nsock_pool ms_pool) {
     gh_list_prepend(&nsp->free_iods, &nsi->nodeq);
   }
 
-  /* Now we free all the memory in the free iod list */
-  while ((current = gh_list_pop(&nsp->free_iods))) {
-    nsi = container_of(current, struct niod, nodeq);
-    free(nsi);
-  }
-
-  while ((current = gh_list_pop(&nsp->free_events))) {
-    nse = lnode_nevent(current);
-    free(nse);
-  }
+  nsock_pool_log_stats(nsp);
 
+  /* Now we free all the memory of the free iod and event lists */
   gh_list_free(&nsp->active_iods);
   gh_list_free(&nsp->free_iods);
   gh_list_free(&nsp->free_events);
 
+  for (i = 0; i < nsp->nslabs; i++)
+    free(nsp->slabs[i]);
+  free(nsp->slabs);
+
+  fs_pool_free(&nsp->bufpool);
+
   nsock_engine_destroy(nsp);
 
 #if HAVE_OPENSSL
+  ssl_session_cache_free(&nsp->sslcache);
   if (nsp->sslctx != NULL)
     SSL_CTX_free(nsp->sslctx);
 #endif
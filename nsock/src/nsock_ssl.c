@@ -61,6 +61,7 @@
 #include "nsock.h"
 #include "nsock_internal.h"
 #include "nsock_ssl.h"
+#include "nsock_log.h"
 #include "netutils.h"
 
 #if HAVE_OPENSSL
@@ -80,6 +81,136 @@
 
 extern struct timeval nsock_tod;
 
+/* Hash the peer address, port and SNI name of iod into a session cache slot.
+ * Returns -1 for peers that can't be cached (e.g. not connected yet). */
+static int ssl_session_slot(const struct niod *iod) {
+  const unsigned char *p;
+  unsigned long h = 5381;
+  size_t len;
+
+  if (iod->peer.ss_family == AF_INET) {
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)&iod->peer;
+    p = (const unsigned char *)&sin->sin_addr;
+    len = sizeof(sin->sin_addr);
+    h = h * 33 + ntohs(sin->sin_port);
+#if HAVE_IPV6
+  } else if (iod->peer.ss_family == AF_INET6) {
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)&iod->peer;
+    p = (const unsigned char *)&sin6->sin6_addr;
+    len = sizeof(sin6->sin6_addr);
+    h = h * 33 + ntohs(sin6->sin6_port);
+#endif
+  } else {
+    return -1;
+  }
+
+  while (len-- > 0)
+    h = h * 33 + *p++;
+  if (iod->hostname != NULL) {
+    for (p = (const unsigned char *)iod->hostname; *p != '\0'; p++)
+      h = h * 33 + *p;
+  }
+
+  return (int)(h % SSL_SESSION_CACHE_SIZE);
+}
+
+static int ssl_session_entry_matches(const struct ssl_session_entry *ent, const struct niod *iod) {
+  if (ent->session == NULL || ent->peerlen != iod->peerlen ||
+      memcmp(&ent->peer, &iod->peer, iod->peerlen) != 0)
+    return 0;
+  if (ent->hostname == NULL || iod->hostname == NULL)
+    return ent->hostname == iod->hostname;
+  return strcmp(ent->hostname, iod->hostname) == 0;
+}
+
+static void ssl_session_entry_clear(struct ssl_session_entry *ent) {
+  if (ent->session != NULL)
+    SSL_SESSION_free(ent->session);
+  free(ent->hostname);
+  memset(ent, 0, sizeof(*ent));
+}
+
+/* Called by OpenSSL whenever the server hands us a new session, which with
+ * TLSv1.3 may happen after the handshake. Returns 1 to keep the reference. */
+static int ssl_new_session_cb(SSL *ssl, SSL_SESSION *sess) {
+  struct niod *iod = (struct niod *)SSL_get_app_data(ssl);
+  struct ssl_session_cache *cache;
+  struct ssl_session_entry *ent;
+  int slot;
+
+  if (iod == NULL)
+    return 0;
+
+  slot = ssl_session_slot(iod);
+  if (slot < 0)
+    return 0;
+
+  cache = &iod->nsp->sslcache;
+  if (cache->entries == NULL)
+    cache->entries = (struct ssl_session_entry *)safe_zalloc(SSL_SESSION_CACHE_SIZE * sizeof(*cache->entries));
+
+  ent = &cache->entries[slot];
+  ssl_session_entry_clear(ent);
+  memcpy(&ent->peer, &iod->peer, iod->peerlen);
+  ent->peerlen = iod->peerlen;
+  if (iod->hostname != NULL)
+    ent->hostname = strdup(iod->hostname);
+  ent->session = sess;
+  cache->stored++;
+
+  return 1;
+}
+
+void ssl_session_cache_lookup(struct npool *nsp, struct niod *iod) {
+  struct ssl_session_cache *cache = &nsp->sslcache;
+  struct ssl_session_entry *ent;
+  int slot;
+
+  slot = ssl_session_slot(iod);
+  if (slot < 0)
+    return;
+
+  cache->lookups++;
+  if (cache->entries == NULL)
+    return;
+
+  ent = &cache->entries[slot];
+  if (!ssl_session_entry_matches(ent, iod))
+    return;
+
+  if (SSL_set_session(iod->ssl, ent->session) != 1) {
+    ssl_session_entry_clear(ent);
+    return;
+  }
+  cache->hits++;
+  nsock_log_debug("Offering cached TLS session to %s (IOD #%li)",
+                  inet_ntop_ez(&iod->peer, iod->peerlen), iod->id);
+}
+
+void ssl_session_cache_evict(struct npool *nsp, struct niod *iod) {
+  struct ssl_session_cache *cache = &nsp->sslcache;
+  int slot;
+
+  if (cache->entries == NULL)
+    return;
+
+  slot = ssl_session_slot(iod);
+  if (slot >= 0 && ssl_session_entry_matches(&cache->entries[slot], iod))
+    ssl_session_entry_clear(&cache->entries[slot]);
+}
+
+void ssl_session_cache_free(struct ssl_session_cache *cache) {
+  int i;
+
+  if (cache->entries == NULL)
+    return;
+
+  for (i = 0; i < SSL_SESSION_CACHE_SIZE; i++)
+    ssl_session_entry_clear(&cache->entries[i]);
+  free(cache->entries);
+  cache->entries = NULL;
+}
+
 /* Create an SSL_CTX and do initialization that is common to all init modes. */
 static SSL_CTX *ssl_init_common() {
   SSL_CTX *ctx;
@@ -93,11 +224,13 @@ static SSL_CTX *ssl_init_common() {
           ERR_error_string(ERR_get_error(), NULL));
   }
 
-  /* Our SSL* will always have the SSL_SESSION* inside it, so we neither need to
-   * use nor waste memory for the session cache.  (Use '1' because '0' means
-   * 'infinite'.)   */
-  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF|SSL_SESS_CACHE_NO_AUTO_CLEAR);
+  /* Client sessions are kept in the pool's own cache (see
+   * ssl_session_cache_lookup()), which OpenSSL feeds through the new session
+   * callback. Its internal cache would only waste memory.  (Use '1' because
+   * '0' means 'infinite'.)   */
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT|SSL_SESS_CACHE_NO_INTERNAL_STORE|SSL_SESS_CACHE_NO_AUTO_CLEAR);
   SSL_CTX_sess_set_cache_size(ctx, 1);
+  SSL_CTX_sess_set_new_cb(ctx, ssl_new_session_cb);
   SSL_CTX_set_timeout(ctx, 3600); /* pretty unnecessary */
 
   return ctx;
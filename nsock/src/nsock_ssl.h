@@ -76,8 +76,44 @@ struct sslinfo {
   int ssl_desire;
 };
 
+/* Number of slots of the per-pool TLS session cache. Sessions are hashed on
+ * the peer address, port and SNI name, a new session replacing whatever
+ * occupied its slot. */
+#define SSL_SESSION_CACHE_SIZE 256
+
+struct ssl_session_entry {
+  struct sockaddr_storage peer;
+  size_t peerlen;
+  char *hostname;
+  SSL_SESSION *session;
+};
+
+struct ssl_session_cache {
+  /* Allocated on the first stored session */
+  struct ssl_session_entry *entries;
+
+  /* Statistics: lookups made, sessions found and offered to the server,
+   * handshakes the server agreed to resume, and sessions stored */
+  unsigned long lookups;
+  unsigned long hits;
+  unsigned long resumed;
+  unsigned long stored;
+};
+
+struct npool;
+struct niod;
+
 int nsi_ssl_post_connect_verify(const nsock_iod nsockiod);
 
+/* Offer the cached session matching the peer and SNI name of iod, if any, on
+ * iod->ssl. */
+void ssl_session_cache_lookup(struct npool *nsp, struct niod *iod);
+
+/* Drop the cached session matching iod, e.g. because the handshake failed. */
+void ssl_session_cache_evict(struct npool *nsp, struct niod *iod);
+
+void ssl_session_cache_free(struct ssl_session_cache *cache);
+
 #endif /* HAVE_OPENSSL */
 #endif /* NSOCK_SSL_H */
 
@@ -0,0 +1,90 @@
+/*
+ * Nsock timer benchmark: binary heap vs. timing wheel.
+ * Same license as nmap -- see https://nmap.org/book/man-legal.html
+ *
+ * Keeps BENCH_TIMERS timers pending at all times: every timer that fires is
+ * re-armed with a new random timeout, until the run duration elapses. The CPU
+ * time spent scheduling and expiring them is reported for both backends.
+ *
+ * Usage: ./bench_timers [timers] [seconds]
+ */
+
+#include "test-common.h"
+#include <time.h>
+
+#define BENCH_TIMERS    100000
+#define BENCH_SECONDS   5
+#define BENCH_MAX_MSEC  1000
+
+
+struct bench_data {
+  nsock_pool nsp;
+  unsigned long fired;
+  int stop;
+};
+
+
+static void bench_handler(nsock_pool nsp, nsock_event nse, void *udata) {
+  struct bench_data *bd = (struct bench_data *)udata;
+
+  if (nse_status(nse) != NSE_STATUS_SUCCESS)
+    return;
+
+  bd->fired++;
+  if (!bd->stop)
+    nsock_timer_create(nsp, bench_handler, rand() % BENCH_MAX_MSEC, bd);
+}
+
+static double cpu_seconds(clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void bench_run(int use_wheel, int count, int seconds) {
+  struct bench_data bd;
+  clock_t start;
+  double t_sched, t_loop;
+  int i;
+
+  memset(&bd, 0, sizeof(bd));
+  srand(42);
+
+  bd.nsp = nsock_pool_new(NULL);
+  assert(bd.nsp != NULL);
+  nsock_pool_set_timer_wheel(bd.nsp, use_wheel);
+
+  start = clock();
+  for (i = 0; i < count; i++)
+    nsock_timer_create(bd.nsp, bench_handler, rand() % BENCH_MAX_MSEC, &bd);
+  t_sched = cpu_seconds(start);
+
+  start = clock();
+  nsock_loop(bd.nsp, seconds * 1000);
+  t_loop = cpu_seconds(start);
+
+  bd.stop = 1;
+  nsock_pool_delete(bd.nsp);
+
+  printf("%-6s %8d timers: schedule %7.3fs cpu, loop %7.3fs cpu, "
+         "%9lu fired (%.0f/cpu-sec)\n",
+         use_wheel ? "wheel" : "heap", count, t_sched, t_loop, bd.fired,
+         t_loop > 0 ? bd.fired / t_loop : 0.0);
+}
+
+int main(int argc, char *argv[]) {
+  int count = BENCH_TIMERS;
+  int seconds = BENCH_SECONDS;
+
+  if (argc > 1)
+    count = atoi(argv[1]);
+  if (argc > 2)
+    seconds = atoi(argv[2]);
+
+  if (count <= 0 || seconds <= 0) {
+    fprintf(stderr, "Usage: %s [timers] [seconds]\n", argv[0]);
+    return 1;
+  }
+
+  bench_run(0, count, seconds);
+  bench_run(1, count, seconds);
+  return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Nsock regression test suite
+ * Same license as nmap -- see https://nmap.org/book/man-legal.html
+ */
+
+#include "test-common.h"
+
+
+#define ECHO_MSG  "nsock echo test\n"
+
+struct echo_test_data {
+  nsock_pool nsp;
+  nsock_iod iod;
+  int status;
+  int done;
+};
+
+
+static void echo_read_handler(nsock_pool nsp, nsock_event nse, void *udata) {
+  struct echo_test_data *etd = (struct echo_test_data *)udata;
+  char *str;
+  int len;
+
+  if (nse_status(nse) != NSE_STATUS_SUCCESS) {
+    etd->status = nse_errorcode(nse) ? -nse_errorcode(nse) : -EIO;
+    etd->done = 1;
+    return;
+  }
+
+  str = nse_readbuf(nse, &len);
+  if (len != strlen(ECHO_MSG) || memcmp(str, ECHO_MSG, len) != 0)
+    etd->status = -EBADMSG;
+  else
+    etd->status = 0;
+  etd->done = 1;
+}
+
+static void echo_write_handler(nsock_pool nsp, nsock_event nse, void *udata) {
+  struct echo_test_data *etd = (struct echo_test_data *)udata;
+
+  if (nse_status(nse) != NSE_STATUS_SUCCESS) {
+    etd->status = nse_errorcode(nse) ? -nse_errorcode(nse) : -EIO;
+    etd->done = 1;
+    return;
+  }
+  nsock_readlines(nsp, etd->iod, echo_read_handler, 4000, etd, 1);
+}
+
+static void echo_connect_handler(nsock_pool nsp, nsock_event nse, void *udata) {
+  struct echo_test_data *etd = (struct echo_test_data *)udata;
+
+  if (nse_status(nse) != NSE_STATUS_SUCCESS) {
+    etd->status = nse_errorcode(nse) ? -nse_errorcode(nse) : -EIO;
+    etd->done = 1;
+    return;
+  }
+  nsock_write(nsp, etd->iod, echo_write_handler, 4000, etd, ECHO_MSG, -1);
+}
+
+static int echo_setup(void **tdata) {
+  struct echo_test_data *etd;
+
+  etd = calloc(1, sizeof(struct echo_test_data));
+  if (etd == NULL)
+    return -ENOMEM;
+
+  etd->nsp = nsock_pool_new(NULL);
+  AssertNonNull(etd->nsp);
+
+  etd->iod = nsock_iod_new(etd->nsp, NULL);
+  AssertNonNull(etd->iod);
+
+  etd->status = -ETIMEDOUT;
+
+  *tdata = etd;
+  return 0;
+}
+
+static int echo_teardown(void *tdata) {
+  struct echo_test_data *etd = (struct echo_test_data *)tdata;
+
+  if (tdata) {
+    nsock_iod_delete(etd->iod, NSOCK_PENDING_SILENT);
+    nsock_pool_delete(etd->nsp);
+    free(tdata);
+  }
+  return 0;
+}
+
+static int echo_loop(struct echo_test_data *etd) {
+  enum nsock_loopstatus loopret;
+
+  loopret = nsock_loop(etd->nsp, 5000);
+  while (!etd->done && loopret == NSOCK_LOOP_TIMEOUT)
+    loopret = nsock_loop(etd->nsp, 5000);
+
+  return etd->status;
+}
+
+static int echo_tcp_run(void *tdata) {
+  struct echo_test_data *etd = (struct echo_test_data *)tdata;
+  struct sockaddr_in peer;
+
+  memset(&peer, 0, sizeof(peer));
+  peer.sin_family = AF_INET;
+  inet_aton("127.0.0.1", &peer.sin_addr);
+
+  nsock_connect_tcp(etd->nsp, etd->iod, echo_connect_handler, 4000, etd,
+                    (struct sockaddr *)&peer, sizeof(peer), PORT_TCP);
+  return echo_loop(etd);
+}
+
+static int echo_udp_run(void *tdata) {
+  struct echo_test_data *etd = (struct echo_test_data *)tdata;
+  struct sockaddr_in peer;
+
+  memset(&peer, 0, sizeof(peer));
+  peer.sin_family = AF_INET;
+  inet_aton("127.0.0.1", &peer.sin_addr);
+
+  nsock_connect_udp(etd->nsp, etd->iod, echo_connect_handler, etd,
+                    (struct sockaddr *)&peer, sizeof(peer), PORT_UDP);
+  return echo_loop(etd);
+}
+
+
+const struct test_case TestEchoTCP = {
+  .t_name     = "TCP write and read back",
+  .t_setup    = echo_setup,
+  .t_run      = echo_tcp_run,
+  .t_teardown = echo_teardown
+};
+
+const struct test_case TestEchoUDP = {
+  .t_name     = "UDP write and read back",
+  .t_setup    = echo_setup,
+  .t_run      = echo_udp_run,
+  .t_teardown = echo_teardown
+};
@@ -0,0 +1,136 @@
+/*
+ * Nsock regression test suite
+ * Same license as nmap -- see https://nmap.org/book/man-legal.html
+ */
+
+#include "test-common.h"
+#include "../src/gh_wheel.h"
+#include <stdint.h>
+#include <time.h>
+
+
+#define WHEEL_NODES  50000
+/* Past the span of the wheel, to exercise the parking of far timers */
+#define WHEEL_RANGE  ((uint64_t)1 << 26)
+#define WHEEL_START  1234567
+
+struct testitem {
+  uint64_t val;
+  int expired;
+  gh_wnode_t node;
+};
+
+static uint64_t rand_u64(uint64_t max) {
+  uint64_t r;
+
+  r = ((uint64_t)rand() << 32) ^ ((uint64_t)rand() << 16) ^ (uint64_t)rand();
+  return r % max;
+}
+
+/* Turn the wheel by irregular steps and make sure that nodes come out neither
+ * too early nor too late, in non-decreasing order of expiration. */
+static int ghwheel_ordering(void *tdata) {
+  struct testitem *items;
+  gh_wheel_t wheel;
+  uint64_t now, last;
+  int i, n = 0;
+
+  items = calloc(WHEEL_NODES, sizeof(struct testitem));
+  AssertNonNull(items);
+
+  srand(time(NULL));
+  gh_wheel_init(&wheel, WHEEL_START);
+
+  for (i = 0; i < WHEEL_NODES; i++) {
+    items[i].val = WHEEL_START + rand_u64(WHEEL_RANGE);
+    gh_wnode_invalidate(&items[i].node);
+    gh_wheel_add(&wheel, &items[i].node, items[i].val);
+  }
+
+  /* Cancel one node out of four */
+  for (i = 0; i < WHEEL_NODES; i += 4) {
+    gh_wheel_remove(&wheel, &items[i].node);
+    items[i].expired = 1;
+    n++;
+  }
+  AssertEqual(gh_wheel_count(&wheel), WHEEL_NODES - n);
+
+  now = WHEEL_START;
+  last = 0;
+  while (!gh_wheel_is_empty(&wheel)) {
+    gh_wnode_t *wnode;
+    uint64_t next;
+
+    AssertEqual(gh_wheel_next_expiry(&wheel, &next), 1);
+
+    while ((wnode = gh_wheel_pop_expired(&wheel, now)) != NULL) {
+      struct testitem *item = container_of(wnode, struct testitem, node);
+
+      __ASSERT_BASE(item->val <= now);
+      __ASSERT_BASE(item->val >= last);
+      __ASSERT_BASE(item->val >= next);
+      last = item->val;
+      item->expired = 1;
+      n++;
+    }
+
+    /* Nothing due must be left behind */
+    for (i = 0; i < WHEEL_NODES; i += 997)
+      __ASSERT_BASE(items[i].expired || items[i].val > now);
+
+    now += 1 + rand_u64(20000);
+  }
+
+  AssertEqual(n, WHEEL_NODES);
+  AssertEqual(gh_wheel_next_expiry(&wheel, &now), 0);
+
+  gh_wheel_free(&wheel);
+  free(items);
+  return 0;
+}
+
+/* Nodes added behind the wheel are due immediately, and gh_wheel_pop() drains
+ * everything regardless of expiration. */
+static int ghwheel_drain(void *tdata) {
+  struct testitem items[256];
+  gh_wheel_t wheel;
+  gh_wnode_t *wnode = NULL;
+  int i, n;
+
+  gh_wheel_init(&wheel, WHEEL_START);
+
+  for (i = 0; i < 256; i++) {
+    items[i].val = WHEEL_START - 128 + (uint64_t)i * i * i;
+    gh_wnode_invalidate(&items[i].node);
+    gh_wheel_add(&wheel, &items[i].node, items[i].val);
+  }
+
+  for (n = 0; (wnode = gh_wheel_next(&wheel, wnode)) != NULL; n++)
+    ;
+  AssertEqual(n, 256);
+
+  AssertNonNull(gh_wheel_pop_expired(&wheel, WHEEL_START - 1));
+
+  for (n = 1; (wnode = gh_wheel_pop(&wheel)) != NULL; n++)
+    __ASSERT_BASE(!gh_wnode_is_valid(wnode));
+  AssertEqual(n, 256);
+  AssertEqual(gh_wheel_count(&wheel), 0);
+
+  gh_wheel_free(&wheel);
+  return 0;
+}
+
+
+const struct test_case TestGHWheels = {
+  .t_name     = "test nsock internal ghwheels",
+  .t_setup    = NULL,
+  .t_run      = ghwheel_ordering,
+  .t_teardown = NULL
+};
+
+const struct test_case TestWheelDrain = {
+  .t_name     = "test wheels draining",
+  .t_setup    = NULL,
+  .t_run      = ghwheel_drain,
+  .t_teardown = NULL
+};
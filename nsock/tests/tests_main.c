@@ -28,6 +28,7 @@ char *socket_strerror(int errnum);
 
 extern const struct test_case TestPoolUserData;
 extern const struct test_case TestTimer;
+extern const struct test_case TestTimerWheel;
 extern const struct test_case TestLogLevels;
 extern const struct test_case TestErrLevels;
 extern const struct test_case TestConnectTCP;
@@ -35,11 +36,15 @@ extern const struct test_case TestConnectFailure;
 extern const struct test_case TestGHLists;
 extern const struct test_case TestGHHeaps;
 extern const struct test_case TestHeapOrdering;
+extern const struct test_case TestGHWheels;
+extern const struct test_case TestWheelDrain;
 extern const struct test_case TestCancelTCP;
 extern const struct test_case TestCancelUDP;
 #ifdef HAVE_OPENSSL
 extern const struct test_case TestCancelSSL;
 #endif
+extern const struct test_case TestEchoTCP;
+extern const struct test_case TestEchoUDP;
 
 
 static const struct test_case *TestCases[] = {
@@ -47,6 +52,7 @@ static const struct test_case *TestCases[] = {
   &TestPoolUserData,
   /* ---- timer.c */
   &TestTimer,
+  &TestTimerWheel,
   /* ---- logs.c */
   &TestLogLevels,
   &TestErrLevels,
@@ -58,12 +64,18 @@ static const struct test_case *TestCases[] = {
   /* ---- ghheaps.c */
   &TestGHHeaps,
   &TestHeapOrdering,
+  /* ---- ghwheels.c */
+  &TestGHWheels,
+  &TestWheelDrain,
   /* ---- cancel.c */
   &TestCancelTCP,
   &TestCancelUDP,
 #ifdef HAVE_OPENSSL
   &TestCancelSSL,
 #endif
+  /* ---- echo.c */
+  &TestEchoTCP,
+  &TestEchoUDP,
   NULL
 };
 
@@ -112,6 +124,14 @@ int main(int ac, char **av) {
   win_init();
 #endif
 
+  /* run the suite against a specific IO engine, e.g. NSOCK_ENGINE=poll */
+  if (getenv("NSOCK_ENGINE") != NULL &&
+      nsock_set_default_engine(getenv("NSOCK_ENGINE")) < 0) {
+    printf("Unknown nsock engine: %s (available: %s)\n",
+           getenv("NSOCK_ENGINE"), nsock_list_engines());
+    return 1;
+  }
+
   for (i = 0; TestCases[i] != NULL; i++) {
     const struct test_case *current = TestCases[i];
     const char *name = get_test_name(current);
@@ -81,6 +81,19 @@ static int timer_setup(void **tdata) {
   return 0;
 }
 
+static int timer_wheel_setup(void **tdata) {
+  struct timer_test_data *ttd;
+  int rc;
+
+  rc = timer_setup(tdata);
+  if (rc)
+    return rc;
+
+  ttd = (struct timer_test_data *)*tdata;
+  nsock_pool_set_timer_wheel(ttd->nsp, 1);
+  return 0;
+}
+
 static int timer_teardown(void *tdata) {
   struct timer_test_data *ttd = (struct timer_test_data *)tdata;
 
@@ -127,3 +140,10 @@ const struct test_case TestTimer = {
   .t_teardown = timer_teardown
 };
 
+
+const struct test_case TestTimerWheel = {
+  .t_name     = "test timer operations (timing wheel)",
+  .t_setup    = timer_wheel_setup,
+  .t_run      = timer_totalmess,
+  .t_teardown = timer_teardown
+};
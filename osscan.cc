@@ -153,6 +153,10 @@
 # endif
 #endif
 
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #include <algorithm>
 #include <list>
 #include <set>
@@ -651,6 +655,167 @@ void match_fingerprint(const FingerPrint *FP, FingerPrintResultsIPv4 *FPR,
   return;
 }
 
+/* The most worker threads a FingerPrintMatcher starts. */
+#define MAX_MATCH_THREADS 8
+
+#if HAVE_PTHREAD_H
+struct FingerPrintMatcher::State {
+  struct Job {
+    const FingerPrint *FP;
+    FingerPrintResultsIPv4 *FPR;
+  };
+
+  std::list<Job> queue;
+  /* The FPRs of the queued and running matches. */
+  std::multiset<const FingerPrintResultsIPv4 *> busy;
+  std::vector<pthread_t> threads;
+  pthread_mutex_t lock;
+  pthread_cond_t work, done;
+  bool stopping;
+
+  const FingerPrintDB *DB;
+  double accuracy_threshold;
+
+  /* Runs the first queued match. Called and returns with lock held. */
+  void run_one() {
+    Job job = queue.front();
+
+    queue.pop_front();
+    pthread_mutex_unlock(&lock);
+    match_fingerprint(job.FP, job.FPR, DB, accuracy_threshold);
+    pthread_mutex_lock(&lock);
+    busy.erase(busy.find(job.FPR));
+    pthread_cond_broadcast(&done);
+  }
+
+  static void *worker(void *arg) {
+    State *state = (State *) arg;
+
+    pthread_mutex_lock(&state->lock);
+    for (;;) {
+      while (state->queue.empty() && !state->stopping)
+        pthread_cond_wait(&state->work, &state->lock);
+      if (state->queue.empty())
+        break;
+      state->run_one();
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    return NULL;
+  }
+};
+#else
+struct FingerPrintMatcher::State {
+};
+#endif
+
+FingerPrintMatcher::FingerPrintMatcher(const FingerPrintDB *DB, double accuracy_threshold) {
+  long ncpus = 1;
+
+  this->DB = DB;
+  this->accuracy_threshold = accuracy_threshold;
+  this->state = NULL;
+
+#if HAVE_PTHREAD_H && defined(_SC_NPROCESSORS_ONLN)
+  ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (ncpus < 2)
+    return;
+
+#if HAVE_PTHREAD_H
+  pthread_t thread;
+  long i;
+
+  state = new State;
+  state->DB = DB;
+  state->accuracy_threshold = accuracy_threshold;
+  state->stopping = false;
+  pthread_mutex_init(&state->lock, NULL);
+  pthread_cond_init(&state->work, NULL);
+  pthread_cond_init(&state->done, NULL);
+  /* The thread calling wait() makes up the last one. */
+  for (i = 0; i < MIN(ncpus, MAX_MATCH_THREADS) - 1; i++) {
+    if (pthread_create(&thread, NULL, State::worker, state) != 0) {
+      if (o.debugging)
+        error("Could not start an OS fingerprint matching thread: %s", strerror(errno));
+      break;
+    }
+    state->threads.push_back(thread);
+  }
+  if (o.debugging > 1)
+    log_write(LOG_PLAIN, "Matching OS fingerprints on %u threads\n", (unsigned int) state->threads.size());
+#endif
+}
+
+FingerPrintMatcher::~FingerPrintMatcher() {
+  if (state == NULL)
+    return;
+
+#if HAVE_PTHREAD_H
+  std::vector<pthread_t>::iterator it;
+
+  wait();
+  pthread_mutex_lock(&state->lock);
+  state->stopping = true;
+  pthread_cond_broadcast(&state->work);
+  pthread_mutex_unlock(&state->lock);
+  for (it = state->threads.begin(); it != state->threads.end(); it++)
+    pthread_join(*it, NULL);
+  pthread_cond_destroy(&state->done);
+  pthread_cond_destroy(&state->work);
+  pthread_mutex_destroy(&state->lock);
+#endif
+  delete state;
+}
+
+void FingerPrintMatcher::add(const FingerPrint *FP, FingerPrintResultsIPv4 *FPR) {
+  if (state == NULL) {
+    match_fingerprint(FP, FPR, DB, accuracy_threshold);
+    return;
+  }
+
+#if HAVE_PTHREAD_H
+  State::Job job = { FP, FPR };
+
+  pthread_mutex_lock(&state->lock);
+  state->queue.push_back(job);
+  state->busy.insert(FPR);
+  pthread_cond_signal(&state->work);
+  pthread_mutex_unlock(&state->lock);
+#endif
+}
+
+bool FingerPrintMatcher::pending(const FingerPrintResultsIPv4 *FPR) {
+  bool result = false;
+
+  if (state == NULL)
+    return false;
+
+#if HAVE_PTHREAD_H
+  pthread_mutex_lock(&state->lock);
+  result = state->busy.find(FPR) != state->busy.end();
+  pthread_mutex_unlock(&state->lock);
+#endif
+
+  return result;
+}
+
+void FingerPrintMatcher::wait(const FingerPrintResultsIPv4 *FPR) {
+  if (state == NULL)
+    return;
+
+#if HAVE_PTHREAD_H
+  pthread_mutex_lock(&state->lock);
+  while (FPR == NULL ? !state->busy.empty() : state->busy.find(FPR) != state->busy.end()) {
+    if (!state->queue.empty())
+      state->run_one();
+    else
+      pthread_cond_wait(&state->done, &state->lock);
+  }
+  pthread_mutex_unlock(&state->lock);
+#endif
+}
+
 static const char *dist_method_fp_string(enum dist_calc_method method)
 {
   const char *s = "";
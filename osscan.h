@@ -257,6 +257,35 @@ double compare_fingerprints(const FingerPrint *referenceFP, const FingerPrint *o
 void match_fingerprint(const FingerPrint *FP, FingerPrintResultsIPv4 *FPR,
                        const FingerPrintDB *DB, double accuracy_threshold);
 
+/* Runs match_fingerprint() for many fingerprints at once on a pool of worker
+   threads, so that OS detection can go on probing other hosts while the
+   fingerprints it already has are scored. Each match writes only to its own
+   FPR, so the results do not depend on the order the matches finish in.
+   Without thread support (or with a single CPU) matches are run by add()
+   itself. */
+class FingerPrintMatcher {
+ public:
+  FingerPrintMatcher(const FingerPrintDB *DB, double accuracy_threshold);
+  /* Waits for the queued matches to finish. */
+  ~FingerPrintMatcher();
+
+  /* Queues FP to be matched into FPR. Neither may be freed or otherwise
+     used until pending(FPR) returns false. */
+  void add(const FingerPrint *FP, FingerPrintResultsIPv4 *FPR);
+  /* Returns true if a match into FPR is queued or running. */
+  bool pending(const FingerPrintResultsIPv4 *FPR);
+  /* Waits until no match into FPR is queued or running, or until no match at
+     all is if FPR is NULL. The calling thread helps with queued matches while
+     it waits. */
+  void wait(const FingerPrintResultsIPv4 *FPR = NULL);
+
+ private:
+  struct State;
+  const FingerPrintDB *DB;
+  double accuracy_threshold;
+  State *state; /* NULL if matches are run by add() */
+};
+
 /* Returns true if perfect match -- if num_subtests & num_subtests_succeeded are non_null it updates them.  if shortcircuit is zero, it does all the tests, otherwise it returns when the first one fails */
 
 void freeFingerPrint(FingerPrint *FP);
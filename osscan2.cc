@@ -453,19 +453,6 @@ const char *tsseqclass2ascii(int seqclass) {
 }
 
 
-/* Start the timeout clocks of any targets that aren't already timedout */
-static void startTimeOutClocks(OsScanInfo *OSI) {
-  std::list<HostOsScanInfo *>::iterator hostI;
-
-  gettimeofday(&now, NULL);
-  for (hostI = OSI->incompleteHosts.begin();
-       hostI != OSI->incompleteHosts.end(); hostI++) {
-    if (!(*hostI)->target->timedOut(NULL))
-      (*hostI)->target->startTimeOutClock(&now);
-  }
-}
-
-
 /** Sets up the pcap descriptor in HOS (obtains a descriptor and sets the
  * appropriate BPF filter, based on the supplied list of targets). */
 static void begin_sniffer(HostOsScan *HOS, std::vector<Target *> &Targets) {
@@ -523,233 +510,265 @@ static void begin_sniffer(HostOsScan *HOS, std::vector<Target *> &Targets) {
 }
 
 
-/* Sets everything up so the current round can be performed. This includes
- * reinitializing some variables of the supplied objects and deleting
- * some old information. */
-static void startRound(OsScanInfo *OSI, HostOsScan *HOS, int roundNum) {
-  std::list<HostOsScanInfo *>::iterator hostI;
-  HostOsScanInfo *hsi = NULL;
+/* Returns how many hosts may be probed at once. The base size depends on the
+ * timing level (above -T4 there is no limit) and is scaled by how far the
+ * group congestion window has moved from where it started, so more hosts are
+ * let in while the network takes the probes well and fewer while probes are
+ * being dropped. */
+static unsigned int windowSize(OsScanInfo *OSI, HostOsScan *HOS) {
+  double base = 20;
 
-  /* Reinitial some parameters of the scan system. */
-  HOS->reInitScanSystem();
+  if (o.timing_level > 4)
+    return OSI->numIncompleteHosts() + OSI->numPendingHosts();
+  if (o.timing_level == 4)
+    base = 30;
 
-  for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
-    hsi = *hostI;
-    if (hsi->FPs[roundNum]) {
-      delete hsi->FPs[roundNum];
-      hsi->FPs[roundNum] = NULL;
-    }
-    hsi->hss->initScanStats();
-  }
+  return (unsigned int) box(base / 4, base * 4,
+                            base * HOS->stats->timing.cwnd / perf.group_initial_cwnd);
 }
 
-/* Run the sequence generation tests (6 TCP probes sent 100ms apart) */
-static void doSeqTests(OsScanInfo *OSI, HostOsScan *HOS) {
-  std::list<HostOsScanInfo *>::iterator hostI;
-  HostOsScanInfo *hsi = NULL;
-  HostOsScanStats *hss = NULL;
-  unsigned int unableToSend = 0;  /* # of times in a row that hosts were unable to send probe */
-  unsigned int expectReplies = 0;
-  long to_usec = 0;
-  int timeToSleep = 0;
-  struct ip *ip = NULL;
-  struct link_header linkhdr;
-  struct sockaddr_storage ss;
-  unsigned int bytes = 0;
-  struct timeval rcvdtime;
-  struct timeval stime;
-  struct timeval tmptv;
-  bool timedout = false;
-  bool thisHostGood = false;
-  bool foundgood = false;
-  bool goodResponse = false;
-  int numProbesLeft = 0;
-
-  memset(&stime, 0, sizeof(stime));
-  memset(&tmptv, 0, sizeof(tmptv));
 
-  /* For each host, build a list of sequence probes to send */
-  for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
-    hsi = *hostI;
-    hss = hsi->hss;
-    HOS->buildSeqProbeList(hss);
+/* Sets everything up so the host can start its next try. This includes
+ * reinitializing its scan stats and deleting the fingerprint left from an
+ * earlier scan in the same slot. */
+static void startTry(HostOsScan *HOS, HostOsScanInfo *hsi) {
+  if (hsi->FPs[hsi->tryNo]) {
+    delete hsi->FPs[hsi->tryNo];
+    hsi->FPs[hsi->tryNo] = NULL;
   }
+  hsi->hss->initScanStats();
+  HOS->buildSeqProbeList(hsi->hss);
+  hsi->phase = OSP_SEQ;
+}
 
-  /* Iterate until we have sent all the probes */
-  do {
-    if (timeToSleep > 0) {
-      if (o.debugging > 1)
-        log_write(LOG_PLAIN, "Sleep %dus for next sequence probe\n", timeToSleep);
-      usleep(timeToSleep);
-    }
 
-    gettimeofday(&now, NULL);
-    expectReplies = 0;
-    unableToSend = 0;
+/* Moves hosts from pendingHosts into the window while there is room for
+ * them, starting their timeout clocks and their first try. Returns the
+ * number of hosts moved. */
+static int fillWindow(OsScanInfo *OSI, HostOsScan *HOS) {
+  HostOsScanInfo *hsi = NULL;
+  unsigned int window = windowSize(OSI, HOS);
+  bool wasEmpty = OSI->incompleteHosts.empty();
+  int hostsAdded = 0;
 
-    if (o.debugging > 2) {
-      for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
-        hss = (*hostI)->hss;
-        log_write(LOG_PLAIN, "Host %s. ProbesToSend %d: \tProbesActive %d\n",
-                  hss->target->targetipstr(), hss->numProbesToSend(),
-                  hss->numProbesActive());
-      }
-    }
+  gettimeofday(&now, NULL);
+  while (!OSI->pendingHosts.empty() && OSI->numIncompleteHosts() < window) {
+    hsi = OSI->pendingHosts.front();
+    OSI->pendingHosts.pop_front();
+    if (!hsi->target->timedOut(NULL))
+      hsi->target->startTimeOutClock(&now);
+    startTry(HOS, hsi);
+    OSI->incompleteHosts.push_back(hsi);
+    hostsAdded++;
+  }
+  if (wasEmpty)
+    OSI->resetHostIterator();
 
-    /* Send a seq probe to each host. */
-    while (unableToSend < OSI->numIncompleteHosts() && HOS->stats->sendOK()) {
-      hsi = OSI->nextIncompleteHost();
-      hss = hsi->hss;
-      gettimeofday(&now, NULL);
-      if (hss->numProbesToSend()>0 && HOS->hostSeqSendOK(hss, NULL)) {
-        HOS->sendNextProbe(hss);
-        expectReplies++;
-        unableToSend = 0;
-      } else {
-        unableToSend++;
-      }
-    }
+  return hostsAdded;
+}
 
-    HOS->stats->num_probes_sent_at_last_wait = HOS->stats->num_probes_sent;
 
-    gettimeofday(&now, NULL);
+/* Makes up the fingerprint of the try the host has just finished and hands it
+ * to the matcher. endTry() takes over once the match is done. */
+static void startMatch(HostOsScan *HOS, FingerPrintMatcher *matcher, HostOsScanInfo *hsi) {
+  int tryNo = hsi->tryNo;
+  int distance = -1;
+  enum dist_calc_method distance_calculation_method = DIST_METHOD_NONE;
 
-    /* Count the pcap wait time. */
-    if (!HOS->stats->sendOK()) {
-      TIMEVAL_MSEC_ADD(stime, now, 1000);
+  HOS->makeFP(hsi->hss);
 
-      for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
-        if (HOS->nextTimeout((*hostI)->hss, &tmptv)) {
-          if (TIMEVAL_SUBTRACT(tmptv, stime) < 0)
-            stime = tmptv;
-        }
-      }
-    } else {
-      foundgood = false;
-      for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
-        thisHostGood = HOS->hostSeqSendOK((*hostI)->hss, &tmptv);
-        if (thisHostGood) {
-          stime = tmptv;
-          foundgood = true;
-          break;
-        }
+  hsi->FPs[tryNo] = hsi->hss->getFP();
+  hsi->FPR->FPs[tryNo] = hsi->FPs[tryNo];
+  hsi->FPR->numFPs = tryNo + 1;
+  double tr = hsi->hss->timingRatio();
+  hsi->target->FPR->maxTimingRatio = MAX(hsi->target->FPR->maxTimingRatio, tr);
+  matcher->add(hsi->FPs[tryNo], &hsi->FP_matches[tryNo]);
+  hsi->phase = OSP_MATCH;
 
-        if (!foundgood || TIMEVAL_SUBTRACT(tmptv, stime) < 0) {
-          stime = tmptv;
-          foundgood = true;
-        }
-      }
-    }
+  if (islocalhost(hsi->target->TargetSockAddr())) {
+    /* scanning localhost */
+    distance = 0;
+    distance_calculation_method = DIST_METHOD_LOCALHOST;
+  } else if (hsi->target->MACAddress()) {
+    /* on the same network segment */
+    distance = 1;
+    distance_calculation_method = DIST_METHOD_DIRECT;
+  } else if (hsi->hss->distance!=-1) {
+    distance = hsi->hss->distance;
+    distance_calculation_method = DIST_METHOD_ICMP;
+  }
 
-    do {
-      to_usec = TIMEVAL_SUBTRACT(stime, now);
-      if (to_usec < 2000)
-        to_usec = 2000;
+  hsi->target->distance = hsi->target->FPR->distance = distance;
+  hsi->target->distance_calculation_method = distance_calculation_method;
+  hsi->target->FPR->distance_guess = hsi->hss->distance_guess;
+}
 
-      if (o.debugging > 2)
-        log_write(LOG_PLAIN, "pcap wait time is %ld.\n", to_usec);
 
-      ip = (struct ip*) readipv4_pcap(HOS->pd, &bytes, to_usec, &rcvdtime, &linkhdr, true);
+/* Looks at how the fingerprint of the host's last try matched. A perfect
+ * match completes the host; the match is then redone into the host's FPR,
+ * which the matcher finishes before os_scan_ipv4() returns. */
+static void endTry(FingerPrintMatcher *matcher, HostOsScanInfo *hsi) {
+  int tryNo = hsi->tryNo;
 
-      gettimeofday(&now, NULL);
+  if (hsi->FP_matches[tryNo].overall_results == OSSCAN_SUCCESS &&
+      hsi->FP_matches[tryNo].num_perfect_matches > 0) {
+    memcpy(&(hsi->target->seq), &hsi->hss->si, sizeof(struct seq_info));
+    if (tryNo > 0) {
+      if (o.verbose)
+        log_write(LOG_STDOUT, "WARNING: OS didn't match until try #%d\n", tryNo + 1);
+    }
+    matcher->add(hsi->FPR->FPs[tryNo], hsi->FPR);
+    hsi->isCompleted = true;
+  }
+}
 
-      if (!ip && TIMEVAL_SUBTRACT(stime, now) < 0) {
-        timedout = true;
-        break;
-      } else if (!ip) {
-        continue;
-      }
 
-      if (TIMEVAL_SUBTRACT(now, stime) > 200000) {
-        /* While packets are still being received, I'll be generous and give
-           an extra 1/5 sec.  But we have to draw the line somewhere */
-        timedout = true;
+/* Checks whether the host may be sent its next probe, the way hostSeqSendOK()
+ * or hostSendOK() do for the phase it is in. If not, fills when (if not NULL)
+ * with the time it may have something to do and returns false. */
+static bool hostTryOK(HostOsScan *HOS, HostOsScanInfo *hsi, struct timeval *when) {
+  if (hsi->phase == OSP_WAIT || hsi->phase == OSP_MATCH || hsi->hss->numProbesToSend() == 0) {
+    if (when) {
+      if (hsi->phase == OSP_WAIT) {
+        *when = hsi->nextTry;
+      } else if (hsi->phase == OSP_MATCH) {
+        /* Check on the match again soon */
+        TIMEVAL_MSEC_ADD(*when, now, 10);
+      } else {
+        HOS->nextTimeout(hsi->hss, when);
       }
+    }
+    return false;
+  }
 
-      if (bytes < (4 * ip->ip_hl) + 4U)
-        continue;
-
-      memset(&ss, 0, sizeof(ss));
-      ((struct sockaddr_in *) &ss)->sin_addr.s_addr = ip->ip_src.s_addr;
-      ss.ss_family = AF_INET;
-      hsi = OSI->findIncompleteHost(&ss);
-      if (!hsi)
-        continue; /* Not from one of our targets. */
-      setTargetMACIfAvailable(hsi->target, &linkhdr, &ss, 0);
+  if (hsi->phase == OSP_SEQ)
+    return HOS->hostSeqSendOK(hsi->hss, when);
+  else
+    return HOS->hostSendOK(hsi->hss, when);
+}
 
-      goodResponse = HOS->processResp(hsi->hss, ip, bytes, &rcvdtime);
 
-      if (goodResponse)
-        expectReplies--;
+/* Moves each host in the window along its try: expires its timed out probes,
+ * starts the TCP, UDP and ICMP tests once the sequence tests are done, and
+ * makes up the fingerprint for the matcher once those are done too. A host
+ * whose fingerprint did not match waits a little before its next try, or is
+ * moved to unMatchedHosts once it has used up its tries. Hosts that matched
+ * or timed out are removed from the window. */
+static void advanceHosts(OsScanInfo *OSI, HostOsScan *HOS, FingerPrintMatcher *matcher,
+                         std::list<HostOsScanInfo *> *unMatchedHosts) {
+  std::list<HostOsScanInfo *>::iterator hostI, nextHost;
+  HostOsScanInfo *hsi = NULL;
+  HostOsScanStats *hss = NULL;
+  int max_tries;
 
-    } while (!timedout && expectReplies > 0);
+  gettimeofday(&now, NULL);
+  for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI = nextHost) {
+    nextHost = hostI;
+    nextHost++;
+    hsi = *hostI;
+    hss = hsi->hss;
 
-    /* Remove any timeout hosts during the scan. */
-    OSI->removeCompletedHosts();
+    if (hsi->target->timedOut(&now)) {
+      /* removeCompletedHosts() drops it below, probes and all. */
+      HOS->stats->num_probes_active -= hss->numProbesActive();
+      if (hsi->phase == OSP_MATCH)
+        matcher->wait(&hsi->FP_matches[hsi->tryNo]);
+      continue;
+    }
 
-    numProbesLeft = 0;
-    for (hostI = OSI->incompleteHosts.begin();
-        hostI != OSI->incompleteHosts.end(); hostI++) {
-      hss = (*hostI)->hss;
+    if (hsi->phase == OSP_SEQ) {
       HOS->updateActiveSeqProbes(hss);
-      numProbesLeft += hss->numProbesToSend();
-      numProbesLeft += hss->numProbesActive();
+    } else if (hsi->phase == OSP_TUI) {
+      HOS->updateActiveTUIProbes(hss);
+    } else if (hsi->phase == OSP_MATCH) {
+      if (matcher->pending(&hsi->FP_matches[hsi->tryNo]))
+        continue;
+    } else if (TIMEVAL_SUBTRACT(hsi->nextTry, now) <= 0) {
+      if (o.verbose) {
+        log_write(LOG_STDOUT, "Retrying OS detection (try #%d) against %s\n",
+                  hsi->tryNo + 1, hsi->target->NameIP());
+        log_flush_all();
+      }
+      startTry(HOS, hsi);
     }
 
-    gettimeofday(&now, NULL);
+    if (hsi->phase == OSP_WAIT || hss->numProbesToSend() > 0 || hss->numProbesActive() > 0)
+      continue;
 
-    if (expectReplies == 0) {
-      timeToSleep = TIMEVAL_SUBTRACT(stime, now);
-    } else {
-      timeToSleep = 0;
+    if (hsi->phase == OSP_SEQ) {
+      HOS->buildTUIProbeList(hss);
+      hsi->phase = OSP_TUI;
+      continue;
     }
 
-  } while (numProbesLeft > 0);
+    if (hsi->phase == OSP_TUI) {
+      startMatch(HOS, matcher, hsi);
+      if (matcher->pending(&hsi->FP_matches[hsi->tryNo]))
+        continue;
+    }
+
+    endTry(matcher, hsi);
+    if (hsi->isCompleted)
+      continue;
+
+    max_tries = o.maxOSTries(); /* The amt. if print is suitable for submission */
+    if (hsi->target->FPR->OmitSubmissionFP())
+      max_tries = MIN(max_tries, STANDARD_OS2_TRIES);
+
+    if (hsi->FPR->numFPs >= max_tries) {
+      /* We've done all the OS2 tries we're going to do ... move this
+         to unMatchedHosts */
+      hsi->target->stopTimeOutClock(&now);
+      OSI->incompleteHosts.erase(hostI);
+      /* We need to adjust nextI if necessary */
+      OSI->resetHostIterator();
+      unMatchedHosts->push_back(hsi);
+    } else {
+      hsi->tryNo++;
+      hsi->phase = OSP_WAIT;
+      /* Wait a little longer before the fourth try just in case it matters */
+      TIMEVAL_MSEC_ADD(hsi->nextTry, now, (hsi->tryNo == 3) ? 2500 : 1000);
+    }
+  }
 
+  OSI->removeCompletedHosts();
 }
 
 
-/* TCP, UDP, ICMP Tests */
-static void doTUITests(OsScanInfo *OSI, HostOsScan *HOS) {
+/* Runs the OS detection tests against the hosts in OSI until each one has
+ * either matched or used up its tries. Only a window of hosts is probed at a
+ * time; pending hosts enter it as others leave, so one slow or lossy host
+ * holds up nobody but itself. */
+static void doTests(OsScanInfo *OSI, HostOsScan *HOS, FingerPrintMatcher *matcher,
+                    std::list<HostOsScanInfo *> *unMatchedHosts) {
   std::list<HostOsScanInfo *>::iterator hostI;
   HostOsScanInfo *hsi = NULL;
   HostOsScanStats *hss = NULL;
-  unsigned int unableToSend; /* # of times in a row that hosts were unable to send probe */
-  unsigned int expectReplies;
-  long to_usec;
+  unsigned int unableToSend = 0;  /* # of times in a row that hosts were unable to send probe */
+  unsigned int expectReplies = 0;
+  long to_usec = 0;
   int timeToSleep = 0;
-
   struct ip *ip = NULL;
   struct link_header linkhdr;
   struct sockaddr_storage ss;
-  unsigned int bytes;
+  unsigned int bytes = 0;
   struct timeval rcvdtime;
-
-  struct timeval stime, tmptv;
-
+  struct timeval stime;
+  struct timeval tmptv;
   bool timedout = false;
-  bool thisHostGood;
-  bool foundgood;
-  bool goodResponse;
-  int numProbesLeft = 0;
+  bool thisHostGood = false;
+  bool foundgood = false;
+  bool goodResponse = false;
 
   memset(&stime, 0, sizeof(stime));
   memset(&tmptv, 0, sizeof(tmptv));
 
-  for (hostI = OSI->incompleteHosts.begin();
-      hostI != OSI->incompleteHosts.end(); hostI++) {
-    hsi = *hostI;
-    hss = hsi->hss;
-    HOS->buildTUIProbeList(hss);
-  }
-
-  do {
+  fillWindow(OSI, HOS);
 
+  while (OSI->numIncompleteHosts() > 0) {
     if (timeToSleep > 0) {
-      if (o.debugging > 1) {
-        log_write(LOG_PLAIN, "Time to sleep %d. Sleeping. \n", timeToSleep);
-      }
-
+      if (o.debugging > 1)
+        log_write(LOG_PLAIN, "Sleep %dus for next OS probe\n", timeToSleep);
       usleep(timeToSleep);
     }
 
@@ -758,21 +777,20 @@ static void doTUITests(OsScanInfo *OSI, HostOsScan *HOS) {
     unableToSend = 0;
 
     if (o.debugging > 2) {
-      for (hostI = OSI->incompleteHosts.begin();
-          hostI != OSI->incompleteHosts.end(); hostI++) {
+      for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
         hss = (*hostI)->hss;
-        log_write(LOG_PLAIN, "Host %s. ProbesToSend %d: \tProbesActive %d\n",
-                  hss->target->targetipstr(), hss->numProbesToSend(),
-                  hss->numProbesActive());
+        log_write(LOG_PLAIN, "Host %s. Try %d phase %d. ProbesToSend %d: \tProbesActive %d\n",
+                  hss->target->targetipstr(), (*hostI)->tryNo + 1, (*hostI)->phase,
+                  hss->numProbesToSend(), hss->numProbesActive());
       }
     }
 
+    /* Send a probe to each host that may have one. */
     while (unableToSend < OSI->numIncompleteHosts() && HOS->stats->sendOK()) {
       hsi = OSI->nextIncompleteHost();
-      hss = hsi->hss;
       gettimeofday(&now, NULL);
-      if (hss->numProbesToSend()>0 && HOS->hostSendOK(hss, NULL)) {
-        HOS->sendNextProbe(hss);
+      if (hostTryOK(HOS, hsi, NULL)) {
+        HOS->sendNextProbe(hsi->hss);
         expectReplies++;
         unableToSend = 0;
       } else {
@@ -788,18 +806,19 @@ static void doTUITests(OsScanInfo *OSI, HostOsScan *HOS) {
     if (!HOS->stats->sendOK()) {
       TIMEVAL_MSEC_ADD(stime, now, 1000);
 
-      for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end();
-          hostI++) {
-        if (HOS->nextTimeout((*hostI)->hss, &tmptv)) {
+      for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
+        if ((*hostI)->phase == OSP_WAIT) {
+          if (TIMEVAL_SUBTRACT((*hostI)->nextTry, stime) < 0)
+            stime = (*hostI)->nextTry;
+        } else if (HOS->nextTimeout((*hostI)->hss, &tmptv)) {
           if (TIMEVAL_SUBTRACT(tmptv, stime) < 0)
             stime = tmptv;
         }
       }
-    }
-    else {
+    } else {
       foundgood = false;
       for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
-        thisHostGood = HOS->hostSendOK((*hostI)->hss, &tmptv);
+        thisHostGood = hostTryOK(HOS, *hostI, &tmptv);
         if (thisHostGood) {
           stime = tmptv;
           foundgood = true;
@@ -813,9 +832,11 @@ static void doTUITests(OsScanInfo *OSI, HostOsScan *HOS) {
       }
     }
 
+    timedout = false;
     do {
       to_usec = TIMEVAL_SUBTRACT(stime, now);
-      if (to_usec < 2000) to_usec = 2000;
+      if (to_usec < 2000)
+        to_usec = 2000;
 
       if (o.debugging > 2)
         log_write(LOG_PLAIN, "pcap wait time is %ld.\n", to_usec);
@@ -847,6 +868,8 @@ static void doTUITests(OsScanInfo *OSI, HostOsScan *HOS) {
       if (!hsi)
         continue; /* Not from one of our targets. */
       setTargetMACIfAvailable(hsi->target, &linkhdr, &ss, 0);
+      if (hsi->phase == OSP_WAIT || hsi->phase == OSP_MATCH)
+        continue; /* A late reply to the last try. */
 
       goodResponse = HOS->processResp(hsi->hss, ip, bytes, &rcvdtime);
 
@@ -855,84 +878,21 @@ static void doTUITests(OsScanInfo *OSI, HostOsScan *HOS) {
 
     } while (!timedout && expectReplies > 0);
 
-    /* Remove any timeout hosts during the scan. */
-    OSI->removeCompletedHosts();
-
-    numProbesLeft = 0;
-    for (hostI = OSI->incompleteHosts.begin();
-        hostI != OSI->incompleteHosts.end(); hostI++) {
-      hss = (*hostI)->hss;
-      HOS->updateActiveTUIProbes(hss);
-      numProbesLeft += hss->numProbesToSend();
-      numProbesLeft += hss->numProbesActive();
-    }
+    advanceHosts(OSI, HOS, matcher, unMatchedHosts);
 
     gettimeofday(&now, NULL);
 
-    if (expectReplies == 0) {
+    /* Hosts let into the window may be sent probes right away. */
+    if (fillWindow(OSI, HOS) == 0 && expectReplies == 0) {
       timeToSleep = TIMEVAL_SUBTRACT(stime, now);
     } else {
       timeToSleep = 0;
     }
-
-  } while (numProbesLeft > 0);
-}
-
-
-static void endRound(OsScanInfo *OSI, HostOsScan *HOS, int roundNum) {
-  std::list<HostOsScanInfo *>::iterator hostI;
-  HostOsScanInfo *hsi = NULL;
-  int distance = -1;
-  enum dist_calc_method distance_calculation_method = DIST_METHOD_NONE;
-
-  for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI++) {
-    distance = -1;
-    hsi = *hostI;
-    HOS->makeFP(hsi->hss);
-
-    hsi->FPs[roundNum] = hsi->hss->getFP();
-    hsi->FPR->FPs[roundNum] = hsi->FPs[roundNum];
-    hsi->FPR->numFPs = roundNum + 1;
-    double tr = hsi->hss->timingRatio();
-    hsi->target->FPR->maxTimingRatio = MAX(hsi->target->FPR->maxTimingRatio, tr);
-    match_fingerprint(hsi->FPs[roundNum], &hsi->FP_matches[roundNum],
-                      o.reference_FPs, OSSCAN_GUESS_THRESHOLD);
-
-    if (hsi->FP_matches[roundNum].overall_results == OSSCAN_SUCCESS &&
-        hsi->FP_matches[roundNum].num_perfect_matches > 0) {
-      memcpy(&(hsi->target->seq), &hsi->hss->si, sizeof(struct seq_info));
-      if (roundNum > 0) {
-        if (o.verbose)
-          log_write(LOG_STDOUT, "WARNING: OS didn't match until try #%d\n", roundNum + 1);
-      }
-      match_fingerprint(hsi->FPR->FPs[roundNum], hsi->FPR,
-                        o.reference_FPs, OSSCAN_GUESS_THRESHOLD);
-      hsi->isCompleted = true;
-    }
-
-    if (islocalhost(hsi->target->TargetSockAddr())) {
-      /* scanning localhost */
-      distance = 0;
-      distance_calculation_method = DIST_METHOD_LOCALHOST;
-    } else if (hsi->target->MACAddress()) {
-      /* on the same network segment */
-      distance = 1;
-      distance_calculation_method = DIST_METHOD_DIRECT;
-    } else if (hsi->hss->distance!=-1) {
-      distance = hsi->hss->distance;
-      distance_calculation_method = DIST_METHOD_ICMP;
-    }
-
-    hsi->target->distance = hsi->target->FPR->distance = distance;
-    hsi->target->distance_calculation_method = distance_calculation_method;
-    hsi->target->FPR->distance_guess = hsi->hss->distance_guess;
-
   }
-  OSI->removeCompletedHosts();
 }
 
 
-static void findBestFPs(OsScanInfo *OSI) {
+static void findBestFPs(OsScanInfo *OSI, FingerPrintMatcher *matcher) {
   std::list<HostOsScanInfo *>::iterator hostI;
   HostOsScanInfo *hsi = NULL;
   int i;
@@ -961,9 +921,9 @@ static void findBestFPs(OsScanInfo *OSI) {
     // Now we redo the match, since target->FPR has various data (such as
     // target->FPR->numFPs) which is not in FP_matches[bestaccidx].  This is
     // kinda ugly.
-    match_fingerprint(hsi->FPR->FPs[bestaccidx], (FingerPrintResultsIPv4 *) hsi->target->FPR,
-                      o.reference_FPs, OSSCAN_GUESS_THRESHOLD);
+    matcher->add(hsi->FPR->FPs[bestaccidx], (FingerPrintResultsIPv4 *) hsi->target->FPR);
   }
+  matcher->wait();
 }
 
 
@@ -989,40 +949,6 @@ static void printFP(OsScanInfo *OSI) {
 }
 
 
-/* Goes through every unmatched host in OSI.  If a host has completed
-   the maximum number of OS detection tries allowed for it without
-   matching, it is transferred to the passed in unMatchedHosts list.
-   Returns the number of hosts moved to unMatchedHosts. */
-static int expireUnmatchedHosts(OsScanInfo *OSI, std::list<HostOsScanInfo *> *unMatchedHosts) {
-  std::list<HostOsScanInfo *>::iterator hostI, nextHost;
-  int hostsRemoved = 0;
-  HostOsScanInfo *HOS;
-
-  gettimeofday(&now, NULL);
-  for (hostI = OSI->incompleteHosts.begin(); hostI != OSI->incompleteHosts.end(); hostI = nextHost) {
-    HOS = *hostI;
-    nextHost = hostI;
-    nextHost++;
-
-    int max_tries = o.maxOSTries(); /* The amt. if print is suitable for submission */
-    if (HOS->target->FPR->OmitSubmissionFP())
-      max_tries = MIN(max_tries, STANDARD_OS2_TRIES);
-
-    if (HOS->FPR->numFPs >= max_tries) {
-      /* We've done all the OS2 tries we're going to do ... move this
-     to unMatchedHosts */
-      HOS->target->stopTimeOutClock(&now);
-      OSI->incompleteHosts.erase(hostI);
-      /* We need to adjust nextI if necessary */
-      OSI->resetHostIterator();
-      hostsRemoved++;
-      unMatchedHosts->push_back(HOS);
-    }
-  }
-  return hostsRemoved;
-}
-
-
 /******************************************************************************
  * Implementation of class OFProbe                                            *
  ******************************************************************************/
@@ -1088,6 +1014,7 @@ HostOsScanStats::HostOsScanStats(Target * t) {
   timing.num_replies_received = 0;
   timing.num_updates = 0;
   gettimeofday(&timing.last_drop, NULL);
+  timing.init(&perf, &timing.last_drop);
 
   for (i = 0; i < NUM_FPTESTS; i++)
     FPtests[i] = NULL;
@@ -1260,6 +1187,11 @@ void HostOsScanStats::initScanStats() {
   storedIcmpReply = -1;
 
   memset(&upi, 0, sizeof(upi));
+
+  tcpSeqBase = get_random_u32();
+  tcpAck = get_random_u32();
+  icmpEchoId = get_random_u16();
+  udpttl = (time(NULL) % 14) + 51;
 }
 
 
@@ -1418,8 +1350,10 @@ void HostOsScan::adjust_times(HostOsScanStats *hss, OFProbe *probe, struct timev
   /* Increase the window for a positive reply. This can overlap with case (1)
      above. */
   if (rcvdtime != NULL) {
-    stats->timing.ack(&perf);
-    hss->timing.ack(&perf);
+    /* The rtt of a retransmitted probe is ambiguous. */
+    long rtt = probe->tryno == 0 ? TIMEVAL_SUBTRACT(*rcvdtime, probe->sent) : -1;
+    stats->timing.ack(&perf, 1.0, rcvdtime, rtt);
+    hss->timing.ack(&perf, 1.0, rcvdtime, rtt);
   }
 }
 
@@ -1450,7 +1384,8 @@ HostOsScan::HostOsScan(Target *t) {
 
   tcpPortBase = o.magic_port_set? o.magic_port : o.magic_port + get_random_u8();
   udpPortBase = o.magic_port_set? o.magic_port : o.magic_port + get_random_u8();
-  reInitScanSystem();
+  tcpMss = 265;
+  icmpEchoSeq = 295;
 
   stats = new ScanStats();
 }
@@ -1470,16 +1405,6 @@ HostOsScan::~HostOsScan() {
 }
 
 
-void HostOsScan::reInitScanSystem() {
-  tcpSeqBase = get_random_u32();
-  tcpAck = get_random_u32();
-  tcpMss = 265;
-  icmpEchoId = get_random_u16();
-  icmpEchoSeq = 295;
-  udpttl = (time(NULL) % 14) + 51;
-}
-
-
 /* Initiate seq probe list */
 void HostOsScan::buildSeqProbeList(HostOsScanStats *hss) {
   assert(hss);
@@ -1825,7 +1750,7 @@ void HostOsScan::sendTSeqProbe(HostOsScanStats *hss, int probeNo) {
 
   send_tcp_probe(hss, o.ttl, false, NULL, 0,
                  tcpPortBase + probeNo, hss->openTCPPort,
-                 tcpSeqBase + probeNo, tcpAck,
+                 hss->tcpSeqBase + probeNo, hss->tcpAck,
                  0, TH_SYN, prbWindowSz[probeNo], 0,
                  prbOpts[probeNo].val, prbOpts[probeNo].len, NULL, 0);
 
@@ -1842,7 +1767,7 @@ void HostOsScan::sendTOpsProbe(HostOsScanStats *hss, int probeNo) {
 
   send_tcp_probe(hss, o.ttl, false, NULL, 0,
                  tcpPortBase + NUM_SEQ_SAMPLES + probeNo, hss->openTCPPort,
-                 tcpSeqBase, tcpAck,
+                 hss->tcpSeqBase, hss->tcpAck,
                  0, TH_SYN, prbWindowSz[probeNo], 0,
                  prbOpts[probeNo].val, prbOpts[probeNo].len, NULL, 0);
 }
@@ -1856,7 +1781,7 @@ void HostOsScan::sendTEcnProbe(HostOsScanStats *hss) {
 
   send_tcp_probe(hss, o.ttl, false, NULL, 0,
                  tcpPortBase + NUM_SEQ_SAMPLES + 6, hss->openTCPPort,
-                 tcpSeqBase, 0,
+                 hss->tcpSeqBase, 0,
                  8, TH_CWR|TH_ECE|TH_SYN, prbWindowSz[6], 63477,
                  prbOpts[6].val, prbOpts[6].len, NULL, 0);
 }
@@ -1877,7 +1802,7 @@ void HostOsScan::sendT1_7Probe(HostOsScanStats *hss, int probeNo) {
       return;
     send_tcp_probe(hss, o.ttl, false, NULL, 0,
                    port_base, hss->openTCPPort,
-                   tcpSeqBase, tcpAck,
+                   hss->tcpSeqBase, hss->tcpAck,
                    0, TH_SYN, prbWindowSz[0], 0,
                    prbOpts[0].val, prbOpts[0].len, NULL, 0);
     break;
@@ -1886,7 +1811,7 @@ void HostOsScan::sendT1_7Probe(HostOsScanStats *hss, int probeNo) {
       return;
     send_tcp_probe(hss, o.ttl, true, NULL, 0,
                    port_base + 1, hss->openTCPPort,
-                   tcpSeqBase, tcpAck,
+                   hss->tcpSeqBase, hss->tcpAck,
                    0, 0, prbWindowSz[7], 0,
                    prbOpts[7].val, prbOpts[7].len, NULL, 0);
     break;
@@ -1895,7 +1820,7 @@ void HostOsScan::sendT1_7Probe(HostOsScanStats *hss, int probeNo) {
       return;
     send_tcp_probe(hss, o.ttl, false, NULL, 0,
                    port_base + 2, hss->openTCPPort,
-                   tcpSeqBase, tcpAck,
+                   hss->tcpSeqBase, hss->tcpAck,
                    0, TH_SYN|TH_FIN|TH_URG|TH_PUSH, prbWindowSz[8], 0,
                    prbOpts[8].val, prbOpts[8].len, NULL, 0);
     break;
@@ -1904,7 +1829,7 @@ void HostOsScan::sendT1_7Probe(HostOsScanStats *hss, int probeNo) {
       return;
     send_tcp_probe(hss, o.ttl, true, NULL, 0,
                    port_base + 3, hss->openTCPPort,
-                   tcpSeqBase, tcpAck,
+                   hss->tcpSeqBase, hss->tcpAck,
                    0, TH_ACK, prbWindowSz[9], 0,
                    prbOpts[9].val, prbOpts[9].len, NULL, 0);
     break;
@@ -1913,7 +1838,7 @@ void HostOsScan::sendT1_7Probe(HostOsScanStats *hss, int probeNo) {
       return;
     send_tcp_probe(hss, o.ttl, false, NULL, 0,
                    port_base + 4, hss->closedTCPPort,
-                   tcpSeqBase, tcpAck,
+                   hss->tcpSeqBase, hss->tcpAck,
                    0, TH_SYN, prbWindowSz[10], 0,
                    prbOpts[10].val, prbOpts[10].len, NULL, 0);
     break;
@@ -1922,7 +1847,7 @@ void HostOsScan::sendT1_7Probe(HostOsScanStats *hss, int probeNo) {
       return;
     send_tcp_probe(hss, o.ttl, true, NULL, 0,
                    port_base + 5, hss->closedTCPPort,
-                   tcpSeqBase, tcpAck,
+                   hss->tcpSeqBase, hss->tcpAck,
                    0, TH_ACK, prbWindowSz[11], 0,
                    prbOpts[11].val, prbOpts[11].len, NULL, 0);
     break;
@@ -1931,7 +1856,7 @@ void HostOsScan::sendT1_7Probe(HostOsScanStats *hss, int probeNo) {
       return;
     send_tcp_probe(hss, o.ttl, false, NULL, 0,
                    port_base + 6, hss->closedTCPPort,
-                   tcpSeqBase, tcpAck,
+                   hss->tcpSeqBase, hss->tcpAck,
                    0, TH_FIN|TH_PUSH|TH_URG, prbWindowSz[12], 0,
                    prbOpts[12].val, prbOpts[12].len, NULL, 0);
   }
@@ -1943,11 +1868,11 @@ void HostOsScan::sendTIcmpProbe(HostOsScanStats *hss, int probeNo) {
   assert(probeNo >= 0 && probeNo < 2);
   if (probeNo == 0) {
     send_icmp_echo_probe(hss, IP_TOS_DEFAULT,
-                         true, 9, icmpEchoId, icmpEchoSeq, 120);
+                         true, 9, hss->icmpEchoId, icmpEchoSeq, 120);
   }
   else {
     send_icmp_echo_probe(hss, IP_TOS_RELIABILITY,
-                         false, 0, icmpEchoId + 1, icmpEchoSeq + 1, 150);
+                         false, 0, hss->icmpEchoId + 1, icmpEchoSeq + 1, 150);
   }
 }
 
@@ -1956,7 +1881,7 @@ void HostOsScan::sendTUdpProbe(HostOsScanStats *hss, int probeNo) {
   assert(hss);
   if (hss->closedUDPPort == -1)
     return;
-  send_closedudp_probe(hss, udpttl, udpPortBase + probeNo, hss->closedUDPPort);
+  send_closedudp_probe(hss, hss->udpttl, udpPortBase + probeNo, hss->closedUDPPort);
 }
 
 
@@ -2043,7 +1968,7 @@ bool HostOsScan::processResp(HostOsScanStats *hss, struct ip *ip, unsigned int l
 
     /* Is it an icmp echo reply? */
     if (icmp->icmp_type == ICMP_ECHOREPLY) {
-      testno = ntohs(icmp->icmp_id) - icmpEchoId;
+      testno = ntohs(icmp->icmp_id) - hss->icmpEchoId;
       if (testno == 0 || testno == 1) {
         isPktUseful = processTIcmpResp(hss, ip, testno);
         if (isPktUseful) {
@@ -2325,6 +2250,7 @@ ScanStats::ScanStats() {
   timing.num_replies_received = 0;
   timing.num_updates = 0;
   gettimeofday(&timing.last_drop, NULL);
+  timing.init(&perf, &timing.last_drop);
 
   initialize_timeout_info(&to);
 
@@ -2751,7 +2677,7 @@ bool HostOsScan::processTSeqResp(HostOsScanStats *hss, struct ip *ip, int replyN
     /*  error("DEBUG: response is SYN|ACK to port %hu\n", ntohs(tcp->th_dport)); */
     /*readtcppacket((char *)ip, ntohs(ip->ip_len));*/
     /* We use the ACK value to match up our sent with rcv'd packets */
-    seq_response_num = ntohl(tcp->th_ack) - tcpSeqBase - 1;
+    seq_response_num = ntohl(tcp->th_ack) - hss->tcpSeqBase - 1;
     /* printf("seq_response_num = %d\treplyNo = %d\n", seq_response_num, replyNo); */
 
     if (seq_response_num != replyNo) {
@@ -2761,7 +2687,7 @@ bool HostOsScan::processTSeqResp(HostOsScanStats *hss, struct ip *ip, int replyN
               hss->target->targetipstr());
         error("Received ack: %lX; sequence sent: %lX. Packet:",
               (unsigned long) ntohl(tcp->th_ack),
-              (unsigned long) tcpSeqBase);
+              (unsigned long) hss->tcpSeqBase);
         readtcppacket((unsigned char *)ip, ntohs(ip->ip_len));
       }
       seq_response_num = replyNo;
@@ -3022,9 +2948,9 @@ bool HostOsScan::processT1_7Resp(HostOsScanStats *hss, struct ip *ip, int replyN
   AV.attribute = "S";
   if (ntohl(tcp->th_seq) == 0)
     AV.value = "Z";
-  else if (ntohl(tcp->th_seq) == tcpAck)
+  else if (ntohl(tcp->th_seq) == hss->tcpAck)
     AV.value = "A";
-  else if (ntohl(tcp->th_seq) == tcpAck + 1)
+  else if (ntohl(tcp->th_seq) == hss->tcpAck + 1)
     AV.value = "A+";
   else
     AV.value = "O";
@@ -3039,9 +2965,9 @@ bool HostOsScan::processT1_7Resp(HostOsScanStats *hss, struct ip *ip, int replyN
   AV.attribute = "A";
   if (ntohl(tcp->th_ack) == 0)
     AV.value = "Z";
-  else if (ntohl(tcp->th_ack) == tcpSeqBase)
+  else if (ntohl(tcp->th_ack) == hss->tcpSeqBase)
     AV.value = "S";
-  else if (ntohl(tcp->th_ack) == tcpSeqBase + 1)
+  else if (ntohl(tcp->th_ack) == hss->tcpSeqBase + 1)
     AV.value = "S+";
   else
     AV.value = "O";
@@ -3279,7 +3205,7 @@ bool HostOsScan::processTUdpResp(HostOsScanStats *hss, struct ip *ip) {
 
   /* Count hop count */
   if (hss->distance == -1) {
-    hss->distance = this->udpttl - ip2->ip_ttl + 1;
+    hss->distance = hss->udpttl - ip2->ip_ttl + 1;
   }
 
   return true;
@@ -3489,6 +3415,9 @@ HostOsScanInfo::HostOsScanInfo(Target *t, OsScanInfo *OsSI) {
   FP_matches = new FingerPrintResultsIPv4[o.maxOSTries()];
   timedOut = false;
   isCompleted = false;
+  tryNo = 0;
+  phase = OSP_SEQ;
+  memset(&nextTry, 0, sizeof(nextTry));
 
   if (target->FPR == NULL) {
     this->FPR = new FingerPrintResultsIPv4;
@@ -3520,7 +3449,7 @@ OsScanInfo::OsScanInfo(std::vector<Target *> &Targets) {
 
   numInitialTargets = 0;
 
-  /* build up incompleteHosts list */
+  /* build up pendingHosts list */
   for (targetno = 0; targetno < Targets.size(); targetno++) {
     /* check if Targets[targetno] is good to be scanned
      * if yes, append it to the list
@@ -3550,7 +3479,7 @@ OsScanInfo::OsScanInfo(std::vector<Target *> &Targets) {
     }
 
     hsi = new HostOsScanInfo(Targets[targetno], this);
-    incompleteHosts.push_back(hsi);
+    pendingHosts.push_back(hsi);
     numInitialTargets++;
   }
 
@@ -3564,6 +3493,10 @@ OsScanInfo::~OsScanInfo()
     delete incompleteHosts.front();
     incompleteHosts.pop_front();
   }
+  while (!pendingHosts.empty()) {
+    delete pendingHosts.front();
+    pendingHosts.pop_front();
+  }
 }
 
 
@@ -3626,7 +3559,7 @@ int OsScanInfo::removeCompletedHosts() {
       }
 
       if (o.verbose && numInitialTargets > 50) {
-        int remain = incompleteHosts.size() - 1;
+        int remain = incompleteHosts.size() + pendingHosts.size() - 1;
         if (remain && !timedout)
           log_write(LOG_STDOUT, "Completed os scan against %s in %.3fs (%d %s)\n",
                     hsi->target->targetipstr(),
@@ -3667,49 +3600,11 @@ void OSScan::reset() {
 }
 
 
-/* This function takes a group of targets and divides it in chunks if there are
- * too many to be processed at the same time. The threshold is based on Nmap's
- * timing level (when timing level is above 4, no chunking is performed).
- * The reason targets are processed in smaller groups is to improve accuracy. */
-int OSScan::chunk_and_do_scan(std::vector<Target *> &Targets, int family) {
-  unsigned int max_os_group_sz = 20;
-  double fudgeratio = 1.2; /* Allow a slightly larger final group rather than finish with a tiny one */
-  std::vector<Target *> tmpTargets;
-  unsigned int startidx = 0;
-
-  if (o.timing_level == 4)
-    max_os_group_sz = (unsigned int) (max_os_group_sz * 1.5);
-
-  if (o.timing_level > 4 || Targets.size() <= max_os_group_sz * fudgeratio) {
-    if (family == AF_INET6)
-      os_scan_ipv6(Targets);
-    else
-      os_scan_ipv4(Targets);
-    return OP_SUCCESS;
-  }
-
-  /* We need to split it up */
-  while (startidx < Targets.size()) {
-    int diff = Targets.size() - startidx;
-    if (diff > max_os_group_sz * fudgeratio) {
-      diff = max_os_group_sz;
-    }
-    tmpTargets.assign(Targets.begin() + startidx, Targets.begin() + startidx + diff);
-    if (family == AF_INET6)
-      os_scan_ipv6(Targets);
-    else
-      os_scan_ipv4(Targets);
-    startidx += diff;
-  }
-  return OP_SUCCESS;
-}
-
-
 /* Performs the OS detection for IPv4 hosts. This method should not be called
- * directly. os_scan() should be used instead, as it handles chunking so
- * you don't do too many targets in parallel */
+ * directly. os_scan() should be used instead, as it separates IPv4 and IPv6
+ * targets. The sniffer is set up once for all the targets and reused as hosts
+ * move through the window. */
 int OSScan::os_scan_ipv4(std::vector<Target *> &Targets) {
-  int itry = 0;
   /* Hosts which haven't matched and have been removed from incompleteHosts because
    * they have exceeded the number of retransmissions the host is allowed. */
   std::list<HostOsScanInfo *> unMatchedHosts;
@@ -3722,38 +3617,28 @@ int OSScan::os_scan_ipv4(std::vector<Target *> &Targets) {
   perf.init();
 
   OsScanInfo OSI(Targets);
-  if (OSI.numIncompleteHosts() == 0) {
+  if (OSI.numPendingHosts() == 0) {
     /* no one will be scanned */
     return OP_FAILURE;
   }
   OSI.starttime = o.TimeSinceStart();
-  startTimeOutClocks(&OSI);
 
   HostOsScan HOS(Targets[0]);
+  /* Fingerprints are matched while other hosts are still being probed. */
+  FingerPrintMatcher matcher(o.reference_FPs, OSSCAN_GUESS_THRESHOLD);
 
   /* Initialize the pcap session handler in HOS */
   begin_sniffer(&HOS, Targets);
-  while (OSI.numIncompleteHosts() != 0) {
-    if (itry > 0)
-      sleep(1);
-    if (itry == 3)
-      usleep(1500000); /* Try waiting a little longer just in case it matters */
-    if (o.verbose) {
-      char targetstr[128];
-      bool plural = (OSI.numIncompleteHosts() != 1);
-      if (!plural) {
-        (*(OSI.incompleteHosts.begin()))->target->NameIP(targetstr, sizeof(targetstr));
-      } else Snprintf(targetstr, sizeof(targetstr), "%d hosts", (int) OSI.numIncompleteHosts());
-      log_write(LOG_STDOUT, "%s OS detection (try #%d) against %s\n", (itry == 0)? "Initiating" : "Retrying", itry + 1, targetstr);
-      log_flush_all();
-    }
-    startRound(&OSI, &HOS, itry);
-    doSeqTests(&OSI, &HOS);
-    doTUITests(&OSI, &HOS);
-    endRound(&OSI, &HOS, itry);
-    expireUnmatchedHosts(&OSI, &unMatchedHosts);
-    itry++;
+  if (o.verbose) {
+    char targetstr[128];
+    bool plural = (OSI.numPendingHosts() != 1);
+    if (!plural) {
+      (*(OSI.pendingHosts.begin()))->target->NameIP(targetstr, sizeof(targetstr));
+    } else Snprintf(targetstr, sizeof(targetstr), "%d hosts", (int) OSI.numPendingHosts());
+    log_write(LOG_STDOUT, "Initiating OS detection (try #1) against %s\n", targetstr);
+    log_flush_all();
   }
+  doTests(&OSI, &HOS, &matcher, &unMatchedHosts);
 
   /* Now move the unMatchedHosts array back to IncompleteHosts */
   if (!unMatchedHosts.empty())
@@ -3762,18 +3647,19 @@ int OSScan::os_scan_ipv4(std::vector<Target *> &Targets) {
   if (OSI.numIncompleteHosts()) {
     /* For hosts that don't have a perfect match, find the closest fingerprint
      * in the DB and, if we are in debugging mode, print them. */
-    findBestFPs(&OSI);
+    findBestFPs(&OSI, &matcher);
     if (o.debugging > 1)
       printFP(&OSI);
   }
+  matcher.wait();
 
   return OP_SUCCESS;
 }
 
 
 /* Performs the OS detection for IPv6 hosts. This method should not be called
- * directly. os_scan() should be used instead, as it handles chunking so
- * you don't do too many targets in parallel */
+ * directly. os_scan() should be used instead, as it separates IPv4 and IPv6
+ * targets. */
 int OSScan::os_scan_ipv6(std::vector<Target *> &Targets) {
 
   /* Object instantiation */
@@ -239,13 +239,22 @@ typedef enum OFProbeType {
   OFP_TUDP
 } OFProbeType;
 
+/* Where a host in the OS detection window is in its current try. */
+typedef enum OsScanPhase {
+  OSP_SEQ,  /* Sending the sequence generation probes */
+  OSP_TUI,  /* Sending the TCP, UDP and ICMP probes */
+  OSP_MATCH, /* Waiting for the fingerprint to be matched */
+  OSP_WAIT  /* Waiting to start the next try */
+} OsScanPhase;
+
 /******************************************************************************
  * FUNCTION PROTOTYPES                                                        *
  ******************************************************************************/
 
 /* This is the primary OS detection function.  If many Targets are
-   passed in (the threshold is based on timing level), they are
-   processed as smaller groups to improve accuracy  */
+   passed in, only a window of them (sized by timing level and how
+   well the network takes the probes) is probed at a time to improve
+   accuracy  */
 void os_scan2(std::vector<Target *> &Targets);
 
 int get_initial_ttl_guess(u8 ttl);
@@ -403,6 +412,13 @@ class HostOsScanStats {
   int storedIcmpReply; /* Which one of the two icmp replies is stored? */
 
   struct udpprobeinfo upi; /* info of the udp probe we sent */
+
+  /* Values chosen afresh for each try, so that late replies to an
+   * earlier try are not taken for replies to this one. */
+  unsigned int tcpSeqBase;    /* Seq value used in TCP probes                 */
+  unsigned int tcpAck;        /* Ack value used in TCP probes                 */
+  int udpttl;                 /* TTL value used in the UDP probe              */
+  unsigned short icmpEchoId;  /* ICMP Echo Identifier value for ICMP probes   */
 };
 
 /* These are statistics for the whole group of Targets */
@@ -432,9 +448,6 @@ class HostOsScan {
   pcap_t *pd;
   ScanStats *stats;
 
-  /* (Re)Initialize the parameters that will be used during the scan.*/
-  void reInitScanSystem();
-
   void buildSeqProbeList(HostOsScanStats *hss);
   void updateActiveSeqProbes(HostOsScanStats *hss);
 
@@ -514,11 +527,7 @@ private:
   int rawsd;    /* Raw socket descriptor */
   eth_t *ethsd; /* Ethernet handle       */
 
-  unsigned int tcpSeqBase;    /* Seq value used in TCP probes                 */
-  unsigned int  tcpAck;       /* Ack value used in TCP probes                 */
   int tcpMss;                 /* TCP MSS value used in TCP probes             */
-  int udpttl;                 /* TTL value used in the UDP probe              */
-  unsigned short icmpEchoId;  /* ICMP Echo Identifier value for ICMP probes   */
   unsigned short icmpEchoSeq; /* ICMP Echo Sequence value used in ICMP probes */
 
   /* Source port number in TCP probes. Different probes will use an arbitrary
@@ -529,7 +538,9 @@ private:
 
 
 
-/* Maintains a link of incomplete HostOsScanInfo. */
+/* Maintains a link of incomplete HostOsScanInfo. Hosts wait in
+   pendingHosts until there is room for them in the window of hosts
+   being probed, incompleteHosts. */
 class OsScanInfo {
 
  public:
@@ -541,8 +552,11 @@ class OsScanInfo {
    * resetHostIterator() afterward). Don't let this list get empty,
    * then add to it again, or you may mess up nextI (I'm not sure) */
   std::list<HostOsScanInfo *> incompleteHosts;
+  /* Hosts that have not entered the window yet. */
+  std::list<HostOsScanInfo *> pendingHosts;
 
   unsigned int numIncompleteHosts() {return incompleteHosts.size();}
+  unsigned int numPendingHosts() {return pendingHosts.size();}
   HostOsScanInfo *findIncompleteHost(struct sockaddr_storage *ss);
 
   /* A circular buffer of the incompleteHosts.  nextIncompleteHost() gives
@@ -583,6 +597,9 @@ class HostOsScanInfo {
   bool timedOut;        /* Did it time out?                            */
   bool isCompleted;     /* Has the OS detection been completed?        */
   HostOsScanStats *hss; /* Scan status of the host in one scan round   */
+  int tryNo;            /* The current try against the host            */
+  OsScanPhase phase;    /* What the current try is doing               */
+  struct timeval nextTry; /* When an OSP_WAIT host starts its next try */
 };
 
 
@@ -593,7 +610,6 @@ class HostOsScanInfo {
 class OSScan {
 
  private:
-  int chunk_and_do_scan(std::vector<Target *> &Targets, int family);
   int os_scan_ipv4(std::vector<Target *> &Targets);
   int os_scan_ipv6(std::vector<Target *> &Targets);
 
@@ -141,6 +141,9 @@
 #include "scan_engine_raw.h"
 #include "timing.h"
 #include "NmapOps.h"
+#include "netsim.h"
+#include "telemetry.h"
+#include "nbase_prof.h"
 #include "nmap_tty.h"
 #include "payload.h"
 #include "Target.h"
@@ -150,8 +153,7 @@
 #include "struct_ip.h"
 
 #include <math.h>
-#include <list>
-#include <map>
+#include <new>
 
 extern NmapOps o;
 #ifdef WIN32
@@ -314,8 +316,177 @@ UltraProbe::UltraProbe() {
 }
 
 UltraProbe::~UltraProbe() {
-  if (type == UP_CONNECT)
-    delete probes.CP;
+}
+
+/* Number of probes in each slab of an UltraProbePool */
+#define PROBE_SLAB_SIZE 256
+
+UltraProbePool::UltraProbePool() {
+  freelist = NULL;
+}
+
+UltraProbePool::~UltraProbePool() {
+  std::vector<char *>::iterator slabI;
+
+  for (slabI = slabs.begin(); slabI != slabs.end(); slabI++)
+    free(*slabI);
+}
+
+UltraProbe *UltraProbePool::alloc() {
+  void *slot;
+  int i;
+
+  if (freelist == NULL) {
+    char *slab = (char *) safe_malloc(PROBE_SLAB_SIZE * sizeof(UltraProbe));
+
+    slabs.push_back(slab);
+    /* Thread the slots of the new slab onto the free list, first one on top. */
+    for (i = PROBE_SLAB_SIZE - 1; i >= 0; i--) {
+      slot = slab + i * sizeof(UltraProbe);
+      *(void **) slot = freelist;
+      freelist = slot;
+    }
+  }
+  slot = freelist;
+  freelist = *(void **) slot;
+
+  return new (slot) UltraProbe();
+}
+
+void UltraProbePool::release(UltraProbe *probe) {
+  void *slot = probe;
+
+  probe->~UltraProbe();
+  *(void **) slot = freelist;
+  freelist = slot;
+}
+
+/* Minimum number of probes sent to a host for its timing to be worth keeping
+   in the --timing-cache */
+#define TIMING_CACHE_MIN_PROBES 20
+
+/* Returns the congestion window to start a host with, given the timing
+   profile of its network. It is the learned one for a fresh profile and moves
+   back toward the default as the profile ages. */
+static double cached_cwnd(const struct scan_performance_vars *perf,
+                          const struct timing_profile *tp) {
+  double cwnd;
+
+  cwnd = perf->host_initial_cwnd + tp->weight * (tp->cwnd - perf->host_initial_cwnd);
+  return box((double) perf->low_cwnd, (double) perf->max_cwnd, cwnd);
+}
+
+/* Returns the protocol that the --timing-cache keeps profiles of this scan
+   under. */
+static const char *timing_cache_proto(const UltraScanInfo *USI) {
+  if (USI->udp_scan)
+    return "udp";
+  else if (USI->sctp_scan)
+    return "sctp";
+  else if (USI->prot_scan)
+    return "ip";
+  return "tcp";
+}
+
+/* Starts a host off with the timing that an earlier scan of its network
+   learned (see --timing-cache), and fills in tp with the profile. Returns
+   false if there was none. */
+static bool seed_host_timing(HostScanStats *hss, struct timing_profile *tp) {
+  UltraScanInfo *USI = hss->USI;
+  struct timeout_info *to = &hss->target->to;
+  struct sockaddr_storage ss;
+  unsigned int maxdelay;
+  size_t sslen;
+
+  hss->target->TargetSockAddr(&ss, &sslen);
+  if (!timing_cache_lookup(&ss, timing_cache_proto(USI), tp))
+    return false;
+
+  hss->timing.cwnd = cached_cwnd(&USI->perf, tp);
+  hss->timing.ssthresh = (int) (USI->perf.initial_ssthresh
+                                + tp->weight * (tp->ssthresh - USI->perf.initial_ssthresh));
+  maxdelay = USI->tcp_scan ? o.maxTCPScanDelay() :
+             USI->udp_scan ? o.maxUDPScanDelay() :
+             o.maxSCTPScanDelay();
+  hss->sdn.delayms = MAX(hss->sdn.delayms, MIN((unsigned int) (tp->weight * tp->delayms), maxdelay));
+  hss->max_successful_tryno = (unsigned int) (tp->weight * tp->max_successful_tryno + 0.5);
+  /* Don't skip the rate limit detection wait on the word of an old profile. */
+  if (tp->weight >= 0.5)
+    hss->rld.max_tryno_sent = tp->max_tryno_sent;
+  /* Timing from host discovery is more recent, so it is kept if there is
+     any. The variance grows as the profile ages. */
+  if (to->srtt == -1 && to->rttvar == -1) {
+    to->srtt = tp->srtt;
+    to->rttvar = (int) (tp->rttvar + (1.0 - tp->weight) * tp->srtt);
+    to->timeout = box(o.minRttTimeout() * 1000, o.maxRttTimeout() * 1000,
+                      to->srtt + (to->rttvar << 2));
+  }
+
+  if (o.debugging > 1) {
+    log_write(LOG_PLAIN, "Timing profile for %s (weight %.2f): cwnd %.1f, ssthresh %d, delay %u ms, max tryno %u, timeout %d ms\n",
+              hss->target->targetipstr(), tp->weight, hss->timing.cwnd,
+              hss->timing.ssthresh, hss->sdn.delayms,
+              hss->max_successful_tryno, to->timeout / 1000);
+  }
+  return true;
+}
+
+/* Starts the group off with the mean of the group congestion windows that
+   the profiles of its hosts recorded, and with the slowest of their
+   timeouts. */
+static void seed_group_timing(GroupScanStats *gstats) {
+  UltraScanInfo *USI = gstats->USI;
+  std::multiset<HostScanStats *, HssPredicate>::iterator hostI;
+  struct timing_profile tp;
+  struct timeout_info to;
+  double cwnd = 0;
+  int seeded = 0;
+
+  to.srtt = to.rttvar = -1;
+  for (hostI = USI->incompleteHosts.begin(); hostI != USI->incompleteHosts.end(); hostI++) {
+    HostScanStats *hss = *hostI;
+
+    if (!seed_host_timing(hss, &tp))
+      continue;
+    seeded++;
+    cwnd += USI->perf.group_initial_cwnd
+            + tp.weight * (tp.group_cwnd - USI->perf.group_initial_cwnd);
+    to.srtt = MAX(to.srtt, hss->target->to.srtt);
+    to.rttvar = MAX(to.rttvar, hss->target->to.rttvar);
+  }
+  if (seeded == 0)
+    return;
+
+  gstats->timing.cwnd = box((double) USI->perf.low_cwnd,
+                            (double) USI->perf.max_cwnd, cwnd / seeded);
+  gstats->to.srtt = to.srtt;
+  gstats->to.rttvar = to.rttvar;
+  gstats->to.timeout = box(o.minRttTimeout() * 1000, o.maxRttTimeout() * 1000,
+                           to.srtt + (to.rttvar << 2));
+}
+
+/* Keeps what was learned about the timing of a host that finished for the
+   next scan of its network. */
+static void record_host_timing(HostScanStats *hss) {
+  struct sockaddr_storage ss;
+  struct timing_profile tp;
+  size_t sslen;
+
+  if (hss->numprobes_sent < TIMING_CACHE_MIN_PROBES || hss->target->to.srtt <= 0)
+    return;
+
+  tp.srtt = hss->target->to.srtt;
+  tp.rttvar = hss->target->to.rttvar;
+  tp.cwnd = hss->timing.cwnd;
+  tp.ssthresh = hss->timing.ssthresh;
+  tp.group_cwnd = hss->USI->gstats->timing.cwnd;
+  /* Only a delay that was forced on us, not the one that was asked for */
+  tp.delayms = hss->sdn.delayms > o.scan_delay ? hss->sdn.delayms : 0;
+  tp.max_successful_tryno = hss->max_successful_tryno;
+  tp.max_tryno_sent = hss->rld.max_tryno_sent;
+  tp.weight = 1.0;
+  hss->target->TargetSockAddr(&ss, &sslen);
+  timing_cache_record(&ss, timing_cache_proto(hss->USI), &tp);
 }
 
 GroupScanStats::GroupScanStats(UltraScanInfo *UltraSI) {
@@ -327,6 +498,9 @@ GroupScanStats::GroupScanStats(UltraScanInfo *UltraSI) {
   /* Default timout should be much lower for arp */
   if (USI->ping_scan_arp)
     to.timeout = MAX(o.minRttTimeout(), MIN(o.initialRttTimeout(), INITIAL_ARP_RTT_TIMEOUT)) * 1000;
+  /* The hosts are seeded here, since this is when all of them exist. */
+  if (o.timing_cache && !USI->ping_scan)
+    seed_group_timing(this);
   num_probes_active = 0;
   numtargets = USI->numIncompleteHosts(); // They are all incomplete at the beginning
   numprobes = USI->numProbesPerHost();
@@ -335,6 +509,7 @@ GroupScanStats::GroupScanStats(UltraScanInfo *UltraSI) {
     CSI = new ConnectScanInfo;
   else CSI = NULL;
   probes_sent = probes_sent_at_last_wait = 0;
+  probes_retransmitted = probes_timedout = 0;
   lastping_sent = lastrcvd = USI->now;
   send_no_earlier_than = USI->now;
   send_no_later_than = USI->now;
@@ -539,7 +714,7 @@ HostScanStats::HostScanStats(Target *t, UltraScanInfo *UltraSI) {
 }
 
 HostScanStats::~HostScanStats() {
-  std::list<UltraProbe *>::iterator probeI, next;
+  ProbeList::iterator probeI, next;
 
   /* Move any hosts from the bench to probes_outstanding for easier deletion  */
   for (probeI = probes_outstanding.begin(); probeI != probes_outstanding.end();
@@ -553,6 +728,7 @@ HostScanStats::~HostScanStats() {
 /* Called whenever a probe is sent to this host. Takes care of updating scan
    delay and rate limiting variables. */
 void HostScanStats::probeSent(unsigned int nbytes) {
+  NBASE_PROF_EVENT("probe sent", nbytes);
   lastprobe_sent = USI->now;
 
   /* Update group variables. */
@@ -597,7 +773,6 @@ unsigned long HostScanStats::probeExpireTime(const UltraProbe *probe) {
    true. */
 bool HostScanStats::sendOK(struct timeval *when) {
   struct ultra_timing_vals tmng;
-  std::list<UltraProbe *>::iterator probeI;
   struct timeval probe_to, earliest_to, sendTime;
   long tdiff;
 
@@ -651,14 +826,11 @@ bool HostScanStats::sendOK(struct timeval *when) {
 
   TIMEVAL_MSEC_ADD(earliest_to, USI->now, 10000);
 
-  // Any timeouts coming up?
-  for (probeI = probes_outstanding.begin(); probeI != probes_outstanding.end();
-       probeI++) {
-    if (!(*probeI)->timedout) {
-      TIMEVAL_MSEC_ADD(probe_to, (*probeI)->sent, probeTimeout() / 1000);
-      if (TIMEVAL_SUBTRACT(probe_to, earliest_to) < 0) {
-        earliest_to = probe_to;
-      }
+  // Any timeouts coming up? The oldest active probe times out first.
+  if (!probes_active.empty()) {
+    TIMEVAL_MSEC_ADD(probe_to, probes_active.front()->sent, probeTimeout() / 1000);
+    if (TIMEVAL_SUBTRACT(probe_to, earliest_to) < 0) {
+      earliest_to = probe_to;
     }
   }
 
@@ -690,27 +862,15 @@ bool HostScanStats::sendOK(struct timeval *when) {
    the earliest one and returns true.  Otherwise returns false and
    puts now in when. */
 bool HostScanStats::nextTimeout(struct timeval *when) {
-  struct timeval probe_to, earliest_to;
-  std::list<UltraProbe *>::iterator probeI;
-  bool firstgood = true;
-
   assert(when);
-  memset(&probe_to, 0, sizeof(probe_to));
-  memset(&earliest_to, 0, sizeof(earliest_to));
 
-  for (probeI = probes_outstanding.begin(); probeI != probes_outstanding.end();
-       probeI++) {
-    if (!(*probeI)->timedout) {
-      TIMEVAL_ADD(probe_to, (*probeI)->sent, probeTimeout());
-      if (firstgood || TIMEVAL_SUBTRACT(probe_to, earliest_to) < 0) {
-        earliest_to = probe_to;
-        firstgood = false;
-      }
-    }
+  if (probes_active.empty()) {
+    *when = USI->now;
+    return false;
   }
-
-  *when = (firstgood) ? USI->now : earliest_to;
-  return !firstgood;
+  /* probes_active is in the order the probes were sent. */
+  TIMEVAL_ADD(*when, probes_active.front()->sent, probeTimeout());
+  return true;
 }
 
 /* gives the maximum try number (try numbers start at zero and
@@ -724,7 +884,7 @@ bool HostScanStats::nextTimeout(struct timeval *when) {
    the allowedTryno may increase again.  If it is false, any probes
    which have reached the given limit may be dealt with. */
 unsigned int HostScanStats::allowedTryno(bool *capped, bool *mayincrease) {
-  std::list<UltraProbe *>::iterator probeI;
+  ProbeQueue::iterator probeI;
   UltraProbe *probe = NULL;
   bool allfinished = true;
   unsigned int maxval = 0;
@@ -741,12 +901,14 @@ unsigned int HostScanStats::allowedTryno(bool *capped, bool *mayincrease) {
   /* Decide if the tryno can possibly increase.  */
   if (tryno_mayincrease && num_probes_active == 0 && freshPortsLeft() == 0) {
     /* If every outstanding probe is timedout and at maxval, then no further
-       retransmits are necessary. */
-    for (probeI = probes_outstanding.begin();
-         probeI != probes_outstanding.end(); probeI++) {
+       retransmits are necessary. Only the probes waiting for a retransmit
+       could need one. */
+    assert(probes_active.empty());
+    for (probeI = probes_waiting_retransmit.begin();
+         probeI != probes_waiting_retransmit.end(); probeI++) {
       probe = *probeI;
-      assert(probe->timedout);
-      if (!probe->retransmitted && !probe->isPing() && probe->tryno < maxval) {
+      assert(probe->timedout && !probe->retransmitted && !probe->isPing());
+      if (probe->tryno < maxval) {
         /* Needs at least one more retransmit. */
         allfinished = false;
         break;
@@ -994,8 +1156,8 @@ void UltraScanInfo::Init(std::vector<Target *> &Targets, struct scan_lists *pts,
 
   /* See if we need an ethernet handle or raw socket. Basically, it's if we
      aren't doing a TCP connect scan, or if we're doing a ping scan that
-     requires it. */
-  if (isRawScan()) {
+     requires it. A simulated network needs neither. */
+  if (isRawScan() && !o.netsim) {
     if (ping_scan_arp || (ping_scan_nd && o.sendpref != PACKET_SEND_IP_STRONG) || ((o.sendpref & PACKET_SEND_ETH) &&
         (Targets[0]->ifType() == devt_ethernet
 #ifdef WIN32
@@ -1248,11 +1410,13 @@ int UltraScanInfo::removeCompletedHosts() {
                   num_outstanding_probes == 1 ? "probe" : "probes");
         if (o.debugging > 3) {
           char tmpbuf[64];
-          std::list<UltraProbe *>::iterator iter;
+          ProbeList::iterator iter;
           for (iter = hss->probes_outstanding.begin(); iter != hss->probes_outstanding.end(); iter++)
             log_write(LOG_PLAIN, "* %s\n", probespec2ascii((probespec *) (*iter)->pspec(), tmpbuf, sizeof(tmpbuf)));
         }
       }
+      if (o.timing_cache && !ping_scan && !timedout)
+        record_host_timing(hss);
       hss->completiontime = now;
       completedHosts.insert(hss);
       incompleteHosts.erase(hostI);
@@ -1332,6 +1496,7 @@ static void init_ultra_timing_vals(ultra_timing_vals *timing,
   if (now)
     timing->last_drop = *now;
   else gettimeofday(&timing->last_drop, NULL);
+  timing->init(perf, &timing->last_drop);
 }
 
 /* Returns the next probe to try against target.  Supports many
@@ -1578,7 +1743,7 @@ int HostScanStats::freshPortsLeft() {
 
 /* Removes a probe from probes_outstanding, adjusts HSS and USS
    active probe stats accordingly, then deletes the probe. */
-void HostScanStats::destroyOutstandingProbe(std::list<UltraProbe *>::iterator probeI) {
+void HostScanStats::destroyOutstandingProbe(ProbeList::iterator probeI) {
   UltraProbe *probe = *probeI;
   assert(!probes_outstanding.empty());
   if (!probe->timedout) {
@@ -1598,7 +1763,8 @@ void HostScanStats::destroyOutstandingProbe(std::list<UltraProbe *>::iterator pr
     USI->gstats->CSI->clearSD(probe->CP()->sd);
 
   probes_outstanding.erase(probeI);
-  delete probe;
+  queueOf(probe)->remove(probe);
+  USI->probe_pool.release(probe);
 }
 
 /* Removes all probes from probes_outstanding using
@@ -1610,6 +1776,27 @@ void HostScanStats::destroyAllOutstandingProbes() {
     destroyOutstandingProbe(probes_outstanding.begin());
 }
 
+/* Adds a probe that has just been sent to probes_outstanding and
+   probes_active, and counts it as active. */
+void HostScanStats::addOutstandingProbe(UltraProbe *probe) {
+  probes_outstanding.push_back(probe);
+  probes_active.push_back(probe);
+  num_probes_active++;
+  USI->gstats->num_probes_active++;
+}
+
+/* Returns the timeout queue that the probe belongs on, given its state. */
+ProbeQueue *HostScanStats::queueOf(UltraProbe *probe) {
+  if (!probe->timedout)
+    return &probes_active;
+  else if (probe->isPing())
+    return &pings_timedout;
+  else if (probe->retransmitted)
+    return &probes_retransmitted;
+  else
+    return &probes_waiting_retransmit;
+}
+
 /* Adjust host and group timeouts (struct timeout_info) based on a received
    packet. If rcvdtime is NULL, nothing is updated.
 
@@ -1663,8 +1850,10 @@ static void ultrascan_adjust_timing(UltraScanInfo *USI, HostScanStats *hss,
   /* Increase the window for a positive reply. This can overlap with case (1)
      above. */
   if (rcvdtime != NULL) {
-    USI->gstats->timing.ack(&USI->perf, ping_magnifier);
-    hss->timing.ack(&USI->perf, ping_magnifier);
+    /* The rtt of a retransmitted probe is ambiguous. */
+    long rtt = probe->tryno == 0 ? TIMEVAL_SUBTRACT(*rcvdtime, probe->sent) : -1;
+    USI->gstats->timing.ack(&USI->perf, ping_magnifier, rcvdtime, rtt);
+    hss->timing.ack(&USI->perf, ping_magnifier, rcvdtime, rtt);
   }
 
   /* If packet drops are particularly bad, enforce a delay between
@@ -1698,11 +1887,15 @@ static void ultrascan_adjust_timing(UltraScanInfo *USI, HostScanStats *hss,
 
 /* Mark an outstanding probe as timedout.  Adjusts stats
     accordingly.  For connect scans, this closes the socket. */
-void HostScanStats::markProbeTimedout(std::list<UltraProbe *>::iterator probeI) {
+void HostScanStats::markProbeTimedout(ProbeList::iterator probeI) {
   UltraProbe *probe = *probeI;
   assert(!probe->timedout);
   assert(!probe->retransmitted);
+  probes_active.remove(probe);
   probe->timedout = true;
+  queueOf(probe)->push_back(probe);
+  USI->gstats->probes_timedout++;
+  NBASE_PROF_EVENT("probe timed out", probe->tryno);
   assert(num_probes_active > 0);
   num_probes_active--;
   assert(USI->gstats->num_probes_active > 0);
@@ -1716,7 +1909,10 @@ void HostScanStats::markProbeTimedout(std::list<UltraProbe *>::iterator probeI)
     /* Free the socket as that is a valuable resource, though it is a shame
        late responses will not be permitted */
     USI->gstats->CSI->clearSD(probe->CP()->sd);
-    close(probe->CP()->sd);
+    if (o.netsim)
+      netsim_close(probe->CP()->sd);
+    else
+      close(probe->CP()->sd);
     probe->CP()->sd = -1;
   }
 }
@@ -1764,6 +1960,7 @@ void HostScanStats::getTiming(struct ultra_timing_vals *tmng) {
   tmng->cwnd = USI->perf.host_initial_cwnd;
   tmng->ssthresh = USI->perf.initial_ssthresh;
   tmng->num_updates = 0;
+  tmng->init(&USI->perf, &USI->now);
   return;
 }
 
@@ -1968,7 +2165,7 @@ void HostScanStats::retransmitBench() {
 /* Moves the given probe from the probes_outstanding list, to
     probe_bench, and decrements num_probes_waiting_retransmit
     accordingly */
-void HostScanStats::moveProbeToBench(std::list<UltraProbe *>::iterator probeI) {
+void HostScanStats::moveProbeToBench(ProbeList::iterator probeI) {
   UltraProbe *probe = *probeI;
   if (!probe_bench.empty())
     assert(bench_tryno == probe->tryno);
@@ -1978,14 +2175,15 @@ void HostScanStats::moveProbeToBench(std::list<UltraProbe *>::iterator probeI) {
   }
   probe_bench.push_back(*probe->pspec());
   probes_outstanding.erase(probeI);
+  probes_waiting_retransmit.remove(probe);
   num_probes_waiting_retransmit--;
-  delete probe;
+  USI->probe_pool.release(probe);
 }
 
 /* Called when a ping response is discovered. If adjust_timing is false, timing
    stats are not updated. */
 void ultrascan_ping_update(UltraScanInfo *USI, HostScanStats *hss,
-                                  std::list<UltraProbe *>::iterator probeI,
+                                  ProbeList::iterator probeI,
                                   struct timeval *rcvdtime,
                                   bool adjust_timing) {
   ultrascan_adjust_timeouts(USI, hss, *probeI, rcvdtime);
@@ -2028,11 +2226,12 @@ static bool ultrascan_host_pspec_update(UltraScanInfo *USI, HostScanStats *hss,
    timing information and other stats as appropriate. If
    adjust_timing_hint is false, packet stats are not updated. */
 void ultrascan_host_probe_update(UltraScanInfo *USI, HostScanStats *hss,
-                                        std::list<UltraProbe *>::iterator probeI,
+                                        ProbeList::iterator probeI,
                                         int newstate, struct timeval *rcvdtime,
                                         bool adjust_timing_hint) {
   UltraProbe *probe = *probeI;
 
+  NBASE_PROF_EVENT("response matched", probe->tryno);
   if (o.debugging > 1) {
     struct timeval tv;
 
@@ -2091,12 +2290,13 @@ void ultrascan_host_probe_update(UltraScanInfo *USI, HostScanStats *hss,
    instead. If adjust_timing_hint is false, packet stats are not
    updated. */
 void ultrascan_port_probe_update(UltraScanInfo *USI, HostScanStats *hss,
-                                 std::list<UltraProbe *>::iterator probeI,
+                                 ProbeList::iterator probeI,
                                  int newstate, struct timeval *rcvdtime,
                                  bool adjust_timing_hint) {
   UltraProbe *probe = *probeI;
   const probespec *pspec = probe->pspec();
 
+  NBASE_PROF_EVENT("response matched", probe->tryno);
   ultrascan_port_pspec_update(USI, hss, pspec, newstate);
 
   ultrascan_adjust_timeouts(USI, hss, probe, rcvdtime);
@@ -2216,6 +2416,7 @@ static void sendNextRetryStackProbe(UltraScanInfo *USI, HostScanStats *hss) {
   u8 pspec_tries;
   hss->numprobes_sent++;
   USI->gstats->probes_sent++;
+  USI->gstats->probes_retransmitted++;
 
   pspec = hss->retry_stack.back();
   hss->retry_stack.pop_back();
@@ -2231,6 +2432,7 @@ static void sendNextRetryStackProbe(UltraScanInfo *USI, HostScanStats *hss) {
 }
 
 static void doAnyNewProbes(UltraScanInfo *USI) {
+  NBASE_PROF_SCOPE("doAnyNewProbes");
   HostScanStats *hss, *unableToSend;
 
   gettimeofday(&USI->now, NULL);
@@ -2254,6 +2456,7 @@ static void doAnyNewProbes(UltraScanInfo *USI) {
 }
 
 static void doAnyRetryStackRetransmits(UltraScanInfo *USI) {
+  NBASE_PROF_SCOPE("doAnyRetryStackRetransmits");
   HostScanStats *hss, *unableToSend;
 
   gettimeofday(&USI->now, NULL);
@@ -2317,6 +2520,7 @@ static void sendGlobalPingProbe(UltraScanInfo *USI) {
 }
 
 static void doAnyPings(UltraScanInfo *USI) {
+  NBASE_PROF_SCOPE("doAnyPings");
   std::multiset<HostScanStats *, HssPredicate>::iterator hostI;
   HostScanStats *hss = NULL;
 
@@ -2382,7 +2586,21 @@ static void retransmitProbe(UltraScanInfo *USI, HostScanStats *hss,
   }
   if (newProbe)
     newProbe->prevSent = probe->sent;
+  hss->probes_waiting_retransmit.remove(probe);
   probe->retransmitted = true;
+  /* Keep probes_retransmitted sorted by send time. Probes are mostly
+     retransmitted oldest first, so this rarely looks past the end. */
+  ProbeQueue::iterator pos = hss->probes_retransmitted.end();
+  while (pos != hss->probes_retransmitted.begin()) {
+    pos--;
+    if (!TIMEVAL_AFTER((*pos)->sent, probe->sent)) {
+      pos++;
+      break;
+    }
+  }
+  hss->probes_retransmitted.insert(pos, probe);
+  USI->gstats->probes_retransmitted++;
+  NBASE_PROF_EVENT("probe retransmitted", probe->tryno);
   assert(hss->num_probes_waiting_retransmit > 0);
   hss->num_probes_waiting_retransmit--;
   hss->numprobes_sent++;
@@ -2392,11 +2610,9 @@ static void retransmitProbe(UltraScanInfo *USI, HostScanStats *hss,
 /* Go through the ProbeQueue of each host, identify any
    timed out probes, then try to retransmit them as appropriate */
 static void doAnyOutstandingRetransmits(UltraScanInfo *USI) {
+  NBASE_PROF_SCOPE("doAnyOutstandingRetransmits");
   std::multiset<HostScanStats *, HssPredicate>::iterator hostI;
-  std::list<UltraProbe *>::iterator probeI;
-  /* A cache of the last processed probe from each host, to avoid re-examining a
-     bunch of probes to find the next one that needs to be retransmitted. */
-  std::map<HostScanStats *, std::list<UltraProbe *>::iterator> probe_cache;
+  ProbeQueue::iterator probeI;
   HostScanStats *host = NULL;
   UltraProbe *probe = NULL;
   int retrans = 0; /* Number of retransmissions during a loop */
@@ -2418,25 +2634,18 @@ static void doAnyOutstandingRetransmits(UltraScanInfo *USI) {
          hostI++) {
       host = *hostI;
       /* Skip this host if it has nothing to send. */
-      if ((host->num_probes_active == 0
-           && host->num_probes_waiting_retransmit == 0))
+      if (host->probes_waiting_retransmit.empty())
         continue;
       if (!host->sendOK(NULL))
         continue;
-      assert(!host->probes_outstanding.empty());
-
-      /* Initialize the probe cache if necessary. */
-      if (probe_cache.find(host) == probe_cache.end())
-        probe_cache[host] = host->probes_outstanding.end();
-      /* Restore the probe iterator from the cache. */
-      probeI = probe_cache[host];
 
+      /* Retransmit the oldest probe that is allowed another try. Once
+         retransmitted, it leaves probes_waiting_retransmit. */
       maxtries = host->allowedTryno(NULL, NULL);
-      do {
-        probeI--;
+      for (probeI = host->probes_waiting_retransmit.begin();
+           probeI != host->probes_waiting_retransmit.end(); probeI++) {
         probe = *probeI;
-        if (probe->timedout && !probe->retransmitted &&
-            maxtries > probe->tryno && !probe->isPing()) {
+        if (maxtries > probe->tryno) {
           /* For rate limit detection, we delay the first time a new tryno
              is seen, as long as we are scanning at least 2 ports */
           if (probe->tryno + 1 > (int) host->rld.max_tryno_sent &&
@@ -2451,13 +2660,7 @@ static void doAnyOutstandingRetransmits(UltraScanInfo *USI) {
           }
           break; /* I only do one probe per host for now to spread load */
         }
-      } while (probeI != host->probes_outstanding.begin());
-
-      /* Wrap the probe iterator around. */
-      if (probeI == host->probes_outstanding.begin())
-        probeI = host->probes_outstanding.end();
-      /* Cache the probe iterator. */
-      probe_cache[host] = probeI;
+      }
     }
   } while (USI->gstats->sendOK(NULL) && retrans != 0);
 
@@ -2469,12 +2672,49 @@ static void doAnyOutstandingRetransmits(UltraScanInfo *USI) {
   }
 }
 
+/* Writes a --telemetry record with the group-wide counters of the scan. */
+static void writeTelemetry(UltraScanInfo *USI) {
+  const GroupScanStats *gstats = USI->gstats;
+  std::multiset<HostScanStats *, HssPredicate>::const_iterator hostI;
+  int queued = 0;
+
+  for (hostI = USI->incompleteHosts.begin(); hostI != USI->incompleteHosts.end(); hostI++)
+    queued += (*hostI)->retry_stack.size() + (*hostI)->num_probes_waiting_retransmit;
+
+  telemetry_start(scantype2str(USI->scantype), &USI->now);
+  telemetry_float("done", USI->getCompletionFraction());
+  telemetry_int("hosts", USI->numInitialHosts());
+  telemetry_int("hosts_left", USI->numIncompleteHosts());
+  telemetry_int("sent", gstats->probes_sent);
+  telemetry_int("acked", gstats->timing.num_replies_received);
+  telemetry_int("dropped", gstats->probes_timedout);
+  telemetry_int("retransmits", gstats->probes_retransmitted);
+  telemetry_int("active", gstats->num_probes_active);
+  telemetry_int("queued", queued);
+  telemetry_float("cwnd", gstats->timing.cwnd);
+  telemetry_int("ssthresh", gstats->timing.ssthresh);
+  telemetry_int("srtt", gstats->to.srtt);
+  telemetry_int("rttvar", gstats->to.rttvar);
+  telemetry_int("timeout", gstats->to.timeout);
+  telemetry_float("pps", USI->send_rate_meter.getCurrentPacketRate(&USI->now, false));
+  if (USI->pd != NULL) {
+    struct pcap_stat stat;
+
+    if (pcap_stats(USI->pd, &stat) == 0) {
+      telemetry_int("pcap_recv", stat.ps_recv);
+      telemetry_int("pcap_drop", stat.ps_drop);
+    }
+  }
+  telemetry_end();
+}
+
 /* Print occasional remaining time estimates, as well as
    debugging information */
 static void printAnyStats(UltraScanInfo *USI) {
   std::multiset<HostScanStats *, HssPredicate>::iterator hostI;
   HostScanStats *hss;
   struct ultra_timing_vals hosttm;
+  char ccstate[128];
 
   /* Print debugging states for each host being scanned */
   if (o.debugging > 2) {
@@ -2484,6 +2724,8 @@ static void printAnyStats(UltraScanInfo *USI) {
               USI->gstats->num_probes_active, USI->gstats->timing.cwnd,
               USI->gstats->timing.ssthresh, USI->gstats->to.timeout,
               USI->gstats->to.srtt, USI->gstats->to.rttvar);
+    USI->gstats->timing.describe(&USI->perf, ccstate, sizeof(ccstate));
+    log_write(LOG_PLAIN, "   Group congestion control: %s\n", ccstate);
 
     if (o.debugging > 3) {
       for (hostI = USI->incompleteHosts.begin();
@@ -2498,6 +2740,8 @@ static void printAnyStats(UltraScanInfo *USI) {
                   hosttm.cwnd, hosttm.ssthresh, hss->sdn.delayms,
                   hss->probeTimeout(), hss->target->to.srtt,
                   hss->target->to.rttvar);
+        hosttm.describe(&USI->perf, ccstate, sizeof(ccstate));
+        log_write(LOG_PLAIN, "      congestion control: %s\n", ccstate);
       }
     }
 
@@ -2507,9 +2751,13 @@ static void printAnyStats(UltraScanInfo *USI) {
 
   if (USI->SPM->mayBePrinted(&USI->now))
     USI->SPM->printStatsIfNecessary(USI->getCompletionFraction(), &USI->now);
+
+  if (telemetry_due(&USI->now))
+    writeTelemetry(USI);
 }
 
 static void waitForResponses(UltraScanInfo *USI) {
+  NBASE_PROF_SCOPE("waitForResponses");
   struct timeval stime;
   bool gotone;
   gettimeofday(&USI->now, NULL);
@@ -2519,21 +2767,23 @@ static void waitForResponses(UltraScanInfo *USI) {
   do {
     gotone = false;
     USI->sendOK(&stime);
+    telemetry_cap_wait(&stime);
     if (USI->ping_scan_arp) {
       gotone = get_arp_result(USI, &stime);
     } else if (USI->ping_scan_nd) {
       gotone = get_ns_result(USI, &stime);
     } else if (USI->ping_scan) {
-      if (USI->pd)
+      if (USI->pd || (o.netsim && USI->isRawScan()))
         gotone = get_ping_pcap_result(USI, &stime);
       if (!gotone && USI->ptech.connecttcpscan)
         gotone = do_one_select_round(USI, &stime);
-    } else if (USI->pd) {
+    } else if (USI->pd || (o.netsim && USI->isRawScan())) {
       gotone = get_pcap_result(USI, &stime);
     } else if (USI->scantype == CONNECT_SCAN) {
       gotone = do_one_select_round(USI, &stime);
     } else assert(0);
-  } while (gotone && USI->gstats->num_probes_active > 0);
+  } while (gotone && USI->gstats->num_probes_active > 0
+           && !telemetry_due(&USI->now));
 
   gettimeofday(&USI->now, NULL);
   USI->gstats->last_wait = USI->now;
@@ -2542,8 +2792,9 @@ static void waitForResponses(UltraScanInfo *USI) {
 /* Go through the data structures, making appropriate changes (such as expiring
    probes, noting when hosts are complete, etc. */
 static void processData(UltraScanInfo *USI) {
+  NBASE_PROF_SCOPE("processData");
   std::multiset<HostScanStats *, HssPredicate>::iterator hostI;
-  std::list<UltraProbe *>::iterator probeI, nextProbeI;
+  ProbeQueue::iterator probeI, nextProbeI;
   HostScanStats *host = NULL;
   UltraProbe *probe = NULL;
   unsigned int maxtries = 0;
@@ -2587,60 +2838,71 @@ static void processData(UltraScanInfo *USI) {
       }
     }
 
-    for (probeI = host->probes_outstanding.begin();
-         probeI != host->probes_outstanding.end(); probeI = nextProbeI) {
+    /* The probes are visited queue by queue, so that only the ones that
+       are due are looked at. Probes that time out are only marked in the
+       last step, so they sit out this round of processData. We don't want
+       them to move to the bench or anything until the other functions have
+       had a chance to see that they've timed out. In particular, timing out
+       a probe may mean that the tryno can no longer increase, which would
+       make the logic below incorrect. */
+    for (probeI = host->probes_waiting_retransmit.begin();
+         probeI != host->probes_waiting_retransmit.end(); probeI = nextProbeI) {
       nextProbeI = probeI;
       nextProbeI++;
       probe = *probeI;
-
-      // give up completely after this long
-      expire_us = host->probeExpireTime(probe);
-
-      if (!probe->timedout && TIMEVAL_SUBTRACT(USI->now, probe->sent) >
-          (long) host->probeTimeout()) {
-        host->markProbeTimedout(probeI);
-        /* Once we've timed out a probe, skip it for this round of processData.
-           We don't want it to move to the bench or anything until the other
-           functions have had a chance to see that it's timed out. In
-           particular, timing out a probe may mean that the tryno can no longer
-           increase, which would make the logic below incorrect. */
+      if (probe->tryno < maxtries)
         continue;
-      }
 
-      if (!probe->isPing() && probe->timedout && !probe->retransmitted) {
-        if (!tryno_mayincrease && probe->tryno >= maxtries) {
-          if (tryno_capped && !host->retry_capped_warned) {
-            log_write(LOG_PLAIN, "Warning: %s giving up on port because"
-                      " retransmission cap hit (%d).\n", host->target->targetipstr(),
-                      probe->tryno);
-            host->retry_capped_warned = true;
-          }
-          if (USI->ping_scan) {
-            ultrascan_host_probe_update(USI, host, probeI, HOST_DOWN, NULL);
-            if (host->target->reason.reason_id == ER_UNKNOWN)
-              host->target->reason.reason_id = ER_NORESPONSE;
-          } else {
-            /* No ultrascan_port_probe_update because that allocates a Port
-               object; the default port state as set by setDefaultPortState
-               handles these no-response ports. */
-            host->destroyOutstandingProbe(probeI);
-          }
-          continue;
-        } else if (probe->tryno >= maxtries &&
-                   TIMEVAL_SUBTRACT(USI->now, probe->sent) > expire_us) {
-          assert(probe->tryno == maxtries);
-          /* Move it to the bench until it is needed (maxtries
-             increases or is capped */
-          host->moveProbeToBench(probeI);
-          continue;
+      if (!tryno_mayincrease) {
+        if (tryno_capped && !host->retry_capped_warned) {
+          log_write(LOG_PLAIN, "Warning: %s giving up on port because"
+                    " retransmission cap hit (%d).\n", host->target->targetipstr(),
+                    probe->tryno);
+          host->retry_capped_warned = true;
         }
+        if (USI->ping_scan) {
+          ultrascan_host_probe_update(USI, host, ProbeList::iterator_to(probe), HOST_DOWN, NULL);
+          if (host->target->reason.reason_id == ER_UNKNOWN)
+            host->target->reason.reason_id = ER_NORESPONSE;
+        } else {
+          /* No ultrascan_port_probe_update because that allocates a Port
+             object; the default port state as set by setDefaultPortState
+             handles these no-response ports. */
+          host->destroyOutstandingProbe(ProbeList::iterator_to(probe));
+        }
+      } else if (TIMEVAL_SUBTRACT(USI->now, probe->sent) > (long) host->probeExpireTime(probe)) {
+        assert(probe->tryno == maxtries);
+        /* Move it to the bench until it is needed (maxtries
+           increases or is capped */
+        host->moveProbeToBench(ProbeList::iterator_to(probe));
       }
+    }
 
-      if ((probe->isPing() || (probe->timedout && probe->retransmitted)) &&
-          TIMEVAL_SUBTRACT(USI->now, probe->sent) > expire_us) {
-        host->destroyOutstandingProbe(probeI);
-        continue;
-      }
+    /* Retransmitted probes and pings are kept only until they expire, in
+       case a late response comes in. Both queues are in send order. */
+    while (!host->probes_retransmitted.empty()) {
+      probe = host->probes_retransmitted.front();
+      // give up completely after this long
+      expire_us = host->probeExpireTime(probe);
+      if (TIMEVAL_SUBTRACT(USI->now, probe->sent) <= expire_us)
+        break;
+      host->destroyOutstandingProbe(ProbeList::iterator_to(probe));
+    }
+    while (!host->pings_timedout.empty()) {
+      probe = host->pings_timedout.front();
+      expire_us = host->probeExpireTime(probe);
+      if (TIMEVAL_SUBTRACT(USI->now, probe->sent) <= expire_us)
+        break;
+      host->destroyOutstandingProbe(ProbeList::iterator_to(probe));
+    }
+
+    /* Mark timedout entries as such. probes_active is in send order, so
+       the ones that timed out are at the front. */
+    while (!host->probes_active.empty()) {
+      probe = host->probes_active.front();
+      if (TIMEVAL_SUBTRACT(USI->now, probe->sent) <= (long) host->probeTimeout())
+        break;
+      host->markProbeTimedout(ProbeList::iterator_to(probe));
     }
   }
 
@@ -2650,19 +2912,24 @@ static void processData(UltraScanInfo *USI) {
   /* Check for expired global pings. */
   HostScanStats *pinghost = USI->gstats->pinghost;
   if (pinghost != NULL) {
-    for (probeI = pinghost->probes_outstanding.begin();
-         probeI != pinghost->probes_outstanding.end();
-         probeI = nextProbeI) {
-      nextProbeI = probeI;
-      nextProbeI++;
-      /* If a global ping probe times out, we want to get rid of it so a new
-         host can take its place. */
-      if ((*probeI)->isPing()
-          && TIMEVAL_SUBTRACT(USI->now, (*probeI)->sent) > (long) pinghost->probeTimeout()) {
-        if (o.debugging)
-          log_write(LOG_STDOUT, "Destroying timed-out global ping from %s.\n", pinghost->target->targetipstr());
-        /* ultrascan_ping_update destroys the probe. */
-        ultrascan_ping_update(USI, pinghost, probeI, NULL);
+    /* A completed pinghost is not marking its probes timed out, so its
+       pings may still be active. Both queues are in send order. */
+    ProbeQueue *queues[] = { &pinghost->pings_timedout, &pinghost->probes_active };
+    for (unsigned int i = 0; i < sizeof(queues) / sizeof(*queues); i++) {
+      for (probeI = queues[i]->begin(); probeI != queues[i]->end(); probeI = nextProbeI) {
+        nextProbeI = probeI;
+        nextProbeI++;
+        probe = *probeI;
+        if (TIMEVAL_SUBTRACT(USI->now, probe->sent) <= (long) pinghost->probeTimeout())
+          break;
+        /* If a global ping probe times out, we want to get rid of it so a new
+           host can take its place. */
+        if (probe->isPing()) {
+          if (o.debugging)
+            log_write(LOG_STDOUT, "Destroying timed-out global ping from %s.\n", pinghost->target->targetipstr());
+          /* ultrascan_ping_update destroys the probe. */
+          ultrascan_ping_update(USI, pinghost, ProbeList::iterator_to(probe), NULL);
+        }
       }
     }
   }
@@ -2733,7 +3000,7 @@ void ultra_scan(std::vector<Target *> &Targets, struct scan_lists *ports,
     log_write(LOG_STDOUT, "Scanning %s [%d port%s%s]\n", targetstr, USI.gstats->numprobes, (USI.gstats->numprobes != 1) ? "s" : "", plural ? "/host" : "");
   }
 
-  if (USI.isRawScan())
+  if (USI.isRawScan() && !o.netsim)
     begin_sniffer(&USI, Targets);
   /* Otherwise, no sniffer needed! */
 
@@ -2769,6 +3036,10 @@ void ultra_scan(std::vector<Target *> &Targets, struct scan_lists *ports,
 
   USI.send_rate_meter.stop(&USI.now);
 
+  /* A last record, so that a reader sees the totals of every phase. */
+  if (o.telemetry)
+    writeTelemetry(&USI);
+
   /* Save the computed timeouts. */
   if (to != NULL)
     *to = USI.gstats->to;
@@ -258,9 +258,19 @@ struct IPExtraProbeData {
   } pd;
 };
 
+/* The links that put a probe on its host's probes_outstanding list and on
+   one of the host's timeout queues (see HostScanStats). They are kept in the
+   probe itself so that moving a probe between lists allocates nothing. */
+struct ProbeOutstandingLink {
+  ProbeOutstandingLink *prev, *next;
+};
+struct ProbeTimeoutLink {
+  ProbeTimeoutLink *prev, *next;
+};
+
 /* At least for now, I'll just use this like a struct and access
    all the data members directly */
-class UltraProbe {
+class UltraProbe : public ProbeOutstandingLink, public ProbeTimeoutLink {
 public:
   UltraProbe();
   ~UltraProbe();
@@ -319,7 +329,7 @@ public:
     return mypspec.proto;
   }
   ConnectProbe *CP() {
-    return probes.CP;  // if type == UP_CONNECT
+    return &connectprobe;  // if type == UP_CONNECT
   }
   // Arpprobe removed because not used.
   //  ArpProbe *AP() { return probes.AP; } // if UP_ARP
@@ -357,9 +367,132 @@ private:
   probespec mypspec; /* Filled in by the appropriate set* function */
   union {
     IPExtraProbeData IP;
-    ConnectProbe *CP;
     //    ArpProbe *AP;
   } probes;
+  ConnectProbe connectprobe; /* Socket of a UP_CONNECT probe */
+};
+
+/* A doubly-linked list of probes that keeps its links in the probes
+   themselves, like nsock's gh_list, so adding and removing a probe allocates
+   nothing and a probe can be removed without searching for it. Link is the
+   base of UltraProbe that holds the links this list uses; a probe can be on
+   one list of each kind at a time. Only the parts of the std::list interface
+   the scan engine needs are provided. */
+template <class Link>
+class IntrusiveProbeList {
+public:
+  class iterator {
+  public:
+    iterator() : node(NULL) {}
+    explicit iterator(Link *n) : node(n) {}
+    UltraProbe *operator*() const {
+      return static_cast<UltraProbe *>(node);
+    }
+    iterator &operator++() {
+      node = node->next;
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator old = *this;
+      node = node->next;
+      return old;
+    }
+    iterator &operator--() {
+      node = node->prev;
+      return *this;
+    }
+    iterator operator--(int) {
+      iterator old = *this;
+      node = node->prev;
+      return old;
+    }
+    bool operator==(const iterator &other) const {
+      return node == other.node;
+    }
+    bool operator!=(const iterator &other) const {
+      return node != other.node;
+    }
+  private:
+    Link *node;
+    friend class IntrusiveProbeList;
+  };
+
+  IntrusiveProbeList() : count(0) {
+    head.prev = head.next = &head;
+  }
+  iterator begin() {
+    return iterator(head.next);
+  }
+  iterator end() {
+    return iterator(&head);
+  }
+  bool empty() const {
+    return count == 0;
+  }
+  size_t size() const {
+    return count;
+  }
+  UltraProbe *front() {
+    return static_cast<UltraProbe *>(head.next);
+  }
+  UltraProbe *back() {
+    return static_cast<UltraProbe *>(head.prev);
+  }
+  /* Inserts probe before pos. */
+  void insert(iterator pos, UltraProbe *probe) {
+    Link *link = probe;
+    link->next = pos.node;
+    link->prev = pos.node->prev;
+    link->prev->next = link;
+    pos.node->prev = link;
+    count++;
+  }
+  void push_back(UltraProbe *probe) {
+    insert(end(), probe);
+  }
+  void erase(iterator pos) {
+    Link *link = pos.node;
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    count--;
+  }
+  void remove(UltraProbe *probe) {
+    erase(iterator_to(probe));
+  }
+  /* Returns an iterator pointing at a probe that is on the list. */
+  static iterator iterator_to(UltraProbe *probe) {
+    return iterator(static_cast<Link *>(probe));
+  }
+
+private:
+  Link head;
+  size_t count;
+  /* Probes point at head, so the list can't be copied. */
+  IntrusiveProbeList(const IntrusiveProbeList &);
+  IntrusiveProbeList &operator=(const IntrusiveProbeList &);
+};
+
+typedef IntrusiveProbeList<ProbeOutstandingLink> ProbeList;
+typedef IntrusiveProbeList<ProbeTimeoutLink> ProbeQueue;
+
+/* Hands out the UltraProbes of one ultra_scan. They are carved out of slabs
+   that are kept until the scan ends, and freed probes are reused before any
+   new slab is allocated, so that after the first round of probes has been
+   sent, sending a probe costs no trip to the allocator. */
+class UltraProbePool {
+public:
+  UltraProbePool();
+  ~UltraProbePool();
+  /* Returns a newly constructed probe. */
+  UltraProbe *alloc();
+  /* Destroys a probe returned by alloc() and keeps its memory for reuse. */
+  void release(UltraProbe *probe);
+
+private:
+  std::vector<char *> slabs;
+  void *freelist;
+  UltraProbePool(const UltraProbePool &);
+  UltraProbePool &operator=(const UltraProbePool &);
 };
 
 /* Global info for the connect scan */
@@ -408,6 +541,8 @@ public:
   int numprobes; /* Number of probes/ports scanned on each host */
   /* The last time waitForResponses finished (initialized to GSS creation time */
   int probes_sent; /* Number of probes sent in total.  This DOES include pings and retransmissions */
+  int probes_retransmitted; /* Number of those probes that were retransmissions */
+  int probes_timedout; /* Number of probes that got no response in time */
 
   /* The most recently received probe response time -- initialized to scan
      start time. */
@@ -523,7 +658,7 @@ public:
 
   /* Removes a probe from probes_outstanding, adjusts HSS and USS
      active probe stats accordingly, then deletes the probe. */
-  void destroyOutstandingProbe(std::list<UltraProbe *>::iterator probeI);
+  void destroyOutstandingProbe(ProbeList::iterator probeI);
 
   /* Removes all probes from probes_outstanding using
      destroyOutstandingProbe. This is used in ping scan to quit waiting
@@ -533,7 +668,11 @@ public:
 
   /* Mark an outstanding probe as timedout.  Adjusts stats
      accordingly.  For connect scans, this closes the socket. */
-  void markProbeTimedout(std::list<UltraProbe *>::iterator probeI);
+  void markProbeTimedout(ProbeList::iterator probeI);
+
+  /* Adds a probe that has just been sent to probes_outstanding and
+     probes_active, and counts it as active. */
+  void addOutstandingProbe(UltraProbe *probe);
 
   /* New (active) probes are appended to the end of this list.  When a
      host times out, it will be marked as such, but may hang around on
@@ -542,7 +681,21 @@ public:
      are outstanding.  Probes on the bench (reached the current
      maximum tryno and expired) are not counted in
      probes_outstanding.  */
-  std::list<UltraProbe *> probes_outstanding;
+  ProbeList probes_outstanding;
+  /* Each outstanding probe is also on one of these queues, according to
+     what happens to it next, so that processData() and
+     doAnyOutstandingRetransmits() look only at the probes that are due.
+     probes_active holds the probes that have not timed out, in the order
+     they were sent, which is also the order in which they will time out.
+     Timed out probes move to probes_waiting_retransmit (or pings_timedout
+     for pings) in that same order, and from there to probes_retransmitted,
+     which is kept sorted by send time so that it expires from the front. */
+  ProbeQueue probes_active;
+  ProbeQueue probes_waiting_retransmit;
+  ProbeQueue probes_retransmitted;
+  ProbeQueue pings_timedout;
+  /* Returns the one of the queues above that the probe belongs on. */
+  ProbeQueue *queueOf(UltraProbe *probe);
   /* The number of probes in probes_outstanding, minus the inactive (timed out) ones */
   unsigned int num_probes_active;
   /* Probes timed out but not yet retransmitted because of congestion
@@ -574,7 +727,7 @@ public:
   /* tryno of probes on the retry queue */
   /* Moves the given probe from the probes_outstanding list, to
      probe_bench, and decrements num_probes_waiting_retransmit accordingly */
-  void moveProbeToBench(std::list<UltraProbe *>::iterator probeI);
+  void moveProbeToBench(ProbeList::iterator probeI);
   /* Dismiss all probe attempts on bench -- the ports are marked
      'filtered' or whatever is appropriate for having no response */
   void dismissBench();
@@ -763,6 +916,7 @@ public:
   eth_t *ethsd;
   u32 seqmask; /* This mask value is used to encode values in sequence
                   numbers.  It is set randomly in UltraScanInfo::Init() */
+  UltraProbePool probe_pool; /* Where the probes of this scan come from */
 private:
 
   unsigned int numInitialTargets;
@@ -777,17 +931,17 @@ enum ultra_timing_type { TIMING_HOST, TIMING_GROUP };
 const char *pspectype2ascii(int type);
 
 void ultrascan_port_probe_update(UltraScanInfo *USI, HostScanStats *hss,
-                                 std::list<UltraProbe *>::iterator probeI,
+                                 ProbeList::iterator probeI,
                                  int newstate, struct timeval *rcvdtime,
                                  bool adjust_timing_hint = true);
 
 void ultrascan_host_probe_update(UltraScanInfo *USI, HostScanStats *hss,
-                                        std::list<UltraProbe *>::iterator probeI,
+                                        ProbeList::iterator probeI,
                                         int newstate, struct timeval *rcvdtime,
                                         bool adjust_timing_hint = true);
 
 void ultrascan_ping_update(UltraScanInfo *USI, HostScanStats *hss,
-                                  std::list<UltraProbe *>::iterator probeI,
+                                  ProbeList::iterator probeI,
                                   struct timeval *rcvdtime,
                                   bool adjust_timing = true);
 #endif /* SCAN_ENGINE_H */
@@ -135,6 +135,8 @@
 #include "scan_engine_connect.h"
 #include "libnetutil/netutil.h" /* for max_sd() */
 #include "NmapOps.h"
+#include "netsim.h"
+#include "nbase_prof.h"
 
 #include <errno.h>
 
@@ -144,7 +146,6 @@ extern NmapOps o;
    port number*/
 void UltraProbe::setConnect(u16 portno) {
   type = UP_CONNECT;
-  probes.CP = new ConnectProbe();
   mypspec.type = PS_CONNECTTCP;
   mypspec.proto = IPPROTO_TCP;
   mypspec.pd.tcp.dport = portno;
@@ -223,13 +224,17 @@ ConnectProbe::ConnectProbe() {
 }
 
 ConnectProbe::~ConnectProbe() {
-  if (sd > 0)
-    close(sd);
+  if (sd > 0) {
+    if (o.netsim)
+      netsim_close(sd);
+    else
+      close(sd);
+  }
   sd = -1;
 }
 
 static void handleConnectResult(UltraScanInfo *USI, HostScanStats *hss,
-                                std::list<UltraProbe *>::iterator probeI,
+                                ProbeList::iterator probeI,
                                 int connect_errno,
                                 bool destroy_probe=false) {
   bool adjust_timing = true;
@@ -345,7 +350,7 @@ static void handleConnectResult(UltraScanInfo *USI, HostScanStats *hss,
     /* getsockname can fail on AIX when socket is closed
      * and we only care about self-connects for open ports anyway
      */
-    if (newportstate == PORT_OPEN) {
+    if (newportstate == PORT_OPEN && !o.netsim) {
       /* Check for self-connected probe */
       if (getsockname(probe->CP()->sd, (struct sockaddr*)&local, &local_len) == 0) {
         if (sockaddr_storage_cmp(&local, &remote) == 0 && (
@@ -423,8 +428,8 @@ static void init_socket(int sd) {
 UltraProbe *sendConnectScanProbe(UltraScanInfo *USI, HostScanStats *hss,
                                  u16 destport, u8 tryno, u8 pingseq) {
 
-  UltraProbe *probe = new UltraProbe();
-  std::list<UltraProbe *>::iterator probeI;
+  UltraProbe *probe = USI->probe_pool.alloc();
+  ProbeList::iterator probeI;
   int rc;
   int connect_errno = 0;
   struct sockaddr_storage sock;
@@ -441,14 +446,18 @@ UltraProbe *sendConnectScanProbe(UltraScanInfo *USI, HostScanStats *hss,
   probe->setConnect(destport);
   CP = probe->CP();
   /* Initiate the connection */
-  CP->sd = socket(o.af(), SOCK_STREAM, IPPROTO_TCP);
-  if (CP->sd == -1)
-    pfatal("Socket creation in %s", __func__);
-  unblock_socket(CP->sd);
-  init_socket(CP->sd);
-  set_ttl(CP->sd, o.ttl);
-  if (o.ipoptionslen)
-    set_ipoptions(CP->sd, o.ipoptions, o.ipoptionslen);
+  if (o.netsim) {
+    CP->sd = netsim_socket();
+  } else {
+    CP->sd = socket(o.af(), SOCK_STREAM, IPPROTO_TCP);
+    if (CP->sd == -1)
+      pfatal("Socket creation in %s", __func__);
+    unblock_socket(CP->sd);
+    init_socket(CP->sd);
+    set_ttl(CP->sd, o.ttl);
+    if (o.ipoptionslen)
+      set_ipoptions(CP->sd, o.ipoptions, o.ipoptionslen);
+  }
   if (hss->target->TargetSockAddr(&sock, &socklen) != 0) {
     fatal("Failed to get target socket address in %s", __func__);
   }
@@ -460,16 +469,16 @@ UltraProbe *sendConnectScanProbe(UltraScanInfo *USI, HostScanStats *hss,
   probe->sent = USI->now;
   /* We don't record a byte count for connect probes. */
   hss->probeSent(0);
-  rc = connect(CP->sd, (struct sockaddr *)&sock, socklen);
+  if (o.netsim)
+    rc = netsim_connect(CP->sd, &sock);
+  else
+    rc = connect(CP->sd, (struct sockaddr *)&sock, socklen);
   gettimeofday(&USI->now, NULL);
   if (rc == -1)
-    connect_errno = socket_errno();
+    connect_errno = o.netsim ? errno : socket_errno();
   /* This counts as probe being sent, so update structures */
-  hss->probes_outstanding.push_back(probe);
-  probeI = hss->probes_outstanding.end();
-  probeI--;
-  USI->gstats->num_probes_active++;
-  hss->num_probes_active++;
+  hss->addOutstandingProbe(probe);
+  probeI = ProbeList::iterator_to(probe);
 
   /* It would be convenient if the connect() call would never succeed
      or permanently fail here, so related code cood all be localized
@@ -492,6 +501,7 @@ UltraProbe *sendConnectScanProbe(UltraScanInfo *USI, HostScanStats *hss,
    quick select() just in case.  Returns true if at least one good result
    (generally a port state change) is found, false if it times out instead */
 bool do_one_select_round(UltraScanInfo *USI, struct timeval *stime) {
+  NBASE_PROF_SCOPE("do_one_select_round");
   fd_set fds_rtmp, fds_wtmp, fds_xtmp;
   int selectres;
   struct timeval timeout;
@@ -516,7 +526,10 @@ bool do_one_select_round(UltraScanInfo *USI, struct timeval *stime) {
     timeout.tv_sec = timeleft / 1000;
     timeout.tv_usec = (timeleft % 1000) * 1000;
 
-    if (CSI->numSDs) {
+    if (CSI->numSDs && o.netsim) {
+      selectres = netsim_select(CSI->maxValidSD + 1, &fds_rtmp, &fds_wtmp,
+                                &fds_xtmp, &timeout);
+    } else if (CSI->numSDs) {
       selectres = select(CSI->maxValidSD + 1, &fds_rtmp, &fds_wtmp,
                          &fds_xtmp, &timeout);
       err = socket_errno();
@@ -554,9 +567,10 @@ bool do_one_select_round(UltraScanInfo *USI, struct timeval *stime) {
     if (host->num_probes_active == 0)
       continue;
 
-    std::list<UltraProbe *>::iterator nextProbeI;
-    for (std::list<UltraProbe *>::iterator probeI = host->probes_outstanding.begin();
-        probeI != host->probes_outstanding.end() && numGoodSD < selectres && host->num_probes_outstanding() > 0; probeI = nextProbeI) {
+    /* Only active probes still have a socket. */
+    ProbeQueue::iterator nextProbeI;
+    for (ProbeQueue::iterator probeI = host->probes_active.begin();
+        probeI != host->probes_active.end() && numGoodSD < selectres && !host->probes_active.empty(); probeI = nextProbeI) {
       /* handleConnectResult may remove the probe at probeI, which invalidates
        * the iterator. We copy and increment it here instead of in the for-loop
        * statement to avoid incrementing an invalid iterator */
@@ -570,11 +584,13 @@ bool do_one_select_round(UltraScanInfo *USI, struct timeval *stime) {
                       checked_fd_isset(sd, &fds_wtmp) ||
                       checked_fd_isset(sd, &fds_xtmp))) {
         numGoodSD++;
-        if (getsockopt(sd, SOL_SOCKET, SO_ERROR, (char *) &optval,
-                       &optlen) != 0)
+        if (o.netsim)
+          optval = netsim_sockerror(sd);
+        else if (getsockopt(sd, SOL_SOCKET, SO_ERROR, (char *) &optval,
+                            &optlen) != 0)
           optval = socket_errno(); /* Stupid Solaris ... */
 
-        handleConnectResult(USI, host, probeI, optval);
+        handleConnectResult(USI, host, ProbeList::iterator_to(probe), optval);
       }
     }
   }
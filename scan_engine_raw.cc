@@ -138,6 +138,7 @@
 #include "struct_ip.h"
 #include "tcpip.h"
 #include "utils.h"
+#include "nbase_prof.h"
 #include <string>
 
 extern NmapOps o;
@@ -497,7 +498,7 @@ int get_ping_pcap_result(UltraScanInfo *USI, struct timeval *stime) {
   struct ppkt *ping;
   long to_usec;
   HostScanStats *hss = NULL;
-  std::list<UltraProbe *>::iterator probeI;
+  ProbeList::iterator probeI;
   UltraProbe *probe = NULL;
   unsigned int trynum = 0;
   int newstate = HOST_UNKNOWN;
@@ -1043,7 +1044,7 @@ void begin_sniffer(UltraScanInfo *USI, std::vector<Target *> &Targets) {
 UltraProbe *sendArpScanProbe(UltraScanInfo *USI, HostScanStats *hss,
                              u8 tryno, u8 pingseq) {
   int rc;
-  UltraProbe *probe = new UltraProbe();
+  UltraProbe *probe = USI->probe_pool.alloc();
 
   /* 3 cheers for libdnet header files */
   u8 frame[ETH_HDR_LEN + ARP_HDR_LEN + ARP_ETHIP_LEN];
@@ -1070,9 +1071,7 @@ UltraProbe *sendArpScanProbe(UltraScanInfo *USI, HostScanStats *hss,
   probe->setARP(frame, sizeof(frame));
 
   /* Now that the probe has been sent, add it to the Queue for this host */
-  hss->probes_outstanding.push_back(probe);
-  USI->gstats->num_probes_active++;
-  hss->num_probes_active++;
+  hss->addOutstandingProbe(probe);
 
   gettimeofday(&USI->now, NULL);
   return probe;
@@ -1080,7 +1079,7 @@ UltraProbe *sendArpScanProbe(UltraScanInfo *USI, HostScanStats *hss,
 
 UltraProbe *sendNDScanProbe(UltraScanInfo *USI, HostScanStats *hss,
                             u8 tryno, u8 pingseq) {
-  UltraProbe *probe = new UltraProbe();
+  UltraProbe *probe = USI->probe_pool.alloc();
   struct eth_nfo eth;
   struct eth_nfo *ethptr = NULL;
   u8 *packet = NULL;
@@ -1139,9 +1138,7 @@ UltraProbe *sendNDScanProbe(UltraScanInfo *USI, HostScanStats *hss,
   free(packet);
 
   /* Now that the probe has been sent, add it to the Queue for this host */
-  hss->probes_outstanding.push_back(probe);
-  USI->gstats->num_probes_active++;
-  hss->num_probes_active++;
+  hss->addOutstandingProbe(probe);
 
   gettimeofday(&USI->now, NULL);
   return probe;
@@ -1270,7 +1267,7 @@ UltraProbe *sendIPScanProbe(UltraScanInfo *USI, HostScanStats *hss,
                             const probespec *pspec, u8 tryno, u8 pingseq) {
   u8 *packet = NULL;
   u32 packetlen = 0;
-  UltraProbe *probe = new UltraProbe();
+  UltraProbe *probe = USI->probe_pool.alloc();
   int decoy = 0;
   u32 seq = 0;
   u32 ack = 0;
@@ -1523,9 +1520,7 @@ UltraProbe *sendIPScanProbe(UltraScanInfo *USI, HostScanStats *hss,
   } else assert(0);
 
   /* Now that the probe has been sent, add it to the Queue for this host */
-  hss->probes_outstanding.push_back(probe);
-  USI->gstats->num_probes_active++;
-  hss->num_probes_active++;
+  hss->addOutstandingProbe(probe);
 
   gettimeofday(&USI->now, NULL);
   return probe;
@@ -1544,7 +1539,7 @@ bool get_arp_result(UltraScanInfo *USI, struct timeval *stime) {
   bool timedout = false;
   struct sockaddr_in sin;
   HostScanStats *hss = NULL;
-  std::list<UltraProbe *>::iterator probeI;
+  ProbeList::iterator probeI;
   int gotone = 0;
 
   gettimeofday(&USI->now, NULL);
@@ -1615,7 +1610,7 @@ bool get_ns_result(UltraScanInfo *USI, struct timeval *stime) {
   bool has_mac = false;
   struct sockaddr_in6 sin6;
   HostScanStats *hss = NULL;
-  std::list<UltraProbe *>::iterator probeI;
+  ProbeList::iterator probeI;
   int gotone = 0;
 
   gettimeofday(&USI->now, NULL);
@@ -1683,6 +1678,7 @@ bool get_ns_result(UltraScanInfo *USI, struct timeval *stime) {
    ultra-quick pcap read just in case.  Returns true if a "good" result
    was found, false if it timed out instead. */
 bool get_pcap_result(UltraScanInfo *USI, struct timeval *stime) {
+  NBASE_PROF_SCOPE("get_pcap_result");
   bool goodone = false;
   bool timedout = false;
   bool adjust_timing = true;
@@ -1691,7 +1687,7 @@ bool get_pcap_result(UltraScanInfo *USI, struct timeval *stime) {
   unsigned int bytes;
   long to_usec;
   HostScanStats *hss = NULL;
-  std::list<UltraProbe *>::iterator probeI;
+  ProbeList::iterator probeI;
   UltraProbe *probe = NULL;
   int newstate = PORT_UNKNOWN;
   unsigned int probenum;
@@ -141,6 +141,8 @@
 #include "protocols.h"
 
 #include "nmap_tty.h"
+#include "telemetry.h"
+#include "nbase_prof.h"
 
 #include <errno.h>
 
@@ -1422,6 +1424,7 @@ int AllProbes::check_excluded_port(unsigned short portno, int proto)
 // no version matched, that field will be NULL. This function may
 // return NULL if there are no match lines at all in this probe.
 const struct MatchDetails *ServiceProbe::testMatch(const u8 *buf, int buflen, int n = 0) {
+  NBASE_PROF_SCOPE("ServiceProbe::testMatch");
   std::vector<ServiceProbeMatch *>::iterator vi;
   const struct MatchDetails *MD;
 
@@ -2133,6 +2136,20 @@ static int scanThroughTunnel(nsock_pool nsp, nsock_iod nsi, ServiceGroup *SG,
 }
 
 /* Prints completion estimates and the like when appropriate */
+/* Writes a --telemetry record with the progress of the service scan. */
+static void writeTelemetry(nsock_pool nsp, ServiceGroup *SG) {
+  double total = (double) SG->services_remaining.size() + SG->services_in_progress.size() + SG->services_finished.size();
+
+  telemetry_start("Service scan", nsock_gettimeofday());
+  telemetry_float("done", total > 0 ? SG->services_finished.size() / total : 1.0);
+  telemetry_int("remaining", SG->services_remaining.size());
+  telemetry_int("in_progress", SG->services_in_progress.size());
+  telemetry_int("finished", SG->services_finished.size());
+  telemetry_int("parallelism", SG->ideal_parallelism);
+  telemetry_int("nsock_events", nsock_pool_get_events_pending(nsp));
+  telemetry_end();
+}
+
 static void considerPrintingStats(nsock_pool nsp, ServiceGroup *SG) {
    /* Check for status requests */
    if (keyWasPressed()) {
@@ -2148,6 +2165,9 @@ static void considerPrintingStats(nsock_pool nsp, ServiceGroup *SG) {
   if (SG->SPM->mayBePrinted(nsock_gettimeofday())) {
     SG->SPM->printStatsIfNecessary(SG->services_finished.size() / ((double)SG->services_remaining.size() + SG->services_in_progress.size() + SG->services_finished.size()), nsock_gettimeofday());
   }
+
+  if (telemetry_due(nsock_gettimeofday()))
+    writeTelemetry(nsp, SG);
 }
 
 /* Check if target is done (no more probes remaining for it in service group),
@@ -2283,6 +2303,7 @@ static int launchSomeServiceProbes(nsock_pool nsp, ServiceGroup *SG) {
 
 
 static void servicescan_connect_handler(nsock_pool nsp, nsock_event nse, void *mydata) {
+  NBASE_PROF_SCOPE("servicescan_connect_handler");
   nsock_iod nsi = nse_iod(nse);
   enum nse_status status = nse_status(nse);
   enum nse_type type = nse_type(nse);
@@ -2351,6 +2372,7 @@ static void servicescan_connect_handler(nsock_pool nsp, nsock_event nse, void *m
 }
 
 static void servicescan_write_handler(nsock_pool nsp, nsock_event nse, void *mydata) {
+  NBASE_PROF_SCOPE("servicescan_write_handler");
   enum nse_status status = nse_status(nse);
   nsock_iod nsi;
   ServiceNFO *svc = (ServiceNFO *)mydata;
@@ -2401,6 +2423,7 @@ static void servicescan_write_handler(nsock_pool nsp, nsock_event nse, void *myd
 }
 
 static void servicescan_read_handler(nsock_pool nsp, nsock_event nse, void *mydata) {
+  NBASE_PROF_SCOPE("servicescan_read_handler");
   nsock_iod nsi = nse_iod(nse);
   enum nse_status status = nse_status(nse);
   enum nse_type type = nse_type(nse);
@@ -2432,6 +2455,7 @@ static void servicescan_read_handler(nsock_pool nsp, nsock_event nse, void *myda
     }
 
     if (MD && MD->serviceName) {
+      NBASE_PROF_EVENT("service matched", MD->lineno);
       // WOO HOO!!!!!!  MATCHED!  But might be soft
       if (MD->isSoft && svc->probe_matched) {
         if (strcmp(svc->probe_matched, MD->serviceName) != 0)
@@ -2776,6 +2800,10 @@ int service_scan(std::vector<Target *> &Targets) {
 
   nsock_pool_set_device(nsp, o.device);
 
+  /* Most probe read timeouts get cancelled by a response, which is cheaper
+   * with a timing wheel than with a heap. */
+  nsock_pool_set_timer_wheel(nsp, 1);
+
   if (o.proxy_chain) {
     nsock_pool_set_proxychain(nsp, o.proxy_chain);
   }
@@ -2798,6 +2826,9 @@ int service_scan(std::vector<Target *> &Targets) {
     fatal("Unexpected nsock_loop error.  Error code %d (%s)", err, socket_strerror(err));
   }
 
+  if (o.telemetry)
+    writeTelemetry(nsp, SG);
+
   nsock_pool_delete(nsp);
 
   if (o.verbose) {
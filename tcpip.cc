@@ -139,6 +139,7 @@
 #include "tcpip.h"
 #include "NmapOps.h"
 #include "Target.h"
+#include "netsim.h"
 #include "utils.h"
 #include "libnetutil/netutil.h"
 
@@ -536,6 +537,9 @@ int send_ip_packet(int sd, const struct eth_nfo *eth,
   if (packetlen < 1)
     return -1;
 
+  if (o.netsim)
+    return netsim_send(packet, packetlen);
+
   if (ip->ip_v == 4) {
     assert(dst->ss_family == AF_INET);
     return send_ipv4_packet(sd, eth, (struct sockaddr_in *) dst, packet, packetlen);
@@ -1559,6 +1563,9 @@ char *readip_pcap(pcap_t *pd, unsigned int *len, long to_usec,
     memset(linknfo, 0, sizeof(*linknfo));
   }
 
+  if (o.netsim)
+    return netsim_read(len, to_usec, rcvdtime);
+
   if (!pd)
     fatal("NULL packet device passed to %s", __func__);
 
@@ -2024,6 +2031,9 @@ int nmap_route_dst(const struct sockaddr_storage *dst, struct route_nfo *rnfo) {
   struct sockaddr_storage spoofss;
   size_t spoofsslen;
 
+  if (o.netsim)
+    return netsim_route(dst, rnfo);
+
   if (o.spoofsource) {
     o.SourceSockAddr(&spoofss, &spoofsslen);
     return route_dst(dst, rnfo, o.device, &spoofss);
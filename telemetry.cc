@@ -0,0 +1,312 @@
+/***************************************************************************
+ * telemetry.cc -- A machine-readable stream of the progress and timing    *
+ * of the scan phases, written as JSON lines at a fixed interval.          *
+ *                                                                         *
+ ***********************IMPORTANT NMAP LICENSE TERMS************************
+ *                                                                         *
+ * The Nmap Security Scanner is (C) 1996-2016 Insecure.Com LLC ("The Nmap  *
+ * Project"). Nmap is also a registered trademark of the Nmap Project.     *
+ * This program is free software; you may redistribute and/or modify it    *
+ * under the terms of the GNU General Public License as published by the   *
+ * Free Software Foundation; Version 2 ("GPL"), BUT ONLY WITH ALL OF THE   *
+ * CLARIFICATIONS AND EXCEPTIONS DESCRIBED HEREIN.  This guarantees your   *
+ * right to use, modify, and redistribute this software under certain      *
+ * conditions.  If you wish to embed Nmap technology into proprietary      *
+ * software, we sell alternative licenses (contact sales@nmap.com).        *
+ * Dozens of software vendors already license Nmap technology such as      *
+ * host discovery, port scanning, OS detection, version detection, and     *
+ * the Nmap Scripting Engine.                                              *
+ *                                                                         *
+ * Note that the GPL places important restrictions on "derivative works",  *
+ * yet it does not provide a detailed definition of that term.  To avoid   *
+ * misunderstandings, we interpret that term as broadly as copyright law   *
+ * allows.  For example, we consider an application to constitute a        *
+ * derivative work for the purpose of this license if it does any of the   *
+ * following with any software or content covered by this license          *
+ * ("Covered Software"):                                                   *
+ *                                                                         *
+ * o Integrates source code from Covered Software.                         *
+ *                                                                         *
+ * o Reads or includes copyrighted data files, such as Nmap's nmap-os-db   *
+ * or nmap-service-probes.                                                 *
+ *                                                                         *
+ * o Is designed specifically to execute Covered Software and parse the    *
+ * results (as opposed to typical shell or execution-menu apps, which will *
+ * execute anything you tell them to).                                     *
+ *                                                                         *
+ * o Includes Covered Software in a proprietary executable installer.  The *
+ * installers produced by InstallShield are an example of this.  Including *
+ * Nmap with other software in compressed or archival form does not        *
+ * trigger this provision, provided appropriate open source decompression  *
+ * or de-archiving software is widely available for no charge.  For the    *
+ * purposes of this license, an installer is considered to include Covered *
+ * Software even if it actually retrieves a copy of Covered Software from  *
+ * another source during runtime (such as by downloading it from the       *
+ * Internet).                                                              *
+ *                                                                         *
+ * o Links (statically or dynamically) to a library which does any of the  *
+ * above.                                                                  *
+ *                                                                         *
+ * o Executes a helper program, module, or script to do any of the above.  *
+ *                                                                         *
+ * This list is not exclusive, but is meant to clarify our interpretation  *
+ * of derived works with some common examples.  Other people may interpret *
+ * the plain GPL differently, so we consider this a special exception to   *
+ * the GPL that we apply to Covered Software.  Works which meet any of     *
+ * these conditions must conform to all of the terms of this license,      *
+ * particularly including the GPL Section 3 requirements of providing      *
+ * source code and allowing free redistribution of the work as a whole.    *
+ *                                                                         *
+ * As another special exception to the GPL terms, the Nmap Project grants  *
+ * permission to link the code of this program with any version of the     *
+ * OpenSSL library which is distributed under a license identical to that  *
+ * listed in the included docs/licenses/OpenSSL.txt file, and distribute   *
+ * linked combinations including the two.                                  *
+ *                                                                         * 
+ * The Nmap Project has permission to redistribute Npcap, a packet         *
+ * capturing driver and library for the Microsoft Windows platform.        *
+ * Npcap is a separate work with it's own license rather than this Nmap    *
+ * license.  Since the Npcap license does not permit redistribution        *
+ * without special permission, our Nmap Windows binary packages which      *
+ * contain Npcap may not be redistributed without special permission.      *
+ *                                                                         *
+ * Any redistribution of Covered Software, including any derived works,    *
+ * must obey and carry forward all of the terms of this license, including *
+ * obeying all GPL rules and restrictions.  For example, source code of    *
+ * the whole work must be provided and free redistribution must be         *
+ * allowed.  All GPL references to "this License", are to be treated as    *
+ * including the terms and conditions of this license text as well.        *
+ *                                                                         *
+ * Because this license imposes special exceptions to the GPL, Covered     *
+ * Work may not be combined (even as part of a larger work) with plain GPL *
+ * software.  The terms, conditions, and exceptions of this license must   *
+ * be included as well.  This license is incompatible with some other open *
+ * source licenses as well.  In some cases we can relicense portions of    *
+ * Nmap or grant special permissions to use it in other open source        *
+ * software.  Please contact fyodor@nmap.org with any such requests.       *
+ * Similarly, we don't incorporate incompatible open source software into  *
+ * Covered Software without special permission from the copyright holders. *
+ *                                                                         *
+ * If you have any questions about the licensing restrictions on using     *
+ * Nmap in other works, are happy to help.  As mentioned above, we also    *
+ * offer alternative license to integrate Nmap into proprietary            *
+ * applications and appliances.  These contracts have been sold to dozens  *
+ * of software vendors, and generally include a perpetual license as well  *
+ * as providing for priority support and updates.  They also fund the      *
+ * continued development of Nmap.  Please email sales@nmap.com for further *
+ * information.                                                            *
+ *                                                                         *
+ * If you have received a written license agreement or contract for        *
+ * Covered Software stating terms other than these, you may choose to use  *
+ * and redistribute Covered Software under those terms instead of these.   *
+ *                                                                         *
+ * Source is provided to this software because we believe users have a     *
+ * right to know exactly what a program is going to do before they run it. *
+ * This also allows you to audit the software for security holes.          *
+ *                                                                         *
+ * Source code also allows you to port Nmap to new platforms, fix bugs,    *
+ * and add new features.  You are highly encouraged to send your changes   *
+ * to the dev@nmap.org mailing list for possible incorporation into the    *
+ * main distribution.  By sending these changes to Fyodor or one of the    *
+ * Insecure.Org development mailing lists, or checking them into the Nmap  *
+ * source code repository, it is understood (unless you specify            *
+ * otherwise) that you are offering the Nmap Project the unlimited,        *
+ * non-exclusive right to reuse, modify, and relicense the code.  Nmap     *
+ * will always be available Open Source, but this is important because     *
+ * the inability to relicense code has caused devastating problems for     *
+ * other Free Software projects (such as KDE and NASM).  We also           *
+ * occasionally relicense the code to third parties as discussed above.    *
+ * If you wish to specify special license conditions of your               *
+ * contributions, just say so when you send them.                          *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Nmap      *
+ * license file for more details (it's in a COPYING file included with     *
+ * Nmap, and also available from https://svn.nmap.org/nmap/COPYING)        *
+ *                                                                         *
+ ***************************************************************************/
+
+/* $Id$ */
+
+#include "telemetry.h"
+#include "NmapOps.h"
+#include "nmap_error.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string>
+#ifndef WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+extern NmapOps o;
+
+static int telemetry_fd = -1;
+static std::string record;
+static struct timeval next_record;
+static bool write_failed = false;
+/* The end of a record a socket took only part of, written before the next
+   one, and the number of records left out because the reader was slow. */
+static std::string pending;
+static unsigned long records_dropped = 0;
+
+/* How long telemetry_close waits for a slow reader to take the end of the
+   last record, in milliseconds */
+#define TELEMETRY_CLOSE_WAIT 500
+
+void telemetry_open(const char *dest) {
+  if (strncmp(dest, "unix:", 5) == 0) {
+#ifndef WIN32
+    struct sockaddr_un sun;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen(dest + 5) >= sizeof(sun.sun_path))
+      fatal("--telemetry socket path \"%s\" is too long", dest + 5);
+    Strncpy(sun.sun_path, dest + 5, sizeof(sun.sun_path));
+    telemetry_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (telemetry_fd == -1)
+      pfatal("Unable to create a socket for --telemetry");
+    if (connect(telemetry_fd, (struct sockaddr *) &sun, sizeof(sun)) == -1)
+      pfatal("Unable to connect to --telemetry socket %s", dest + 5);
+    unblock_socket(telemetry_fd);
+#else
+    fatal("--telemetry to a UNIX domain socket is not supported on Windows");
+#endif
+  } else {
+    telemetry_fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (telemetry_fd == -1)
+      pfatal("Unable to open --telemetry file %s", dest);
+  }
+  /* The first record is written as soon as a phase starts. */
+  memset(&next_record, 0, sizeof(next_record));
+}
+
+/* Writes as much of data as the descriptor takes and removes it from data.
+   Returns false on an error other than the socket being full. */
+static bool telemetry_write(std::string &data) {
+  ssize_t n;
+
+  n = write(telemetry_fd, data.data(), data.size());
+  if (n == -1)
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  data.erase(0, n);
+  return true;
+}
+
+/* Waits up to TELEMETRY_CLOSE_WAIT milliseconds for the reader to take the
+   end of the last record, so it does not see half a record. A reader that is
+   stuck must not keep Nmap from exiting, so after that the end is dropped and
+   counted with the dropped records. */
+static void telemetry_flush(void) {
+  struct timeval deadline, now, tv;
+  long usec;
+  fd_set fds;
+
+  gettimeofday(&now, NULL);
+  TIMEVAL_MSEC_ADD(deadline, now, TELEMETRY_CLOSE_WAIT);
+  while (!pending.empty() && telemetry_write(pending) && !pending.empty()) {
+    gettimeofday(&now, NULL);
+    usec = TIMEVAL_SUBTRACT(deadline, now);
+    if (usec <= 0)
+      break;
+    tv.tv_sec = usec / 1000000;
+    tv.tv_usec = usec % 1000000;
+    FD_ZERO(&fds);
+    checked_fd_set(telemetry_fd, &fds);
+    if (select(telemetry_fd + 1, NULL, &fds, NULL, &tv) == -1 && socket_errno() != EINTR)
+      break;
+  }
+  if (!pending.empty()) {
+    records_dropped++;
+    pending.clear();
+  }
+}
+
+void telemetry_close(void) {
+  if (telemetry_fd != -1) {
+    if (!pending.empty())
+      telemetry_flush();
+    close(telemetry_fd);
+  }
+  telemetry_fd = -1;
+  if (records_dropped > 0) {
+    error("Warning: %lu telemetry records were dropped because the reader was not keeping up", records_dropped);
+    records_dropped = 0;
+  }
+}
+
+bool telemetry_due(const struct timeval *now) {
+  return telemetry_fd != -1 && !TIMEVAL_BEFORE(*now, next_record);
+}
+
+void telemetry_cap_wait(struct timeval *until) {
+  if (telemetry_fd != -1 && TIMEVAL_BEFORE(next_record, *until))
+    *until = next_record;
+}
+
+void telemetry_start(const char *phase, const struct timeval *now) {
+  char buf[64];
+
+  Snprintf(buf, sizeof(buf), "{\"t\":%.3f,\"phase\":\"", o.TimeSinceStart(now));
+  record = buf;
+  /* Phase names are fixed strings, but keep the line valid JSON anyway. */
+  for (; *phase != '\0'; phase++) {
+    if (*phase == '"' || *phase == '\\')
+      record += '\\';
+    record += *phase;
+  }
+  record += '"';
+  TIMEVAL_ADD(next_record, *now, (long) (o.telemetry_interval * 1000000));
+}
+
+void telemetry_int(const char *key, long long value) {
+  char buf[64];
+
+  Snprintf(buf, sizeof(buf), ",\"%s\":%lld", key, value);
+  record += buf;
+}
+
+void telemetry_float(const char *key, double value) {
+  char buf[64];
+
+  Snprintf(buf, sizeof(buf), ",\"%s\":%.6g", key, value);
+  record += buf;
+}
+
+void telemetry_end(void) {
+  size_t size;
+
+  if (telemetry_fd == -1)
+    return;
+  if (records_dropped > 0)
+    telemetry_int("records_dropped", records_dropped);
+  record += "}\n";
+  /* The socket does not block, so a slow reader does not slow the scan. If
+     it is full, the rest of a record it took only in part is sent before the
+     next one, and a record it takes none of is dropped, so the reader never
+     sees half a record. A reader that went away only ends the stream. */
+  if (!pending.empty() && !telemetry_write(pending))
+    goto fail;
+  if (!pending.empty()) {
+    records_dropped++;
+    return;
+  }
+  size = record.size();
+  if (!telemetry_write(record))
+    goto fail;
+  if (record.size() == size)
+    records_dropped++;
+  else
+    pending = record;
+  return;
+
+fail:
+  if (!write_failed) {
+    write_failed = true;
+    error("Warning: Unable to write telemetry (%s); no more will be written", strerror(errno));
+    telemetry_close();
+  }
+}
@@ -0,0 +1,46 @@
+#!/bin/sh
+
+# Measures the scan engine against a simulated network (--netsim), so that no
+# root privileges, raw sockets or real hosts are needed. Runs a SYN, UDP,
+# connect and ping scan of the same network and prints the completion time,
+# the rate at which probes were sent, and the CPU time Nmap spent on each
+# probe. Any arguments are passed on to every scan, for example to compare
+# --congestion-control bbr with the default.
+#
+# Usage: ./tests/bench-scan.sh [nmap options]
+
+NMAP=${NMAP:-./nmap}
+DATADIR=${DATADIR:-.}
+TARGETS=${TARGETS:-10.0.0.0/24}
+NETSIM=${NETSIM:-"net=10.0.0.0/24;hosts=20;open=22,25,80,443,3306;filtered=135-139,445;udp-open=53,123,161;rtt=2-40;jitter=2;loss=0.5;icmp-rate=100;rst-rate=500;seed=1"}
+
+STATUS=0
+
+# Runs one scan and prints a line of results after the label in the first
+# argument.
+bench() {
+	label=$1
+	shift
+	$NMAP --datadir "$DATADIR" --netsim "$NETSIM" "$@" $TARGETS 2>&1 |
+		awk -v label="$label" '
+			/^Simulated network: .* packets sent/ { sent = $3; rcvd = $6 }
+			/^Simulated network: .*packets\/s/ { secs = $3; rate = $4; cpu = $6 }
+			/^QUITTING!/ { failed = 1 }
+			END {
+				if (failed || secs == "") {
+					printf "%-16s failed\n", label
+					exit 1
+				}
+				sub(/s,$/, "", secs)
+				sub(/us$/, "", cpu)
+				printf "%-16s %9.2f s %9d %9d %11d %9.1f us\n", label, secs, sent, rcvd, rate, cpu
+			}' || STATUS=1
+}
+
+printf "%-16s %11s %9s %9s %11s %12s\n" "scan" "time" "sent" "rcvd" "packets/s" "CPU/probe"
+bench "SYN scan" -sS -p1-1000 "$@"
+bench "UDP scan" -sU -p1-200 "$@"
+bench "connect scan" -sT -p1-1000 "$@"
+bench "ping scan" -sn "$@"
+
+exit $STATUS
@@ -0,0 +1,47 @@
+#!/bin/sh
+
+# Checks that --script-workers does not change the results of a script scan.
+# Runs tests/script-workers.nse against loopback addresses without workers
+# and with 2 and 3 workers, and compares the normal output of the runs. No
+# packets are sent, since host discovery and the port scan are skipped.
+#
+# Usage: ./tests/check-script-workers.sh
+
+NMAP=${NMAP:-./nmap}
+DATADIR=${DATADIR:-.}
+TARGETS=${TARGETS:-127.0.0.1-8}
+
+TMPDIR=${TMPDIR:-/tmp}
+BASE=$TMPDIR/check-script-workers.$$
+trap 'rm -f "$BASE".*' 0
+
+STATUS=0
+
+# Runs the script scan with any further arguments and writes its normal
+# output, without the lines that hold times, to the file in the first
+# argument.
+scan() {
+	out=$1
+	shift
+	$NMAP --datadir "$DATADIR" -n -sn -Pn --script "$DATADIR/tests/script-workers.nse" \
+		"$@" -oN - $TARGETS 2>&1 | grep -v -e '^#' -e '^Nmap done' > "$out"
+}
+
+scan "$BASE.0"
+if ! grep -q '^|_  sum:' "$BASE.0"; then
+	echo "no script output without workers:"
+	cat "$BASE.0"
+	exit 1
+fi
+
+for workers in 2 3; do
+	scan "$BASE.$workers" --script-workers $workers
+	if diff -u "$BASE.0" "$BASE.$workers"; then
+		echo "--script-workers $workers: ok"
+	else
+		echo "--script-workers $workers: output differs"
+		STATUS=1
+	fi
+done
+
+exit $STATUS
@@ -0,0 +1,510 @@
+/***************************************************************************
+ * congestion_sim.cc -- Compares the ultra_scan congestion control         *
+ * algorithms on simulated network paths.                                  *
+ *                                                                         *
+ ***********************IMPORTANT NMAP LICENSE TERMS************************
+ *                                                                         *
+ * The Nmap Security Scanner is (C) 1996-2016 Insecure.Com LLC ("The Nmap  *
+ * Project"). Nmap is also a registered trademark of the Nmap Project.     *
+ * This program is free software; you may redistribute and/or modify it    *
+ * under the terms of the GNU General Public License as published by the   *
+ * Free Software Foundation; Version 2 ("GPL"), BUT ONLY WITH ALL OF THE   *
+ * CLARIFICATIONS AND EXCEPTIONS DESCRIBED HEREIN.  This guarantees your   *
+ * right to use, modify, and redistribute this software under certain      *
+ * conditions.  If you wish to embed Nmap technology into proprietary      *
+ * software, we sell alternative licenses (contact sales@nmap.com).        *
+ * Dozens of software vendors already license Nmap technology such as      *
+ * host discovery, port scanning, OS detection, version detection, and     *
+ * the Nmap Scripting Engine.                                              *
+ *                                                                         *
+ * Note that the GPL places important restrictions on "derivative works",  *
+ * yet it does not provide a detailed definition of that term.  To avoid   *
+ * misunderstandings, we interpret that term as broadly as copyright law   *
+ * allows.  For example, we consider an application to constitute a        *
+ * derivative work for the purpose of this license if it does any of the   *
+ * following with any software or content covered by this license          *
+ * ("Covered Software"):                                                   *
+ *                                                                         *
+ * o Integrates source code from Covered Software.                         *
+ *                                                                         *
+ * o Reads or includes copyrighted data files, such as Nmap's nmap-os-db   *
+ * or nmap-service-probes.                                                 *
+ *                                                                         *
+ * o Is designed specifically to execute Covered Software and parse the    *
+ * results (as opposed to typical shell or execution-menu apps, which will *
+ * execute anything you tell them to).                                     *
+ *                                                                         *
+ * o Includes Covered Software in a proprietary executable installer.  The *
+ * installers produced by InstallShield are an example of this.  Including *
+ * Nmap with other software in compressed or archival form does not        *
+ * trigger this provision, provided appropriate open source decompression  *
+ * or de-archiving software is widely available for no charge.  For the    *
+ * purposes of this license, an installer is considered to include Covered *
+ * Software even if it actually retrieves a copy of Covered Software from  *
+ * another source during runtime (such as by downloading it from the       *
+ * Internet).                                                              *
+ *                                                                         *
+ * o Links (statically or dynamically) to a library which does any of the  *
+ * above.                                                                  *
+ *                                                                         *
+ * o Executes a helper program, module, or script to do any of the above.  *
+ *                                                                         *
+ * This list is not exclusive, but is meant to clarify our interpretation  *
+ * of derived works with some common examples.  Other people may interpret *
+ * the plain GPL differently, so we consider this a special exception to   *
+ * the GPL that we apply to Covered Software.  Works which meet any of     *
+ * these conditions must conform to all of the terms of this license,      *
+ * particularly including the GPL Section 3 requirements of providing      *
+ * source code and allowing free redistribution of the work as a whole.    *
+ *                                                                         *
+ * As another special exception to the GPL terms, the Nmap Project grants  *
+ * permission to link the code of this program with any version of the     *
+ * OpenSSL library which is distributed under a license identical to that  *
+ * listed in the included docs/licenses/OpenSSL.txt file, and distribute   *
+ * linked combinations including the two.                                  *
+ *                                                                         * 
+ * The Nmap Project has permission to redistribute Npcap, a packet         *
+ * capturing driver and library for the Microsoft Windows platform.        *
+ * Npcap is a separate work with it's own license rather than this Nmap    *
+ * license.  Since the Npcap license does not permit redistribution        *
+ * without special permission, our Nmap Windows binary packages which      *
+ * contain Npcap may not be redistributed without special permission.      *
+ *                                                                         *
+ * Any redistribution of Covered Software, including any derived works,    *
+ * must obey and carry forward all of the terms of this license, including *
+ * obeying all GPL rules and restrictions.  For example, source code of    *
+ * the whole work must be provided and free redistribution must be         *
+ * allowed.  All GPL references to "this License", are to be treated as    *
+ * including the terms and conditions of this license text as well.        *
+ *                                                                         *
+ * Because this license imposes special exceptions to the GPL, Covered     *
+ * Work may not be combined (even as part of a larger work) with plain GPL *
+ * software.  The terms, conditions, and exceptions of this license must   *
+ * be included as well.  This license is incompatible with some other open *
+ * source licenses as well.  In some cases we can relicense portions of    *
+ * Nmap or grant special permissions to use it in other open source        *
+ * software.  Please contact fyodor@nmap.org with any such requests.       *
+ * Similarly, we don't incorporate incompatible open source software into  *
+ * Covered Software without special permission from the copyright holders. *
+ *                                                                         *
+ * If you have any questions about the licensing restrictions on using     *
+ * Nmap in other works, are happy to help.  As mentioned above, we also    *
+ * offer alternative license to integrate Nmap into proprietary            *
+ * applications and appliances.  These contracts have been sold to dozens  *
+ * of software vendors, and generally include a perpetual license as well  *
+ * as providing for priority support and updates.  They also fund the      *
+ * continued development of Nmap.  Please email sales@nmap.com for further *
+ * information.                                                            *
+ *                                                                         *
+ * If you have received a written license agreement or contract for        *
+ * Covered Software stating terms other than these, you may choose to use  *
+ * and redistribute Covered Software under those terms instead of these.   *
+ *                                                                         *
+ * Source is provided to this software because we believe users have a     *
+ * right to know exactly what a program is going to do before they run it. *
+ * This also allows you to audit the software for security holes.          *
+ *                                                                         *
+ * Source code also allows you to port Nmap to new platforms, fix bugs,    *
+ * and add new features.  You are highly encouraged to send your changes   *
+ * to the dev@nmap.org mailing list for possible incorporation into the    *
+ * main distribution.  By sending these changes to Fyodor or one of the    *
+ * Insecure.Org development mailing lists, or checking them into the Nmap  *
+ * source code repository, it is understood (unless you specify            *
+ * otherwise) that you are offering the Nmap Project the unlimited,        *
+ * non-exclusive right to reuse, modify, and relicense the code.  Nmap     *
+ * will always be available Open Source, but this is important because     *
+ * the inability to relicense code has caused devastating problems for     *
+ * other Free Software projects (such as KDE and NASM).  We also           *
+ * occasionally relicense the code to third parties as discussed above.    *
+ * If you wish to specify special license conditions of your               *
+ * contributions, just say so when you send them.                          *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful, but     *
+ * WITHOUT ANY WARRANTY; without even the implied warranty of              *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the Nmap      *
+ * license file for more details (it's in a COPYING file included with     *
+ * Nmap, and also available from https://svn.nmap.org/nmap/COPYING)        *
+ *                                                                         *
+ ***************************************************************************/
+
+/* Runs a simulated port scan of one host through each congestion control
+   algorithm and prints how long it took. The path to the host is a
+   bottleneck that forwards a number of probes per second, with a FIFO queue
+   in front of it, a base rtt, random jitter and random loss. Its conditions
+   may change over time. Probes are retransmitted after a timeout. As in
+   ultra_scan, a reply is matched to the try it answers: a late reply to the
+   first try still gives an rtt and a timeout sample, and only a reply to a
+   retransmission counts as a drop. Scan delays and rate limit detection are
+   left out.
+
+   Everything is driven by a simulated clock and a seeded random number
+   generator, so a run always gives the same results. After the results, a
+   summary gives the time each algorithm took on each path against reno, and
+   what it cost in retransmissions.
+
+   Usage: tests/congestion_sim [-n probes] [-s seed] [scenario|tracefile]...
+
+   The built-in scenarios are listed by -h. A trace file has one line per
+   change of the path, holding the time it starts at (seconds), the
+   bottleneck rate (probes per second), the rtt and jitter (milliseconds), the
+   loss (percent) and the queue size (probes). Lines starting with # are
+   ignored. */
+
+#include "../nmap.h"
+#include "../NmapOps.h"
+#include "../timing.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+extern NmapOps o;
+
+struct path_phase {
+  double start; /* seconds */
+  double rate; /* probes per second */
+  double rtt, jitter; /* milliseconds */
+  double loss; /* percent */
+  int queue; /* probes */
+};
+
+struct scenario {
+  const char *name;
+  const char *description;
+  struct path_phase phases[2];
+  int numphases;
+};
+
+static const struct scenario scenarios[] = {
+  { "lan", "fast local network",
+    { { 0, 20000, 0.5, 0.1, 0, 1000 } }, 1 },
+  { "wan", "long fat path, about 200 probes in flight",
+    { { 0, 2000, 100, 5, 0, 100 } }, 1 },
+  { "lossy", "long fat path with 2% random loss",
+    { { 0, 2000, 100, 5, 2, 100 } }, 1 },
+  { "ratelimit", "host answering 100 probes per second",
+    { { 0, 100, 20, 2, 0, 10 } }, 1 },
+  { "shift", "path that slows down after 5 seconds",
+    { { 0, 2000, 50, 5, 0, 100 }, { 5, 500, 150, 10, 0, 100 } }, 2 },
+};
+
+#define NUM_SCENARIOS (sizeof(scenarios) / sizeof(*scenarios))
+
+/* Simulated runs are given up after this many seconds. */
+#define MAX_SIM_TIME 3600
+
+struct sim_probe {
+  int tryno;
+  bool waiting; /* Timed out and waiting to be retransmitted */
+  bool done;
+};
+
+enum sim_event_type { SIM_REPLY, SIM_TIMEOUT };
+
+struct sim_event {
+  enum sim_event_type type;
+  int probe;
+  int tryno;
+  long long sent; /* microseconds, when this try was sent */
+};
+
+struct sim_result {
+  double time; /* seconds */
+  int sent, retransmitted, lost;
+  double cwnd;
+  char state[128];
+};
+
+static unsigned long long rng_state;
+
+/* xorshift64*, returning a number in [0, 1) */
+static double sim_random() {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return ((rng_state * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+static void usec2tv(long long usec, struct timeval *tv) {
+  tv->tv_sec = usec / 1000000;
+  tv->tv_usec = usec % 1000000;
+}
+
+static const struct path_phase *phase_at(const std::vector<struct path_phase> &path, long long now) {
+  const struct path_phase *phase = &path[0];
+  unsigned int i;
+
+  for (i = 1; i < path.size() && path[i].start * 1000000 <= now; i++)
+    phase = &path[i];
+  return phase;
+}
+
+static void simulate(const std::vector<struct path_phase> &path, int numprobes,
+                     unsigned long long seed, struct sim_result *res) {
+  struct scan_performance_vars perf;
+  struct ultra_timing_vals host, group;
+  struct timeout_info to;
+  std::vector<struct sim_probe> probes(numprobes);
+  std::deque<int> retry;
+  std::multimap<long long, struct sim_event> events;
+  long long now = 0, link_free = 0;
+  int next = 0, active = 0, finished = 0;
+  unsigned int maxtries = o.getMaxRetransmissions();
+  struct timeval tv;
+
+  rng_state = seed;
+  memset(res, 0, sizeof(*res));
+  perf.init();
+  initialize_timeout_info(&to);
+  memset(&host, 0, sizeof(host));
+  memset(&group, 0, sizeof(group));
+  host.cwnd = perf.host_initial_cwnd;
+  group.cwnd = perf.group_initial_cwnd;
+  host.ssthresh = group.ssthresh = perf.initial_ssthresh;
+  usec2tv(now, &tv);
+  host.last_drop = group.last_drop = tv;
+  host.init(&perf, &tv);
+  group.init(&perf, &tv);
+
+  while (finished < numprobes && now < (long long) MAX_SIM_TIME * 1000000) {
+    /* Send everything the windows allow. */
+    while (host.cwnd >= active + 0.5 && group.cwnd >= active + 0.5
+           && (!retry.empty() || next < numprobes)) {
+      const struct path_phase *phase = phase_at(path, now);
+      struct sim_event ev;
+      double queued;
+      int id;
+
+      if (!retry.empty()) {
+        id = retry.front();
+        retry.pop_front();
+        probes[id].tryno++;
+        probes[id].waiting = false;
+        res->retransmitted++;
+      } else {
+        id = next++;
+      }
+      res->sent++;
+      active++;
+      ev.probe = id;
+      ev.tryno = probes[id].tryno;
+      ev.sent = now;
+      ev.type = SIM_TIMEOUT;
+      events.insert(std::make_pair(now + to.timeout, ev));
+
+      /* The bottleneck drops probes that find its queue full. */
+      link_free = MAX(link_free, now);
+      queued = (link_free - now) * phase->rate / 1000000;
+      if (queued >= phase->queue)
+        continue;
+      link_free += (long long) (1000000 / phase->rate);
+      if (sim_random() * 100 < phase->loss)
+        continue;
+      ev.type = SIM_REPLY;
+      events.insert(std::make_pair(link_free + (long long) ((phase->rtt + sim_random() * phase->jitter) * 1000), ev));
+    }
+
+    if (events.empty())
+      break;
+    now = events.begin()->first;
+    struct sim_event ev = events.begin()->second;
+    events.erase(events.begin());
+    struct sim_probe *probe = &probes[ev.probe];
+    struct timeval sent;
+
+    usec2tv(now, &tv);
+    usec2tv(ev.sent, &sent);
+    if (ev.type == SIM_REPLY) {
+      if (probe->done)
+        continue;
+      probe->done = true;
+      finished++;
+      /* A late reply may come after the probe timed out. */
+      if (probe->waiting)
+        retry.erase(std::find(retry.begin(), retry.end(), ev.probe));
+      else
+        active--;
+      host.num_replies_expected++;
+      group.num_replies_expected++;
+      host.num_updates++;
+      group.num_updates++;
+      if (ev.tryno > 0) {
+        if (TIMEVAL_AFTER(sent, host.last_drop))
+          host.drop(active, &perf, &tv);
+        if (TIMEVAL_AFTER(sent, group.last_drop))
+          group.drop_group(active, &perf, &tv);
+      }
+      long rtt = ev.tryno == 0 ? now - ev.sent : -1;
+      group.ack(&perf, 1, &tv, rtt);
+      host.ack(&perf, 1, &tv, rtt);
+      adjust_timeouts2(&sent, &tv, &to);
+    } else {
+      if (probe->done || ev.tryno != probe->tryno)
+        continue;
+      active--;
+      host.num_replies_expected++;
+      group.num_replies_expected++;
+      if ((unsigned int) probe->tryno < maxtries) {
+        probe->waiting = true;
+        retry.push_back(ev.probe);
+      } else {
+        probe->done = true;
+        finished++;
+        res->lost++;
+      }
+    }
+  }
+
+  res->time = now / 1000000.0;
+  res->cwnd = host.cwnd;
+  host.describe(&perf, res->state, sizeof(res->state));
+}
+
+/* Reads a trace file into path. Returns false on error. */
+static bool read_trace(const char *filename, std::vector<struct path_phase> &path) {
+  struct path_phase phase;
+  char line[256];
+  FILE *fp;
+  int lineno = 0;
+
+  fp = fopen(filename, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "Unable to open %s: %s\n", filename, strerror(errno));
+    return false;
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+    if (sscanf(line, "%lf %lf %lf %lf %lf %d", &phase.start, &phase.rate,
+               &phase.rtt, &phase.jitter, &phase.loss, &phase.queue) != 6
+        || phase.rate <= 0 || phase.queue < 1
+        || (!path.empty() && phase.start < path.back().start)) {
+      fprintf(stderr, "%s:%d: bad trace line\n", filename, lineno);
+      fclose(fp);
+      return false;
+    }
+    path.push_back(phase);
+  }
+  fclose(fp);
+  if (path.empty()) {
+    fprintf(stderr, "%s: empty trace\n", filename);
+    return false;
+  }
+  return true;
+}
+
+static void usage() {
+  unsigned int i;
+
+  printf("Usage: congestion_sim [-n probes] [-s seed] [scenario|tracefile]...\n"
+         "Algorithms: %s\n"
+         "Scenarios:\n", congestion_control_names());
+  for (i = 0; i < NUM_SCENARIOS; i++)
+    printf("  %-10s %s\n", scenarios[i].name, scenarios[i].description);
+}
+
+static const char *algorithms[] = { "reno", "bbr" };
+
+#define NUM_ALGORITHMS (sizeof(algorithms) / sizeof(*algorithms))
+
+/* What each scenario cost with each algorithm, for the summary */
+struct sim_summary {
+  std::string name;
+  struct sim_result res[NUM_ALGORITHMS];
+};
+
+static std::vector<struct sim_summary> summaries;
+
+static void run(const char *name, const std::vector<struct path_phase> &path,
+                int numprobes, unsigned long long seed) {
+  struct sim_summary summary;
+  struct sim_result *res;
+  unsigned int i;
+
+  summary.name = name;
+  for (i = 0; i < NUM_ALGORITHMS; i++) {
+    res = &summary.res[i];
+    o.congestion_control = congestion_control_by_name(algorithms[i]);
+    simulate(path, numprobes, seed, res);
+    printf("%-10s %-5s %9.2f %7d %7d %5d %7.1f  %s\n", name, algorithms[i],
+           res->time, res->sent, res->retransmitted, res->lost, res->cwnd,
+           res->state);
+  }
+  summaries.push_back(summary);
+}
+
+/* Prints how each algorithm did against the first one: the time taken, and
+   the retransmissions it cost, as a share of the probes sent. */
+static void print_summary() {
+  unsigned int i, j;
+
+  printf("\nAgainst %s:\n", algorithms[0]);
+  for (i = 0; i < summaries.size(); i++) {
+    const struct sim_result *base = &summaries[i].res[0];
+
+    for (j = 1; j < NUM_ALGORITHMS; j++) {
+      const struct sim_result *res = &summaries[i].res[j];
+
+      printf("%-10s %-5s %5.2fx the time, %d retransmissions (%.1f%% of probes sent) against %d (%.1f%%)\n",
+             summaries[i].name.c_str(), algorithms[j], res->time / base->time,
+             res->retransmitted, 100.0 * res->retransmitted / res->sent,
+             base->retransmitted, 100.0 * base->retransmitted / base->sent);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<struct path_phase> path;
+  unsigned long long seed = 1;
+  int numprobes = 10000;
+  unsigned int i;
+  int c;
+
+  while ((c = getopt(argc, argv, "hn:s:")) != -1) {
+    switch (c) {
+    case 'n':
+      numprobes = atoi(optarg);
+      if (numprobes < 1) {
+        fprintf(stderr, "Bogus -n argument\n");
+        return 1;
+      }
+      break;
+    case 's':
+      seed = strtoull(optarg, NULL, 10);
+      if (seed == 0)
+        seed = 1;
+      break;
+    default:
+      usage();
+      return c == 'h' ? 0 : 1;
+    }
+  }
+
+  printf("%-10s %-5s %9s %7s %7s %5s %7s  %s\n", "scenario", "cc", "time (s)",
+         "sent", "retrans", "lost", "cwnd", "final state");
+  if (optind == argc) {
+    for (i = 0; i < NUM_SCENARIOS; i++) {
+      path.assign(scenarios[i].phases, scenarios[i].phases + scenarios[i].numphases);
+      run(scenarios[i].name, path, numprobes, seed);
+    }
+    print_summary();
+    return 0;
+  }
+  for (; optind < argc; optind++) {
+    path.clear();
+    for (i = 0; i < NUM_SCENARIOS; i++) {
+      if (strcmp(argv[optind], scenarios[i].name) == 0) {
+        path.assign(scenarios[i].phases, scenarios[i].phases + scenarios[i].numphases);
+        break;
+      }
+    }
+    if (path.empty() && !read_trace(argv[optind], path))
+      return 1;
+    run(argv[optind], path, numprobes, seed);
+  }
+  print_summary();
+  return 0;
+}
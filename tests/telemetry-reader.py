@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+
+# Prints the records of Nmap's --telemetry stream as they arrive, one line per
+# record. The stream can be read from a file that Nmap is writing, or this
+# script can listen on a UNIX domain socket for Nmap to connect to:
+#
+#   ./telemetry-reader.py -f scan.jsonl      # nmap --telemetry scan.jsonl ...
+#   ./telemetry-reader.py unix:/tmp/nmap.sock  # nmap --telemetry unix:/tmp/nmap.sock ...
+#
+# With -j, the records are printed as they are, for piping into other tools.
+
+import json
+import os
+import socket
+import sys
+import time
+
+
+def follow(f):
+    """Yields the lines of a file, waiting for more at its end."""
+    while True:
+        line = f.readline()
+        if line.endswith("\n"):
+            yield line
+        elif line:
+            # Nmap writes each record at once, but a read may catch it
+            # half-written.
+            time.sleep(0.1)
+            f.seek(f.tell() - len(line))
+        else:
+            time.sleep(0.5)
+
+
+def listen(path):
+    """Yields the lines sent by the first Nmap to connect to a socket."""
+    if os.path.exists(path):
+        os.unlink(path)
+    s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    s.bind(path)
+    s.listen(1)
+    try:
+        conn, _ = s.accept()
+        for line in conn.makefile("r"):
+            yield line
+    finally:
+        s.close()
+        os.unlink(path)
+
+
+def show(record):
+    fields = " ".join("%s=%s" % (k, v) for k, v in record.items()
+                      if k not in ("t", "phase", "done"))
+    done = record.get("done")
+    if done is not None:
+        done = "%5.1f%%" % (done * 100)
+    else:
+        done = ""
+    print("%8.2fs %-24s %6s %s" % (record["t"], record["phase"], done, fields))
+
+
+def main(args):
+    raw = False
+    tail = False
+    while args and args[0].startswith("-"):
+        if args[0] == "-j":
+            raw = True
+        elif args[0] == "-f":
+            tail = True
+        else:
+            break
+        args = args[1:]
+    if len(args) != 1:
+        sys.stderr.write("Usage: %s [-j] [-f] <file|unix:path>\n" % sys.argv[0])
+        return 2
+
+    if args[0].startswith("unix:"):
+        lines = listen(args[0][5:])
+    elif tail:
+        lines = follow(open(args[0]))
+    else:
+        lines = open(args[0])
+
+    try:
+        for line in lines:
+            if raw:
+                sys.stdout.write(line)
+            else:
+                show(json.loads(line))
+            sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
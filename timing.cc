@@ -137,8 +137,11 @@
 #include "utils.h"
 #include "xml.h"
 
+#include <errno.h>
 #include <math.h>
 #include <limits>
+#include <map>
+#include <string>
 
 extern NmapOps o;
 
@@ -273,6 +276,170 @@ void enforce_scan_delay(struct timeval *tv) {
   return;
 }
 
+/* Timing profiles older than this are forgotten, and the weight of the others
+   is halved every TIMING_CACHE_HALF_LIFE seconds. */
+#define TIMING_CACHE_MAX_AGE (30 * 24 * 60 * 60)
+#define TIMING_CACHE_HALF_LIFE (7 * 24 * 60 * 60)
+
+struct timing_cache_entry {
+  struct timing_profile tp;
+  time_t updated; /* When the profile was last learned */
+  /* How many hosts have been recorded into the profile in this run. Zero for
+     a profile that was only loaded. */
+  unsigned int samples;
+};
+
+static std::map<std::string, struct timing_cache_entry> timing_cache;
+
+/* Returns the network of ss and the protocol in a form like
+   "192.168.0.0/24 tcp", or an empty string if the address family is not
+   supported. Profiles are kept apart by protocol because their timing
+   differs: a UDP scan is slowed by ICMP rate limits that a TCP scan of the
+   same hosts never meets. */
+static std::string timing_cache_key(const struct sockaddr_storage *ss,
+                                    const char *proto) {
+  struct sockaddr_storage net;
+  char buf[INET6_ADDRSTRLEN + 16];
+  int bits;
+
+  memcpy(&net, ss, sizeof(net));
+  if (net.ss_family == AF_INET) {
+    struct sockaddr_in *sin = (struct sockaddr_in *) &net;
+    sin->sin_addr.s_addr &= htonl(0xffffff00);
+    bits = 24;
+#if HAVE_IPV6
+  } else if (net.ss_family == AF_INET6) {
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &net;
+    memset(sin6->sin6_addr.s6_addr + 8, 0, 8);
+    bits = 64;
+#endif
+  } else {
+    return std::string();
+  }
+  Snprintf(buf, sizeof(buf), "%s/%d %s", inet_ntop_ez(&net, sizeof(net)), bits, proto);
+  return buf;
+}
+
+/* Reads the profiles in filename, if it exists, forgetting those that are
+   too old to be of use. */
+void timing_cache_load(const char *filename) {
+  struct timing_cache_entry e;
+  char line[256], net[64], proto[8];
+  time_t now = time(NULL);
+  int lineno = 0;
+  long updated;
+  FILE *fp;
+
+  fp = fopen(filename, "r");
+  if (fp == NULL) {
+    if (errno != ENOENT)
+      error("Warning: Unable to open timing cache %s for reading: %s", filename, strerror(errno));
+    return;
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+    memset(&e, 0, sizeof(e));
+    if (sscanf(line, "%63s %7s %ld %d %d %lf %d %lf %u %u %u", net, proto,
+               &updated, &e.tp.srtt, &e.tp.rttvar, &e.tp.cwnd,
+               &e.tp.ssthresh, &e.tp.group_cwnd, &e.tp.delayms,
+               &e.tp.max_successful_tryno, &e.tp.max_tryno_sent) != 11
+        || e.tp.srtt <= 0 || e.tp.rttvar < 0 || e.tp.cwnd < 1
+        || e.tp.ssthresh < 1 || e.tp.group_cwnd < 1) {
+      error("Warning: Ignoring malformed line %d of timing cache %s", lineno, filename);
+      continue;
+    }
+    e.updated = (time_t) updated;
+    if (difftime(now, e.updated) > TIMING_CACHE_MAX_AGE)
+      continue;
+    timing_cache[std::string(net) + " " + proto] = e;
+  }
+  fclose(fp);
+
+  if (o.debugging)
+    log_write(LOG_PLAIN, "Loaded %u timing profiles from %s\n",
+              (unsigned int) timing_cache.size(), filename);
+}
+
+/* Writes the profiles loaded and learned in this run to filename. */
+void timing_cache_save(const char *filename) {
+  std::map<std::string, struct timing_cache_entry>::const_iterator it;
+  FILE *fp;
+
+  fp = fopen(filename, "w");
+  if (fp == NULL) {
+    error("Warning: Unable to open timing cache %s for writing: %s", filename, strerror(errno));
+    return;
+  }
+  fprintf(fp, "# Nmap timing cache. Each line holds a network, a protocol, the time it\n"
+              "# was last scanned, srtt, rttvar, cwnd, ssthresh, group cwnd, scan delay,\n"
+              "# max successful tryno and max tryno sent.\n");
+  for (it = timing_cache.begin(); it != timing_cache.end(); it++) {
+    const struct timing_profile *tp = &it->second.tp;
+    fprintf(fp, "%s %ld %d %d %.2f %d %.2f %u %u %u\n", it->first.c_str(),
+            (long) it->second.updated, tp->srtt, tp->rttvar, tp->cwnd,
+            tp->ssthresh, tp->group_cwnd, tp->delayms,
+            tp->max_successful_tryno, tp->max_tryno_sent);
+  }
+  if (fclose(fp) != 0)
+    error("Warning: Unable to write timing cache %s: %s", filename, strerror(errno));
+}
+
+/* Fills in tp with the profile of the network of ss for scans of protocol
+   proto and returns true, or returns false if there isn't one. */
+bool timing_cache_lookup(const struct sockaddr_storage *ss, const char *proto,
+                         struct timing_profile *tp) {
+  std::map<std::string, struct timing_cache_entry>::const_iterator it;
+  double age;
+
+  if (timing_cache.empty())
+    return false;
+  it = timing_cache.find(timing_cache_key(ss, proto));
+  if (it == timing_cache.end())
+    return false;
+
+  *tp = it->second.tp;
+  if (it->second.samples > 0) {
+    tp->weight = 1.0;
+  } else {
+    age = MAX(difftime(time(NULL), it->second.updated), 0.0);
+    tp->weight = pow(0.5, age / TIMING_CACHE_HALF_LIFE);
+  }
+  return true;
+}
+
+/* Records what was learned about a host in a scan of protocol proto in this
+   run into the profile of its network. The weight of tp is ignored. */
+void timing_cache_record(const struct sockaddr_storage *ss, const char *proto,
+                         const struct timing_profile *tp) {
+  std::string key = timing_cache_key(ss, proto);
+  unsigned int n;
+
+  if (key.empty())
+    return;
+  struct timing_cache_entry &e = timing_cache[key];
+  e.updated = time(NULL);
+  /* A profile from an earlier run is replaced, not averaged into. */
+  if (e.samples == 0) {
+    e.tp = *tp;
+    e.samples = 1;
+    return;
+  }
+
+  n = ++e.samples;
+  e.tp.srtt += (tp->srtt - e.tp.srtt) / (int) n;
+  e.tp.rttvar += (tp->rttvar - e.tp.rttvar) / (int) n;
+  e.tp.cwnd += (tp->cwnd - e.tp.cwnd) / n;
+  e.tp.ssthresh += (tp->ssthresh - e.tp.ssthresh) / (int) n;
+  e.tp.group_cwnd += (tp->group_cwnd - e.tp.group_cwnd) / n;
+  /* The delay is averaged too, so that one rate limited host doesn't slow
+     down every other host on its network in the next scan. */
+  e.tp.delayms = (unsigned int) (e.tp.delayms + ((double) tp->delayms - e.tp.delayms) / n + 0.5);
+  e.tp.max_successful_tryno = MAX(e.tp.max_successful_tryno, tp->max_successful_tryno);
+  e.tp.max_tryno_sent = MAX(e.tp.max_tryno_sent, tp->max_tryno_sent);
+}
+
 
 /* Returns the scaling factor to use when incrementing the congestion
    window. */
@@ -285,16 +452,52 @@ double ultra_timing_vals::cc_scale(const struct scan_performance_vars *perf) {
   return MIN(ratio, perf->cc_scale_max);
 }
 
+void ultra_timing_vals::init(const struct scan_performance_vars *perf, const struct timeval *now) {
+  perf->cc->init(this, perf, now);
+}
+
 /* Update congestion variables for the receipt of a reply. */
-void ultra_timing_vals::ack(const struct scan_performance_vars *perf, double scale) {
+void ultra_timing_vals::ack(const struct scan_performance_vars *perf, double scale,
+  const struct timeval *now, long rtt) {
   num_replies_received++;
+  perf->cc->ack(this, perf, scale, now, rtt);
+}
+
+/* Update congestion variables for a detected drop. */
+void ultra_timing_vals::drop(unsigned in_flight,
+  const struct scan_performance_vars *perf, const struct timeval *now) {
+  perf->cc->drop(this, in_flight, perf, now);
+  last_drop = *now;
+}
+
+/* Update congestion variables for a detected drop, but less aggressively for
+   group congestion control. */
+void ultra_timing_vals::drop_group(unsigned in_flight,
+  const struct scan_performance_vars *perf, const struct timeval *now) {
+  perf->cc->drop_group(this, in_flight, perf, now);
+  last_drop = *now;
+}
+
+void ultra_timing_vals::describe(const struct scan_performance_vars *perf,
+  char *buf, size_t len) const {
+  perf->cc->describe(this, perf, buf, len);
+}
+
+/* The default algorithm, based on TCP congestion control from RFC2581. */
+
+static void reno_init(struct ultra_timing_vals *timing,
+  const struct scan_performance_vars *perf, const struct timeval *now) {
+}
 
-  if (cwnd < ssthresh) {
+static void reno_ack(struct ultra_timing_vals *timing,
+  const struct scan_performance_vars *perf, double scale,
+  const struct timeval *now, long rtt) {
+  if (timing->cwnd < timing->ssthresh) {
     /* In slow start mode. "During slow start, a TCP increments cwnd by at most
        SMSS bytes for each ACK received that acknowledges new data." */
-    cwnd += perf->slow_incr * cc_scale(perf) * scale;
-    if (cwnd > ssthresh)
-      cwnd = ssthresh;
+    timing->cwnd += perf->slow_incr * timing->cc_scale(perf) * scale;
+    if (timing->cwnd > timing->ssthresh)
+      timing->cwnd = timing->ssthresh;
   } else {
     /* Congestion avoidance mode. "During congestion avoidance, cwnd is
        incremented by 1 full-sized segment per round-trip time (RTT). The
@@ -302,14 +505,13 @@ void ultra_timing_vals::ack(const struct scan_performance_vars *perf, double sca
          cwnd += SMSS*SMSS/cwnd
        provides an acceptable approximation to the underlying principle of
        increasing cwnd by 1 full-sized segment per RTT." */
-    cwnd += perf->ca_incr / cwnd * cc_scale(perf) * scale;
+    timing->cwnd += perf->ca_incr / timing->cwnd * timing->cc_scale(perf) * scale;
   }
-  if (cwnd > perf->max_cwnd)
-    cwnd = perf->max_cwnd;
+  if (timing->cwnd > perf->max_cwnd)
+    timing->cwnd = perf->max_cwnd;
 }
 
-/* Update congestion variables for a detected drop. */
-void ultra_timing_vals::drop(unsigned in_flight,
+static void reno_drop(struct ultra_timing_vals *timing, unsigned in_flight,
   const struct scan_performance_vars *perf, const struct timeval *now) {
   /* "When a TCP sender detects segment loss using the retransmission timer, the
      value of ssthresh MUST be set to no more than the value
@@ -317,18 +519,211 @@ void ultra_timing_vals::drop(unsigned in_flight,
      Furthermore, upon a timeout cwnd MUST be set to no more than the loss
      window, LW, which equals 1 full-sized segment (regardless of the value of
      IW)." */
-  cwnd = perf->low_cwnd;
-  ssthresh = (int) MAX(in_flight / perf->host_drop_ssthresh_divisor, 2);
-  last_drop = *now;
+  timing->cwnd = perf->low_cwnd;
+  timing->ssthresh = (int) MAX(in_flight / perf->host_drop_ssthresh_divisor, 2);
 }
 
-/* Update congestion variables for a detected drop, but less aggressively for
-   group congestion control. */
-void ultra_timing_vals::drop_group(unsigned in_flight,
+static void reno_drop_group(struct ultra_timing_vals *timing, unsigned in_flight,
   const struct scan_performance_vars *perf, const struct timeval *now) {
-  cwnd = MAX(perf->low_cwnd, cwnd / perf->group_drop_cwnd_divisor);
-  ssthresh = (int) MAX(in_flight / perf->group_drop_ssthresh_divisor, 2);
-  last_drop = *now;
+  timing->cwnd = MAX(perf->low_cwnd, timing->cwnd / perf->group_drop_cwnd_divisor);
+  timing->ssthresh = (int) MAX(in_flight / perf->group_drop_ssthresh_divisor, 2);
+}
+
+static void reno_describe(const struct ultra_timing_vals *timing,
+  const struct scan_performance_vars *perf, char *buf, size_t len) {
+  Snprintf(buf, len, "reno %s", timing->cwnd < timing->ssthresh ?
+           "slow start" : "congestion avoidance");
+}
+
+/* A delay-based algorithm modeled on BBR. It measures the rate at which
+   replies come back and the smallest rtt, and keeps about their product (the
+   bandwidth-delay product, or BDP) in flight. In startup the window doubles
+   every round until the rate stops growing. After that it stays at the BDP,
+   going up to 25% above it one round in eight to look for more bandwidth and
+   as far below it the next round to drain the queue this built. Isolated drops
+   don't shrink the window below the BDP, which keeps lossy but uncongested
+   paths busy. There is no pacing; the window alone limits the rate.
+
+   The rtt timeout is only four mean deviations above the smoothed rtt, which
+   on a steady path is a few percent of it, and a probe that waits longer in
+   the queue is retransmitted. The retransmission adds to the queue while its
+   slot in the window is reused, so a full 25% probe can leave a path
+   retransmitting a quarter of the probes. Probing is therefore scaled down so
+   that the queue it builds stays within BBR_PROBE_RTTVARS mean deviations of
+   the rtt. */
+
+/* The bandwidth estimate is a maximum over this many rounds. */
+#define BBR_BW_ROUNDS 10
+/* The minimum rtt is measured again after this many microseconds. */
+#define BBR_MIN_RTT_WINDOW 10000000
+/* Startup ends after this many rounds without 25% more bandwidth. */
+#define BBR_FULL_BW_ROUNDS 3
+/* Rounds last at least this many microseconds, because the delivery rate
+   over shorter ones is mostly noise from timer and pcap granularity. */
+#define BBR_MIN_ROUND 1000
+/* Smallest window kept in BBR_PROBE_BW, as in BBR */
+#define BBR_MIN_CWND 4
+/* Probing builds a queue of at most this many mean rtt deviations. */
+#define BBR_PROBE_RTTVARS 2
+
+static const double bbr_gain_cycle[] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+static double bbr_bw(const struct ultra_timing_vals *timing) {
+  return MAX(timing->bbr.bw[0], timing->bbr.bw[1]);
+}
+
+/* Returns the bandwidth-delay product in probes, or 0 if it is not known
+   yet. */
+static double bbr_bdp(const struct ultra_timing_vals *timing) {
+  return bbr_bw(timing) * timing->bbr.min_rtt / 1000000.0;
+}
+
+/* Returns the gain of the current phase of the gain cycle, with probing and
+   draining scaled down on paths whose rtt varies less than the queue they
+   would build. */
+static double bbr_gain(const struct ultra_timing_vals *timing) {
+  double gain = bbr_gain_cycle[timing->bbr.cycle];
+  double queue = (double) BBR_PROBE_RTTVARS * timing->bbr.rttvar / timing->bbr.min_rtt;
+
+  return 1 + (gain - 1) * MIN(1, queue / (bbr_gain_cycle[0] - 1));
+}
+
+/* The window doesn't go below BBR_MIN_CWND on account of a small BDP. On a LAN
+   the BDP may be less than a probe, and it is the speed of Nmap itself that
+   limits the scan. */
+static double bbr_min_cwnd(const struct scan_performance_vars *perf) {
+  return box(perf->low_cwnd, perf->max_cwnd, BBR_MIN_CWND);
+}
+
+static void bbr_init(struct ultra_timing_vals *timing,
+  const struct scan_performance_vars *perf, const struct timeval *now) {
+  memset(&timing->bbr, 0, sizeof(timing->bbr));
+  timing->bbr.mode = BBR_STARTUP;
+  timing->bbr.round_start = *now;
+  timing->bbr.min_rtt_stamp = *now;
+}
+
+/* Ends a round in which replies came back at rate probes per second. */
+static void bbr_round(struct ultra_timing_vals *timing, double rate) {
+  timing->bbr.rounds++;
+  if (timing->bbr.rounds % BBR_BW_ROUNDS == 0) {
+    timing->bbr.bw[1] = timing->bbr.bw[0];
+    timing->bbr.bw[0] = 0;
+  }
+  timing->bbr.bw[0] = MAX(timing->bbr.bw[0], rate);
+
+  if (timing->bbr.mode == BBR_STARTUP) {
+    if (bbr_bw(timing) >= timing->bbr.full_bw * 1.25) {
+      timing->bbr.full_bw = bbr_bw(timing);
+      timing->bbr.full_bw_rounds = 0;
+    } else if (++timing->bbr.full_bw_rounds >= BBR_FULL_BW_ROUNDS) {
+      timing->bbr.mode = BBR_PROBE_BW;
+      timing->bbr.cycle = 1; /* Drain what startup queued */
+    }
+  } else {
+    timing->bbr.cycle = (timing->bbr.cycle + 1) % (sizeof(bbr_gain_cycle) / sizeof(*bbr_gain_cycle));
+  }
+}
+
+static void bbr_ack(struct ultra_timing_vals *timing,
+  const struct scan_performance_vars *perf, double scale,
+  const struct timeval *now, long rtt) {
+  double delivered, bdp;
+  long elapsed;
+
+  /* Unlike the window increments of reno, this is not scaled by cc_scale().
+     Probes that go unanswered because of drops would otherwise inflate the
+     bandwidth estimate, which would cause more drops. */
+  delivered = scale;
+  timing->bbr.delivered += delivered;
+
+  if (rtt > 0 && (timing->bbr.min_rtt == 0 || rtt <= timing->bbr.min_rtt
+                  || TIMEVAL_SUBTRACT(*now, timing->bbr.min_rtt_stamp) > BBR_MIN_RTT_WINDOW)) {
+    timing->bbr.min_rtt = rtt;
+    timing->bbr.min_rtt_stamp = *now;
+  }
+  if (rtt > 0) {
+    if (timing->bbr.srtt == 0) {
+      timing->bbr.srtt = rtt;
+      timing->bbr.rttvar = rtt / 2;
+    } else {
+      long delta = rtt - timing->bbr.srtt;
+      timing->bbr.srtt += delta >> 3;
+      timing->bbr.rttvar += (ABS(delta) - timing->bbr.rttvar) >> 2;
+    }
+  }
+
+  elapsed = TIMEVAL_SUBTRACT(*now, timing->bbr.round_start);
+  if (timing->bbr.min_rtt > 0 && elapsed >= MAX(timing->bbr.min_rtt, BBR_MIN_ROUND)) {
+    bbr_round(timing, (timing->bbr.delivered - timing->bbr.round_delivered) * 1000000.0 / elapsed);
+    timing->bbr.round_start = *now;
+    timing->bbr.round_delivered = timing->bbr.delivered;
+  }
+
+  bdp = bbr_bdp(timing);
+  if (timing->bbr.mode == BBR_STARTUP || bdp == 0)
+    timing->cwnd += perf->slow_incr * delivered;
+  else
+    timing->cwnd = MAX(bbr_gain(timing) * bdp + perf->ca_incr, bbr_min_cwnd(perf));
+  timing->cwnd = box((double) perf->low_cwnd, (double) perf->max_cwnd, timing->cwnd);
+}
+
+/* A drop ends startup or the probing phase of the gain cycle, but the window
+   is only cut to the BDP. Until that is known, the window is halved. */
+static void bbr_drop(struct ultra_timing_vals *timing, unsigned in_flight,
+  const struct scan_performance_vars *perf, const struct timeval *now) {
+  double bdp = bbr_bdp(timing);
+
+  if (timing->bbr.mode == BBR_STARTUP) {
+    timing->bbr.mode = BBR_PROBE_BW;
+    timing->bbr.cycle = 1;
+  } else if (bbr_gain_cycle[timing->bbr.cycle] > 1) {
+    timing->bbr.cycle++;
+  }
+  if (bdp > 0)
+    timing->cwnd = MIN(timing->cwnd, MAX(bdp, bbr_min_cwnd(perf)));
+  else
+    timing->cwnd /= 2;
+  timing->cwnd = box((double) perf->low_cwnd, (double) perf->max_cwnd, timing->cwnd);
+}
+
+static void bbr_describe(const struct ultra_timing_vals *timing,
+  const struct scan_performance_vars *perf, char *buf, size_t len) {
+  Snprintf(buf, len, "bbr %s, bw %.1f/s, min_rtt %.1fms, bdp %.1f",
+           timing->bbr.mode == BBR_STARTUP ? "startup" : "probe_bw",
+           bbr_bw(timing), timing->bbr.min_rtt / 1000.0, bbr_bdp(timing));
+}
+
+static const struct congestion_control congestion_controls[] = {
+  { "reno", reno_init, reno_ack, reno_drop, reno_drop_group, reno_describe },
+  { "bbr", bbr_init, bbr_ack, bbr_drop, bbr_drop, bbr_describe },
+};
+
+/* Returns the congestion control algorithm with the given name, or NULL if
+   there is none. */
+const struct congestion_control *congestion_control_by_name(const char *name) {
+  unsigned int i;
+
+  for (i = 0; i < sizeof(congestion_controls) / sizeof(*congestion_controls); i++) {
+    if (strcmp(congestion_controls[i].name, name) == 0)
+      return &congestion_controls[i];
+  }
+  return NULL;
+}
+
+/* Returns a comma-separated list of the congestion control algorithms. */
+const char *congestion_control_names() {
+  static std::string names;
+  unsigned int i;
+
+  if (names.empty()) {
+    for (i = 0; i < sizeof(congestion_controls) / sizeof(*congestion_controls); i++) {
+      if (i > 0)
+        names += ", ";
+      names += congestion_controls[i].name;
+    }
+  }
+  return names.c_str();
 }
 
 /* Do initialization after the global NmapOps table has been filled in. */
@@ -358,6 +753,7 @@ void scan_performance_vars::init() {
     ssthresh_divisor = (5.0 / 4.0);
   group_drop_ssthresh_divisor = ssthresh_divisor;
   host_drop_ssthresh_divisor = ssthresh_divisor;
+  cc = o.congestion_control ? o.congestion_control : &congestion_controls[0];
 }
 
 /* current_rate_history defines how far back (in seconds) we look when
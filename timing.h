@@ -148,7 +148,13 @@
 
 #include <nbase.h> /* u32 */
 
-/* Based on TCP congestion control techniques from RFC2581. */
+struct scan_performance_vars;
+
+/* Phases of the BBR congestion control algorithm */
+enum bbr_mode { BBR_STARTUP, BBR_PROBE_BW };
+
+/* Congestion control for a host or a group of hosts. The algorithm that
+   updates the window is one of the congestion_control below. */
 struct ultra_timing_vals {
   double cwnd; /* Congestion window - in probes */
   int ssthresh; /* The threshold above which mode is changed from slow start
@@ -167,14 +173,66 @@ struct ultra_timing_vals {
      sudden batch of drops doesn't destroy timing.  Init to now */
   struct timeval last_drop;
 
+  /* State of the BBR algorithm, which estimates the bottleneck bandwidth and
+     the minimum rtt of the path and keeps about their product in flight. */
+  struct {
+    enum bbr_mode mode;
+    double delivered; /* Probes estimated to have been answered so far */
+    double round_delivered; /* Value of delivered when the round started */
+    struct timeval round_start; /* A round lasts at least min_rtt */
+    unsigned int rounds;
+    /* Highest delivery rate (probes per second) seen in this and in the
+       previous BBR_BW_ROUNDS rounds; the bandwidth is the higher of them. */
+    double bw[2];
+    double full_bw; /* Bandwidth when it last grew by 25% in startup */
+    int full_bw_rounds; /* Rounds since then */
+    int min_rtt; /* Microseconds, 0 until known */
+    struct timeval min_rtt_stamp;
+    int cycle; /* Phase of the gain cycle in BBR_PROBE_BW */
+    /* Smoothed rtt and its mean deviation, in microseconds, as in
+       timeout_info. The deviation bounds the queue built by probing. */
+    int srtt, rttvar;
+  } bbr;
+
+  /* Call this after setting cwnd and ssthresh to their initial values. */
+  void init(const struct scan_performance_vars *perf, const struct timeval *now);
   double cc_scale(const struct scan_performance_vars *perf);
-  void ack(const struct scan_performance_vars *perf, double scale = 1.0);
+  /* Update for a reply received at now to a probe sent rtt microseconds
+     earlier (or -1 if that is not known). */
+  void ack(const struct scan_performance_vars *perf, double scale,
+    const struct timeval *now, long rtt);
   void drop(unsigned in_flight,
     const struct scan_performance_vars *perf, const struct timeval *now);
   void drop_group(unsigned in_flight,
     const struct scan_performance_vars *perf, const struct timeval *now);
+  /* Writes a short description of the algorithm and its state to buf. */
+  void describe(const struct scan_performance_vars *perf, char *buf, size_t len) const;
+};
+
+/* A congestion control algorithm, selected with --congestion-control. The
+   functions implement the ultra_timing_vals methods of the same names. */
+struct congestion_control {
+  const char *name;
+  void (*init)(struct ultra_timing_vals *timing,
+    const struct scan_performance_vars *perf, const struct timeval *now);
+  void (*ack)(struct ultra_timing_vals *timing,
+    const struct scan_performance_vars *perf, double scale,
+    const struct timeval *now, long rtt);
+  void (*drop)(struct ultra_timing_vals *timing, unsigned in_flight,
+    const struct scan_performance_vars *perf, const struct timeval *now);
+  void (*drop_group)(struct ultra_timing_vals *timing, unsigned in_flight,
+    const struct scan_performance_vars *perf, const struct timeval *now);
+  void (*describe)(const struct ultra_timing_vals *timing,
+    const struct scan_performance_vars *perf, char *buf, size_t len);
 };
 
+/* Returns the congestion control algorithm with the given name, or NULL if
+   there is none. */
+const struct congestion_control *congestion_control_by_name(const char *name);
+
+/* Returns a comma-separated list of the congestion control algorithms. */
+const char *congestion_control_names();
+
 /* These are mainly initializers for ultra_timing_vals. */
 struct scan_performance_vars {
   int low_cwnd;  /* The lowest cwnd (congestion window) allowed */
@@ -195,6 +253,7 @@ struct scan_performance_vars {
                                          any drop occurs */
   double host_drop_ssthresh_divisor; /* used to drop the host ssthresh when
                                          any drop occurs */
+  const struct congestion_control *cc; /* The congestion control algorithm */
 
   /* Do initialization after the global NmapOps table has been filled in. */
   void init();
@@ -222,6 +281,41 @@ void adjust_timeouts2(const struct timeval *sent,
    response.  We update our RTT averages, etc. */
 void adjust_timeouts(struct timeval sent, struct timeout_info *to);
 
+/* What an earlier scan learned about the timing of a network (a /24 for IPv4,
+   a /64 for IPv6). These are kept between runs in the --timing-cache file so
+   that ultra_scan doesn't have to learn them again from scratch. */
+struct timing_profile {
+  int srtt; /* Smoothed rtt estimate of the hosts (microseconds) */
+  int rttvar; /* Their rtt variance (microseconds) */
+  double cwnd; /* Host congestion window at the end of the scan */
+  int ssthresh; /* Host slow start threshold at the end of the scan */
+  double group_cwnd; /* Group congestion window when the host finished */
+  unsigned int delayms; /* Scan delay that drops or rate limiting forced */
+  unsigned int max_successful_tryno; /* Highest useful retransmission */
+  unsigned int max_tryno_sent; /* Highest tryno rate limit detection saw */
+  /* How far the profile can be trusted, from 1 for one learned in this run
+     down toward 0 as it ages. */
+  double weight;
+};
+
+/* Reads the profiles in filename, if it exists, forgetting those that are
+   too old to be of use. */
+void timing_cache_load(const char *filename);
+
+/* Writes the profiles loaded and learned in this run to filename. */
+void timing_cache_save(const char *filename);
+
+/* Fills in tp with the profile of the network of ss for scans of protocol
+   proto ("tcp", "udp", "sctp" or "ip") and returns true, or returns false if
+   there isn't one. */
+bool timing_cache_lookup(const struct sockaddr_storage *ss, const char *proto,
+                         struct timing_profile *tp);
+
+/* Records what was learned about a host in a scan of protocol proto in this
+   run into the profile of its network. The weight of tp is ignored. */
+void timing_cache_record(const struct sockaddr_storage *ss, const char *proto,
+                         const struct timing_profile *tp);
+
 #define DEFAULT_CURRENT_RATE_HISTORY 5.0
 
 /* Sleeps if necessary to ensure that it isn't called twice within less